@@ -0,0 +1,321 @@
+#!/usr/bin/python3
+## Micro-benchmarks for the cups module's hot paths.
+##
+## An in-process HTTP server plays the part of cupsd, answering with
+## canned IPP responses, so no real CUPS server is needed.  Run it
+## with "make bench".
+
+import argparse
+import http.server
+import io
+import os
+import socketserver
+import struct
+import sys
+import tempfile
+import threading
+import time
+import tracemalloc
+
+import cups
+
+## IPP encoding
+
+TAG_OPERATION = 0x01
+TAG_JOB = 0x02
+TAG_END = 0x03
+TAG_PRINTER = 0x04
+TAG_INTEGER = 0x21
+TAG_BOOLEAN = 0x22
+TAG_ENUM = 0x23
+TAG_TEXT = 0x41
+TAG_NAME = 0x42
+TAG_KEYWORD = 0x44
+TAG_URI = 0x45
+TAG_CHARSET = 0x47
+TAG_LANGUAGE = 0x48
+
+OP_GET_JOBS = 0x000a
+OP_CUPS_GET_PRINTERS = 0x4002
+OP_CUPS_GET_PPDS = 0x400c
+
+def encode_value (tag, value):
+	if tag in (TAG_INTEGER, TAG_ENUM):
+		return struct.pack (">i", value)
+	if tag == TAG_BOOLEAN:
+		return struct.pack (">b", value)
+	return value.encode ("utf-8")
+
+def encode_attr (tag, name, values):
+	if not isinstance (values, list):
+		values = [values]
+
+	out = []
+	for i, value in enumerate (values):
+		n = name.encode ("ascii") if i == 0 else b""
+		v = encode_value (tag, value)
+		out.append (struct.pack (">bH", tag, len (n)) + n +
+			    struct.pack (">H", len (v)) + v)
+
+	return b"".join (out)
+
+def encode_response (group_tag, groups, status=0):
+	"""An IPP response with each of groups, a list of
+	(tag, name, values) lists, as a separate group.  The request ID
+	is patched in by the server."""
+	out = [struct.pack (">bbHi", 2, 0, status, 0),
+	       struct.pack (">b", TAG_OPERATION),
+	       encode_attr (TAG_CHARSET, "attributes-charset", "utf-8"),
+	       encode_attr (TAG_LANGUAGE, "attributes-natural-language", "en")]
+	for group in groups:
+		out.append (struct.pack (">b", group_tag))
+		for tag, name, values in group:
+			out.append (encode_attr (tag, name, values))
+
+	out.append (struct.pack (">b", TAG_END))
+	return b"".join (out)
+
+## Canned data
+
+def printers_response (n):
+	groups = []
+	for i in range (n):
+		name = "printer-%05d" % i
+		uri = "ipp://localhost/printers/" + name
+		groups.append ([
+			(TAG_NAME, "printer-name", name),
+			(TAG_ENUM, "printer-type", 0x801c),
+			(TAG_TEXT, "printer-location", "Floor %d" % (i % 20)),
+			(TAG_TEXT, "printer-info", "Printer number %d" % i),
+			(TAG_TEXT, "printer-make-and-model", "Generic PostScript"),
+			(TAG_ENUM, "printer-state", 3),
+			(TAG_TEXT, "printer-state-message", ""),
+			(TAG_KEYWORD, "printer-state-reasons", ["none"]),
+			(TAG_URI, "printer-uri-supported", uri),
+			(TAG_URI, "device-uri", "socket://10.0.%d.%d"
+			 % (i // 256 % 256, i % 256)),
+			(TAG_BOOLEAN, "printer-is-shared", True),
+			])
+
+	return encode_response (TAG_PRINTER, groups)
+
+def jobs_response (n):
+	groups = []
+	for i in range (n):
+		groups.append ([
+			(TAG_INTEGER, "job-id", i + 1),
+			(TAG_NAME, "job-name", "document-%d.pdf" % i),
+			(TAG_ENUM, "job-state", 3 + i % 7),
+			(TAG_URI, "job-printer-uri",
+			 "ipp://localhost/printers/printer-%05d" % (i % 1000)),
+			(TAG_NAME, "job-originating-user-name", "user%d" % (i % 50)),
+			(TAG_INTEGER, "job-k-octets", i % 4096),
+			(TAG_INTEGER, "time-at-creation", 1400000000 + i),
+			])
+
+	return encode_response (TAG_JOB, groups)
+
+def ppds_response (n):
+	groups = []
+	for i in range (n):
+		make = "Make%d" % (i % 100)
+		model = "%s Model %d" % (make, i)
+		groups.append ([
+			(TAG_NAME, "ppd-name", "drv:///bench/%d.ppd" % i),
+			(TAG_LANGUAGE, "ppd-natural-language", "en"),
+			(TAG_TEXT, "ppd-make", make),
+			(TAG_TEXT, "ppd-make-and-model", model),
+			(TAG_TEXT, "ppd-device-id",
+			 "MFG:%s;MDL:Model %d;" % (make, i)),
+			(TAG_TEXT, "ppd-product", "(%s)" % model),
+			(TAG_TEXT, "ppd-psversion", "(3010.000) 0"),
+			(TAG_KEYWORD, "ppd-type", "postscript"),
+			])
+
+	return encode_response (TAG_PRINTER, groups)
+
+def write_ppd (path, n_groups, n_options, n_choices):
+	lines = ['*PPD-Adobe: "4.3"',
+		 '*FormatVersion: "4.3"',
+		 '*FileVersion: "1.0"',
+		 '*LanguageVersion: English',
+		 '*LanguageEncoding: ISOLatin1',
+		 '*PCFileName: "BENCH.PPD"',
+		 '*Manufacturer: "Bench"',
+		 '*Product: "(Bench)"',
+		 '*ModelName: "Bench Printer"',
+		 '*ShortNickName: "Bench Printer"',
+		 '*NickName: "Bench Printer"',
+		 '*PSVersion: "(3010.000) 0"']
+	for g in range (n_groups):
+		lines.append ("*OpenGroup: Group%d/Group %d" % (g, g))
+		for o in range (n_options):
+			opt = "Opt%d_%d" % (g, o)
+			lines.append ("*OpenUI *%s/Option %d.%d: PickOne" % (opt, g, o))
+			lines.append ("*Default%s: C0" % opt)
+			for c in range (n_choices):
+				lines.append ('*%s C%d/Choice %d: "%%%s %d"'
+					      % (opt, c, c, opt, c))
+			lines.append ("*CloseUI: *%s" % opt)
+			if o > 0:
+				prev = "Opt%d_%d" % (g, o - 1)
+				lines.append ("*UIConstraints: *%s C1 *%s C1"
+					      % (opt, prev))
+		lines.append ("*CloseGroup: Group%d" % g)
+
+	with open (path, "w") as f:
+		f.write ("\n".join (lines) + "\n")
+
+## Mock server
+
+class Responder (http.server.BaseHTTPRequestHandler):
+	protocol_version = "HTTP/1.1"
+	responses_by_op = {}
+
+	def do_POST (self):
+		length = int (self.headers.get ("Content-Length", 0))
+		body = self.rfile.read (length)
+		(op, request_id) = struct.unpack (">Hi", body[2:8])
+		resp = self.responses_by_op.get (op)
+		if resp is None:
+			# server-error-operation-not-supported
+			resp = encode_response (TAG_PRINTER, [], status=0x0501)
+
+		resp = resp[:4] + struct.pack (">i", request_id) + resp[8:]
+		self.send_response (200)
+		self.send_header ("Content-Type", "application/ipp")
+		self.send_header ("Content-Length", str (len (resp)))
+		self.end_headers ()
+		self.wfile.write (resp)
+
+	def log_message (self, format, *args):
+		pass
+
+class Server (socketserver.ThreadingMixIn, http.server.HTTPServer):
+	daemon_threads = True
+
+def start_server ():
+	server = Server (("127.0.0.1", 0), Responder)
+	thread = threading.Thread (target=server.serve_forever)
+	thread.daemon = True
+	thread.start ()
+	return server
+
+## Measurement
+
+def measure (fn, min_time, repeat):
+	fn ()
+	runs = 0
+	start = time.perf_counter ()
+	elapsed = 0.0
+	while runs < repeat or elapsed < min_time:
+		fn ()
+		runs += 1
+		elapsed = time.perf_counter () - start
+
+	# Allocations made by one call, counting only what Python's
+	# allocator sees, and how much of it the result keeps alive.
+	tracemalloc.start ()
+	before = tracemalloc.take_snapshot ()
+	result = fn ()
+	current, peak = tracemalloc.get_traced_memory ()
+	after = tracemalloc.take_snapshot ()
+	tracemalloc.stop ()
+	blocks = sum (stat.count_diff
+		      for stat in after.compare_to (before, "filename"))
+	del result
+	return (runs / elapsed, elapsed / runs, blocks, peak)
+
+def main ():
+	parser = argparse.ArgumentParser (description="pycups benchmarks")
+	parser.add_argument ("--scale", type=float, default=1.0,
+			     help="multiply the canned data sizes by this")
+	parser.add_argument ("--min-time", type=float, default=1.0,
+			     help="minimum seconds to run each benchmark")
+	parser.add_argument ("--repeat", type=int, default=3,
+			     help="minimum number of runs of each benchmark")
+	parser.add_argument ("only", nargs="*",
+			     help="names of the benchmarks to run")
+	args = parser.parse_args ()
+
+	n_printers = max (1, int (10000 * args.scale))
+	n_jobs = max (1, int (100000 * args.scale))
+	n_ppds = max (1, int (20000 * args.scale))
+
+	sys.stderr.write ("Building canned responses...\n")
+	printers = printers_response (n_printers)
+	Responder.responses_by_op = {
+		OP_CUPS_GET_PRINTERS: printers,
+		OP_GET_JOBS: jobs_response (n_jobs),
+		OP_CUPS_GET_PPDS: ppds_response (n_ppds),
+		}
+
+	server = start_server ()
+	port = server.server_address[1]
+	conn = cups.Connection (host="127.0.0.1", port=port,
+				encryption=cups.HTTP_ENCRYPT_NEVER)
+
+	tmpdir = tempfile.mkdtemp ()
+	ppdfile = os.path.join (tmpdir, "bench.ppd")
+	write_ppd (ppdfile, 10, 20, 10)
+	ppd = cups.PPD (ppdfile)
+
+	def ppd_walk ():
+		ppd.markDefaults ()
+		n = 0
+		for group in ppd.optionGroups:
+			for opt in group.options:
+				ppd.findOption (opt.keyword)
+				for choice in opt.choices:
+					n += len (choice["choice"])
+		ppd.conflicts ()
+		return n
+
+	def ipp_read ():
+		req = cups.IPPRequest ()
+		req.readIO (io.BytesIO (printers).read)
+		return req
+
+	def ipp_read_from ():
+		req = cups.IPPRequest ()
+		req.readFrom (printers)
+		return req
+
+	parsed = ipp_read_from ()
+
+	def ipp_write ():
+		out = io.BytesIO ()
+		parsed.state = cups.IPP_STATE_IDLE
+		parsed.writeIO (out.write)
+		return out
+
+	benches = [
+		("getPrinters[%d]" % n_printers, conn.getPrinters),
+		("getJobs[%d]" % n_jobs, conn.getJobs),
+		("getPPDs[%d]" % n_ppds, conn.getPPDs),
+		("ppd-option-walk", ppd_walk),
+		("ipp-read[%d]" % n_printers, ipp_read),
+		("ipp-readFrom[%d]" % n_printers, ipp_read_from),
+		("ipp-write[%d]" % n_printers, ipp_write),
+		]
+
+	print ("%-24s %12s %12s %12s %12s" % ("benchmark", "ops/sec",
+					     "ms/op", "kept blocks",
+					     "peak KiB"))
+	try:
+		for name, fn in benches:
+			if args.only and not [o for o in args.only
+					      if name.startswith (o)]:
+				continue
+
+			(rate, per, blocks, peak) = measure (fn, args.min_time,
+							   args.repeat)
+			print ("%-24s %12.2f %12.3f %12d %12d" %
+			       (name, rate, per * 1000, blocks, peak // 1024))
+	finally:
+		server.shutdown ()
+		os.unlink (ppdfile)
+		os.rmdir (tmpdir)
+
+if __name__ == "__main__":
+	main ()
@@ -19,16 +19,27 @@
  */
 
 #include "cupsconnection.h"
+#include "cupsipp.h"
 #include "cupsppd.h"
 #include "cupsmodule.h"
 
 #ifndef __SVR4
 #include <paths.h>
 #endif
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
+#include <utime.h>
 
 #ifndef _PATH_TMP
 #define _PATH_TMP P_tmpdir
@@ -102,6 +113,89 @@ PyObj_from_UTF8 (const char *utf8)
   return val;
 }
 
+/*
+ * Attribute names and keyword values recur in every printer and
+ * job of a response, so keep one Python string for each and hand out
+ * new references to it.  The table is filled in by
+ * Connection_init_interned() and grows on demand up to
+ * INTERNED_MAX entries; past that, strings are simply not shared.
+ */
+
+#define INTERNED_SIZE 2048	/* must be a power of two */
+#define INTERNED_MAX (INTERNED_SIZE / 4 * 3)
+
+typedef struct
+{
+  char *str;
+  unsigned int hash;
+  PyObject *obj;
+} interned_t;
+
+static interned_t interned[INTERNED_SIZE];
+static size_t num_interned = 0;
+
+static unsigned int
+str_hash (const char *str)
+{
+  /* FNV-1a */
+  unsigned int h = 2166136261U;
+  while (*str) {
+    h ^= (unsigned char) *str++;
+    h *= 16777619U;
+  }
+
+  return h;
+}
+
+static PyObject *
+PyObj_from_interned_UTF8 (const char *utf8)
+{
+  unsigned int hash = str_hash (utf8);
+  unsigned int slot = hash;
+  interned_t *entry;
+  PyObject *val;
+
+  while ((entry = &interned[slot & (INTERNED_SIZE - 1)])->str != NULL) {
+    if (entry->hash == hash && !strcmp (entry->str, utf8)) {
+      Py_INCREF (entry->obj);
+      return entry->obj;
+    }
+
+    slot++;
+  }
+
+  val = PyObj_from_UTF8 (utf8);
+  if (!val || num_interned >= INTERNED_MAX)
+    return val;
+
+  entry->str = strdup (utf8);
+  if (!entry->str)
+    return val;
+
+#if PY_MAJOR_VERSION >= 3
+  PyUnicode_InternInPlace (&val);
+#endif
+  entry->hash = hash;
+  entry->obj = val;
+  num_interned++;
+  Py_INCREF (val);
+  return val;
+}
+
+static int
+set_attr_item (PyObject *dict, ipp_attribute_t *attr, PyObject *val)
+{
+  PyObject *key = PyObj_from_interned_UTF8 (ippGetName (attr));
+  int ret;
+
+  if (!key)
+    return -1;
+
+  ret = PyDict_SetItem (dict, key, val);
+  Py_DECREF (key);
+  return ret;
+}
+
 const char *
 UTF8_from_PyObj (char **const utf8, PyObject *obj)
 // converts PyUnicode or PyBytes to char *
@@ -184,6 +278,11 @@ Connection_new (PyTypeObject *type, PyObject *args, PyObject *kwds)
     self->http = NULL;
     self->host = NULL;
     self->tstate = NULL;
+    self->pending_resource = NULL;
+    self->job_attrs_request = NULL;
+    self->in_call = 0;
+    self->last_stats = NULL;
+    self->trace_cb = NULL;
 #ifdef HAVE_CUPS_1_4
     self->cb_password = NULL;
 #endif /* HAVE_CUPS_1_4 */
@@ -211,6 +310,9 @@ Connection_init (Connection *self, PyObject *args, PyObject *kwds)
     return -1;
   }
 
+  self->port = port;
+  self->encryption = encryption;
+
   Connection_begin_allow_threads (self);
   debugprintf ("httpConnectEncrypt(...)\n");
   self->http = httpConnectEncrypt (host, port, (http_encryption_t) encryption);
@@ -310,6 +412,13 @@ Connection_dealloc (Connection *self)
 #endif /* HAVE_CUPS_1_4 */
   }
 
+  free (self->pending_resource);
+  if (self->job_attrs_request)
+    ippDelete (self->job_attrs_request);
+
+  Py_XDECREF (self->last_stats);
+  Py_XDECREF (self->trace_cb);
+
   ((PyObject *)self)->ob_type->tp_free ((PyObject *) self);
 }
 
@@ -340,6 +449,25 @@ Connection_begin_allow_threads (void *connection)
 #endif /* !HAVE_CUPS_1_4 */
 
   self->tstate = PyEval_SaveThread ();
+  if (self->in_call)
+    self->released_start = stats_now ();
+}
+
+/*
+ * Fail if a sendRequest() response is still to be collected: anything
+ * sent now would discard it.  Every path that talks to the server on
+ * this connection checks this first.
+ */
+static int
+Connection_check_idle (Connection *self)
+{
+  if (!self->pending_resource)
+    return 0;
+
+  PyErr_SetString (PyExc_RuntimeError,
+		   "a response is pending on this connection; "
+		   "call pollResponse() first");
+  return -1;
 }
 
 void
@@ -347,10 +475,118 @@ Connection_end_allow_threads (void *connection)
 {
   Connection *self = (Connection *) connection;
   debugprintf ("end allow threads\n");
+  if (self->in_call)
+    self->released_ns += stats_now () - self->released_start;
+
   PyEval_RestoreThread (self->tstate);
   self->tstate = NULL;
 }
 
+// Send request and read its answer, as cupsDoRequest() does, but
+// leave the request to the caller: cupsDoRequest() and
+// cupsDoIORequest() both free it.  The request is resent after an
+// authentication challenge, as there.  Called without the GIL.
+static ipp_t *
+do_request_keep (http_t *http, ipp_t *request, const char *resource)
+{
+  ipp_t *answer = NULL;
+  http_status_t status;
+  int tries;
+
+  for (tries = 0; !answer && tries < 3; tries++) {
+    status = cupsSendRequest (http, request, resource, ippLength (request));
+    if (status != HTTP_CONTINUE && status != HTTP_OK) {
+      httpFlush (http);
+      break;
+    }
+
+    answer = cupsGetResponse (http, resource);
+    if (!answer && httpGetStatus (http) != HTTP_UNAUTHORIZED)
+      break;
+  }
+
+  return answer;
+}
+
+// Per-call metrics for lastRequestStats and the trace callback.  The
+// instrumented methods run between Connection_call_begin() and
+// Connection_call_end(), and send with Connection_do_request().
+
+static void
+Connection_call_begin (Connection *self)
+{
+  self->in_call = 1;
+  self->call_start = stats_now ();
+  self->released_ns = 0;
+  self->request_bytes = 0;
+  self->response_bytes = 0;
+  self->num_attrs = 0;
+}
+
+// As cupsDoRequest(), which frees the request, or, if consume is
+// false, do_request_keep() leaving it to the caller; counting what
+// goes each way.  Called without the GIL.
+static ipp_t *
+Connection_do_request (Connection *self, ipp_t *request,
+		       const char *resource, int consume)
+{
+  ipp_attribute_t *attr;
+  ipp_t *answer;
+
+  self->request_bytes += ippLength (request);
+  if (consume)
+    answer = cupsDoRequest (self->http, request, resource);
+  else
+    answer = do_request_keep (self->http, request, resource);
+
+  if (answer) {
+    self->response_bytes += ippLength (answer);
+    for (attr = ippFirstAttribute (answer); attr;
+	 attr = ippNextAttribute (answer))
+      if (ippGetName (attr))
+	self->num_attrs++;
+  }
+
+  return answer;
+}
+
+// Record the metrics for the call and pass its result through.
+static PyObject *
+Connection_call_end (Connection *self, const char *operation,
+		     PyObject *result)
+{
+  PyObject *exc_type, *exc_value, *exc_tb;
+  PyObject *stats;
+
+  self->in_call = 0;
+  PyErr_Fetch (&exc_type, &exc_value, &exc_tb);
+  stats = Py_BuildValue ("{sssdsdsnsnsnsO}",
+			 "operation", operation,
+			 "wall", (stats_now () - self->call_start) / 1e9,
+			 "released", self->released_ns / 1e9,
+			 "request_bytes", (Py_ssize_t) self->request_bytes,
+			 "response_bytes", (Py_ssize_t) self->response_bytes,
+			 "attributes", (Py_ssize_t) self->num_attrs,
+			 "failed", result ? Py_False : Py_True);
+  if (stats) {
+    Py_XDECREF (self->last_stats);
+    self->last_stats = stats;
+    if (self->trace_cb) {
+      PyObject *ret = PyObject_CallFunctionObjArgs (self->trace_cb,
+						    (PyObject *) self,
+						    stats, NULL);
+      if (ret)
+	Py_DECREF (ret);
+      else
+	PyErr_WriteUnraisable (self->trace_cb);
+    }
+  } else
+    PyErr_Clear ();
+
+  PyErr_Restore (exc_type, exc_value, exc_tb);
+  return result;
+}
+
 ////////////////
 // Connection // METHODS
 ////////////////
@@ -457,6 +693,9 @@ do_printer_request (Connection *self, PyObject *args, PyObject *kwds,
   char uri[HTTP_MAX_URI];
   ipp_t *request, *answer;
 
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
   switch (op) {
   case IPP_PAUSE_PRINTER:
   case CUPS_REJECT_JOBS:
@@ -524,39 +763,120 @@ do_printer_request (Connection *self, PyObject *args, PyObject *kwds,
   Py_RETURN_NONE;
 }
 
+#define DEST_ARENA_ALIGN(n) \
+  (((n) + sizeof (void *) - 1) & ~(sizeof (void *) - 1))
+
+// Bytes copy_dest() will take from an arena for src.
+static size_t
+dest_arena_size (cups_dest_t *src)
+{
+  size_t size = src->num_options * sizeof (cups_option_t);
+  int i;
+
+  size += strlen (src->name) + 1;
+  if (src->instance)
+    size += strlen (src->instance) + 1;
+
+  for (i = 0; i < src->num_options; i++)
+    size += (strlen (src->options[i].name) + 1 +
+	     strlen (src->options[i].value) + 1);
+
+  return DEST_ARENA_ALIGN (size);
+}
+
+static DestArena *
+dest_arena_new (int num_dests, cups_dest_t *dests)
+{
+  DestArena *arena;
+  size_t size = 0;
+  int i;
+
+  for (i = 0; i < num_dests; i++)
+    size += dest_arena_size (dests + i);
+
+  arena = malloc (sizeof (DestArena) + size);
+  if (!arena) {
+    PyErr_NoMemory ();
+    return NULL;
+  }
+
+  arena->refcount = 1;
+  arena->next = (char *) (arena + 1);
+  return arena;
+}
+
+static void
+dest_arena_release (DestArena *arena)
+{
+  if (arena && --arena->refcount == 0)
+    free (arena);
+}
+
+static char *
+dest_arena_strcpy (char **p, const char *str)
+{
+  char *copy = *p;
+  size_t len = strlen (str) + 1;
+
+  memcpy (copy, str, len);
+  *p += len;
+  return copy;
+}
+
+// Copy src into dst, taking the space from arena.
 static int
-copy_dest (Dest *dst, cups_dest_t *src)
+copy_dest (Dest *dst, cups_dest_t *src, DestArena *arena)
 {
+  char *p = arena->next;
   int i;
+
+  dst->arena = arena;
+  arena->refcount++;
   dst->is_default = src->is_default;
-  dst->destname = strdup (src->name);
-  dst->instance = (src->instance ? strdup (src->instance) : NULL );
   dst->num_options = src->num_options;
-  dst->name = malloc (src->num_options * sizeof (char *));
-  dst->value = malloc (src->num_options * sizeof (char *));
+  dst->options = (cups_option_t *) p;
+  p += src->num_options * sizeof (cups_option_t);
+  dst->destname = dest_arena_strcpy (&p, src->name);
+  dst->instance = (src->instance ? dest_arena_strcpy (&p, src->instance)
+		   : NULL);
   for (i = 0; i < src->num_options; i++) {
-    dst->name[i] = strdup (src->options[i].name);
-    dst->value[i] = strdup (src->options[i].value);
+    dst->options[i].name = dest_arena_strcpy (&p, src->options[i].name);
+    dst->options[i].value = dest_arena_strcpy (&p, src->options[i].value);
   }
+
+  arena->next += dest_arena_size (src);
   return 0;
 }
 
 static PyObject *
 Connection_getDests (Connection *self)
 {
-  cups_dest_t *dests;
+  cups_dest_t *dests, *dest;
   int num_dests;
   PyObject *pydests = PyDict_New ();
+  PyObject *nameinstance;
+  DestArena *arena;
   int i;
 
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
   debugprintf ("-> Connection_getDests()\n");
   debugprintf ("cupsGetDests2()\n");
   Connection_begin_allow_threads (self);
   num_dests = cupsGetDests2 (self->http, &dests);
   Connection_end_allow_threads (self);
 
+  arena = dest_arena_new (num_dests, dests);
+  if (!arena) {
+    cupsFreeDests (num_dests, dests);
+    Py_DECREF (pydests);
+    debugprintf ("<- Connection_getDests() EXCEPTION\n");
+    return NULL;
+  }
+
   // Create a dict indexed by (name,instance)
-  for (i = 0; i <= num_dests; i++) {
+  for (i = 0; i < num_dests; i++) {
     PyObject *largs = Py_BuildValue ("()");
     PyObject *lkwlist = Py_BuildValue ("{}");
     Dest *destobj = (Dest *) PyType_GenericNew (&cups_DestType,
@@ -564,32 +884,31 @@ Connection_getDests (Connection *self)
     Py_DECREF (largs);
     Py_DECREF (lkwlist);
 
-    cups_dest_t *dest;
-    PyObject *nameinstance;
-    if (i == num_dests)
-      {
-	// Add a (None,None) entry for the default printer.
-	dest = cupsGetDest (NULL, NULL, num_dests, dests);
-	if (dest == NULL) {
-	  /* No default printer. */
-	  Py_DECREF ((PyObject *) destobj);
-	  break;
-	}
-
-	nameinstance = Py_BuildValue ("(ss)", NULL, NULL);
-      }
-    else
-      {
-	dest = dests + i;
-	nameinstance = Py_BuildValue ("(ss)", dest->name, dest->instance);
-      }
-
-    copy_dest (destobj, dest);
+    dest = dests + i;
+    nameinstance = Py_BuildValue ("(ss)", dest->name, dest->instance);
+    copy_dest (destobj, dest, arena);
 
     PyDict_SetItem (pydests, nameinstance, (PyObject *) destobj);
+    Py_DECREF (nameinstance);
     Py_DECREF ((PyObject *) destobj);
   }
 
+  // Add a (None,None) entry for the default printer, sharing its Dest.
+  dest = cupsGetDest (NULL, NULL, num_dests, dests);
+  if (dest) {
+    PyObject *destobj;
+
+    nameinstance = Py_BuildValue ("(ss)", dest->name, dest->instance);
+    destobj = PyDict_GetItem (pydests, nameinstance); // borrowed ref
+    Py_DECREF (nameinstance);
+    if (destobj) {
+      nameinstance = Py_BuildValue ("(ss)", NULL, NULL);
+      PyDict_SetItem (pydests, nameinstance, destobj);
+      Py_DECREF (nameinstance);
+    }
+  }
+
+  dest_arena_release (arena);
   debugprintf ("cupsFreeDests()\n");
   cupsFreeDests (num_dests, dests);
   debugprintf ("<- Connection_getDests()\n");
@@ -604,6 +923,7 @@ cups_dest_cb (void *user_data, unsigned flags, cups_dest_t *dest)
   PyObject *largs = Py_BuildValue ("()");
   PyObject *lkwlist = Py_BuildValue ("{}");
   Dest *destobj;
+  DestArena *arena;
   PyObject *args;
   PyObject *result;
   int ret = 0;
@@ -613,7 +933,15 @@ cups_dest_cb (void *user_data, unsigned flags, cups_dest_t *dest)
 					largs, lkwlist);
   Py_DECREF (largs);
   Py_DECREF (lkwlist);
-  copy_dest (destobj, dest);
+  arena = dest_arena_new (1, dest);
+  if (!arena) {
+    Py_DECREF ((PyObject *) destobj);
+    debugprintf ("<- cups_dest_cb (no memory)\n");
+    return 0;
+  }
+
+  copy_dest (destobj, dest, arena);
+  dest_arena_release (arena);
   args = Py_BuildValue ("(OiO)",
 			context->user_data,
 			flags,
@@ -657,7 +985,14 @@ PyObject_from_attr_value (ipp_attribute_t *attr, int i)
   switch (ippGetValueTag(attr)) {
   case IPP_TAG_NAME:
   case IPP_TAG_TEXT:
+    val = PyObj_from_UTF8 (ippGetString (attr, i, NULL));
+    break;
   case IPP_TAG_KEYWORD:
+    // Keywords come from a small vocabulary, so share them.  Other
+    // strings, URIs above all, are mostly unique to one object and
+    // would only fill the table.
+    val = PyObj_from_interned_UTF8 (ippGetString (attr, i, NULL));
+    break;
   case IPP_TAG_URI:
   case IPP_TAG_CHARSET:
   case IPP_TAG_MIMETYPE:
@@ -724,166 +1059,474 @@ PyList_from_attr_values (ipp_attribute_t *attr)
   return list;
 }
 
-static PyObject *
-Connection_getPrinters (Connection *self)
+////////////////////////
+// Attribute decoding //
+////////////////////////
+
+/*
+ * Attributes that need special treatment when they are turned into
+ * Python objects.  Every method that builds dictionaries from IPP
+ * responses shares this table.  The methods have never agreed on
+ * the shape of some attributes, and callers rely on each method's
+ * own shapes, so the table records which methods treat an attribute
+ * specially rather than forcing one shape on all of them.
+ */
+
+#define ATTR_PRINTERS		(1 << 0) /* reported by getPrinters() */
+#define ATTR_JOBS		(1 << 1) /* first value only in getJobs() */
+#define ATTR_PRINTER_KEY	(1 << 2) /* getPrinters() dictionary key */
+#define ATTR_JOB_KEY		(1 << 3) /* getJobs() dictionary key */
+#define ATTR_BOOL_AS_INT	(1 << 4) /* an integer in getPrinters() */
+#define ATTR_MULTIVALUE		(1 << 5) /* list in getPrinterAttributes() */
+#define ATTR_SHEETS		(1 << 6) /* 2-tuple in getPrinterAttributes() */
+
+/* The method decoding an attribute, for PyObject_from_attr() and
+ * attr_info_t.list_in. */
+#define ATTR_CTX_PRINTERS	(1 << 0) /* getPrinters() */
+#define ATTR_CTX_JOBS		(1 << 1) /* getJobs() */
+#define ATTR_CTX_PRINTER_ATTRS	(1 << 2) /* getPrinterAttributes() */
+#define ATTR_CTX_JOB_ATTRS	(1 << 3) /* getJobAttributes() */
+#define ATTR_CTX_SUBSCRIPTIONS	(1 << 4) /* getSubscriptions() */
+#define ATTR_CTX_NOTIFICATIONS	(1 << 5) /* getNotifications() */
+
+typedef struct
 {
-  PyObject *result;
-  ipp_t *request = ippNewRequest(CUPS_GET_PRINTERS), *answer;
-  ipp_attribute_t *attr;
-  const char *attributes[] = {
-    "printer-name",
-    "printer-type",
-    "printer-location",
-    "printer-info",
-    "printer-make-and-model",
-    "printer-state",
-    "printer-state-message",
-    "printer-state-reasons",
-    "printer-uri-supported",
-    "device-uri",
-    "printer-is-shared",
-  };
+  const char *name;
+  ipp_tag_t value_tag;		/* tag the entry describes */
+  unsigned int flags;
+  unsigned int list_in;		/* methods always giving a list */
+} attr_info_t;
+
+static const attr_info_t attr_info[] = {
+  { "printer-name",			IPP_TAG_NAME,
+    ATTR_PRINTERS | ATTR_PRINTER_KEY },
+  { "printer-type",			IPP_TAG_ENUM,	 ATTR_PRINTERS },
+  { "printer-state",			IPP_TAG_ENUM,	 ATTR_PRINTERS },
+  { "printer-make-and-model",		IPP_TAG_TEXT,	 ATTR_PRINTERS },
+  { "printer-info",			IPP_TAG_TEXT,	 ATTR_PRINTERS },
+  { "printer-location",			IPP_TAG_TEXT,	 ATTR_PRINTERS },
+  { "printer-state-message",		IPP_TAG_TEXT,	 ATTR_PRINTERS },
+  { "printer-state-reasons",		IPP_TAG_KEYWORD,
+    ATTR_PRINTERS | ATTR_MULTIVALUE,
+    ATTR_CTX_PRINTERS | ATTR_CTX_NOTIFICATIONS },
+  { "printer-is-accepting-jobs",	IPP_TAG_BOOLEAN,
+    ATTR_PRINTERS | ATTR_BOOL_AS_INT },
+  { "printer-up-time",			IPP_TAG_INTEGER, ATTR_PRINTERS },
+  { "queued-job-count",			IPP_TAG_INTEGER, ATTR_PRINTERS },
+  { "device-uri",			IPP_TAG_URI,	 ATTR_PRINTERS },
+  { "printer-uri-supported",		IPP_TAG_URI,	 ATTR_PRINTERS },
+  { "printer-is-shared",		IPP_TAG_BOOLEAN, ATTR_PRINTERS },
+  { "job-id",				IPP_TAG_INTEGER, ATTR_JOB_KEY },
+  { "job-k-octets",			IPP_TAG_INTEGER, ATTR_JOBS },
+  { "job-priority",			IPP_TAG_INTEGER, ATTR_JOBS },
+  { "time-at-creation",			IPP_TAG_INTEGER, ATTR_JOBS },
+  { "time-at-processing",		IPP_TAG_INTEGER, ATTR_JOBS },
+  { "time-at-completed",		IPP_TAG_INTEGER, ATTR_JOBS },
+  { "job-media-sheets",			IPP_TAG_INTEGER, ATTR_JOBS },
+  { "job-media-sheets-completed",	IPP_TAG_INTEGER, ATTR_JOBS },
+  { "job-impressions",			IPP_TAG_INTEGER, ATTR_JOBS },
+  { "job-impressions-completed",	IPP_TAG_INTEGER, ATTR_JOBS },
+  { "job-printer-up-time",		IPP_TAG_INTEGER, ATTR_JOBS },
+  { "number-of-documents",		IPP_TAG_INTEGER, ATTR_JOBS },
+  { "job-state",			IPP_TAG_ENUM,	 ATTR_JOBS },
+  { "job-name",				IPP_TAG_NAME,	 ATTR_JOBS },
+  { "job-originating-user-name",	IPP_TAG_NAME,	 ATTR_JOBS },
+  { "job-printer-uri",			IPP_TAG_URI,	 ATTR_JOBS },
+  { "job-preserved",			IPP_TAG_BOOLEAN, ATTR_JOBS },
+  { "job-printer-state-reasons",	IPP_TAG_KEYWORD, 0,
+    ATTR_CTX_JOB_ATTRS | ATTR_CTX_NOTIFICATIONS },
+  { "job-sheets-default",		IPP_TAG_NAME,	 ATTR_SHEETS },
+  { "notify-events",			IPP_TAG_KEYWORD, 0,
+    ATTR_CTX_SUBSCRIPTIONS | ATTR_CTX_NOTIFICATIONS },
+  { "notify-events-default",		IPP_TAG_KEYWORD, ATTR_MULTIVALUE },
+  { "requesting-user-name-allowed",	IPP_TAG_NAME,	 ATTR_MULTIVALUE },
+  { "requesting-user-name-denied",	IPP_TAG_NAME,	 ATTR_MULTIVALUE },
+  { "member-names",			IPP_TAG_NAME,	 ATTR_MULTIVALUE },
+  { "marker-names",			IPP_TAG_NAME,	 ATTR_MULTIVALUE },
+  { "marker-colors",			IPP_TAG_NAME,	 ATTR_MULTIVALUE },
+  { "marker-types",			IPP_TAG_KEYWORD, ATTR_MULTIVALUE },
+  { "marker-levels",			IPP_TAG_INTEGER, ATTR_MULTIVALUE },
+};
+
+#define NUM_ATTR_INFO (sizeof (attr_info) / sizeof (attr_info[0]))
+
+/* Open-addressed index into attr_info[], filled in on first use.
+ * Must stay a power of two and well over twice NUM_ATTR_INFO. */
+#define ATTR_INDEX_SIZE 128
+static const attr_info_t *attr_index[ATTR_INDEX_SIZE];
+static int attr_index_ready = 0;
 
-  debugprintf ("-> Connection_getPrinters()\n");
+static void
+build_attr_index (void)
+{
+  size_t i;
+  for (i = 0; i < NUM_ATTR_INFO; i++) {
+    unsigned int slot = str_hash (attr_info[i].name);
+    while (attr_index[slot & (ATTR_INDEX_SIZE - 1)])
+      slot++;
 
-  ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
-		 "requested-attributes",
-		 sizeof (attributes) / sizeof (attributes[0]),
-		 NULL, attributes);
-  debugprintf ("cupsDoRequest(\"/\")\n");
-  Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/");
-  Connection_end_allow_threads (self);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_FOUND) {
-      // No printers.
-      debugprintf ("<- Connection_getPrinters() = {} (no printers)\n");
-      ippDelete (answer);
-      return PyDict_New ();
-    }
+    attr_index[slot & (ATTR_INDEX_SIZE - 1)] = &attr_info[i];
+  }
 
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
-    debugprintf ("<- Connection_getPrinters() (error)\n");
+  attr_index_ready = 1;
+}
+
+static const attr_info_t *
+lookup_attr_info (const char *name)
+{
+  unsigned int slot;
+  const attr_info_t *info;
+
+  if (!name)
     return NULL;
+
+  if (!attr_index_ready)
+    build_attr_index ();
+
+  slot = str_hash (name);
+  while ((info = attr_index[slot & (ATTR_INDEX_SIZE - 1)]) != NULL) {
+    if (!strcmp (info->name, name))
+      return info;
+
+    slot++;
   }
 
-  result = PyDict_New ();
-  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer)) {
-    PyObject *dict;
-    char *printer = NULL;
+  return NULL;
+}
 
-    while (attr && ippGetGroupTag (attr) != IPP_TAG_PRINTER)
-      attr = ippNextAttribute (answer);
+/* attr's attr_info[] entry, if it has the value tag the entry
+ * describes. */
+static const attr_info_t *
+attr_info_for_value (ipp_attribute_t *attr)
+{
+  const attr_info_t *info = lookup_attr_info (ippGetName (attr));
+  if (info && ippGetValueTag (attr) != info->value_tag)
+    info = NULL;
 
-    if (!attr)
-      break;
+  return info;
+}
 
-    dict = PyDict_New ();
-    for (; attr && ippGetGroupTag (attr) == IPP_TAG_PRINTER;
-	 attr = ippNextAttribute (answer)) {
-      PyObject *val = NULL;
+static int
+attr_has_values (ipp_attribute_t *attr)
+{
+  switch (ippGetValueTag (attr)) {
+  case IPP_TAG_NOVALUE:
+  case IPP_TAG_UNKNOWN:
+  case IPP_TAG_NOTSETTABLE:
+  case IPP_TAG_DELETEATTR:
+  case IPP_TAG_ADMINDEFINE:
+    return 0;
+  default:
+    return 1;
+  }
+}
 
-      debugprintf ("Attribute: %s\n", ippGetName (attr));
-      if (!strcmp (ippGetName (attr), "printer-name") &&
-	  ippGetValueTag (attr) == IPP_TAG_NAME)
-	printer = (char *) ippGetString (attr, 0, NULL);
-      else if ((!strcmp (ippGetName (attr), "printer-type") ||
-		!strcmp (ippGetName (attr), "printer-state")) &&
-	       ippGetValueTag (attr) == IPP_TAG_ENUM) {
-	int ptype = ippGetInteger (attr, 0);
-#if PY_MAJOR_VERSION >= 3
-	val = PyLong_FromLong (ptype);
-#else
-	val = PyInt_FromLong (ptype);
-#endif
-      }
-      else if ((!strcmp (ippGetName (attr),
-			 "printer-make-and-model") ||
-		!strcmp (ippGetName (attr), "printer-info") ||
-		!strcmp (ippGetName (attr), "printer-location") ||
-		!strcmp (ippGetName (attr), "printer-state-message")) &&
-	       ippGetValueTag (attr) == IPP_TAG_TEXT) {
-	val = PyObj_from_UTF8 (ippGetString (attr, 0, NULL));
-      }
-      else if (!strcmp (ippGetName (attr),
-			"printer-state-reasons") &&
-	       ippGetValueTag (attr) == IPP_TAG_KEYWORD) {
-	val = PyList_from_attr_values (attr);
-      }
-      else if (!strcmp (ippGetName (attr),
-			"printer-is-accepting-jobs") &&
-	       ippGetValueTag (attr) == IPP_TAG_BOOLEAN) {
-	int b = ippGetBoolean (attr, 0);
-#if PY_MAJOR_VERSION >= 3
-	val = PyLong_FromLong (b);
-#else
-	val = PyInt_FromLong (b);
-#endif
-      }
-      else if ((!strcmp (ippGetName (attr),
-			 "printer-up-time") ||
-		!strcmp (ippGetName (attr),
-			 "queued-job-count")) &&
-	       ippGetValueTag (attr) == IPP_TAG_INTEGER) {
-	int u = ippGetInteger (attr, 0);
+/*
+ * Convert an attribute to a Python object as the method ctx (one of
+ * the ATTR_CTX_* values) has always done.  info is the attribute's
+ * attr_info[] entry, or NULL.  The result is a list when there are
+ * several values, or when list_in says so for ctx.  getPrinters and
+ * getJobs give just the first value of the attributes they know, and
+ * getPrinterAttributes gives job-sheets-default as a 2-tuple.  (The
+ * ATTR_MULTIVALUE lists are made by getPrinterAttributes itself.)
+ */
+static PyObject *
+PyObject_from_attr (ipp_attribute_t *attr, const attr_info_t *info,
+		    unsigned int ctx)
+{
+  if (info) {
+    if ((info->flags & ATTR_SHEETS) && ctx == ATTR_CTX_PRINTER_ATTRS &&
+	ippGetValueTag (attr) == info->value_tag) {
+      const char *start = ippGetString (attr, 0, NULL);
+      const char *end = "";
+      if (ippGetCount (attr) >= 2)
+	end = ippGetString (attr, 1, NULL);
+
+      return Py_BuildValue ("(NN)",
+			    PyObj_from_UTF8 (start),
+			    PyObj_from_UTF8 (end));
+    }
+
+    if ((info->list_in & ctx) && attr_has_values (attr))
+      return PyList_from_attr_values (attr);
+
+    if ((ctx == ATTR_CTX_PRINTERS && (info->flags & ATTR_PRINTERS)) ||
+	(ctx == ATTR_CTX_JOBS && (info->flags & ATTR_JOBS))) {
+      if ((info->flags & ATTR_BOOL_AS_INT) &&
+	  ippGetValueTag (attr) == IPP_TAG_BOOLEAN)
 #if PY_MAJOR_VERSION >= 3
-	val = PyLong_FromLong (u);
+	return PyLong_FromLong (ippGetBoolean (attr, 0));
 #else
-	val = PyInt_FromLong (u);
+	return PyInt_FromLong (ippGetBoolean (attr, 0));
 #endif
-      }
-      else if ((!strcmp (ippGetName (attr), "device-uri") ||
-		!strcmp (ippGetName (attr), "printer-uri-supported")) &&
-	       ippGetValueTag (attr) == IPP_TAG_URI) {
-	val = PyObj_from_UTF8 (ippGetString (attr, 0, NULL));
-      }
-      else if (!strcmp (ippGetName (attr), "printer-is-shared") &&
-	       ippGetValueTag (attr) == IPP_TAG_BOOLEAN) {
-	val = PyBool_FromLong (ippGetBoolean (attr, 0));
-      }
-
-      if (val) {
-	debugprintf ("Added %s to dict\n", ippGetName (attr));
-	PyDict_SetItemString (dict, ippGetName (attr), val);
-	Py_DECREF (val);
-      }
-    }
 
-    if (printer) {
-      PyObject *key = PyObj_from_UTF8 (printer);
-      PyDict_SetItem (result, key, dict);
-      Py_DECREF (key);
+      return PyObject_from_attr_value (attr, 0);
     }
-
-    Py_DECREF (dict);
-    if (!attr)
-      break;
   }
 
-  ippDelete (answer);
-  debugprintf ("<- Connection_getPrinters() = dict\n");
-  return result;
+  if (ippGetCount (attr) > 1)
+    return PyList_from_attr_values (attr);
+
+  return PyObject_from_attr_value (attr, 0);
 }
 
-static PyObject *
-Connection_getClasses (Connection *self)
+int
+Connection_init_interned (void)
 {
-  PyObject *result;
-  ipp_t *request = ippNewRequest(CUPS_GET_CLASSES), *answer;
-  ipp_attribute_t *attr;
-  const char *attributes[] = {
-    "printer-name",
-    "member-names",
+  static const char *keywords[] = {
+    "none",
+    "utf-8",
+    "en",
+    "application/octet-stream",
+    "application/pdf",
+    "application/postscript",
+    "job-completed-successfully",
+    "job-printing",
+    "job-incoming",
+    "job-canceled-by-user",
+    "job-hold-until-specified",
+    "job-queued",
+    "processing-to-stop-point",
+    "paused",
+    "media-empty",
+    "toner-low",
+    "offline-report",
+    "cups-remote",
+    NULL
   };
+  const char **keyword;
+  size_t i;
 
-  debugprintf ("-> Connection_getClasses()\n");
-  ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
-		 "requested-attributes",
-		 sizeof (attributes) / sizeof (attributes[0]),
-		 NULL, attributes);
+  build_attr_index ();
+  for (i = 0; i < NUM_ATTR_INFO; i++) {
+    PyObject *obj = PyObj_from_interned_UTF8 (attr_info[i].name);
+    if (!obj)
+      return -1;
+
+    Py_DECREF (obj);
+  }
+
+  for (keyword = keywords; *keyword; keyword++) {
+    PyObject *obj = PyObj_from_interned_UTF8 (*keyword);
+    if (!obj)
+      return -1;
+
+    Py_DECREF (obj);
+  }
+
+  return 0;
+}
+
+/* The attributes getPrinters() asks for. */
+static const char *printer_summary_attrs[] = {
+  "printer-name",
+  "printer-type",
+  "printer-location",
+  "printer-info",
+  "printer-make-and-model",
+  "printer-state",
+  "printer-state-message",
+  "printer-state-reasons",
+  "printer-uri-supported",
+  "device-uri",
+  "printer-is-shared",
+};
+
+#define NUM_PRINTER_SUMMARY_ATTRS \
+  (sizeof (printer_summary_attrs) / sizeof (printer_summary_attrs[0]))
+
+/*
+ * Decode the printer group starting at attr into a new dict as
+ * getPrinters() does, leaving out printer-name which is returned in
+ * *printer (NULL if there is none).  Returns the first attribute
+ * after the group.
+ */
+static ipp_attribute_t *
+printer_dict_from_group (ipp_t *answer, ipp_attribute_t *attr,
+			 PyObject **dict, const char **printer)
+{
+  *dict = PyDict_New ();
+  *printer = NULL;
+  for (; attr && ippGetGroupTag (attr) == IPP_TAG_PRINTER;
+       attr = ippNextAttribute (answer)) {
+    PyObject *val = NULL;
+    const attr_info_t *info;
+
+    debugprintf ("Attribute: %s\n", ippGetName (attr));
+    info = attr_info_for_value (attr);
+    if (!info || !(info->flags & ATTR_PRINTERS))
+      continue;
+
+    if (info->flags & ATTR_PRINTER_KEY)
+      *printer = ippGetString (attr, 0, NULL);
+    else
+      val = PyObject_from_attr (attr, info, ATTR_CTX_PRINTERS);
+
+    if (val) {
+      debugprintf ("Added %s to dict\n", ippGetName (attr));
+      set_attr_item (*dict, attr, val);
+      Py_DECREF (val);
+    }
+  }
+
+  return attr;
+}
+
+static PyObject *build_ResultMap (ipp_t *answer, ipp_tag_t group);
+static int get_requested_attrs (PyObject *requested_attrs, size_t *n_attrs,
+				char ***attrs);
+static void free_requested_attrs (size_t n_attrs, char **attrs);
+static int ensure_requested_attr (size_t *n_attrs, char ***attrs,
+				  const char *name);
+
+typedef struct
+{
+  PyObject_HEAD
+  ipp_t *answer;
+  ipp_attribute_t *attr;	/* next attribute to decode */
+  int all_lists;
+} PPDIterator;
+
+typedef struct
+{
+  PyObject_HEAD
+  Connection *conn;		/* private connection used for paging */
+  char *which;
+  int my_jobs;
+  int page_size;
+  size_t n_attrs;
+  char **attrs;
+  int first_job_id;		/* lowest job ID for the next page */
+  int by_id;			/* list the job IDs, then fetch by ID */
+  int *ids;			/* the listed job IDs */
+  int n_ids;
+  int next_id;			/* index in ids of the next page */
+  int single_end;		/* fetch one job at a time before this */
+  ipp_t *page;			/* page being consumed */
+  ipp_attribute_t *attr;	/* next attribute of page */
+  int prefetching;		/* next page's request already sent */
+  int last_page;		/* no more pages after this one */
+} JobIterator;
+
+/* The getPrinters() dict for a CUPS-Get-Printers response. */
+static PyObject *
+printers_from_answer (ipp_t *answer)
+{
+  PyObject *result = PyDict_New ();
+  ipp_attribute_t *attr;
+
+  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer)) {
+    PyObject *dict;
+    const char *printer;
+
+    while (attr && ippGetGroupTag (attr) != IPP_TAG_PRINTER)
+      attr = ippNextAttribute (answer);
+
+    if (!attr)
+      break;
+
+    attr = printer_dict_from_group (answer, attr, &dict, &printer);
+    if (printer) {
+      PyObject *key = PyObj_from_UTF8 (printer);
+      PyDict_SetItem (result, key, dict);
+      Py_DECREF (key);
+    }
+
+    Py_DECREF (dict);
+    if (!attr)
+      break;
+  }
+
+  return result;
+}
+
+static PyObject *
+do_getPrinters (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *result;
+  ipp_t *request, *answer;
+  int lazy = 0;
+  static char *kwlist[] = { "lazy", NULL };
+  STATS_CLOCK (stats_clock);
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|b", kwlist, &lazy))
+    return NULL;
+
+  debugprintf ("-> Connection_getPrinters()\n");
+
+  request = ippNewRequest(CUPS_GET_PRINTERS);
+  ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		 "requested-attributes", NUM_PRINTER_SUMMARY_ATTRS,
+		 NULL, printer_summary_attrs);
+  STATS_BUILT (STATS_GET_PRINTERS, stats_clock);
+  debugprintf ("cupsDoRequest(\"/\")\n");
+  Connection_begin_allow_threads (self);
+  answer = Connection_do_request (self, request, "/", 1);
+  Connection_end_allow_threads (self);
+  STATS_WAITED (STATS_GET_PRINTERS, stats_clock);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_FOUND) {
+      // No printers.
+      debugprintf ("<- Connection_getPrinters() = {} (no printers)\n");
+      if (lazy)
+	return build_ResultMap (answer, IPP_TAG_PRINTER);
+
+      ippDelete (answer);
+      return PyDict_New ();
+    }
+
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    STATS_FAILED (STATS_GET_PRINTERS);
+    debugprintf ("<- Connection_getPrinters() (error)\n");
+    return NULL;
+  }
+
+  if (lazy) {
+    debugprintf ("<- Connection_getPrinters() = ResultMap\n");
+    return build_ResultMap (answer, IPP_TAG_PRINTER);
+  }
+
+  result = printers_from_answer (answer);
+  ippDelete (answer);
+  STATS_DECODED (STATS_GET_PRINTERS, stats_clock);
+  debugprintf ("<- Connection_getPrinters() = dict\n");
+  return result;
+}
+
+static PyObject *
+Connection_getPrinters (Connection *self, PyObject *args, PyObject *kwds)
+{
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  Connection_call_begin (self);
+  return Connection_call_end (self, "getPrinters",
+			      do_getPrinters (self, args, kwds));
+}
+
+static PyObject *
+Connection_getClasses (Connection *self)
+{
+  PyObject *result;
+  ipp_t *request, *answer;
+  ipp_attribute_t *attr;
+  const char *attributes[] = {
+    "printer-name",
+    "member-names",
+  };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  debugprintf ("-> Connection_getClasses()\n");
+  request = ippNewRequest(CUPS_GET_CLASSES);
+  ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		 "requested-attributes",
+		 sizeof (attributes) / sizeof (attributes[0]),
+		 NULL, attributes);
   debugprintf ("cupsDoRequest(\"/\")\n");
   Connection_begin_allow_threads (self);
   answer = cupsDoRequest (self->http, request, "/");
@@ -957,12 +1600,15 @@ Connection_getClasses (Connection *self)
   return result;
 }
 
-static PyObject *
-do_getPPDs (Connection *self, PyObject *args, PyObject *kwds, int all_lists)
+/*
+ * Build a CUPS-Get-PPDs request from the getPPDs() arguments.  If
+ * all_lists is not NULL, an all_lists argument is also accepted and
+ * stored there, as for iterPPDs().
+ */
+static ipp_t *
+new_get_ppds_request (PyObject *args, PyObject *kwds, int *all_lists)
 {
-  PyObject *result = NULL;
-  ipp_t *request, *answer;
-  ipp_attribute_t *attr;
+  ipp_t *request;
   int limit = 0;
   PyObject *exclude_schemes_obj = NULL;	/* string list */
   PyObject *include_schemes_obj = NULL;	/* string list */
@@ -979,6 +1625,10 @@ do_getPPDs (Connection *self, PyObject *args, PyObject *kwds, int all_lists)
   PyObject *ppd_psversion_obj = NULL;	/* UTF-8 string */
   char *ppd_psversion;
   char *ppd_type = NULL;
+  PyObject *requested_attrs = NULL;
+  char **attrs = NULL;
+  size_t n_attrs = 0;
+  int ok;
   static char *kwlist[] = { "limit",
 			    "exclude_schemes",
 			    "include_schemes",
@@ -990,17 +1640,48 @@ do_getPPDs (Connection *self, PyObject *args, PyObject *kwds, int all_lists)
 			    "ppd_product",
 			    "ppd_psversion",
 			    "ppd_type",
+			    "requested_attributes",
 			    NULL };
-
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|iOOsOOOiOOs", kwlist,
-				    &limit,
-				    &exclude_schemes_obj, &include_schemes_obj,
-				    &ppd_natural_language,
-				    &ppd_device_id_obj, &ppd_make_obj,
-				    &ppd_make_and_model_obj,
-				    &ppd_model_number,
-				    &ppd_product_obj, &ppd_psversion_obj,
-				    &ppd_type))
+  static char *iter_kwlist[] = { "limit",
+				 "exclude_schemes",
+				 "include_schemes",
+				 "ppd_natural_language",
+				 "ppd_device_id",
+				 "ppd_make",
+				 "ppd_make_and_model",
+				 "ppd_model_number",
+				 "ppd_product",
+				 "ppd_psversion",
+				 "ppd_type",
+				 "requested_attributes",
+				 "all_lists",
+				 NULL };
+
+  if (all_lists)
+    ok = PyArg_ParseTupleAndKeywords (args, kwds, "|iOOsOOOiOOsOi",
+				      iter_kwlist,
+				      &limit,
+				      &exclude_schemes_obj,
+				      &include_schemes_obj,
+				      &ppd_natural_language,
+				      &ppd_device_id_obj, &ppd_make_obj,
+				      &ppd_make_and_model_obj,
+				      &ppd_model_number,
+				      &ppd_product_obj, &ppd_psversion_obj,
+				      &ppd_type, &requested_attrs,
+				      all_lists);
+  else
+    ok = PyArg_ParseTupleAndKeywords (args, kwds, "|iOOsOOOiOOsO", kwlist,
+				      &limit,
+				      &exclude_schemes_obj,
+				      &include_schemes_obj,
+				      &ppd_natural_language,
+				      &ppd_device_id_obj, &ppd_make_obj,
+				      &ppd_make_and_model_obj,
+				      &ppd_model_number,
+				      &ppd_product_obj, &ppd_psversion_obj,
+				      &ppd_type, &requested_attrs);
+  if (!ok)
     return NULL;
 
   request = ippNewRequest(CUPS_GET_PPDS);
@@ -1159,16 +1840,102 @@ do_getPPDs (Connection *self, PyObject *args, PyObject *kwds, int all_lists)
     ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
 		  "ppd-type", NULL, ppd_type);
 
-  debugprintf ("-> Connection_getPPDs()\n");
+  if (requested_attrs) {
+    if (get_requested_attrs (requested_attrs, &n_attrs, &attrs) == -1) {
+      ippDelete (request);
+      return NULL;
+    }
+
+    // Results are keyed by it.
+    if (ensure_requested_attr (&n_attrs, &attrs, "ppd-name") == -1) {
+      free_requested_attrs (n_attrs, attrs);
+      ippDelete (request);
+      PyErr_NoMemory ();
+      return NULL;
+    }
+
+    ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		   "requested-attributes", n_attrs, NULL,
+		   (const char **) attrs);
+    free_requested_attrs (n_attrs, attrs);
+  }
+
+  return request;
+}
+
+/*
+ * Make a dict of the PPD attributes in the group beginning at attr,
+ * and find its ppd-name.  Returns the first attribute after the
+ * group.
+ */
+static ipp_attribute_t *
+ppd_dict_from_group (ipp_t *answer, ipp_attribute_t *attr, int all_lists,
+		     PyObject **dict, const char **ppdname)
+{
+  *dict = PyDict_New ();
+  *ppdname = NULL;
+  for (; attr && ippGetGroupTag (attr) == IPP_TAG_PRINTER;
+       attr = ippNextAttribute (answer)) {
+    PyObject *val = NULL;
+    debugprintf ("Attribute: %s\n", ippGetName (attr));
+    if (!strcmp (ippGetName (attr), "ppd-name") &&
+	ippGetValueTag (attr) == IPP_TAG_NAME)
+      *ppdname = ippGetString (attr, 0, NULL);
+    else {
+      if (all_lists)
+	val = PyList_from_attr_values (attr);
+      else
+	val = PyObject_from_attr_value (attr, 0);
+
+      if (val) {
+	debugprintf ("Adding %s to ppd dict\n", ippGetName (attr));
+	set_attr_item (*dict, attr, val);
+	Py_DECREF (val);
+      }
+    }
+  }
+
+  return attr;
+}
+
+static ipp_t *
+do_get_ppds_answer (Connection *self, ipp_t *request)
+{
+  ipp_t *answer;
+
   debugprintf ("cupsDoRequest(\"/\")\n");
   Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/");
+  answer = Connection_do_request (self, request, "/", 1);
   Connection_end_allow_threads (self);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
+    return NULL;
+  }
+
+  return answer;
+}
+
+static PyObject *
+do_getPPDs (Connection *self, PyObject *args, PyObject *kwds, int all_lists)
+{
+  PyObject *result = NULL;
+  ipp_t *request, *answer;
+  ipp_attribute_t *attr;
+  STATS_CLOCK (stats_clock);
+
+  request = new_get_ppds_request (args, kwds, NULL);
+  if (!request)
+    return NULL;
+
+  debugprintf ("-> Connection_getPPDs()\n");
+  STATS_BUILT (STATS_GET_PPDS, stats_clock);
+  answer = do_get_ppds_answer (self, request);
+  STATS_WAITED (STATS_GET_PPDS, stats_clock);
+  if (!answer) {
+    STATS_FAILED (STATS_GET_PPDS);
     debugprintf ("<- Connection_getPPDs() (error)\n");
     return NULL;
   }
@@ -1176,7 +1943,7 @@ do_getPPDs (Connection *self, PyObject *args, PyObject *kwds, int all_lists)
   result = PyDict_New ();
   for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer)) {
     PyObject *dict;
-    char *ppdname = NULL;
+    const char *ppdname;
 
     while (attr && ippGetGroupTag (attr) != IPP_TAG_PRINTER)
       attr = ippNextAttribute (answer);
@@ -1184,28 +1951,7 @@ do_getPPDs (Connection *self, PyObject *args, PyObject *kwds, int all_lists)
     if (!attr)
       break;
 
-    dict = PyDict_New ();
-    for (; attr && ippGetGroupTag (attr) == IPP_TAG_PRINTER;
-	 attr = ippNextAttribute (answer)) {
-      PyObject *val = NULL;
-      debugprintf ("Attribute: %s\n", ippGetName (attr));
-      if (!strcmp (ippGetName (attr), "ppd-name") &&
-	  ippGetValueTag (attr) == IPP_TAG_NAME)
-	ppdname = (char *) ippGetString (attr, 0, NULL);
-      else {
-	if (all_lists)
-	  val = PyList_from_attr_values (attr);
-	else
-	  val = PyObject_from_attr_value (attr, 0);
-
-	if (val) {
-	  debugprintf ("Adding %s to ppd dict\n", ippGetName (attr));
-	  PyDict_SetItemString (dict, ippGetName (attr), val);
-	  Py_DECREF (val);
-	}
-      }
-    }
-
+    attr = ppd_dict_from_group (answer, attr, all_lists, &dict, &ppdname);
     if (ppdname) {
       PyObject *key = PyObj_from_UTF8 (ppdname);
       debugprintf ("Adding %s to result dict\n", ppdname);
@@ -1219,6 +1965,7 @@ do_getPPDs (Connection *self, PyObject *args, PyObject *kwds, int all_lists)
   }
 
   ippDelete (answer);
+  STATS_DECODED (STATS_GET_PPDS, stats_clock);
   debugprintf ("<- Connection_getPPDs() = dict\n");
   return result;
 }
@@ -1226,13 +1973,63 @@ do_getPPDs (Connection *self, PyObject *args, PyObject *kwds, int all_lists)
 static PyObject *
 Connection_getPPDs (Connection *self, PyObject *args, PyObject *kwds)
 {
-  return do_getPPDs (self, args, kwds, 0);
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  Connection_call_begin (self);
+  return Connection_call_end (self, "getPPDs",
+			      do_getPPDs (self, args, kwds, 0));
 }
 
 static PyObject *
 Connection_getPPDs2 (Connection *self, PyObject *args, PyObject *kwds)
 {
-  return do_getPPDs (self, args, kwds, 1);
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  Connection_call_begin (self);
+  return Connection_call_end (self, "getPPDs2",
+			      do_getPPDs (self, args, kwds, 1));
+}
+
+static PyObject *
+Connection_iterPPDs (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *largs, *lkwlist;
+  PPDIterator *it;
+  ipp_t *request, *answer;
+  int all_lists = 0;
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  request = new_get_ppds_request (args, kwds, &all_lists);
+  if (!request)
+    return NULL;
+
+  debugprintf ("-> Connection_iterPPDs()\n");
+  answer = do_get_ppds_answer (self, request);
+  if (!answer) {
+    debugprintf ("<- Connection_iterPPDs() (error)\n");
+    return NULL;
+  }
+
+  largs = Py_BuildValue ("()");
+  lkwlist = Py_BuildValue ("{}");
+  it = (PPDIterator *) PyType_GenericNew (&cups_PPDIteratorType,
+					  largs, lkwlist);
+  Py_DECREF (largs);
+  Py_DECREF (lkwlist);
+  if (!it) {
+    ippDelete (answer);
+    return NULL;
+  }
+
+  it->answer = answer;
+  it->attr = ippFirstAttribute (answer);
+  it->all_lists = all_lists;
+  debugprintf ("<- Connection_iterPPDs()\n");
+  return (PyObject *) it;
 }
 
 static PyObject *
@@ -1242,6 +2039,8 @@ Connection_getServerPPD (Connection *self, PyObject *args)
   const char *ppd_name, *filename;
   if (!PyArg_ParseTuple (args, "s", &ppd_name))
     return NULL;
+  if (Connection_check_idle (self) < 0)
+    return NULL;
   debugprintf ("-> Connection_getServerPPD()\n");
   Connection_begin_allow_threads (self);
   filename = cupsGetServerPPD (self->http, ppd_name);
@@ -1277,6 +2076,9 @@ Connection_getDocument (Connection *self, PyObject *args)
   char docfilename[PATH_MAX];
   int fd;
 
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
   if (!PyArg_ParseTuple (args, "Oii", &uriobj, &jobid, &docnum))
     return NULL;
 
@@ -1355,40 +2157,207 @@ Connection_getDocument (Connection *self, PyObject *args)
 #endif /* CUPS 1.4 */
 }
 
+// Device discovery cache.  Maps (host, limit, include_schemes,
+// exclude_schemes) to (time found, devices dict) so that repeated
+// getDevices calls need not wait for every backend again.
+static PyObject *device_cache = NULL;
+
 static PyObject *
-Connection_getDevices (Connection *self, PyObject *args, PyObject *kwds)
+device_schemes_key (PyObject *schemes, const char *what)
 {
-  PyObject *result;
-  ipp_t *request, *answer;
-  ipp_attribute_t *attr;
-  int limit = 0;
-  int timeout = 0;
-  PyObject *exclude_schemes = NULL;
-  PyObject *include_schemes = NULL;
-  static char *kwlist[] = { "limit",
-			    "exclude_schemes",
-			    "include_schemes",
-			    "timeout",
-			    NULL };
+  PyObject *list, *key;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|iOOi", kwlist, &limit,
-				    &exclude_schemes, &include_schemes,
-				    &timeout))
+  if (!schemes || schemes == Py_None) {
+    Py_INCREF (Py_None);
+    return Py_None;
+  }
+
+  if (!PyList_Check (schemes)) {
+    char msg[64];
+    snprintf (msg, sizeof (msg), "List required (%s)", what);
+    PyErr_SetString (PyExc_TypeError, msg);
     return NULL;
+  }
 
-  request = ippNewRequest(CUPS_GET_DEVICES);
-  if (limit > 0)
-    ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-		   "limit", limit);
+  list = PyList_GetSlice (schemes, 0, PyList_Size (schemes));
+  if (!list)
+    return NULL;
 
-  if (exclude_schemes)
-    {
-      size_t i, n;
-      char **ss;
-      if (!PyList_Check (exclude_schemes))
+  if (PyList_Sort (list) < 0) {
+    Py_DECREF (list);
+    return NULL;
+  }
+
+  key = PyList_AsTuple (list);
+  Py_DECREF (list);
+  return key;
+}
+
+// Everything the answer can depend on: which server, and the request.
+static PyObject *
+device_cache_key (Connection *self, int limit, int timeout,
+		  PyObject *include_schemes, PyObject *exclude_schemes)
+{
+  PyObject *inc, *exc, *key;
+
+  inc = device_schemes_key (include_schemes, "include_schemes");
+  if (!inc)
+    return NULL;
+
+  exc = device_schemes_key (exclude_schemes, "exclude_schemes");
+  if (!exc) {
+    Py_DECREF (inc);
+    return NULL;
+  }
+
+  key = Py_BuildValue ("(ziiiiOO)", self->host, self->port,
+		       self->encryption, limit, timeout, inc, exc);
+  Py_DECREF (inc);
+  Py_DECREF (exc);
+  return key;
+}
+
+// A copy of a devices dict, so callers cannot alter the cached one.
+static PyObject *
+copy_devices (PyObject *devices)
+{
+  PyObject *copy = PyDict_New ();
+  PyObject *key, *value;
+  Py_ssize_t pos = 0;
+
+  while (copy && PyDict_Next (devices, &pos, &key, &value)) {
+    PyObject *dict = PyDict_Copy (value);
+    if (!dict || PyDict_SetItem (copy, key, dict) < 0) {
+      Py_XDECREF (dict);
+      Py_DECREF (copy);
+      return NULL;
+    }
+
+    Py_DECREF (dict);
+  }
+
+  return copy;
+}
+
+// Returns a new reference to the cached devices dict for key if it
+// was found less than ttl seconds ago, otherwise NULL.
+static PyObject *
+device_cache_lookup (PyObject *key, double ttl)
+{
+  PyObject *entry;
+  unsigned long long found;
+
+  if (!device_cache || ttl <= 0)
+    return NULL;
+
+  entry = PyDict_GetItem (device_cache, key); // borrowed ref
+  if (!entry)
+    return NULL;
+
+  found = PyLong_AsUnsignedLongLong (PyTuple_GET_ITEM (entry, 0));
+  if ((stats_now () - found) / 1e9 >= ttl) {
+    PyDict_DelItem (device_cache, key);
+    return NULL;
+  }
+
+  Py_INCREF (PyTuple_GET_ITEM (entry, 1));
+  return PyTuple_GET_ITEM (entry, 1);
+}
+
+static void
+device_cache_store (PyObject *key, PyObject *devices)
+{
+  PyObject *copy, *entry;
+
+  if (!device_cache) {
+    device_cache = PyDict_New ();
+    if (!device_cache) {
+      PyErr_Clear ();
+      return;
+    }
+  }
+
+  copy = copy_devices (devices);
+  if (!copy) {
+    PyErr_Clear ();
+    return;
+  }
+
+  entry = Py_BuildValue ("(KN)", stats_now (), copy);
+  if (!entry || PyDict_SetItem (device_cache, key, entry) < 0)
+    PyErr_Clear ();
+
+  Py_XDECREF (entry);
+}
+
+PyObject *
+Connection_clearDeviceCache (PyObject *self, PyObject *args)
+{
+  debugprintf ("-> Connection_clearDeviceCache()\n");
+  if (device_cache)
+    PyDict_Clear (device_cache);
+
+  debugprintf ("<- Connection_clearDeviceCache()\n");
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+Connection_getDevices (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *result;
+  PyObject *cache_key = NULL;
+  ipp_t *request, *answer;
+  ipp_attribute_t *attr;
+  int limit = 0;
+  int timeout = 0;
+  double cache_ttl = 0;
+  PyObject *exclude_schemes = NULL;
+  PyObject *include_schemes = NULL;
+  static char *kwlist[] = { "limit",
+			    "exclude_schemes",
+			    "include_schemes",
+			    "timeout",
+			    "cache_ttl",
+			    NULL };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|iOOid", kwlist, &limit,
+				    &exclude_schemes, &include_schemes,
+				    &timeout, &cache_ttl))
+    return NULL;
+
+  if (cache_ttl > 0) {
+    cache_key = device_cache_key (self, limit, timeout, include_schemes,
+				  exclude_schemes);
+    if (!cache_key)
+      return NULL;
+
+    result = device_cache_lookup (cache_key, cache_ttl);
+    if (result) {
+      PyObject *copy = copy_devices (result);
+      Py_DECREF (result);
+      Py_DECREF (cache_key);
+      debugprintf ("<> Connection_getDevices() = cached dict\n");
+      return copy;
+    }
+  }
+
+  request = ippNewRequest(CUPS_GET_DEVICES);
+  if (limit > 0)
+    ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+		   "limit", limit);
+
+  if (exclude_schemes)
+    {
+      size_t i, n;
+      char **ss;
+      if (!PyList_Check (exclude_schemes))
 	{
 	  PyErr_SetString (PyExc_TypeError, "List required (exclude_schemes)");
 	  ippDelete (request);
+	  Py_XDECREF (cache_key);
 	  return NULL;
 	}
 
@@ -1405,6 +2374,7 @@ Connection_getDevices (Connection *self, PyObject *args, PyObject *kwds)
 	      while (i > 0)
 		free (ss[--i]);
 	      free (ss);
+	      Py_XDECREF (cache_key);
 	      return NULL;
 	    }
 
@@ -1427,6 +2397,7 @@ Connection_getDevices (Connection *self, PyObject *args, PyObject *kwds)
 	{
 	  PyErr_SetString (PyExc_TypeError, "List required (include_schemes)");
 	  ippDelete (request);
+	  Py_XDECREF (cache_key);
 	  return NULL;
 	}
 
@@ -1443,6 +2414,7 @@ Connection_getDevices (Connection *self, PyObject *args, PyObject *kwds)
 	      while (i > 0)
 		free (ss[--i]);
 	      free (ss);
+	      Py_XDECREF (cache_key);
 	      return NULL;
 	    }
 
@@ -1471,6 +2443,7 @@ Connection_getDevices (Connection *self, PyObject *args, PyObject *kwds)
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
+    Py_XDECREF (cache_key);
     debugprintf ("<- Connection_getDevices() (error)\n");
     return NULL;
   }
@@ -1500,7 +2473,7 @@ Connection_getDevices (Connection *self, PyObject *args, PyObject *kwds)
 
       if (val) {
 	debugprintf ("Adding %s to device dict\n", ippGetName (attr));
-	PyDict_SetItemString (dict, ippGetName (attr), val);
+	set_attr_item (dict, attr, val);
 	Py_DECREF (val);
       }
     }
@@ -1518,10 +2491,252 @@ Connection_getDevices (Connection *self, PyObject *args, PyObject *kwds)
   }
 
   ippDelete (answer);
+  if (cache_key) {
+    device_cache_store (cache_key, result);
+    Py_DECREF (cache_key);
+  }
+
   debugprintf ("<- Connection_getDevices() = dict\n");
   return result;
 }
 
+#ifdef HAVE_CUPS_1_4
+struct stream_devices_context
+{
+  Connection *conn;
+  PyObject *cb;
+  PyObject *devices;
+  int failed;
+};
+
+static void
+stream_devices_cb (const char *device_class,
+		   const char *device_id,
+		   const char *device_info,
+		   const char *device_make_and_model,
+		   const char *device_uri,
+		   const char *device_location,
+		   void *user_data)
+{
+  struct stream_devices_context *context = user_data;
+  PyObject *dict, *uri, *result;
+
+  debugprintf ("-> stream_devices_cb(%s)\n", device_uri);
+  Connection_end_allow_threads (context->conn);
+  if (context->failed)
+    goto out;
+
+  dict = Py_BuildValue ("{sNsNsNsNsN}",
+			"device-class", PyObj_from_UTF8 (device_class),
+			"device-id", PyObj_from_UTF8 (device_id),
+			"device-info", PyObj_from_UTF8 (device_info),
+			"device-make-and-model",
+			PyObj_from_UTF8 (device_make_and_model),
+			"device-location", PyObj_from_UTF8 (device_location));
+  uri = PyObj_from_UTF8 (device_uri);
+  if (!dict || !uri || PyDict_SetItem (context->devices, uri, dict) < 0) {
+    Py_XDECREF (dict);
+    Py_XDECREF (uri);
+    context->failed = 1;
+    goto out;
+  }
+
+  result = PyObject_CallFunctionObjArgs (context->cb, uri, dict, NULL);
+  Py_DECREF (dict);
+  Py_DECREF (uri);
+  if (result)
+    Py_DECREF (result);
+  else
+    // Keep the exception; cupsGetDevices cannot be interrupted, so
+    // the remaining devices are ignored.
+    context->failed = 1;
+
+ out:
+  Connection_begin_allow_threads (context->conn);
+  debugprintf ("<- stream_devices_cb()\n");
+}
+
+static int
+join_schemes (PyObject *schemes, const char *what, char **joined)
+{
+  Py_ssize_t i, n;
+  size_t len = 1;
+  char **ss;
+
+  *joined = NULL;
+  if (!schemes || schemes == Py_None)
+    return 0;
+
+  if (!PyList_Check (schemes)) {
+    char msg[64];
+    snprintf (msg, sizeof (msg), "List required (%s)", what);
+    PyErr_SetString (PyExc_TypeError, msg);
+    return -1;
+  }
+
+  n = PyList_Size (schemes);
+  ss = calloc (n + 1, sizeof (char *));
+  if (!ss) {
+    PyErr_NoMemory ();
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    PyObject *val = PyList_GetItem (schemes, i); // borrowed ref
+    if (!PyUnicode_Check (val) && !PyBytes_Check (val)) {
+      char msg[64];
+      snprintf (msg, sizeof (msg), "String list required (%s)", what);
+      PyErr_SetString (PyExc_TypeError, msg);
+      goto fail;
+    }
+
+    if (UTF8_from_PyObj (&ss[i], val) == NULL)
+      goto fail;
+
+    len += strlen (ss[i]) + 1;
+  }
+
+  *joined = malloc (len);
+  if (!*joined) {
+    PyErr_NoMemory ();
+    goto fail;
+  }
+
+  (*joined)[0] = '\0';
+  for (i = 0; i < n; i++) {
+    if (i)
+      strcat (*joined, ",");
+    strcat (*joined, ss[i]);
+    free (ss[i]);
+  }
+
+  free (ss);
+  return 0;
+
+ fail:
+  while (i > 0)
+    free (ss[--i]);
+  free (ss);
+  return -1;
+}
+#endif /* HAVE_CUPS_1_4 */
+
+static PyObject *
+Connection_streamDevices (Connection *self, PyObject *args, PyObject *kwds)
+{
+#ifdef HAVE_CUPS_1_4
+  struct stream_devices_context context;
+  PyObject *cb;
+  PyObject *cache_key = NULL;
+  PyObject *exclude_schemes = NULL;
+  PyObject *include_schemes = NULL;
+  char *include = NULL, *exclude = NULL;
+  int timeout = 0;
+  double cache_ttl = 0;
+  ipp_status_t status;
+  static char *kwlist[] = { "callback",
+			    "exclude_schemes",
+			    "include_schemes",
+			    "timeout",
+			    "cache_ttl",
+			    NULL };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|OOid", kwlist, &cb,
+				    &exclude_schemes, &include_schemes,
+				    &timeout, &cache_ttl))
+    return NULL;
+
+  if (!PyCallable_Check (cb)) {
+    PyErr_SetString (PyExc_TypeError, "callback must be callable");
+    return NULL;
+  }
+
+  if (cache_ttl > 0) {
+    PyObject *cached;
+
+    cache_key = device_cache_key (self, 0, timeout, include_schemes,
+				  exclude_schemes);
+    if (!cache_key)
+      return NULL;
+
+    cached = device_cache_lookup (cache_key, cache_ttl);
+    if (cached) {
+      PyObject *copy = copy_devices (cached);
+      PyObject *key, *value;
+      Py_ssize_t pos = 0;
+
+      Py_DECREF (cached);
+      Py_DECREF (cache_key);
+      debugprintf ("-> Connection_streamDevices() from cache\n");
+      while (copy && PyDict_Next (copy, &pos, &key, &value)) {
+	PyObject *result = PyObject_CallFunctionObjArgs (cb, key, value,
+							 NULL);
+	if (!result) {
+	  Py_CLEAR (copy);
+	  break;
+	}
+
+	Py_DECREF (result);
+      }
+
+      debugprintf ("<- Connection_streamDevices()%s\n",
+		   copy ? "" : " EXCEPTION");
+      return copy;
+    }
+  }
+
+  if (join_schemes (include_schemes, "include_schemes", &include) < 0 ||
+      join_schemes (exclude_schemes, "exclude_schemes", &exclude) < 0) {
+    free (include);
+    Py_XDECREF (cache_key);
+    return NULL;
+  }
+
+  context.conn = self;
+  context.cb = cb;
+  context.devices = PyDict_New ();
+  context.failed = 0;
+
+  debugprintf ("-> Connection_streamDevices()\n");
+  Connection_begin_allow_threads (self);
+  status = cupsGetDevices (self->http, timeout, include, exclude,
+			   stream_devices_cb, &context);
+  Connection_end_allow_threads (self);
+  free (include);
+  free (exclude);
+
+  if (context.failed) {
+    Py_DECREF (context.devices);
+    Py_XDECREF (cache_key);
+    debugprintf ("<- Connection_streamDevices() EXCEPTION\n");
+    return NULL;
+  }
+
+  if (status > IPP_OK_CONFLICT) {
+    set_ipp_error (status, cupsLastErrorString ());
+    Py_DECREF (context.devices);
+    Py_XDECREF (cache_key);
+    debugprintf ("<- Connection_streamDevices() (error)\n");
+    return NULL;
+  }
+
+  if (cache_key) {
+    device_cache_store (cache_key, context.devices);
+    Py_DECREF (cache_key);
+  }
+
+  debugprintf ("<- Connection_streamDevices() = dict\n");
+  return context.devices;
+#else /* earlier than CUPS 1.4 */
+  PyErr_SetString (PyExc_RuntimeError,
+		   "Operation not supported - recompile against CUPS 1.4 or later");
+  return NULL;
+#endif /* CUPS 1.4 */
+}
+
 static int
 get_requested_attrs (PyObject *requested_attrs, size_t *n_attrs, char ***attrs)
 {
@@ -1568,29 +2783,11 @@ free_requested_attrs (size_t n_attrs, char **attrs)
   free (attrs);
 }
 
-static PyObject *
-Connection_getJobs (Connection *self, PyObject *args, PyObject *kwds)
+static ipp_t *
+new_get_jobs_request (const char *which, int my_jobs, int limit,
+		      int first_job_id, size_t n_attrs, char **attrs)
 {
-  PyObject *result;
-  ipp_t *request, *answer;
-  ipp_attribute_t *attr;
-  char *which = NULL;
-  int my_jobs = 0;
-  int limit = -1;
-  int first_job_id = -1;
-  PyObject *requested_attrs = NULL;
-  char **attrs = NULL; /* initialised to calm compiler */
-  size_t n_attrs = 0; /* initialised to calm compiler */
-  static char *kwlist[] = { "which_jobs", "my_jobs", "limit", "first_job_id", 
-			    "requested_attributes", NULL };
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|siiiO", kwlist,
-				    &which, &my_jobs, &limit, &first_job_id,
-				    &requested_attrs))
-    return NULL;
-
-  debugprintf ("-> Connection_getJobs(%s,%d)\n",
-	       which ? which : "(null)", my_jobs);
-  request = ippNewRequest(IPP_GET_JOBS);
+  ipp_t *request = ippNewRequest(IPP_GET_JOBS);
   ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri",
 		NULL, "ipp://localhost/printers/");
 
@@ -1610,35 +2807,84 @@ Connection_getJobs (Connection *self, PyObject *args, PyObject *kwds)
     ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
 		   "first-job-id", first_job_id);
 
-  if (requested_attrs) {
-    if (get_requested_attrs (requested_attrs, &n_attrs, &attrs) == -1) {
-      ippDelete (request);
-      return NULL;
-    }
-
+  if (n_attrs > 0)
     ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
 		   "requested-attributes", n_attrs, NULL,
 		   (const char **) attrs);
-    free_requested_attrs (n_attrs, attrs);
-  }
 
-  debugprintf ("cupsDoRequest(\"/\")\n");
-  Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/");
-  Connection_end_allow_threads (self);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
-    debugprintf ("<- Connection_getJobs() (error)\n");
-    return NULL;
+  return request;
+}
+
+/*
+ * Make sure name is among the requested attributes, for callers that
+ * depend on it being returned.
+ */
+static int
+ensure_requested_attr (size_t *n_attrs, char ***attrs, const char *name)
+{
+  char **as = *attrs;
+  size_t i;
+
+  for (i = 0; i < *n_attrs; i++)
+    if (!strcmp (as[i], name))
+      return 0;
+
+  as = realloc (as, (*n_attrs + 2) * sizeof (char *));
+  if (!as)
+    return -1;
+
+  *attrs = as;
+  if ((as[*n_attrs] = strdup (name)) == NULL)
+    return -1;
+
+  as[++(*n_attrs)] = NULL;
+  return 0;
+}
+
+/*
+ * Decode the job group starting at attr into a new dict, leaving out
+ * job-id which is returned in *job_id (-1 if there is none).  Returns
+ * the first attribute after the group.
+ */
+static ipp_attribute_t *
+job_dict_from_group (ipp_t *answer, ipp_attribute_t *attr,
+		     PyObject **dict, int *job_id)
+{
+  *dict = PyDict_New ();
+  *job_id = -1;
+  for (; attr && ippGetGroupTag (attr) == IPP_TAG_JOB;
+       attr = ippNextAttribute (answer)) {
+    PyObject *val = NULL;
+    const attr_info_t *info;
+
+    debugprintf ("Attribute: %s\n", ippGetName (attr));
+    info = attr_info_for_value (attr);
+
+    if (info && (info->flags & ATTR_JOB_KEY))
+      *job_id = ippGetInteger (attr, 0);
+    else
+      val = PyObject_from_attr (attr, info, ATTR_CTX_JOBS);
+
+    if (val) {
+      debugprintf ("Adding %s to job dict\n", ippGetName (attr));
+      set_attr_item (*dict, attr, val);
+      Py_DECREF (val);
+    }
   }
 
-  result = PyDict_New ();
+  return attr;
+}
+
+/* The getJobs() dict for a Get-Jobs response. */
+static PyObject *
+jobs_from_answer (ipp_t *answer)
+{
+  PyObject *result = PyDict_New ();
+  ipp_attribute_t *attr;
+
   for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer)) {
     PyObject *dict;
-    int job_id = -1;
+    int job_id;
 
     while (attr && ippGetGroupTag (attr) != IPP_TAG_JOB)
       attr = ippNextAttribute (answer);
@@ -1646,54 +2892,7 @@ Connection_getJobs (Connection *self, PyObject *args, PyObject *kwds)
     if (!attr)
       break;
 
-    dict = PyDict_New ();
-    for (; attr && ippGetGroupTag (attr) == IPP_TAG_JOB;
-	 attr = ippNextAttribute (answer)) {
-      PyObject *val = NULL;
-
-      debugprintf ("Attribute: %s\n", ippGetName (attr));
-      if (!strcmp (ippGetName (attr), "job-id") &&
-	  ippGetValueTag (attr) == IPP_TAG_INTEGER)
-	job_id = ippGetInteger (attr, 0);
-      else if (((!strcmp (ippGetName (attr), "job-k-octets") ||
-		 !strcmp (ippGetName (attr), "job-priority") ||
-		 !strcmp (ippGetName (attr), "time-at-creation") ||
-		 !strcmp (ippGetName (attr), "time-at-processing") ||
-		 !strcmp (ippGetName (attr), "time-at-completed") ||
-		 !strcmp (ippGetName (attr), "job-media-sheets") ||
-		 !strcmp (ippGetName (attr), "job-media-sheets-completed")) &&
-		ippGetValueTag (attr) == IPP_TAG_INTEGER) ||
-	       (!strcmp (ippGetName (attr), "job-state") &&
-		ippGetValueTag (attr) == IPP_TAG_ENUM))
-#if PY_MAJOR_VERSION >= 3
-	val = PyLong_FromLong (ippGetInteger (attr, 0));
-#else
-	val = PyInt_FromLong (ippGetInteger (attr, 0));
-#endif
-      else if ((!strcmp (ippGetName (attr), "job-name") &&
-		ippGetValueTag (attr) == IPP_TAG_NAME) ||
-	       (!strcmp (ippGetName (attr), "job-originating-user-name") &&
-		ippGetValueTag (attr) == IPP_TAG_NAME) ||
-	       (!strcmp (ippGetName (attr), "job-printer-uri") &&
-		ippGetValueTag (attr) == IPP_TAG_URI))
-	val = PyObj_from_UTF8 (ippGetString (attr, 0, NULL));
-      else if (!strcmp (ippGetName (attr), "job-preserved") &&
-	       ippGetValueTag (attr) == IPP_TAG_BOOLEAN)
-	val = PyBool_FromLong (ippGetInteger (attr, 0));
-      else {
-	if (ippGetCount (attr) > 1)
-	  val = PyList_from_attr_values (attr);
-	else
-	  val = PyObject_from_attr_value (attr, 0);
-      }
-
-      if (val) {
-	debugprintf ("Adding %s to job dict\n", ippGetName (attr));
-	PyDict_SetItemString (dict, ippGetName (attr), val);
-	Py_DECREF (val);
-      }
-    }
-
+    attr = job_dict_from_group (answer, attr, &dict, &job_id);
     if (job_id != -1) {
       debugprintf ("Adding %d to result dict\n", job_id);
 #if PY_MAJOR_VERSION >= 3
@@ -1711,25 +2910,28 @@ Connection_getJobs (Connection *self, PyObject *args, PyObject *kwds)
       break;
   }
 
-  ippDelete (answer);
-  debugprintf ("<- Connection_getJobs() = dict\n");
   return result;
 }
 
 static PyObject *
-Connection_getJobAttributes (Connection *self, PyObject *args, PyObject *kwds)
+do_getJobs (Connection *self, PyObject *args, PyObject *kwds)
 {
   PyObject *result;
   ipp_t *request, *answer;
-  ipp_attribute_t *attr;
-  int job_id;
+  char *which = NULL;
+  int my_jobs = 0;
+  int limit = -1;
+  int first_job_id = -1;
   PyObject *requested_attrs = NULL;
   char **attrs = NULL; /* initialised to calm compiler */
   size_t n_attrs = 0; /* initialised to calm compiler */
-  char uri[1024];
-  static char *kwlist[] = { "job_id", "requested_attributes", NULL };
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "i|O", kwlist,
-				    &job_id, &requested_attrs))
+  int lazy = 0;
+  static char *kwlist[] = { "which_jobs", "my_jobs", "limit", "first_job_id", 
+			    "requested_attributes", "lazy", NULL };
+  STATS_CLOCK (stats_clock);
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|siiiOb", kwlist,
+				    &which, &my_jobs, &limit, &first_job_id,
+				    &requested_attrs, &lazy))
     return NULL;
 
   if (requested_attrs) {
@@ -1737,555 +2939,565 @@ Connection_getJobAttributes (Connection *self, PyObject *args, PyObject *kwds)
       return NULL;
   }
 
-  debugprintf ("-> Connection_getJobAttributes(%d)\n", job_id);
-  request = ippNewRequest(IPP_GET_JOB_ATTRIBUTES);
-  snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", job_id);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri",
-		NULL, uri);
+  debugprintf ("-> Connection_getJobs(%s,%d)\n",
+	       which ? which : "(null)", my_jobs);
+  request = new_get_jobs_request (which, my_jobs, limit, first_job_id,
+				  n_attrs, attrs);
   if (requested_attrs)
-    ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
-		   "requested-attributes", n_attrs, NULL,
-		   (const char **) attrs);
+    free_requested_attrs (n_attrs, attrs);
 
+  STATS_BUILT (STATS_GET_JOBS, stats_clock);
   debugprintf ("cupsDoRequest(\"/\")\n");
   Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/");
+  answer = Connection_do_request (self, request, "/", 1);
   Connection_end_allow_threads (self);
-  if (requested_attrs)
-    free_requested_attrs (n_attrs, attrs);
+  STATS_WAITED (STATS_GET_JOBS, stats_clock);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
-    debugprintf ("<- Connection_getJobAttributes() (error)\n");
+    STATS_FAILED (STATS_GET_JOBS);
+    debugprintf ("<- Connection_getJobs() (error)\n");
     return NULL;
   }
 
-  result = PyDict_New ();
-  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer)) {
-    PyObject *obj;
-
-    debugprintf ("Attr: %s\n", ippGetName (attr));
-    if (ippGetCount (attr) > 1 ||
-	!strcmp (ippGetName (attr), "job-printer-state-reasons"))
-      obj = PyList_from_attr_values (attr);
-    else
-      obj = PyObject_from_attr_value (attr, 0);
-
-    if (!obj)
-      // Can't represent this.
-      continue;
-
-    PyDict_SetItemString (result, ippGetName (attr), obj);
-    Py_DECREF (obj);
+  if (lazy) {
+    debugprintf ("<- Connection_getJobs() = ResultMap\n");
+    return build_ResultMap (answer, IPP_TAG_JOB);
   }
 
+  result = jobs_from_answer (answer);
   ippDelete (answer);
-  debugprintf ("<- Connection_getJobAttributes() = dict\n");
+  STATS_DECODED (STATS_GET_JOBS, stats_clock);
+  debugprintf ("<- Connection_getJobs() = dict\n");
   return result;
 }
 
 static PyObject *
-Connection_cancelJob (Connection *self, PyObject *args, PyObject *kwds)
+Connection_getJobs (Connection *self, PyObject *args, PyObject *kwds)
 {
-  ipp_t *request, *answer;
-  int job_id;
-  int purge_job = 0;
-  char uri[1024];
-  static char *kwlist[] = { "job_id", "purge_job", NULL };
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "i|i", kwlist,
-				    &job_id, &purge_job))
-    return NULL;
-
-  debugprintf ("-> Connection_cancelJob(%d)\n", job_id);
-  request = ippNewRequest(IPP_CANCEL_JOB);
-  snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", job_id);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, uri);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		"requesting-user-name", NULL, cupsUser ());
-  if (purge_job)
-    ippAddBoolean(request, IPP_TAG_OPERATION, "purge-job", 1);
-  debugprintf ("cupsDoRequest(\"/jobs/\")\n");
-  Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/jobs/");
-  Connection_end_allow_threads (self);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
-    debugprintf ("<- Connection_cancelJob() (error)\n");
+  if (Connection_check_idle (self) < 0)
     return NULL;
-  }
 
-  debugprintf ("<- Connection_cancelJob() = None\n");
-  Py_RETURN_NONE;
+  Connection_call_begin (self);
+  return Connection_call_end (self, "getJobs",
+			      do_getJobs (self, args, kwds));
 }
 
 static PyObject *
-Connection_cancelAllJobs (Connection *self, PyObject *args, PyObject *kwds)
+Connection_iterJobs (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *nameobj = NULL;
-  char *name;
-  PyObject *uriobj = NULL;
-  char *uri;
-  char consuri[HTTP_MAX_URI];
-  ipp_t *request, *answer;
+  PyObject *largs, *lkwlist;
+  JobIterator *it;
+  char *which = NULL;
   int my_jobs = 0;
-  int purge_jobs = 1;
-  int i;
-  static char *kwlist[] = { "name", "uri", "my_jobs", "purge_jobs", NULL };
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|OOii", kwlist,
-				    &nameobj, &uriobj, &my_jobs, &purge_jobs))
+  int page_size = 100;
+  PyObject *requested_attrs = NULL;
+  static char *kwlist[] = { "which_jobs", "my_jobs", "page_size",
+			    "requested_attributes", NULL };
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|siiO", kwlist,
+				    &which, &my_jobs, &page_size,
+				    &requested_attrs))
     return NULL;
 
-  if (nameobj && uriobj) {
-    PyErr_SetString (PyExc_RuntimeError,
-		     "name or uri must be specified but not both");
+  if (page_size < 1) {
+    PyErr_SetString (PyExc_ValueError, "page_size must be positive");
     return NULL;
   }
 
-  if (nameobj) {
-    if (UTF8_from_PyObj (&name, nameobj) == NULL)
-      return NULL;
-  } else if (uriobj) {
-    if (UTF8_from_PyObj (&uri, uriobj) == NULL)
-      return NULL;
-  } else {
-    PyErr_SetString (PyExc_RuntimeError,
-		     "name or uri must be specified");
+  debugprintf ("-> Connection_iterJobs(%s,%d,%d)\n",
+	       which ? which : "(null)", my_jobs, page_size);
+  largs = Py_BuildValue ("()");
+  lkwlist = Py_BuildValue ("{}");
+  it = (JobIterator *) PyType_GenericNew (&cups_JobIteratorType,
+					  largs, lkwlist);
+  Py_DECREF (largs);
+  Py_DECREF (lkwlist);
+  if (!it)
     return NULL;
-  }
 
-  debugprintf ("-> Connection_cancelAllJobs(%s, my_jobs=%d, purge_jobs=%d)\n",
-	       nameobj ? name : uri, my_jobs, purge_jobs);
-  if (nameobj) {
-    construct_uri (consuri, sizeof (consuri),
-		   "ipp://localhost/printers/", name);
-    uri = consuri;
+  it->which = strdup (which ? which : "not-completed");
+  it->my_jobs = my_jobs;
+  it->page_size = page_size;
+  it->first_job_id = 1;
+  if (!it->which) {
+    Py_DECREF (it);
+    return PyErr_NoMemory ();
   }
 
-  for (i = 0; i < 2; i++) {
-    request = ippNewRequest(IPP_PURGE_JOBS);
-    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri",
-		  NULL, uri);
+  // Paging on first-job-id only works when the server returns jobs in
+  // ID order.  CUPS does that for completed jobs and all jobs, but
+  // orders the active ones by priority, so a page could end on a job
+  // with a higher ID than ones not yet returned.  For those, list just
+  // the job IDs first and then fetch the jobs a page of IDs at a time.
+  it->by_id = (strcmp (it->which, "completed") && strcmp (it->which, "all"));
 
-    if (my_jobs)
-    {
-      ippAddBoolean (request, IPP_TAG_OPERATION, "my-jobs", my_jobs);
-      ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		    "requesting-user-name", NULL, cupsUser());
+  if (requested_attrs) {
+    if (get_requested_attrs (requested_attrs, &it->n_attrs,
+			     &it->attrs) == -1) {
+      Py_DECREF (it);
+      return NULL;
     }
 
-    ippAddBoolean (request, IPP_TAG_OPERATION, "purge-jobs", purge_jobs);
-    debugprintf ("cupsDoRequest(\"/admin/\") with printer-uri=%s\n", uri);
-    Connection_begin_allow_threads (self);
-    answer = cupsDoRequest (self->http, request, "/admin/");
-    Connection_end_allow_threads (self);
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      ippDelete (answer);
-      if (uriobj)
-	break;
-
-      // Perhaps it's a class, not a printer.
-      construct_uri (consuri, sizeof (consuri),
-		     "ipp://localhost/classes/", name);
-    } else break;
+    // Paging needs the job IDs.
+    if (ensure_requested_attr (&it->n_attrs, &it->attrs, "job-id") == -1) {
+      Py_DECREF (it);
+      return PyErr_NoMemory ();
+    }
   }
 
-  if (nameobj)
-    free (name);
-
-  if (uriobj)
-    free (uri);
-
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
-
-    debugprintf ("<- Connection_cancelAllJobs() (error)\n");
+  // Page on a connection of our own, so that sending the next page's
+  // request early cannot get in the way of the caller's requests.
+  it->conn = (Connection *) PyObject_CallFunction ((PyObject *)
+						   &cups_ConnectionType,
+						   "sii", self->host,
+						   self->port,
+						   self->encryption);
+  if (!it->conn) {
+    Py_DECREF (it);
+    debugprintf ("<- Connection_iterJobs() (error)\n");
     return NULL;
   }
 
-  debugprintf ("<- Connection_cancelAllJobs() = None\n");
-  Py_RETURN_NONE;
+  debugprintf ("<- Connection_iterJobs()\n");
+  return (PyObject *) it;
 }
 
-static PyObject *
-Connection_createJob (Connection *self, PyObject *args, PyObject *kwds)
+#if PY_MAJOR_VERSION >= 3
+typedef long long column_int_t;
+#define COLUMN_INT_TYPECODE "q"
+#else
+typedef long column_int_t;
+#define COLUMN_INT_TYPECODE "l"
+#endif
+
+typedef struct
 {
-  static char *kwlist[] = { "printer", "title", "options", NULL };
-  PyObject *printer_obj;
-  char *printer;
-  PyObject *title_obj;
-  char *title;
-  PyObject *options_obj, *key, *val;
-  int num_settings = 0;
-  DICT_POS_TYPE pos = 0;
-  cups_option_t *settings = NULL;
-  int jobid;
+  const char *name;
+  const attr_info_t *info;
+  column_int_t *ints;		/* integer column, in array's buffer... */
+  PyObject *array;
+#if PY_MAJOR_VERSION >= 3
+  Py_buffer view;
+#endif
+  PyObject *list;		/* ...or list of objects */
+} job_column_t;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "OOO", kwlist,
-				    &printer_obj, &title_obj,
-				    &options_obj))
-    return NULL;
+/*
+ * Make col->array an array.array of n integers, and point col->ints
+ * at its storage so that the column is decoded straight into it.
+ * Python 2 arrays do not export their buffer, so there the column
+ * is decoded into memory of our own and copied in at the end by
+ * job_column_finish().
+ */
+static int
+job_column_alloc (job_column_t *col, size_t n)
+{
+  static PyObject *array_type = NULL;
+  PyObject *array;
 
-  if (UTF8_from_PyObj (&printer, printer_obj) == NULL)
-    return NULL;
-  if (UTF8_from_PyObj (&title, title_obj) == NULL) {
-    free (printer);
-    return NULL;
-  }
-  debugprintf ("-> Connection_createJob(printer=%s, title=%s)\n", printer, title);
+  if (!array_type) {
+    PyObject *module = PyImport_ImportModule ("array");
+    if (!module)
+      return -1;
 
-  if (!PyDict_Check (options_obj)) {
-    free (title);
-    free (printer);
-    PyErr_SetString (PyExc_TypeError, "options must be a dict");
-    return NULL;
+    array_type = PyObject_GetAttrString (module, "array");
+    Py_DECREF (module);
+    if (!array_type)
+      return -1;
   }
-  while (PyDict_Next (options_obj, &pos, &key, &val)) {
-    char *name, *value;
-    if ((!PyUnicode_Check (key) && !PyBytes_Check (key)) ||
-        (!PyUnicode_Check (val) && !PyBytes_Check (val))) {
-      cupsFreeOptions (num_settings, settings);
-      free (title);
-      free (printer);
-      PyErr_SetString (PyExc_TypeError, "Keys and values must be strings");
-      return NULL;
-    }
 
-    num_settings = cupsAddOption (UTF8_from_PyObj (&name, key),
-				  UTF8_from_PyObj (&value, val),
-				  num_settings,
-				  &settings);
-    free (name);
-    free (value);
-  }
+#if PY_MAJOR_VERSION >= 3
+  array = PyObject_CallFunction (array_type, "s[i]", COLUMN_INT_TYPECODE, 0);
+  if (!array)
+    return -1;
 
-  Connection_begin_allow_threads (self);
-  jobid = cupsCreateJob(self->http, printer, title, num_settings, settings);
-  Connection_end_allow_threads (self);
+  col->array = PySequence_Repeat (array, n);
+  Py_DECREF (array);
+  if (!col->array)
+    return -1;
 
-  if (jobid == 0) {
-    cupsFreeOptions (num_settings, settings);
-    free (title);
-    free (printer);
-    set_ipp_error (cupsLastError (), cupsLastErrorString ());
-    debugprintf ("<- Connection_createJob() = NULL\n");
-    return NULL;
+  if (PyObject_GetBuffer (col->array, &col->view, PyBUF_WRITABLE) < 0) {
+    Py_CLEAR (col->array);
+    return -1;
   }
 
-  cupsFreeOptions (num_settings, settings);
-  free (title);
-  free (printer);
-  debugprintf ("<- Connection_createJob() = %d\n", jobid);
-#if PY_MAJOR_VERSION >= 3
-  return PyLong_FromLong (jobid);
+  col->ints = col->view.buf;
 #else
-  return PyInt_FromLong (jobid);
+  col->array = PyObject_CallFunction (array_type, "s", COLUMN_INT_TYPECODE);
+  if (!col->array)
+    return -1;
+
+  col->ints = malloc ((n + 1) * sizeof (column_int_t));
+  if (!col->ints) {
+    Py_CLEAR (col->array);
+    PyErr_NoMemory ();
+    return -1;
+  }
 #endif
+
+  return 0;
 }
 
-static PyObject *
-Connection_startDocument (Connection *self, PyObject *args, PyObject *kwds)
+/* Finish with an integer column's storage, copying it into the array
+ * if need be.  Returns -1 if that failed. */
+static int
+job_column_finish (job_column_t *col, size_t n)
 {
-  static char *kwlist[] = { "printer", "job_id", "doc_name", "format", "last_document", NULL };
-  PyObject *printer_obj;
-  char *printer;
-  int jobid;
-  PyObject *doc_name_obj;
-  char *doc_name;
-  PyObject *format_obj;
-  char *format;
-  int last_document;
-  http_status_t	status;		/* Write status */
+  int ret = 0;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "OiOOi", kwlist,
-				    &printer_obj, &jobid, &doc_name_obj,
-				    &format_obj, &last_document))
-    return NULL;
+#if PY_MAJOR_VERSION >= 3
+  // An empty array's buffer may be NULL, so test the view instead.
+  if (col->view.obj)
+    PyBuffer_Release (&col->view);
+#else
+  if (!col->ints)
+    return 0;
+
+  if (col->array) {
+    PyObject *r = PyObject_CallMethod (col->array, "fromstring", "s#",
+				       (const char *) col->ints,
+				       (int) (n * sizeof (column_int_t)));
+    if (r)
+      Py_DECREF (r);
+    else
+      ret = -1;
+  }
 
-  if (UTF8_from_PyObj (&printer, printer_obj) == NULL)
+  free (col->ints);
+#endif
+  col->ints = NULL;
+  return ret;
+}
+
+static PyObject *
+Connection_getJobsColumnar (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *result = NULL;
+  ipp_t *request, *answer;
+  ipp_attribute_t *attr;
+  PyObject *requested_attrs;
+  char *which = NULL;
+  int my_jobs = 0;
+  int limit = -1;
+  int first_job_id = -1;
+  char **attrs;
+  size_t n_attrs;
+  job_column_t *columns;
+  size_t num_jobs = 0, row, i;
+  static char *kwlist[] = { "attrs", "which_jobs", "my_jobs", "limit",
+			    "first_job_id", NULL };
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|siii", kwlist,
+				    &requested_attrs, &which, &my_jobs,
+				    &limit, &first_job_id))
     return NULL;
-  if (UTF8_from_PyObj (&doc_name, doc_name_obj) == NULL) {
-    free (printer);
+
+  if (Connection_check_idle (self) < 0)
     return NULL;
-  }
-  if (UTF8_from_PyObj (&format, format_obj) == NULL) {
-    free (doc_name);
-    free (printer);
+
+  if (get_requested_attrs (requested_attrs, &n_attrs, &attrs) == -1)
     return NULL;
+
+  if (ensure_requested_attr (&n_attrs, &attrs, "job-id") == -1) {
+    free_requested_attrs (n_attrs, attrs);
+    return PyErr_NoMemory ();
   }
-  debugprintf ("-> Connection_startDocument(printer=%s, jobid=%d, doc_name=%s, format=%s)\n",
-              printer, jobid, doc_name, format);
 
+  debugprintf ("-> Connection_getJobsColumnar(%s,%d)\n",
+	       which ? which : "(null)", my_jobs);
+  request = new_get_jobs_request (which, my_jobs, limit, first_job_id,
+				  n_attrs, attrs);
+  debugprintf ("cupsDoRequest(\"/\")\n");
   Connection_begin_allow_threads (self);
-  status = cupsStartDocument(self->http, printer, jobid, doc_name, format, last_document);
+  answer = cupsDoRequest (self->http, request, "/");
   Connection_end_allow_threads (self);
-
-  if (status != HTTP_CONTINUE)
-  {
-    free (format);
-    free (doc_name);
-    free (printer);
-    set_ipp_error (cupsLastError (), cupsLastErrorString ());
-    debugprintf ("<- Connection_startDocument() = NULL\n");
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    free_requested_attrs (n_attrs, attrs);
+    debugprintf ("<- Connection_getJobsColumnar() (error)\n");
     return NULL;
   }
 
-  free (format);
-  free (doc_name);
-  free (printer);
-  debugprintf ("<- Connection_startDocument() = %d\n", status);
-#if PY_MAJOR_VERSION >= 3
-  return PyLong_FromLong (status);
-#else
-  return PyInt_FromLong (status);
-#endif
-}
+  // Count the jobs so that each column is allocated once.
+  for (attr = ippFirstAttribute (answer); attr;
+       attr = ippNextAttribute (answer)) {
+    while (attr && ippGetGroupTag (attr) != IPP_TAG_JOB)
+      attr = ippNextAttribute (answer);
 
-static PyObject *
-Connection_writeRequestData (Connection *self, PyObject *args, PyObject *kwds)
-{
-  static char *kwlist[] = { "buffer", "length", NULL };
-  PyObject *buffer_obj;
-  char *buffer;
-  int length;
-  http_status_t	status;		/* Write status */
+    if (!attr)
+      break;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "Oi", kwlist,
-				    &buffer_obj, &length))
-    return NULL;
+    num_jobs++;
+    while (attr && ippGetGroupTag (attr) == IPP_TAG_JOB)
+      attr = ippNextAttribute (answer);
 
-  buffer = strdup(PyBytes_AsString (buffer_obj));
-  debugprintf ("-> Connection_writeRequestData(length=%d)\n", length);
+    if (!attr)
+      break;
+  }
 
-  Connection_begin_allow_threads (self);
-  status = cupsWriteRequestData(self->http, buffer, length);
-  Connection_end_allow_threads (self);
+  columns = calloc (n_attrs, sizeof (job_column_t));
+  if (!columns) {
+    PyErr_NoMemory ();
+    goto out;
+  }
 
-  if (status != HTTP_CONTINUE)
-  {
-    free (buffer);
-    set_ipp_error (cupsLastError (), cupsLastErrorString ());
-    debugprintf ("<- Connection_writeRequestData() = NULL\n");
-    return NULL;
+  for (i = 0; i < n_attrs; i++) {
+    job_column_t *col = &columns[i];
+    col->name = attrs[i];
+    col->info = lookup_attr_info (attrs[i]);
+    if (col->info &&
+	(col->info->value_tag == IPP_TAG_INTEGER ||
+	 col->info->value_tag == IPP_TAG_ENUM ||
+	 col->info->value_tag == IPP_TAG_BOOLEAN)) {
+      if (job_column_alloc (col, num_jobs) < 0)
+	goto out;
+    } else if ((col->list = PyList_New (num_jobs)) == NULL)
+      goto out;
   }
 
-  free (buffer);
-  debugprintf ("<- Connection_writeRequestData() = %d\n", status);
-#if PY_MAJOR_VERSION >= 3
-  return PyLong_FromLong (status);
-#else
-  return PyInt_FromLong (status);
-#endif
-}
+  row = 0;
+  for (attr = ippFirstAttribute (answer); attr && row < num_jobs;
+       attr = ippNextAttribute (answer)) {
+    while (attr && ippGetGroupTag (attr) != IPP_TAG_JOB)
+      attr = ippNextAttribute (answer);
 
-static PyObject *
-Connection_finishDocument (Connection *self, PyObject *args, PyObject *kwds)
-{
-  static char *kwlist[] = { "printer", NULL };
-  PyObject *printer_obj;
-  char *printer;
-  int answer;
+    if (!attr)
+      break;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O", kwlist, &printer_obj))
-    return NULL;
+    for (i = 0; i < n_attrs; i++)
+      if (columns[i].ints)
+	columns[i].ints[row] = -1;
 
-  if (UTF8_from_PyObj (&printer, printer_obj) == NULL)
-    return NULL;
+    for (; attr && ippGetGroupTag (attr) == IPP_TAG_JOB;
+	 attr = ippNextAttribute (answer)) {
+      const char *name = ippGetName (attr);
+      job_column_t *col = NULL;
 
-  debugprintf ("-> Connection_finishDocument(printer=%s)\n", printer);
-  Connection_begin_allow_threads (self);
-  answer = cupsFinishDocument(self->http, printer);
-  Connection_end_allow_threads (self);
+      for (i = 0; i < n_attrs; i++)
+	if (!strcmp (columns[i].name, name)) {
+	  col = &columns[i];
+	  break;
+	}
 
-  if (answer != IPP_OK) {
-    free (printer);
-    set_ipp_error (cupsLastError (), cupsLastErrorString ());
-    debugprintf ("<- Connection_finishDocument() = NULL\n");
-    return NULL;
+      if (!col)
+	continue;
+
+      if (col->ints) {
+	switch (ippGetValueTag (attr)) {
+	case IPP_TAG_INTEGER:
+	case IPP_TAG_ENUM:
+	  col->ints[row] = ippGetInteger (attr, 0);
+	  break;
+	case IPP_TAG_BOOLEAN:
+	  col->ints[row] = ippGetBoolean (attr, 0);
+	  break;
+	default:
+	  break;
+	}
+      } else {
+	// Decoded as job_dict_from_group() does for getJobs().
+	PyObject *val = PyObject_from_attr (attr, attr_info_for_value (attr),
+					    ATTR_CTX_JOBS);
+	if (!val)
+	  goto out;
+
+	Py_XDECREF (PyList_GET_ITEM (col->list, row));
+	PyList_SET_ITEM (col->list, row, val);
+      }
+    }
+
+    for (i = 0; i < n_attrs; i++)
+      if (columns[i].list && !PyList_GET_ITEM (columns[i].list, row)) {
+	Py_INCREF (Py_None);
+	PyList_SET_ITEM (columns[i].list, row, Py_None);
+      }
+
+    row++;
+    if (!attr)
+      break;
   }
 
-  free (printer);
-  debugprintf ("<- Connection_finishDicument() = %d\n", answer);
-#if PY_MAJOR_VERSION >= 3
-  return PyLong_FromLong (answer);
-#else
-  return PyInt_FromLong (answer);
-#endif
+  result = PyDict_New ();
+  for (i = 0; result && i < n_attrs; i++) {
+    PyObject *key, *val;
+
+    if (columns[i].array) {
+      if (job_column_finish (&columns[i], num_jobs) < 0) {
+	Py_CLEAR (result);
+	break;
+      }
+
+      val = columns[i].array;
+    } else
+      val = columns[i].list;
+
+    Py_INCREF (val);
+
+    key = PyObj_from_interned_UTF8 (columns[i].name);
+    if (!val || !key) {
+      Py_XDECREF (val);
+      Py_XDECREF (key);
+      Py_DECREF (result);
+      result = NULL;
+      break;
+    }
+
+    PyDict_SetItem (result, key, val);
+    Py_DECREF (key);
+    Py_DECREF (val);
+  }
+
+ out:
+  if (columns) {
+    for (i = 0; i < n_attrs; i++) {
+      job_column_finish (&columns[i], num_jobs);
+      Py_XDECREF (columns[i].array);
+      Py_XDECREF (columns[i].list);
+    }
+
+    free (columns);
+  }
+
+  free_requested_attrs (n_attrs, attrs);
+  ippDelete (answer);
+  debugprintf ("<- Connection_getJobsColumnar() = %zu jobs\n", num_jobs);
+  return result;
 }
 
 static PyObject *
-Connection_moveJob (Connection *self, PyObject *args, PyObject *kwds)
+do_getJobAttributes (Connection *self, PyObject *args, PyObject *kwds)
 {
-  int job_id = -1;
-  PyObject *printeruriobj = NULL;
-  char *printeruri;
-  PyObject *jobprinteruriobj = NULL;
-  char *jobprinteruri;
+  PyObject *result;
   ipp_t *request, *answer;
-  static char *kwlist[] = { "printer_uri", "job_id", "job_printer_uri", NULL };
-
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|OiO", kwlist,
-				    &printeruriobj, &job_id,
-				    &jobprinteruriobj))
-    return NULL;
+  ipp_attribute_t *attr;
+  int job_id;
+  PyObject *requested_attrs = NULL;
+  char **attrs = NULL; /* initialised to calm compiler */
+  size_t n_attrs = 0; /* initialised to calm compiler */
+  char uri[1024];
+  static char *kwlist[] = { "job_id", "requested_attributes", NULL };
+  STATS_CLOCK (stats_clock);
 
-  if (!jobprinteruriobj) {
-    PyErr_SetString (PyExc_RuntimeError,
-		     "No job_printer_uri (destination) given");
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "i|O", kwlist,
+				    &job_id, &requested_attrs))
     return NULL;
-  }
 
-  if (printeruriobj) {
-    if (UTF8_from_PyObj (&printeruri, printeruriobj) == NULL)
+  if (requested_attrs) {
+    if (get_requested_attrs (requested_attrs, &n_attrs, &attrs) == -1)
       return NULL;
-  } else if (job_id == -1) {
-    PyErr_SetString (PyExc_RuntimeError,
-		     "job_id or printer_uri required");
-    return NULL;
   }
 
-  if (UTF8_from_PyObj (&jobprinteruri, jobprinteruriobj) == NULL) {
-    if (printeruriobj)
-      free (printeruri);
-    return NULL;
-  }
+  debugprintf ("-> Connection_getJobAttributes(%d)\n", job_id);
+  snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", job_id);
+  if (requested_attrs) {
+    request = ippNewRequest(IPP_GET_JOB_ATTRIBUTES);
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri",
+		  NULL, uri);
+    ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		   "requested-attributes", n_attrs, NULL,
+		   (const char **) attrs);
 
-  request = ippNewRequest (CUPS_MOVE_JOB);
-  if (!printeruriobj) {
-    char joburi[HTTP_MAX_URI];
-    snprintf (joburi, sizeof (joburi), "ipp://localhost/jobs/%d", job_id);
-    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL,
-		  joburi);
+    STATS_BUILT (STATS_GET_JOB_ATTRIBUTES, stats_clock);
+    debugprintf ("cupsDoRequest(\"/\")\n");
+    Connection_begin_allow_threads (self);
+    answer = Connection_do_request (self, request, "/", 1);
+    Connection_end_allow_threads (self);
+    free_requested_attrs (n_attrs, attrs);
   } else {
-    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL,
-		  printeruri);
-    free (printeruri);
+    // Polling for job state is common, so keep the request and
+    // just patch its job-uri and request-id each time.
+    ipp_attribute_t *job_uri;
+
+    request = self->job_attrs_request;
+    if (!request) {
+      request = ippNewRequest(IPP_GET_JOB_ATTRIBUTES);
+      ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri",
+		    NULL, uri);
+      self->job_attrs_request = request;
+    } else {
+      job_uri = ippFindAttribute (request, "job-uri", IPP_TAG_URI);
+      copy_ipp_string (request, &job_uri, 0, uri);
+      ippSetRequestId (request, ippGetRequestId (request) + 1);
+    }
 
-    if (job_id != -1)
-      ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id",
-		     job_id);
+    // Sent without being freed, so that it can be patched next time.
+    STATS_BUILT (STATS_GET_JOB_ATTRIBUTES, stats_clock);
+    debugprintf ("cupsSendRequest(\"/\")\n");
+    Connection_begin_allow_threads (self);
+    answer = Connection_do_request (self, request, "/", 0);
+    Connection_end_allow_threads (self);
   }
 
-  ippAddString (request, IPP_TAG_JOB, IPP_TAG_URI, "job-printer-uri", NULL,
-		jobprinteruri);
-  free (jobprinteruri);
-  Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/jobs");
-  Connection_end_allow_threads (self);
+  STATS_WAITED (STATS_GET_JOB_ATTRIBUTES, stats_clock);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
+    STATS_FAILED (STATS_GET_JOB_ATTRIBUTES);
+    debugprintf ("<- Connection_getJobAttributes() (error)\n");
     return NULL;
   }
 
-  ippDelete (answer);
-  Py_RETURN_NONE;
-}
+  result = PyDict_New ();
+  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer)) {
+    PyObject *obj;
 
-static PyObject *
-Connection_authenticateJob (Connection *self, PyObject *args)
-{
-  ipp_t *request, *answer;
-  int job_id;
-  PyObject *auth_info_list = NULL;
-  int num_auth_info = 0; /* initialised to calm compiler */
-  char *auth_info_values[3];
-  int i;
-  char uri[1024];
-
-  if (!PyArg_ParseTuple (args, "i|O", &job_id, &auth_info_list))
-    return NULL;
-
-  if (auth_info_list) {
-    if (!PyList_Check (auth_info_list)) {
-      PyErr_SetString (PyExc_TypeError, "List required");
-      return NULL;
-    }
+    debugprintf ("Attr: %s\n", ippGetName (attr));
+    obj = PyObject_from_attr (attr, lookup_attr_info (ippGetName (attr)), ATTR_CTX_JOB_ATTRS);
 
-    num_auth_info = PyList_Size (auth_info_list);
-    debugprintf ("sizeof values = %Zd\n", sizeof (auth_info_values));
-    if (num_auth_info > sizeof (auth_info_values))
-      num_auth_info = sizeof (auth_info_values);
+    if (!obj)
+      // Can't represent this.
+      continue;
 
-    for (i = 0; i < num_auth_info; i++) {
-      PyObject *val = PyList_GetItem (auth_info_list, i); // borrowed ref
-      if (UTF8_from_PyObj (&auth_info_values[i], val) == NULL) {
-	while (--i >= 0)
-	  free (auth_info_values[i]);
-	return NULL;
-      }
-    }
+    set_attr_item (result, attr, obj);
+    Py_DECREF (obj);
   }
 
-  debugprintf ("-> Connection_authenticateJob(%d)\n", job_id);
-  request = ippNewRequest(CUPS_AUTHENTICATE_JOB);
-  snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", job_id);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, uri);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		"requesting-user-name", NULL, cupsUser ());
-  if (auth_info_list) 
-    {
-      ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_TEXT, "auth-info",
-		     num_auth_info, NULL,
-		     (const char *const *) auth_info_values);
-      for (i = 0; i < num_auth_info; i++)
-	free (auth_info_values[i]);
-    }
+  ippDelete (answer);
+  STATS_DECODED (STATS_GET_JOB_ATTRIBUTES, stats_clock);
+  debugprintf ("<- Connection_getJobAttributes() = dict\n");
+  return result;
+}
 
-  debugprintf ("cupsDoRequest(\"/jobs/\")\n");
-  Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/jobs/");
-  Connection_end_allow_threads (self);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
-    debugprintf ("<- Connection_authenticateJob() (error)\n");
+static PyObject *
+Connection_getJobAttributes (Connection *self, PyObject *args, PyObject *kwds)
+{
+  if (Connection_check_idle (self) < 0)
     return NULL;
-  }
 
-  debugprintf ("<- Connection_authenticateJob() = None\n");
-  Py_RETURN_NONE;
+  Connection_call_begin (self);
+  return Connection_call_end (self, "getJobAttributes",
+			      do_getJobAttributes (self, args, kwds));
 }
 
 static PyObject *
-Connection_setJobHoldUntil (Connection *self, PyObject *args)
+Connection_cancelJob (Connection *self, PyObject *args, PyObject *kwds)
 {
   ipp_t *request, *answer;
   int job_id;
-  PyObject *job_hold_until_obj;
-  char *job_hold_until;
+  int purge_job = 0;
   char uri[1024];
-  cups_option_t *options = NULL;
-  int num_options = 0;
-  if (!PyArg_ParseTuple (args, "iO", &job_id, &job_hold_until_obj))
+  static char *kwlist[] = { "job_id", "purge_job", NULL };
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "i|i", kwlist,
+				    &job_id, &purge_job))
     return NULL;
 
-  if (UTF8_from_PyObj (&job_hold_until, job_hold_until_obj) == NULL)
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  debugprintf ("-> Connection_setJobHoldUntil(%d,%s)\n",
-	       job_id, job_hold_until);
-  request = ippNewRequest(IPP_SET_JOB_ATTRIBUTES);
+  debugprintf ("-> Connection_cancelJob(%d)\n", job_id);
+  request = ippNewRequest(IPP_CANCEL_JOB);
   snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", job_id);
   ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, uri);
   ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
 		"requesting-user-name", NULL, cupsUser ());
-  num_options = cupsAddOption ("job-hold-until", job_hold_until,
-			       num_options, &options);
-  cupsEncodeOptions (request, num_options, options);
-  free (job_hold_until);
-
+  if (purge_job)
+    ippAddBoolean(request, IPP_TAG_OPERATION, "purge-job", 1);
   debugprintf ("cupsDoRequest(\"/jobs/\")\n");
   Connection_begin_allow_threads (self);
   answer = cupsDoRequest (self->http, request, "/jobs/");
@@ -2295,447 +3507,400 @@ Connection_setJobHoldUntil (Connection *self, PyObject *args)
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
-    debugprintf ("<- Connection_setJobHoldUntil() (error)\n");
+    debugprintf ("<- Connection_cancelJob() (error)\n");
     return NULL;
   }
 
-  debugprintf ("<- Connection_setJobHoldUntil() = None\n");
+  debugprintf ("<- Connection_cancelJob() = None\n");
   Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_restartJob (Connection *self, PyObject *args, PyObject *kwds)
+Connection_cancelAllJobs (Connection *self, PyObject *args, PyObject *kwds)
 {
-  static char *kwlist[] = { "job_id", "job_hold_until", NULL };
+  PyObject *nameobj = NULL;
+  char *name;
+  PyObject *uriobj = NULL;
+  char *uri;
+  char consuri[HTTP_MAX_URI];
   ipp_t *request, *answer;
-  int job_id;
-  char *job_hold_until = NULL;
-  char uri[1024];
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "i|s", kwlist,
-				    &job_id, &job_hold_until))
+  int my_jobs = 0;
+  int purge_jobs = 1;
+  int i;
+  static char *kwlist[] = { "name", "uri", "my_jobs", "purge_jobs", NULL };
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|OOii", kwlist,
+				    &nameobj, &uriobj, &my_jobs, &purge_jobs))
     return NULL;
 
-  debugprintf ("-> Connection_restartJob(%d)\n", job_id);
-  request = ippNewRequest(IPP_RESTART_JOB);
-  snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", job_id);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, uri);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		"requesting-user-name", NULL, cupsUser ());
-  if (job_hold_until)
-    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		  "job-hold-until", NULL, job_hold_until);
-
-  debugprintf ("cupsDoRequest(\"/jobs/\")\n");
-  Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/jobs/");
-  Connection_end_allow_threads (self);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
-    debugprintf ("<- Connection_restartJob() (error)\n");
+  if (Connection_check_idle (self) < 0)
     return NULL;
-  }
-
-  debugprintf ("<- Connection_restartJob() = None\n");
-  Py_RETURN_NONE;
-}
-
-static PyObject *
-Connection_getFile (Connection *self, PyObject *args, PyObject *kwds)
-{
-  static char *kwlist[] = { "resource", "filename", "fd", "file", NULL };
-  const char *resource, *filename = NULL;
-  int fd = -1;
-  PyObject *fileobj = NULL;
-  http_status_t status;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "s|siO", kwlist,
-				    &resource, &filename, &fd, &fileobj))
+  if (nameobj && uriobj) {
+    PyErr_SetString (PyExc_RuntimeError,
+		     "name or uri must be specified but not both");
     return NULL;
+  }
 
-  if ((fd > -1 && (filename || fileobj)) ||
-      (filename && fileobj)) {
+  if (nameobj) {
+    if (UTF8_from_PyObj (&name, nameobj) == NULL)
+      return NULL;
+  } else if (uriobj) {
+    if (UTF8_from_PyObj (&uri, uriobj) == NULL)
+      return NULL;
+  } else {
     PyErr_SetString (PyExc_RuntimeError,
-		     "Only one destination type may be specified");
+		     "name or uri must be specified");
     return NULL;
   }
 
-  if (fileobj) {
-#if PY_MAJOR_VERSION >= 3
-    fd = PyObject_AsFileDescriptor(fileobj);
-#else
-    FILE *f = PyFile_AsFile (fileobj);
-    fd = fileno (f);
-#endif
+  debugprintf ("-> Connection_cancelAllJobs(%s, my_jobs=%d, purge_jobs=%d)\n",
+	       nameobj ? name : uri, my_jobs, purge_jobs);
+  if (nameobj) {
+    construct_uri (consuri, sizeof (consuri),
+		   "ipp://localhost/printers/", name);
+    uri = consuri;
   }
 
-  if (filename) {
-    debugprintf ("-> Connection_getFile(%s, %s)\n", resource, filename);
-    debugprintf ("cupsGetFile()\n");
-    Connection_begin_allow_threads (self);
-    status = cupsGetFile (self->http, resource, filename);
-    Connection_end_allow_threads (self);
-  } else {
-    debugprintf ("-> Connection_getFile(%s, %d)\n", resource, fd);
-    debugprintf ("cupsGetFd()\n");
+  for (i = 0; i < 2; i++) {
+    request = ippNewRequest(IPP_PURGE_JOBS);
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri",
+		  NULL, uri);
+
+    if (my_jobs)
+    {
+      ippAddBoolean (request, IPP_TAG_OPERATION, "my-jobs", my_jobs);
+      ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		    "requesting-user-name", NULL, cupsUser());
+    }
+
+    ippAddBoolean (request, IPP_TAG_OPERATION, "purge-jobs", purge_jobs);
+    debugprintf ("cupsDoRequest(\"/admin/\") with printer-uri=%s\n", uri);
     Connection_begin_allow_threads (self);
-    status = cupsGetFd (self->http, resource, fd);
+    answer = cupsDoRequest (self->http, request, "/admin/");
     Connection_end_allow_threads (self);
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      ippDelete (answer);
+      if (uriobj)
+	break;
+
+      // Perhaps it's a class, not a printer.
+      construct_uri (consuri, sizeof (consuri),
+		     "ipp://localhost/classes/", name);
+    } else break;
   }
 
-  if (status != HTTP_OK) {
-    set_http_error (status);
-    debugprintf ("<- Connection_getFile() (error)\n");
+  if (nameobj)
+    free (name);
+
+  if (uriobj)
+    free (uri);
+
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+
+    debugprintf ("<- Connection_cancelAllJobs() (error)\n");
     return NULL;
   }
 
-  debugprintf ("<- Connection_getFile() = None\n");
+  debugprintf ("<- Connection_cancelAllJobs() = None\n");
   Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_putFile (Connection *self, PyObject *args, PyObject *kwds)
+Connection_createJob (Connection *self, PyObject *args, PyObject *kwds)
 {
-  static char *kwlist[] = { "resource", "filename", "fd", "file", NULL };
-  const char *resource, *filename = NULL;
-  int fd = -1;
-  PyObject *fileobj = NULL;
-  http_status_t status;
+  static char *kwlist[] = { "printer", "title", "options", NULL };
+  PyObject *printer_obj;
+  char *printer;
+  PyObject *title_obj;
+  char *title;
+  PyObject *options_obj, *key, *val;
+  int num_settings = 0;
+  DICT_POS_TYPE pos = 0;
+  cups_option_t *settings = NULL;
+  int jobid;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "s|siO", kwlist,
-				    &resource, &filename, &fd, &fileobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if ((fd > -1 && (filename || fileobj)) ||
-      (filename && fileobj)) {
-    PyErr_SetString (PyExc_RuntimeError,
-		     "Only one destination type may be specified");
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "OOO", kwlist,
+				    &printer_obj, &title_obj,
+				    &options_obj))
     return NULL;
-  }
 
-  if (fileobj) {
-#if PY_MAJOR_VERSION >= 3
-    fd = PyObject_AsFileDescriptor(fileobj);
-#else
-    FILE *f = PyFile_AsFile (fileobj);
-    fd = fileno (f);
-#endif
+  if (UTF8_from_PyObj (&printer, printer_obj) == NULL)
+    return NULL;
+  if (UTF8_from_PyObj (&title, title_obj) == NULL) {
+    free (printer);
+    return NULL;
   }
+  debugprintf ("-> Connection_createJob(printer=%s, title=%s)\n", printer, title);
 
-  if (filename) {
-    debugprintf ("-> Connection_putFile(%s, %s)\n", resource, filename);
-    debugprintf ("cupsPutFile()\n");
-    Connection_begin_allow_threads (self);
-    status = cupsPutFile (self->http, resource, filename);
-    Connection_end_allow_threads (self);
-  } else {
-    debugprintf ("-> Connection_putFile(%s, %d)\n", resource, fd);
-    debugprintf ("cupsPutFd()\n");
-    Connection_begin_allow_threads (self);
-    status = cupsPutFd (self->http, resource, fd);
-    Connection_end_allow_threads (self);
+  if (!PyDict_Check (options_obj)) {
+    free (title);
+    free (printer);
+    PyErr_SetString (PyExc_TypeError, "options must be a dict");
+    return NULL;
   }
+  while (PyDict_Next (options_obj, &pos, &key, &val)) {
+    char *name, *value;
+    if ((!PyUnicode_Check (key) && !PyBytes_Check (key)) ||
+        (!PyUnicode_Check (val) && !PyBytes_Check (val))) {
+      cupsFreeOptions (num_settings, settings);
+      free (title);
+      free (printer);
+      PyErr_SetString (PyExc_TypeError, "Keys and values must be strings");
+      return NULL;
+    }
 
-  if (status != HTTP_OK && status != HTTP_CREATED) {
-    set_http_error (status);
-    debugprintf ("<- Connection_putFile() (error)\n");
-    return NULL;
+    num_settings = cupsAddOption (UTF8_from_PyObj (&name, key),
+				  UTF8_from_PyObj (&value, val),
+				  num_settings,
+				  &settings);
+    free (name);
+    free (value);
   }
 
-  debugprintf ("<- Connection_putFile() = None\n");
-  Py_RETURN_NONE;
-}
+  Connection_begin_allow_threads (self);
+  jobid = cupsCreateJob(self->http, printer, title, num_settings, settings);
+  Connection_end_allow_threads (self);
 
-static ipp_t *
-add_modify_printer_request (const char *name)
-{
-  char uri[HTTP_MAX_URI];
-  ipp_t *request = ippNewRequest (CUPS_ADD_MODIFY_PRINTER);
-  construct_uri (uri, sizeof (uri), "ipp://localhost/printers/", name);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, uri);
-  return request;
-}
+  if (jobid == 0) {
+    cupsFreeOptions (num_settings, settings);
+    free (title);
+    free (printer);
+    set_ipp_error (cupsLastError (), cupsLastErrorString ());
+    debugprintf ("<- Connection_createJob() = NULL\n");
+    return NULL;
+  }
 
-static ipp_t *
-add_modify_class_request (const char *name)
-{
-  char uri[HTTP_MAX_URI];
-  ipp_t *request = ippNewRequest (CUPS_ADD_MODIFY_CLASS);
-  construct_uri (uri, sizeof (uri), "ipp://localhost/classes/", name);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, uri);
-  return request;
+  cupsFreeOptions (num_settings, settings);
+  free (title);
+  free (printer);
+  debugprintf ("<- Connection_createJob() = %d\n", jobid);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (jobid);
+#else
+  return PyInt_FromLong (jobid);
+#endif
 }
 
 static PyObject *
-Connection_addPrinter (Connection *self, PyObject *args, PyObject *kwds)
+Connection_startDocument (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *nameobj = NULL;
-  char *name = NULL;
-  PyObject *ppdfileobj = NULL;
-  char *ppdfile = NULL;
-  PyObject *ppdnameobj = NULL;
-  char *ppdname = NULL;
-  PyObject *infoobj = NULL;
-  char *info = NULL;
-  PyObject *locationobj = NULL;
-  char *location = NULL;
-  PyObject *deviceobj = NULL;
-  char *device = NULL;
-  PyObject *ppd = NULL;
-  ipp_t *request, *answer;
-  int ppds_specified = 0;
-  static char *kwlist[] = { "name", "filename", "ppdname", "info",
-			    "location", "device", "ppd", NULL };
+  static char *kwlist[] = { "printer", "job_id", "doc_name", "format", "last_document", NULL };
+  PyObject *printer_obj;
+  char *printer;
+  int jobid;
+  PyObject *doc_name_obj;
+  char *doc_name;
+  PyObject *format_obj;
+  char *format;
+  int last_document;
+  http_status_t	status;		/* Write status */
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|OOOOOO", kwlist,
-				    &nameobj, &ppdfileobj, &ppdnameobj,
-				    &infoobj, &locationobj, &deviceobj, &ppd))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&name, nameobj) == NULL ||
-      (ppdfileobj && UTF8_from_PyObj (&ppdfile, ppdfileobj) == NULL) ||
-      (ppdnameobj && UTF8_from_PyObj (&ppdname, ppdnameobj) == NULL) ||
-      (infoobj && UTF8_from_PyObj (&info, infoobj) == NULL) ||
-      (locationobj && UTF8_from_PyObj (&location, locationobj) == NULL) ||
-      (deviceobj && UTF8_from_PyObj (&device, deviceobj) == NULL)) {
-    free (name);
-    free (ppdfile);
-    free (ppdname);
-    free (info);
-    free (location);
-    free (device);
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "OiOOi", kwlist,
+				    &printer_obj, &jobid, &doc_name_obj,
+				    &format_obj, &last_document))
     return NULL;
-  }
 
-  debugprintf ("-> Connection_addPrinter(%s,%s,%s,%s,%s,%s,%s)\n",
-	       name, ppdfile ? ppdfile: "", ppdname ? ppdname: "",
-	       info ? info: "", location ? location: "",
-	       device ? device: "", ppd ? "(PPD object)": "");
+  if (UTF8_from_PyObj (&printer, printer_obj) == NULL)
+    return NULL;
+  if (UTF8_from_PyObj (&doc_name, doc_name_obj) == NULL) {
+    free (printer);
+    return NULL;
+  }
+  if (UTF8_from_PyObj (&format, format_obj) == NULL) {
+    free (doc_name);
+    free (printer);
+    return NULL;
+  }
+  debugprintf ("-> Connection_startDocument(printer=%s, jobid=%d, doc_name=%s, format=%s)\n",
+              printer, jobid, doc_name, format);
 
-  if (ppdfile)
-    ppds_specified++;
-  if (ppdname)
-    ppds_specified++;
-  if (ppd) {
-    if (!PyObject_TypeCheck (ppd, &cups_PPDType)) {
-      PyErr_SetString (PyExc_TypeError, "Expecting cups.PPD");
-      debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
-      free (name);
-      free (ppdfile);
-      free (ppdname);
-      free (info);
-      free (location);
-      free (device);
-      return NULL;
-    }
+  Connection_begin_allow_threads (self);
+  status = cupsStartDocument(self->http, printer, jobid, doc_name, format, last_document);
+  Connection_end_allow_threads (self);
 
-    ppds_specified++;
-  }
-  if (ppds_specified > 1) {
-    PyErr_SetString (PyExc_RuntimeError,
-		     "Only one PPD may be given");
-    debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
-    free (name);
-    free (ppdfile);
-    free (ppdname);
-    free (info);
-    free (location);
-    free (device);
+  if (status != HTTP_CONTINUE)
+  {
+    free (format);
+    free (doc_name);
+    free (printer);
+    set_ipp_error (cupsLastError (), cupsLastErrorString ());
+    debugprintf ("<- Connection_startDocument() = NULL\n");
     return NULL;
   }
 
-  if (ppd) {
-    // We've been given a cups.PPD object.  Construct a PPD file.
-    char template[PATH_MAX];
-    int fd;
-    PyObject *args, *result;
+  free (format);
+  free (doc_name);
+  free (printer);
+  debugprintf ("<- Connection_startDocument() = %d\n", status);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (status);
+#else
+  return PyInt_FromLong (status);
+#endif
+}
 
-    snprintf(template, sizeof (template), "%s/scp-ppd-XXXXXX", _PATH_TMP);
-    ppdfile = strdup(template);
-    fd = mkstemp (ppdfile);
-    if (fd < 0) {
-      debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
-      free (name);
-      free (ppdfile);
-      free (ppdname);
-      free (info);
-      free (location);
-      free (device);
-      return PyErr_SetFromErrno (PyExc_RuntimeError);
-    }
+static PyObject *
+Connection_writeRequestData (Connection *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = { "buffer", "length", NULL };
+  PyObject *buffer_obj;
+  Py_buffer view;
+  Py_ssize_t length = -1;
+  http_status_t	status;		/* Write status */
 
-    args = Py_BuildValue ("(i)", fd);
-    result = PPD_writeFd ((PPD *) ppd, args);
-    Py_DECREF (args);
-    close (fd);
+  if (Connection_check_idle (self) < 0)
+    return NULL;
 
-    if (result == NULL) {
-      unlink (ppdfile);
-      debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
-      free (name);
-      free (ppdfile);
-      free (ppdname);
-      free (info);
-      free (location);
-      free (device);
-      return NULL;
-    }
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|n", kwlist,
+				    &buffer_obj, &length))
+    return NULL;
+
+  // Any object supporting the buffer protocol will do (bytes,
+  // bytearray, memoryview, mmap...).  Its memory is passed straight
+  // to libcups without copying.
+  if (PyObject_GetBuffer (buffer_obj, &view, PyBUF_SIMPLE) == -1)
+    return NULL;
+
+  if (length < 0)
+    length = view.len;
+  else if (length > view.len) {
+    PyBuffer_Release (&view);
+    PyErr_SetString (PyExc_ValueError, "length exceeds buffer size");
+    return NULL;
   }
 
-  request = add_modify_printer_request (name);
-  free (name);
-  if (ppdname) {
-    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		  "ppd-name", NULL, ppdname);
-    free (ppdname);
-  }
-  if (info) {
-    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_TEXT,
-		  "printer-info", NULL, info);
-    free (info);
-  }
-  if (location) {
-    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_TEXT,
-		  "printer-location", NULL, location);
-    free (location);
-  }
-  if (device) {
-    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_URI,
-		  "device-uri", NULL, device);
-    free (device);
-  }
-  if (ppds_specified)
-    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_KEYWORD,
-		  "printer-state-reasons", NULL, "none");
-  
+  debugprintf ("-> Connection_writeRequestData(length=%zd)\n", length);
+
   Connection_begin_allow_threads (self);
-  if (ppdfile) {
-    answer = cupsDoFileRequest (self->http, request, "/admin/", ppdfile);
-  } else
-    answer = cupsDoRequest (self->http, request, "/admin/");
+  status = cupsWriteRequestData(self->http, view.buf, length);
   Connection_end_allow_threads (self);
 
-  if (ppd) {
-    unlink (ppdfile);
-    free (ppdfile);
-  } else if (ppdfile)
-    free (ppdfile);
-
-  if (PyErr_Occurred ()) {
-    if (answer)
-      ippDelete (answer);
-    debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
-    return NULL;
-  }
-
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
-
-    debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
+  PyBuffer_Release (&view);
+  if (status != HTTP_CONTINUE)
+  {
+    set_ipp_error (cupsLastError (), cupsLastErrorString ());
+    debugprintf ("<- Connection_writeRequestData() = NULL\n");
     return NULL;
   }
 
-  ippDelete (answer);
-  debugprintf ("<- Connection_addPrinter() = None\n");
-  Py_RETURN_NONE;
+  debugprintf ("<- Connection_writeRequestData() = %d\n", status);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (status);
+#else
+  return PyInt_FromLong (status);
+#endif
 }
 
 static PyObject *
-Connection_setPrinterDevice (Connection *self, PyObject *args)
+Connection_finishDocument (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *nameobj;
-  PyObject *device_uriobj;
-  char *name;
-  char *device_uri;
-  ipp_t *request, *answer;
+  static char *kwlist[] = { "printer", NULL };
+  PyObject *printer_obj;
+  char *printer;
+  int answer;
 
-  if (!PyArg_ParseTuple (args, "OO", &nameobj, &device_uriobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O", kwlist, &printer_obj))
     return NULL;
 
-  if (UTF8_from_PyObj (&device_uri, device_uriobj) == NULL) {
-    free (name);
+  if (UTF8_from_PyObj (&printer, printer_obj) == NULL)
     return NULL;
-  }
 
-  request = add_modify_printer_request (name);
-  free (name);
-  ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_URI,
-		"device-uri", NULL, device_uri);
-  free (device_uri);
+  debugprintf ("-> Connection_finishDocument(printer=%s)\n", printer);
   Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/admin/");
+  answer = cupsFinishDocument(self->http, printer);
   Connection_end_allow_threads (self);
-  if (PyErr_Occurred ()) {
-    if (answer)
-      ippDelete (answer);
-    return NULL;
-  }
 
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
+  if (answer != IPP_OK) {
+    free (printer);
+    set_ipp_error (cupsLastError (), cupsLastErrorString ());
+    debugprintf ("<- Connection_finishDocument() = NULL\n");
     return NULL;
   }
 
-  ippDelete (answer);
-  Py_RETURN_NONE;
+  free (printer);
+  debugprintf ("<- Connection_finishDicument() = %d\n", answer);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (answer);
+#else
+  return PyInt_FromLong (answer);
+#endif
 }
 
 static PyObject *
-Connection_setPrinterInfo (Connection *self, PyObject *args)
+Connection_moveJob (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *nameobj;
-  PyObject *infoobj;
-  char *name;
-  char *info;
+  int job_id = -1;
+  PyObject *printeruriobj = NULL;
+  char *printeruri;
+  PyObject *jobprinteruriobj = NULL;
+  char *jobprinteruri;
   ipp_t *request, *answer;
-  int i;
+  static char *kwlist[] = { "printer_uri", "job_id", "job_printer_uri", NULL };
 
-  if (!PyArg_ParseTuple (args, "OO", &nameobj, &infoobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|OiO", kwlist,
+				    &printeruriobj, &job_id,
+				    &jobprinteruriobj))
     return NULL;
 
-  if (UTF8_from_PyObj (&info, infoobj) == NULL) {
-    free (name);
+  if (!jobprinteruriobj) {
+    PyErr_SetString (PyExc_RuntimeError,
+		     "No job_printer_uri (destination) given");
     return NULL;
   }
 
-  request = add_modify_printer_request (name);
-  for (i = 0; i < 2; i++) {
-    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_TEXT,
-		  "printer-info", NULL, info);
-    Connection_begin_allow_threads (self);
-    answer = cupsDoRequest (self->http, request, "/admin/");
-    Connection_end_allow_threads (self);
-    if (PyErr_Occurred ()) {
-      if (answer)
-	ippDelete (answer);
+  if (printeruriobj) {
+    if (UTF8_from_PyObj (&printeruri, printeruriobj) == NULL)
       return NULL;
-    }
+  } else if (job_id == -1) {
+    PyErr_SetString (PyExc_RuntimeError,
+		     "job_id or printer_uri required");
+    return NULL;
+  }
 
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      // Perhaps it's a class, not a printer.
-      ippDelete (answer);
-      request = add_modify_class_request (name);
-    } else break;
+  if (UTF8_from_PyObj (&jobprinteruri, jobprinteruriobj) == NULL) {
+    if (printeruriobj)
+      free (printeruri);
+    return NULL;
   }
 
-  free (name);
-  free (info);
+  request = ippNewRequest (CUPS_MOVE_JOB);
+  if (!printeruriobj) {
+    char joburi[HTTP_MAX_URI];
+    snprintf (joburi, sizeof (joburi), "ipp://localhost/jobs/%d", job_id);
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL,
+		  joburi);
+  } else {
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL,
+		  printeruri);
+    free (printeruri);
+
+    if (job_id != -1)
+      ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id",
+		     job_id);
+  }
+
+  ippAddString (request, IPP_TAG_JOB, IPP_TAG_URI, "job-printer-uri", NULL,
+		jobprinteruri);
+  free (jobprinteruri);
+  Connection_begin_allow_threads (self);
+  answer = cupsDoRequest (self->http, request, "/jobs");
+  Connection_end_allow_threads (self);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
@@ -2749,833 +3914,1118 @@ Connection_setPrinterInfo (Connection *self, PyObject *args)
 }
 
 static PyObject *
-Connection_setPrinterLocation (Connection *self, PyObject *args)
+Connection_authenticateJob (Connection *self, PyObject *args)
 {
-  PyObject *nameobj;
-  PyObject *locationobj;
-  char *name;
-  char *location;
   ipp_t *request, *answer;
+  int job_id;
+  PyObject *auth_info_list = NULL;
+  int num_auth_info = 0; /* initialised to calm compiler */
+  char *auth_info_values[3];
   int i;
+  char uri[1024];
 
-  if (!PyArg_ParseTuple (args, "OO", &nameobj, &locationobj))
-    return NULL;
-
-  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&location, locationobj) == NULL) {
-    free (name);
+  if (!PyArg_ParseTuple (args, "i|O", &job_id, &auth_info_list))
     return NULL;
-  }
 
-  request = add_modify_printer_request (name);
-  for (i = 0; i < 2; i++) {
-    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_TEXT,
-		  "printer-location", NULL, location);
-    Connection_begin_allow_threads (self);
-    answer = cupsDoRequest (self->http, request, "/admin/");
-    Connection_end_allow_threads (self);
-    if (PyErr_Occurred ()) {
-      if (answer)
-	ippDelete (answer);
+  if (auth_info_list) {
+    if (!PyList_Check (auth_info_list)) {
+      PyErr_SetString (PyExc_TypeError, "List required");
       return NULL;
     }
 
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      // Perhaps it's a class, not a printer.
-      ippDelete (answer);
-      request = add_modify_class_request (name);
-    } else break;
+    num_auth_info = PyList_Size (auth_info_list);
+    debugprintf ("sizeof values = %Zd\n", sizeof (auth_info_values));
+    if (num_auth_info > sizeof (auth_info_values))
+      num_auth_info = sizeof (auth_info_values);
+
+    for (i = 0; i < num_auth_info; i++) {
+      PyObject *val = PyList_GetItem (auth_info_list, i); // borrowed ref
+      if (UTF8_from_PyObj (&auth_info_values[i], val) == NULL) {
+	while (--i >= 0)
+	  free (auth_info_values[i]);
+	return NULL;
+      }
+    }
   }
 
-  free (name);
-  free (location);
+  debugprintf ("-> Connection_authenticateJob(%d)\n", job_id);
+  request = ippNewRequest(CUPS_AUTHENTICATE_JOB);
+  snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", job_id);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, uri);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+  if (auth_info_list) 
+    {
+      ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_TEXT, "auth-info",
+		     num_auth_info, NULL,
+		     (const char *const *) auth_info_values);
+      for (i = 0; i < num_auth_info; i++)
+	free (auth_info_values[i]);
+    }
+
+  debugprintf ("cupsDoRequest(\"/jobs/\")\n");
+  Connection_begin_allow_threads (self);
+  answer = cupsDoRequest (self->http, request, "/jobs/");
+  Connection_end_allow_threads (self);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
+    debugprintf ("<- Connection_authenticateJob() (error)\n");
     return NULL;
   }
 
-  ippDelete (answer);
+  debugprintf ("<- Connection_authenticateJob() = None\n");
   Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_setPrinterShared (Connection *self, PyObject *args)
+Connection_setJobHoldUntil (Connection *self, PyObject *args)
 {
-  PyObject *nameobj;
-  char *name;
-  int sharing;
   ipp_t *request, *answer;
-  int i;
-
-  if (!PyArg_ParseTuple (args, "Oi", &nameobj, &sharing))
+  int job_id;
+  PyObject *job_hold_until_obj;
+  char *job_hold_until;
+  char uri[1024];
+  cups_option_t *options = NULL;
+  int num_options = 0;
+  if (!PyArg_ParseTuple (args, "iO", &job_id, &job_hold_until_obj))
     return NULL;
 
-  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  request = add_modify_printer_request (name);
-  for (i = 0; i < 2; i++) {
-    ippAddBoolean (request, IPP_TAG_OPERATION, "printer-is-shared", sharing);
-    Connection_begin_allow_threads (self);
-    answer = cupsDoRequest (self->http, request, "/admin/");
-    Connection_end_allow_threads (self);
-    if (PyErr_Occurred ()) {
-      if (answer)
-	ippDelete (answer);
-      return NULL;
-    }
+  if (UTF8_from_PyObj (&job_hold_until, job_hold_until_obj) == NULL)
+    return NULL;
 
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      // Perhaps it's a class, not a printer.
-      ippDelete (answer);
-      request = add_modify_class_request (name);
-    } else break;
-  }
+  debugprintf ("-> Connection_setJobHoldUntil(%d,%s)\n",
+	       job_id, job_hold_until);
+  request = ippNewRequest(IPP_SET_JOB_ATTRIBUTES);
+  snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", job_id);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, uri);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+  num_options = cupsAddOption ("job-hold-until", job_hold_until,
+			       num_options, &options);
+  cupsEncodeOptions (request, num_options, options);
+  free (job_hold_until);
 
-  free (name);
+  debugprintf ("cupsDoRequest(\"/jobs/\")\n");
+  Connection_begin_allow_threads (self);
+  answer = cupsDoRequest (self->http, request, "/jobs/");
+  Connection_end_allow_threads (self);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
+    debugprintf ("<- Connection_setJobHoldUntil() (error)\n");
     return NULL;
   }
 
-  ippDelete (answer);
+  debugprintf ("<- Connection_setJobHoldUntil() = None\n");
   Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_setPrinterJobSheets (Connection *self, PyObject *args)
+Connection_restartJob (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *nameobj;
-  PyObject *startobj;
-  PyObject *endobj;
-  char *name;
-  char *start;
-  char *end;
+  static char *kwlist[] = { "job_id", "job_hold_until", NULL };
   ipp_t *request, *answer;
-  ipp_attribute_t *a;
-  int i;
-
-  if (!PyArg_ParseTuple (args, "OOO", &nameobj, &startobj, &endobj))
-    return NULL;
-
-  if (UTF8_from_PyObj (&name, nameobj) == NULL)
-    return NULL;
-
-  if (UTF8_from_PyObj (&start, startobj) == NULL) {
-    free (name);
+  int job_id;
+  char *job_hold_until = NULL;
+  char uri[1024];
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "i|s", kwlist,
+				    &job_id, &job_hold_until))
     return NULL;
-  }
 
-  if (UTF8_from_PyObj (&end, endobj) == NULL) {
-    free (name);
-    free (start);
+  if (Connection_check_idle (self) < 0)
     return NULL;
-  }
-
-  request = add_modify_printer_request (name);
-  for (i = 0; i < 2; i++) {
-    a = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
-		       "job-sheets-default", 2, NULL, NULL);
-    ippSetString(request, &a, 0, strdup (start));
-    ippSetString(request, &a, 1, strdup (end));
-    Connection_begin_allow_threads (self);
-    answer = cupsDoRequest (self->http, request, "/admin/");
-    Connection_end_allow_threads (self);
-    if (PyErr_Occurred ()) {
-      if (answer)
-	ippDelete (answer);
-      return NULL;
-    }
 
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      ippDelete (answer);
-      // Perhaps it's a class, not a printer.
-      request = add_modify_class_request (name);
-    } else break;
-  }
+  debugprintf ("-> Connection_restartJob(%d)\n", job_id);
+  request = ippNewRequest(IPP_RESTART_JOB);
+  snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", job_id);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, uri);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+  if (job_hold_until)
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		  "job-hold-until", NULL, job_hold_until);
 
-  free (name);
-  free (start);
-  free (end);
+  debugprintf ("cupsDoRequest(\"/jobs/\")\n");
+  Connection_begin_allow_threads (self);
+  answer = cupsDoRequest (self->http, request, "/jobs/");
+  Connection_end_allow_threads (self);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
+    debugprintf ("<- Connection_restartJob() (error)\n");
     return NULL;
   }
 
-  ippDelete (answer);
+  debugprintf ("<- Connection_restartJob() = None\n");
   Py_RETURN_NONE;
 }
 
-static PyObject *
-Connection_setPrinterErrorPolicy (Connection *self, PyObject *args)
+// Parse a sequence of job IDs into a new array.
+static int
+job_ids_from_PyObj (PyObject *obj, Py_ssize_t *n_ids, int **ids)
 {
-  PyObject *nameobj;
-  char *name;
-  PyObject *policyobj;
-  char *policy;
-  ipp_t *request, *answer;
-  int i;
-
-  if (!PyArg_ParseTuple (args, "OO", &nameobj, &policyobj))
-    return NULL;
+  PyObject *seq;
+  Py_ssize_t i, n;
+  int *as;
 
-  if (UTF8_from_PyObj (&name, nameobj) == NULL)
-    return NULL;
+  seq = PySequence_Fast (obj, "job_ids must be a sequence");
+  if (!seq)
+    return -1;
 
-  if (UTF8_from_PyObj (&policy, policyobj) == NULL) {
-    free (name);
-    return NULL;
+  n = PySequence_Fast_GET_SIZE (seq);
+  as = malloc ((n ? n : 1) * sizeof (int));
+  if (!as) {
+    Py_DECREF (seq);
+    PyErr_NoMemory ();
+    return -1;
   }
 
-  request = add_modify_printer_request (name);
-  for (i = 0; i < 2; i++) {
-    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
-		  "printer-error-policy", NULL, policy);
-    Connection_begin_allow_threads (self);
-    answer = cupsDoRequest (self->http, request, "/admin/");
-    Connection_end_allow_threads (self);
-    if (PyErr_Occurred ()) {
-      if (answer)
-	ippDelete (answer);
-      return NULL;
+  for (i = 0; i < n; i++) {
+    PyObject *id = PySequence_Fast_GET_ITEM (seq, i);
+#if PY_MAJOR_VERSION >= 3
+    if (!PyLong_Check (id)) {
+#else
+    if (!PyInt_Check (id) && !PyLong_Check (id)) {
+#endif
+      PyErr_SetString (PyExc_TypeError, "job_ids must be a list "
+		       "of integers");
+      free (as);
+      Py_DECREF (seq);
+      return -1;
     }
 
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      ippDelete (answer);
-      // Perhaps it's a class, not a printer.
-      request = add_modify_class_request (name);
-    } else break;
+    as[i] = PyLong_AsLong (id);
   }
 
-  free (name);
-  free (policy);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
+  Py_DECREF (seq);
+  *n_ids = n;
+  *ids = as;
+  return 0;
+}
+
+// Send the job request once for each job, patching its job-uri and
+// request-id in place (do_request_keep() leaves it to us between
+// sends), and return a dict of job ID to IPP status.
+// If all_status is not NULL, the request has already been handled for
+// every job at once: that status is used for each, and nothing is
+// sent.  Takes ownership of request.
+static PyObject *
+do_job_requests (Connection *self, ipp_t *request, const char *resource,
+		 Py_ssize_t n_ids, const int *ids,
+		 const ipp_status_t *all_status)
+{
+  PyObject *result;
+  ipp_attribute_t *job_uri;
+  ipp_status_t *statuses;
+  char uri[1024];
+  Py_ssize_t i;
+
+  statuses = calloc (n_ids ? n_ids : 1, sizeof (ipp_status_t));
+  if (!statuses) {
+    ippDelete (request);
+    return PyErr_NoMemory ();
+  }
+
+  job_uri = ippFindAttribute (request, "job-uri", IPP_TAG_URI);
+  Connection_begin_allow_threads (self);
+  for (i = 0; i < n_ids; i++) {
+    ipp_t *answer;
+
+    if (all_status) {
+      statuses[i] = *all_status;
+      continue;
+    }
+
+    snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", ids[i]);
+    copy_ipp_string (request, &job_uri, 0, uri);
+    ippSetRequestId (request, ippGetRequestId (request) + 1);
+    answer = do_request_keep (self->http, request, resource);
+    statuses[i] = answer ? ippGetStatusCode (answer) : cupsLastError ();
     if (answer)
       ippDelete (answer);
-    return NULL;
   }
+  Connection_end_allow_threads (self);
 
-  ippDelete (answer);
-  Py_RETURN_NONE;
+  ippDelete (request);
+  result = PyDict_New ();
+  for (i = 0; result && i < n_ids; i++) {
+#if PY_MAJOR_VERSION >= 3
+    PyObject *key = PyLong_FromLong (ids[i]);
+    PyObject *val = PyLong_FromLong (statuses[i]);
+#else
+    PyObject *key = PyInt_FromLong (ids[i]);
+    PyObject *val = PyInt_FromLong (statuses[i]);
+#endif
+    if (!key || !val || PyDict_SetItem (result, key, val) < 0)
+      Py_CLEAR (result);
+
+    Py_XDECREF (key);
+    Py_XDECREF (val);
+  }
+
+  free (statuses);
+  return result;
+}
+
+// A request for op on one job, with a job-uri for do_job_requests()
+// to fill in.
+static ipp_t *
+new_job_request (ipp_op_t op)
+{
+  ipp_t *request = ippNewRequest (op);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL,
+		"ipp://localhost/jobs/0");
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+  return request;
 }
 
 static PyObject *
-Connection_setPrinterOpPolicy (Connection *self, PyObject *args)
+Connection_cancelJobs (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *nameobj;
-  char *name;
-  PyObject *policyobj;
-  char *policy;
-  ipp_t *request, *answer;
-  int i;
+  PyObject *job_ids_obj;
+  PyObject *result;
+  ipp_status_t all_status = IPP_OK;
+  int bulk_done = 0;
+  ipp_t *request;
+  Py_ssize_t n_ids;
+  int *ids;
+  int purge_job = 0;
+  static char *kwlist[] = { "job_ids", "purge_job", NULL };
 
-  if (!PyArg_ParseTuple (args, "OO", &nameobj, &policyobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|i", kwlist,
+				    &job_ids_obj, &purge_job))
     return NULL;
 
-  if (UTF8_from_PyObj (&policy, policyobj) == NULL) {
-    free (name);
+  if (job_ids_from_PyObj (job_ids_obj, &n_ids, &ids) == -1)
     return NULL;
-  }
 
-  request = add_modify_printer_request (name);
-  for (i = 0; i < 2; i++) {
-    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
-		  "printer-op-policy", NULL, policy);
+  debugprintf ("-> Connection_cancelJobs(%zd jobs)\n", n_ids);
+#ifdef HAVE_CUPS_1_6
+  if (n_ids > 1 && !purge_job) {
+    // Try them all in one Cancel-Jobs request.  It succeeds or fails
+    // as a whole, so on failure fall back to one request per job to
+    // find out which jobs could not be cancelled.
+    ipp_t *answer;
+    ipp_attribute_t *attr;
+    Py_ssize_t i;
+
+    request = ippNewRequest (IPP_CANCEL_JOBS);
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri",
+		  NULL, "ipp://localhost/printers/");
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		  "requesting-user-name", NULL, cupsUser ());
+    attr = ippAddIntegers (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+			   "job-ids", n_ids, NULL);
+    for (i = 0; i < n_ids; i++)
+      ippSetInteger (request, &attr, i, ids[i]);
+
+    debugprintf ("cupsDoRequest(\"/admin/\")\n");
     Connection_begin_allow_threads (self);
     answer = cupsDoRequest (self->http, request, "/admin/");
     Connection_end_allow_threads (self);
-    if (PyErr_Occurred ()) {
-      if (answer)
-	ippDelete (answer);
-      return NULL;
+    if (answer && ippGetStatusCode (answer) <= IPP_OK_CONFLICT) {
+      all_status = ippGetStatusCode (answer);
+      bulk_done = 1;
     }
 
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      ippDelete (answer);
-      // Perhaps it's a class, not a printer.
-      request = add_modify_class_request (name);
-    } else break;
-  }
-
-  free (name);
-  free (policy);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
-    return NULL;
   }
+#endif /* HAVE_CUPS_1_6 */
 
-  ippDelete (answer);
-  Py_RETURN_NONE;
+  request = new_job_request (IPP_CANCEL_JOB);
+  if (purge_job)
+    ippAddBoolean (request, IPP_TAG_OPERATION, "purge-job", 1);
+
+  result = do_job_requests (self, request, "/jobs/", n_ids, ids,
+			    bulk_done ? &all_status : NULL);
+  free (ids);
+  debugprintf ("<- Connection_cancelJobs()\n");
+  return result;
 }
 
 static PyObject *
-do_requesting_user_names (Connection *self, PyObject *args,
-			  const char *requeststr)
+Connection_holdJobs (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *nameobj;
-  char *name;
-  char *tmp;
-  PyObject *users;
-  int num_users, i, j;
-  ipp_t *request, *answer;
-  ipp_attribute_t *attr;
-
-  if (!PyArg_ParseTuple (args, "OO", &nameobj, &users))
-    return NULL;
+  PyObject *job_ids_obj;
+  PyObject *result;
+  ipp_t *request;
+  Py_ssize_t n_ids;
+  int *ids;
+  const char *job_hold_until = "indefinite";
+  static char *kwlist[] = { "job_ids", "job_hold_until", NULL };
 
-  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (!PyList_Check (users)) {
-    PyErr_SetString (PyExc_TypeError, "List required");
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|s", kwlist,
+				    &job_ids_obj, &job_hold_until))
     return NULL;
-  }
-  request = add_modify_printer_request (name);
-  for (i = 0; i < 2; i++) {
-    num_users = PyList_Size (users);
-    if (num_users) {
-      attr = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
-			    requeststr, num_users, NULL, NULL);
-      for (j = 0; j < num_users; j++) {
-	PyObject *username = PyList_GetItem (users, j); // borrowed ref
-	if (!PyUnicode_Check (username) && !PyBytes_Check (username)) {
-	  int k;
-	  PyErr_SetString (PyExc_TypeError, "String required");
-	  for (k = 0; k < j; k++) {
-	    free ((void *)ippGetString (attr, k, NULL));
-	    ippSetString(request, &attr, k, NULL);
-	  }
-	  ippDelete (request);
-	  return NULL;
-	}
-	ippSetString(request, &attr, j, UTF8_from_PyObj (&tmp, username));
-	free(tmp);
-      }
-    } else {
-      attr = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
-			    requeststr, 1, NULL, NULL);
-      if (strstr (requeststr, "denied"))
-	ippSetString(request, &attr, 0, strdup ("none"));
-      else
-	ippSetString(request, &attr, 0, strdup ("all"));
-    }
-    Connection_begin_allow_threads (self);
-    answer = cupsDoRequest (self->http, request, "/admin/");
-    Connection_end_allow_threads (self);
-    if (PyErr_Occurred ()) {
-      if (answer)
-	ippDelete (answer);
-      return NULL;
-    }
-
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      ippDelete (answer);
-      // Perhaps it's a class, not a printer.
-      request = add_modify_class_request (name);
-    } else break;
-  }
 
-  free (name);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
+  if (job_ids_from_PyObj (job_ids_obj, &n_ids, &ids) == -1)
     return NULL;
-  }
 
-  ippDelete (answer);
-  Py_RETURN_NONE;
+  debugprintf ("-> Connection_holdJobs(%zd jobs, %s)\n",
+	       n_ids, job_hold_until);
+  request = new_job_request (IPP_HOLD_JOB);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		"job-hold-until", NULL, job_hold_until);
+  result = do_job_requests (self, request, "/jobs/", n_ids, ids, NULL);
+  free (ids);
+  debugprintf ("<- Connection_holdJobs()\n");
+  return result;
 }
 
 static PyObject *
-Connection_setPrinterUsersAllowed (Connection *self, PyObject *args)
+Connection_releaseJobs (Connection *self, PyObject *args, PyObject *kwds)
 {
-  return do_requesting_user_names (self, args, "requesting-user-name-allowed");
-}
+  PyObject *job_ids_obj;
+  PyObject *result;
+  Py_ssize_t n_ids;
+  int *ids;
+  static char *kwlist[] = { "job_ids", NULL };
 
-static PyObject *
-Connection_setPrinterUsersDenied (Connection *self, PyObject *args)
-{
-  return do_requesting_user_names (self, args, "requesting-user-name-denied");
-}
+  if (Connection_check_idle (self) < 0)
+    return NULL;
 
-static char *
-PyObject_to_string (PyObject *pyvalue)
-{
-  char string[BUFSIZ];
-  char *value = "{unknown type}";
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O", kwlist, &job_ids_obj))
+    return NULL;
 
-  if (PyUnicode_Check (pyvalue) || PyBytes_Check (pyvalue)) {
-    UTF8_from_PyObj (&value, pyvalue);
-  } else if (PyBool_Check (pyvalue)) {
-    value = (pyvalue == Py_True) ? "true" : "false";
-  } else if (PyLong_Check (pyvalue)) {
-    long v = PyLong_AsLong (pyvalue);
-    snprintf (string, sizeof (string), "%ld", v);
-    value = string;
-#if PY_MAJOR_VERSION < 3
-  } else if (PyInt_Check (pyvalue)) {
-    long v = PyInt_AsLong (pyvalue);
-    snprintf (string, sizeof (string), "%ld", v);
-    value = string;
-#endif
-  } else if (PyFloat_Check (pyvalue)) {
-    double v = PyFloat_AsDouble (pyvalue);
-    snprintf (string, sizeof (string), "%f", v);
-    value = string;
-  }
+  if (job_ids_from_PyObj (job_ids_obj, &n_ids, &ids) == -1)
+    return NULL;
 
-  return strdup (value);
+  debugprintf ("-> Connection_releaseJobs(%zd jobs)\n", n_ids);
+  result = do_job_requests (self, new_job_request (IPP_RELEASE_JOB),
+			    "/jobs/", n_ids, ids, NULL);
+  free (ids);
+  debugprintf ("<- Connection_releaseJobs()\n");
+  return result;
 }
 
 static PyObject *
-Connection_addPrinterOptionDefault (Connection *self, PyObject *args)
+Connection_moveJobs (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *nameobj;
-  char *name;
-  PyObject *optionobj;
-  char *option;
-  PyObject *pyvalue;
-  const char const suffix[] = "-default";
-  char *opt;
-  ipp_t *request, *answer;
-  int i;
-  size_t optionlen;
+  PyObject *job_ids_obj;
+  PyObject *jobprinteruriobj;
+  PyObject *result;
+  char *jobprinteruri;
+  ipp_t *request;
+  Py_ssize_t n_ids;
+  int *ids;
+  static char *kwlist[] = { "job_ids", "job_printer_uri", NULL };
 
-  if (!PyArg_ParseTuple (args, "OOO", &nameobj, &optionobj, &pyvalue))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "OO", kwlist,
+				    &job_ids_obj, &jobprinteruriobj))
     return NULL;
 
-  if (UTF8_from_PyObj (&option, optionobj) == NULL) {
-    free (name);
+  if (UTF8_from_PyObj (&jobprinteruri, jobprinteruriobj) == NULL)
     return NULL;
-  }
-
-  optionlen = strlen (option);
-  opt = malloc (optionlen + sizeof (suffix) + 1);
-  memcpy (opt, option, optionlen);
-  strcpy (opt + optionlen, suffix);
-  request = add_modify_printer_request (name);
-  for (i = 0; i < 2; i++) {
-    if (!PyUnicode_Check (pyvalue) && !PyBytes_Check (pyvalue) &&
-	PySequence_Check (pyvalue)) {
-      ipp_attribute_t *attr;
-      int len = PySequence_Size (pyvalue);
-      int j;
-      attr = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
-			    opt, len, NULL, NULL);
-      for (j = 0; j < len; j++) {
-	PyObject *each = PySequence_GetItem (pyvalue, j);
-	ippSetString(request, &attr, j, PyObject_to_string (each));
-      }
-    } else
-      ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
-		    opt, NULL, PyObject_to_string (pyvalue));
-
-    Connection_begin_allow_threads (self);
-    answer = cupsDoRequest (self->http, request, "/admin/");
-    Connection_end_allow_threads (self);
-    if (PyErr_Occurred ()) {
-      if (answer)
-	ippDelete (answer);
-      return NULL;
-    }
-
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      ippDelete (answer);
-      // Perhaps it's a class, not a printer.
-      request = add_modify_class_request (name);
-    } else break;
-  }
 
-  free (name);
-  free (option);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
+  if (job_ids_from_PyObj (job_ids_obj, &n_ids, &ids) == -1) {
+    free (jobprinteruri);
     return NULL;
   }
 
-  ippDelete (answer);
-  Py_RETURN_NONE;
+  debugprintf ("-> Connection_moveJobs(%zd jobs, %s)\n",
+	       n_ids, jobprinteruri);
+  request = new_job_request (CUPS_MOVE_JOB);
+  ippAddString (request, IPP_TAG_JOB, IPP_TAG_URI, "job-printer-uri", NULL,
+		jobprinteruri);
+  free (jobprinteruri);
+  result = do_job_requests (self, request, "/jobs", n_ids, ids, NULL);
+  free (ids);
+  debugprintf ("<- Connection_moveJobs()\n");
+  return result;
 }
 
 static PyObject *
-Connection_deletePrinterOptionDefault (Connection *self, PyObject *args)
+Connection_getFile (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *nameobj;
-  char *name;
-  PyObject *optionobj;
-  char *option;
-  const char const suffix[] = "-default";
-  char *opt;
-  ipp_t *request, *answer;
-  int i;
-  size_t optionlen;
+  static char *kwlist[] = { "resource", "filename", "fd", "file", NULL };
+  const char *resource, *filename = NULL;
+  int fd = -1;
+  PyObject *fileobj = NULL;
+  http_status_t status;
 
-  if (!PyArg_ParseTuple (args, "OO", &nameobj, &optionobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "s|siO", kwlist,
+				    &resource, &filename, &fd, &fileobj))
     return NULL;
 
-  if (UTF8_from_PyObj (&option, optionobj) == NULL) {
-    free (name);
+  if ((fd > -1 && (filename || fileobj)) ||
+      (filename && fileobj)) {
+    PyErr_SetString (PyExc_RuntimeError,
+		     "Only one destination type may be specified");
     return NULL;
   }
 
-  optionlen = strlen (option);
-  opt = malloc (optionlen + sizeof (suffix) + 1);
-  memcpy (opt, option, optionlen);
-  strcpy (opt + optionlen, suffix);
-  request = add_modify_printer_request (name);
-  for (i = 0; i < 2; i++) {
-    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_DELETEATTR,
-		  opt, NULL, NULL);
+  if (fileobj) {
+#if PY_MAJOR_VERSION >= 3
+    fd = PyObject_AsFileDescriptor(fileobj);
+#else
+    FILE *f = PyFile_AsFile (fileobj);
+    fd = fileno (f);
+#endif
+  }
+
+  if (filename) {
+    debugprintf ("-> Connection_getFile(%s, %s)\n", resource, filename);
+    debugprintf ("cupsGetFile()\n");
     Connection_begin_allow_threads (self);
-    answer = cupsDoRequest (self->http, request, "/admin/");
+    status = cupsGetFile (self->http, resource, filename);
+    Connection_end_allow_threads (self);
+  } else {
+    debugprintf ("-> Connection_getFile(%s, %d)\n", resource, fd);
+    debugprintf ("cupsGetFd()\n");
+    Connection_begin_allow_threads (self);
+    status = cupsGetFd (self->http, resource, fd);
     Connection_end_allow_threads (self);
-    if (PyErr_Occurred ()) {
-      if (answer)
-	ippDelete (answer);
-      return NULL;
-    }
-
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      ippDelete (answer);
-      // Perhaps it's a class, not a printer.
-      request = add_modify_class_request (name);
-    } else break;
   }
 
-  free (name);
-  free (option);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
+  if (status != HTTP_OK) {
+    set_http_error (status);
+    debugprintf ("<- Connection_getFile() (error)\n");
     return NULL;
   }
 
-  ippDelete (answer);
+  debugprintf ("<- Connection_getFile() = None\n");
   Py_RETURN_NONE;
 }
 
-static PyObject *
-Connection_deletePrinter (Connection *self, PyObject *args, PyObject *kwds)
-{
-  return do_printer_request (self, args, kwds, CUPS_DELETE_PRINTER);
-}
+/////////////////////////////
+// Memory-mapped transfers //
+/////////////////////////////
 
-static PyObject *
-Connection_getPrinterAttributes (Connection *self, PyObject *args,
-				 PyObject *kwds)
+/*
+ * Documents are mapped into memory and handed to libcups in large
+ * slices.  For slices bigger than its own buffer httpWrite2 writes
+ * straight from the caller's memory, so the data goes from the page
+ * cache to the socket without passing through user-space buffers.
+ */
+
+#define MAPPED_CHUNK_SIZE (1024 * 1024)
+
+typedef struct
 {
-  PyObject *ret;
-  PyObject *nameobj = NULL;
-  char *name;
-  PyObject *uriobj = NULL;
-  char *uri;
-  PyObject *requested_attrs = NULL;
-  char **attrs = NULL; /* initialised to calm compiler */
-  size_t n_attrs = 0; /* initialised to calm compiler */
-  ipp_t *request, *answer;
-  ipp_attribute_t *attr;
-  char consuri[HTTP_MAX_URI];
-  int i;
-  static char *kwlist[] = { "name", "uri", "requested_attributes", NULL };
+  int fd;		/* fd to close, or -1 */
+  void *base;		/* mapping, or NULL */
+  size_t length;	/* mapping length */
+  const char *data;	/* start of data within mapping */
+  size_t size;		/* number of bytes of data */
+} mapped_file_t;
+
+typedef struct
+{
+  Connection *conn;
+  PyObject *callback;	/* progress callback, or NULL */
+  size_t sent;
+  size_t total;
+  struct timeval start;
+} transfer_progress_t;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|OOO", kwlist,
-				    &nameobj, &uriobj, &requested_attrs))
-    return NULL;
+typedef http_status_t (*chunk_writer_t) (http_t *http,
+					 const char *buffer,
+					 size_t length);
 
-  if (nameobj && uriobj) {
-    PyErr_SetString (PyExc_RuntimeError,
-		     "name or uri must be specified but not both");
-    return NULL;
-  }
+static void
+unmap_file (mapped_file_t *map)
+{
+  if (map->base)
+    munmap (map->base, map->length);
+  if (map->fd != -1)
+    close (map->fd);
+  map->base = NULL;
+  map->fd = -1;
+}
 
-  if (nameobj) {
-    if (UTF8_from_PyObj (&name, nameobj) == NULL)
-      return NULL;
-  } else if (uriobj) {
-    if (UTF8_from_PyObj (&uri, uriobj) == NULL)
-      return NULL;
+/*
+ * Map either the named file, or the remainder of an open file
+ * descriptor from its current offset.  Returns -1 and sets errno on
+ * failure.
+ */
+static int
+map_file (mapped_file_t *map, const char *filename, int fd)
+{
+  struct stat st;
+  off_t offset = 0;
+  int err;
+
+  map->fd = -1;
+  map->base = NULL;
+  map->length = 0;
+  map->data = NULL;
+  map->size = 0;
+
+  if (filename) {
+    fd = open (filename, O_RDONLY);
+    if (fd == -1)
+      return -1;
+
+    map->fd = fd;
   } else {
-    PyErr_SetString (PyExc_RuntimeError,
-		     "name or uri must be specified");
-    return NULL;
+    offset = lseek (fd, 0, SEEK_CUR);
+    if (offset == (off_t) -1)
+      offset = 0;
   }
 
-  if (requested_attrs) {
-    if (get_requested_attrs (requested_attrs, &n_attrs, &attrs) == -1) {
-      if (nameobj)
-	free (name);
-      else if (uriobj)
-	free (uri);
-      return NULL;
-    }
+  if (fstat (fd, &st) == -1)
+    goto fail;
+
+  if (!S_ISREG (st.st_mode)) {
+    errno = EINVAL;
+    goto fail;
   }
 
-  debugprintf ("-> Connection_getPrinterAttributes(%s)\n",
-	       nameobj ? name : uri);
+  if (st.st_size > offset) {
+    map->length = st.st_size;
+    map->base = mmap (NULL, map->length, PROT_READ, MAP_SHARED, fd, 0);
+    if (map->base == MAP_FAILED) {
+      map->base = NULL;
+      goto fail;
+    }
 
-  if (nameobj) {
-    construct_uri (consuri, sizeof (consuri),
-		   "ipp://localhost/printers/", name);
-    uri = consuri;
+#ifdef MADV_SEQUENTIAL
+    madvise (map->base, map->length, MADV_SEQUENTIAL);
+#endif /* MADV_SEQUENTIAL */
+    map->data = (const char *) map->base + offset;
+    map->size = st.st_size - offset;
   }
 
-  for (i = 0; i < 2; i++) {
-    request = ippNewRequest (IPP_GET_PRINTER_ATTRIBUTES);
-    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		  "printer-uri", NULL, uri);
-    if (requested_attrs)
-      ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
-		     "requested-attributes", n_attrs, NULL,
-		     (const char **) attrs);
-    debugprintf ("trying request with uri %s\n", uri);
-    Connection_begin_allow_threads (self);
-    answer = cupsDoRequest (self->http, request, "/");
-    Connection_end_allow_threads (self);
-    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
-      ippDelete (answer);
-      if (uriobj)
-	break;
+  return 0;
 
-      // Perhaps it's a class, not a printer.
-      construct_uri (consuri, sizeof (consuri),
-		     "ipp://localhost/classes/", name);
-    } else break;
+ fail:
+  err = errno;
+  unmap_file (map);
+  errno = err;
+  return -1;
+}
+
+static void
+transfer_progress_init (transfer_progress_t *progress, Connection *conn,
+			PyObject *callback, size_t total)
+{
+  progress->conn = conn;
+  progress->callback = (callback && callback != Py_None) ? callback : NULL;
+  progress->sent = 0;
+  progress->total = total;
+  gettimeofday (&progress->start, NULL);
+}
+
+/*
+ * Call the progress callback.  This is called with the GIL released.
+ * Returns -1 if the callback raised an exception, which is left set.
+ */
+static int
+transfer_progress_report (transfer_progress_t *progress)
+{
+  struct timeval now;
+  double elapsed, rate;
+  PyObject *result;
+
+  if (!progress->callback)
+    return 0;
+
+  gettimeofday (&now, NULL);
+  elapsed = (now.tv_sec - progress->start.tv_sec) +
+    (now.tv_usec - progress->start.tv_usec) / 1000000.0;
+  rate = elapsed > 0 ? progress->sent / elapsed : 0;
+
+  Connection_end_allow_threads (progress->conn);
+  result = PyObject_CallFunction (progress->callback, "KKd",
+				  (unsigned long long) progress->sent,
+				  (unsigned long long) progress->total,
+				  rate);
+  Py_XDECREF (result);
+  Connection_begin_allow_threads (progress->conn);
+  return result ? 0 : -1;
+}
+
+static http_status_t
+http_write_chunk (http_t *http, const char *buffer, size_t length)
+{
+  if (httpWrite2 (http, buffer, length) < 0)
+    return HTTP_ERROR;
+
+  return HTTP_CONTINUE;
+}
+
+static http_status_t
+write_mapped_file (http_t *http, chunk_writer_t writer,
+		   const mapped_file_t *map, transfer_progress_t *progress)
+{
+  const char *data = map->data;
+  size_t left = map->size;
+  while (left > 0) {
+    size_t n = left < MAPPED_CHUNK_SIZE ? left : MAPPED_CHUNK_SIZE;
+    http_status_t status = writer (http, data, n);
+    if (status != HTTP_CONTINUE)
+      return status;
+
+    data += n;
+    left -= n;
+    progress->sent += n;
+    if (transfer_progress_report (progress) == -1)
+      return HTTP_ERROR;
+  }
+
+  return HTTP_CONTINUE;
+}
+
+static void
+cancel_job_quietly (http_t *http, int jobid)
+{
+  ipp_t *request = ippNewRequest (IPP_CANCEL_JOB);
+  char uri[1024];
+  snprintf (uri, sizeof (uri), "ipp://localhost/jobs/%d", jobid);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, uri);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+  ippDelete (cupsDoRequest (http, request, "/jobs/"));
+}
+
+/*
+ * Like cupsPrintFiles2, but sends memory-mapped documents and reports
+ * progress.  Returns the job ID, or 0 with an exception set.
+ */
+static int
+print_mapped_files (Connection *self, const char *printer,
+		    int num_files, char **filenames, const char *title,
+		    int num_settings, cups_option_t *settings,
+		    PyObject *callback)
+{
+  mapped_file_t *maps;
+  transfer_progress_t progress;
+  const char *format;
+  size_t total = 0;
+  ipp_status_t last_error = IPP_OK;
+  char *last_error_string = NULL;
+  int jobid;
+  int i;
+
+  maps = calloc (num_files, sizeof (mapped_file_t));
+  if (!maps) {
+    PyErr_NoMemory ();
+    return 0;
   }
 
-  if (nameobj)
-    free (name);
+  for (i = 0; i < num_files; i++) {
+    if (map_file (&maps[i], filenames[i], -1) == -1) {
+      PyErr_SetFromErrnoWithFilename (PyExc_RuntimeError, filenames[i]);
+      while (i > 0)
+	unmap_file (&maps[--i]);
+      free (maps);
+      return 0;
+    }
 
-  if (uriobj)
-    free (uri);
+    total += maps[i].size;
+  }
 
-  if (requested_attrs)
-    free_requested_attrs (n_attrs, attrs);
+  format = cupsGetOption ("document-format", num_settings, settings);
+  if (!format)
+    format = CUPS_FORMAT_AUTO;
 
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
+  transfer_progress_init (&progress, self, callback, total);
+  debugprintf ("print_mapped_files(%s, %d files, %zu bytes)\n",
+	       printer, num_files, total);
+  Connection_begin_allow_threads (self);
+  jobid = cupsCreateJob (self->http, printer, title, num_settings, settings);
+  for (i = 0; jobid > 0 && i < num_files; i++) {
+    const char *docname = strrchr (filenames[i], '/');
+    http_status_t status;
+    ipp_status_t finished;
+
+    docname = docname ? docname + 1 : filenames[i];
+    status = cupsStartDocument (self->http, printer, jobid, docname,
+				format, i == num_files - 1);
+    if (status == HTTP_CONTINUE)
+      status = write_mapped_file (self->http, cupsWriteRequestData,
+				  &maps[i], &progress);
+
+    finished = cupsFinishDocument (self->http, printer);
+    if (status != HTTP_CONTINUE || finished > IPP_OK_CONFLICT) {
+      last_error = cupsLastError ();
+      last_error_string = strdup (cupsLastErrorString ());
+      cancel_job_quietly (self->http, jobid);
+      jobid = 0;
+    }
+  }
 
-    debugprintf ("<- Connection_getPrinterAttributes() (error)\n");
-    return NULL;
+  if (jobid == 0 && !last_error_string) {
+    last_error = cupsLastError ();
+    last_error_string = strdup (cupsLastErrorString ());
   }
+  Connection_end_allow_threads (self);
 
-  ret = PyDict_New ();
-  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer)) {
-    while (attr && ippGetGroupTag (attr) != IPP_TAG_PRINTER)
-      attr = ippNextAttribute (answer);
+  for (i = 0; i < num_files; i++)
+    unmap_file (&maps[i]);
+  free (maps);
 
-    if (!attr)
-      break;
+  // An exception from the progress callback takes precedence.
+  if (jobid == 0 && !PyErr_Occurred ())
+    set_ipp_error (last_error, last_error_string);
 
-    for (; attr && ippGetGroupTag (attr) == IPP_TAG_PRINTER;
-	 attr = ippNextAttribute (answer)) {
-      size_t namelen = strlen (ippGetName (attr));
-      int is_list = ippGetCount (attr) > 1;
+  free (last_error_string);
+  return jobid;
+}
 
-      debugprintf ("Attribute: %s\n", ippGetName (attr));
-      // job-sheets-default is special, since it is always two values.
-      // Make it a tuple.
-      if (!strcmp (ippGetName (attr), "job-sheets-default") &&
-	  ippGetValueTag (attr) == IPP_TAG_NAME) {
-	PyObject *startobj, *endobj, *tuple;
-	const char *start, *end;
-	start = ippGetString (attr, 0, NULL);
-	if (ippGetCount (attr) >= 2)
-	  end = ippGetString (attr, 1, NULL);
-	else
-	  end = "";
-
-	startobj = PyObj_from_UTF8 (start);
-	endobj = PyObj_from_UTF8 (end);
-	tuple = Py_BuildValue ("(OO)", startobj, endobj);
-	Py_DECREF (startobj);
-	Py_DECREF (endobj);
-	PyDict_SetItemString (ret, "job-sheets-default", tuple);
-	Py_DECREF (tuple);
-	continue;
+/*
+ * Like cupsPutFd, but sends a memory-mapped file and reports
+ * progress.  This is called with the GIL released.
+ */
+static http_status_t
+put_mapped_file (Connection *self, const char *resource,
+		 const mapped_file_t *map, transfer_progress_t *progress)
+{
+  http_status_t status;
+  int tries = 0;
+
+  do {
+    httpClearFields (self->http);
+    httpSetLength (self->http, map->size);
+    httpSetField (self->http, HTTP_FIELD_AUTHORIZATION,
+		  httpGetAuthString (self->http));
+    httpSetExpect (self->http, HTTP_CONTINUE);
+
+    if (httpPut (self->http, resource)) {
+      if (httpReconnect (self->http)) {
+	status = HTTP_ERROR;
+	break;
       }
 
-      // Check for '-supported' suffix.  Any xxx-supported attribute
-      // that is a text type must be a list.
-      //
-      // Also check for attributes that are known to allow multiple
-      // string values, and make them lists.
-      if (!is_list && namelen > 10) {
-	const char *multivalue_options[] =
-	  {
-	    "notify-events-default",
-	    "requesting-user-name-allowed",
-	    "requesting-user-name-denied",
-	    "printer-state-reasons",
-	    "marker-colors",
-	    "marker-names",
-	    "marker-types",
-	    "marker-levels",
-	    "member-names",
-	    NULL
-	  };
+      // Connection was stale; just try again.
+      status = HTTP_UNAUTHORIZED;
+      continue;
+    }
 
-	switch (ippGetValueTag (attr)) {
-	case IPP_TAG_NAME:
-	case IPP_TAG_TEXT:
-	case IPP_TAG_KEYWORD:
-	case IPP_TAG_URI:
-	case IPP_TAG_CHARSET:
-	case IPP_TAG_MIMETYPE:
-	case IPP_TAG_LANGUAGE:
-	case IPP_TAG_ENUM:
-	case IPP_TAG_INTEGER:
-	case IPP_TAG_RESOLUTION:
-	  is_list = !strcmp (ippGetName (attr) + namelen - 10, "-supported");
+    // Wait for the "100 Continue" before sending the data.
+    status = HTTP_CONTINUE;
+    if (httpWait (self->http, 1000))
+      status = httpUpdate (self->http);
 
-	  if (!is_list) {
-	    const char **opt;
-	    for (opt = multivalue_options; !is_list && *opt; opt++)
-	      is_list = !strcmp (ippGetName (attr), *opt);
-	  }
+    if (status == HTTP_CONTINUE) {
+      progress->sent = 0;
+      status = write_mapped_file (self->http, http_write_chunk,
+				  map, progress);
+      if (status != HTTP_CONTINUE)
+	break;
 
-	default:
-	  break;
-	}
-      }
+      while ((status = httpUpdate (self->http)) == HTTP_CONTINUE);
+    }
 
-      if (is_list) {
-	PyObject *list = PyList_from_attr_values (attr);
-	PyDict_SetItemString (ret, ippGetName (attr), list);
-	Py_DECREF (list);
-      } else {
-	PyObject *val = PyObject_from_attr_value (attr, i);
-	PyDict_SetItemString (ret, ippGetName (attr), val);
+    if (status == HTTP_UNAUTHORIZED) {
+      httpFlush (self->http);
+      if (cupsDoAuthentication (self->http, "PUT", resource))
+	break;
+
+      if (httpReconnect (self->http)) {
+	status = HTTP_ERROR;
+	break;
       }
     }
+  } while (status == HTTP_UNAUTHORIZED && ++tries < 5);
 
-    if (!attr)
-      break;
-  }
+  if (status != HTTP_OK && status != HTTP_CREATED)
+    httpFlush (self->http);
 
-  debugprintf ("<- Connection_getPrinterAttributes() = dict\n");
-  return ret;
+  return status;
 }
 
 static PyObject *
-Connection_addPrinterToClass (Connection *self, PyObject *args)
+Connection_putFile (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *printernameobj;
-  char *printername;
-  PyObject *classnameobj;
-  char *classname;
-  char classuri[HTTP_MAX_URI];
-  char printeruri[HTTP_MAX_URI];
-  ipp_t *request, *answer;
+  static char *kwlist[] = { "resource", "filename", "fd", "file",
+			    "mmap", "progress", NULL };
+  const char *resource, *filename = NULL;
+  int fd = -1;
+  PyObject *fileobj = NULL;
+  char use_mmap = 0;
+  PyObject *progress_cb = NULL;
+  http_status_t status;
 
-  if (!PyArg_ParseTuple (args, "OO", &printernameobj, &classnameobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&printername, printernameobj) == NULL)
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "s|siObO", kwlist,
+				    &resource, &filename, &fd, &fileobj,
+				    &use_mmap, &progress_cb))
     return NULL;
 
-  if (UTF8_from_PyObj (&classname, classnameobj) == NULL) {
-    free (printername);
+  if (progress_cb == Py_None)
+    progress_cb = NULL;
+
+  if (progress_cb && !PyCallable_Check (progress_cb)) {
+    PyErr_SetString (PyExc_TypeError, "progress must be callable");
     return NULL;
   }
 
-  // Does the class exist, and is the printer already in it?
-  request = ippNewRequest (IPP_GET_PRINTER_ATTRIBUTES);
-  construct_uri (classuri, sizeof (classuri),
-		 "ipp://localhost/classes/", classname);
-	    
-  free (classname);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, classuri);
-  Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/");
-  Connection_end_allow_threads (self);
-  if (answer) {
-    ipp_attribute_t *printers;
-    printers = ippFindAttribute (answer, "member-names", IPP_TAG_NAME);
-    if (printers) {
-      int i;
-      for (i = 0; i < ippGetCount (printers); i++) {
-	if (!strcasecmp (ippGetString (printers, i, NULL), printername)) {
-	  ippDelete (answer);
-	  PyErr_SetString (PyExc_RuntimeError, "Printer already in class");
-	  free (printername);
-	  return NULL;
-	}
-      }
-    }
+  if ((fd > -1 && (filename || fileobj)) ||
+      (filename && fileobj)) {
+    PyErr_SetString (PyExc_RuntimeError,
+		     "Only one destination type may be specified");
+    return NULL;
   }
 
-  request = ippNewRequest (CUPS_ADD_CLASS);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, classuri);
-  construct_uri (printeruri, sizeof (printeruri),
-		 "ipp://localhost/printers/", printername);
-  free (printername);
-  if (answer) {
-    ipp_attribute_t *printers;
-    printers = ippFindAttribute (answer, "member-uris", IPP_TAG_URI);
-    if (printers) {
-      ipp_attribute_t *attr;
-      int i;
-      attr = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_URI,
-			    "member-uris", ippGetCount (printers) + 1,
-			    NULL, NULL);
-      for (i = 0; i < ippGetCount (printers); i++)
-        ippSetString(request, &attr, i,
-                     strdup (ippGetString (printers, i, NULL)));
-      ippSetString(request, &attr, ippGetCount (printers), strdup (printeruri));
-
+  if (fileobj) {
+#if PY_MAJOR_VERSION >= 3
+    fd = PyObject_AsFileDescriptor(fileobj);
+#else
+    FILE *f = PyFile_AsFile (fileobj);
+    fd = fileno (f);
+#endif
+  }
+
+  if (use_mmap || progress_cb) {
+    mapped_file_t map;
+    transfer_progress_t progress;
+
+    debugprintf ("-> Connection_putFile(%s, %s/%d) [mapped]\n", resource,
+		 filename ? filename : "(fd)", fd);
+    if (map_file (&map, filename, fd) == -1) {
+      debugprintf ("<- Connection_putFile() (error)\n");
+      if (filename)
+	return PyErr_SetFromErrnoWithFilename (PyExc_RuntimeError, filename);
+      return PyErr_SetFromErrno (PyExc_RuntimeError);
     }
 
-    ippDelete (answer);
+    transfer_progress_init (&progress, self, progress_cb, map.size);
+    Connection_begin_allow_threads (self);
+    status = put_mapped_file (self, resource, &map, &progress);
+    Connection_end_allow_threads (self);
+    unmap_file (&map);
+    if (PyErr_Occurred ()) {
+      debugprintf ("<- Connection_putFile() (callback exception)\n");
+      return NULL;
+    }
+  } else if (filename) {
+    debugprintf ("-> Connection_putFile(%s, %s)\n", resource, filename);
+    debugprintf ("cupsPutFile()\n");
+    Connection_begin_allow_threads (self);
+    status = cupsPutFile (self->http, resource, filename);
+    Connection_end_allow_threads (self);
+  } else {
+    debugprintf ("-> Connection_putFile(%s, %d)\n", resource, fd);
+    debugprintf ("cupsPutFd()\n");
+    Connection_begin_allow_threads (self);
+    status = cupsPutFd (self->http, resource, fd);
+    Connection_end_allow_threads (self);
   }
 
-  // If the class didn't exist, create a new one.
-  if (!ippFindAttribute (request, "member-uris", IPP_TAG_URI))
-    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_URI,
-		  "member-uris", NULL, printeruri);
+  if (status != HTTP_OK && status != HTTP_CREATED) {
+    set_http_error (status);
+    debugprintf ("<- Connection_putFile() (error)\n");
+    return NULL;
+  }
+
+  debugprintf ("<- Connection_putFile() = None\n");
+  Py_RETURN_NONE;
+}
+
+static ipp_t *
+add_modify_printer_request (const char *name)
+{
+  char uri[HTTP_MAX_URI];
+  ipp_t *request = ippNewRequest (CUPS_ADD_MODIFY_PRINTER);
+  construct_uri (uri, sizeof (uri), "ipp://localhost/printers/", name);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, uri);
+  return request;
+}
+
+static ipp_t *
+add_modify_class_request (const char *name)
+{
+  char uri[HTTP_MAX_URI];
+  ipp_t *request = ippNewRequest (CUPS_ADD_MODIFY_CLASS);
+  construct_uri (uri, sizeof (uri), "ipp://localhost/classes/", name);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, uri);
+  return request;
+}
+
+static PyObject *
+Connection_addPrinter (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *nameobj = NULL;
+  char *name = NULL;
+  PyObject *ppdfileobj = NULL;
+  char *ppdfile = NULL;
+  PyObject *ppdnameobj = NULL;
+  char *ppdname = NULL;
+  PyObject *infoobj = NULL;
+  char *info = NULL;
+  PyObject *locationobj = NULL;
+  char *location = NULL;
+  PyObject *deviceobj = NULL;
+  char *device = NULL;
+  PyObject *ppd = NULL;
+  ipp_t *request, *answer;
+  int ppds_specified = 0;
+  static char *kwlist[] = { "name", "filename", "ppdname", "info",
+			    "location", "device", "ppd", NULL };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|OOOOOO", kwlist,
+				    &nameobj, &ppdfileobj, &ppdnameobj,
+				    &infoobj, &locationobj, &deviceobj, &ppd))
+    return NULL;
+
+  if (UTF8_from_PyObj (&name, nameobj) == NULL ||
+      (ppdfileobj && UTF8_from_PyObj (&ppdfile, ppdfileobj) == NULL) ||
+      (ppdnameobj && UTF8_from_PyObj (&ppdname, ppdnameobj) == NULL) ||
+      (infoobj && UTF8_from_PyObj (&info, infoobj) == NULL) ||
+      (locationobj && UTF8_from_PyObj (&location, locationobj) == NULL) ||
+      (deviceobj && UTF8_from_PyObj (&device, deviceobj) == NULL)) {
+    free (name);
+    free (ppdfile);
+    free (ppdname);
+    free (info);
+    free (location);
+    free (device);
+    return NULL;
+  }
+
+  debugprintf ("-> Connection_addPrinter(%s,%s,%s,%s,%s,%s,%s)\n",
+	       name, ppdfile ? ppdfile: "", ppdname ? ppdname: "",
+	       info ? info: "", location ? location: "",
+	       device ? device: "", ppd ? "(PPD object)": "");
+
+  if (ppdfile)
+    ppds_specified++;
+  if (ppdname)
+    ppds_specified++;
+  if (ppd) {
+    if (!PyObject_TypeCheck (ppd, &cups_PPDType)) {
+      PyErr_SetString (PyExc_TypeError, "Expecting cups.PPD");
+      debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
+      free (name);
+      free (ppdfile);
+      free (ppdname);
+      free (info);
+      free (location);
+      free (device);
+      return NULL;
+    }
 
+    ppds_specified++;
+  }
+  if (ppds_specified > 1) {
+    PyErr_SetString (PyExc_RuntimeError,
+		     "Only one PPD may be given");
+    debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
+    free (name);
+    free (ppdfile);
+    free (ppdname);
+    free (info);
+    free (location);
+    free (device);
+    return NULL;
+  }
+
+  if (ppd) {
+    // We've been given a cups.PPD object.  Construct a PPD file.
+    char template[PATH_MAX];
+    int fd;
+    PyObject *args, *result;
+
+    snprintf(template, sizeof (template), "%s/scp-ppd-XXXXXX", _PATH_TMP);
+    ppdfile = strdup(template);
+    fd = mkstemp (ppdfile);
+    if (fd < 0) {
+      debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
+      free (name);
+      free (ppdfile);
+      free (ppdname);
+      free (info);
+      free (location);
+      free (device);
+      return PyErr_SetFromErrno (PyExc_RuntimeError);
+    }
+
+    args = Py_BuildValue ("(i)", fd);
+    result = PPD_writeFd ((PPD *) ppd, args);
+    Py_DECREF (args);
+    close (fd);
+
+    if (result == NULL) {
+      unlink (ppdfile);
+      debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
+      free (name);
+      free (ppdfile);
+      free (ppdname);
+      free (info);
+      free (location);
+      free (device);
+      return NULL;
+    }
+  }
+
+  request = add_modify_printer_request (name);
+  free (name);
+  if (ppdname) {
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		  "ppd-name", NULL, ppdname);
+    free (ppdname);
+  }
+  if (info) {
+    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_TEXT,
+		  "printer-info", NULL, info);
+    free (info);
+  }
+  if (location) {
+    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_TEXT,
+		  "printer-location", NULL, location);
+    free (location);
+  }
+  if (device) {
+    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_URI,
+		  "device-uri", NULL, device);
+    free (device);
+  }
+  if (ppds_specified)
+    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_KEYWORD,
+		  "printer-state-reasons", NULL, "none");
+  
   Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/admin/");
+  if (ppdfile) {
+    answer = cupsDoFileRequest (self->http, request, "/admin/", ppdfile);
+  } else
+    answer = cupsDoRequest (self->http, request, "/admin/");
   Connection_end_allow_threads (self);
+
+  if (ppd) {
+    unlink (ppdfile);
+    free (ppdfile);
+  } else if (ppdfile)
+    free (ppdfile);
+
   if (PyErr_Occurred ()) {
     if (answer)
       ippDelete (answer);
+    debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
     return NULL;
   }
 
@@ -3584,111 +5034,111 @@ Connection_addPrinterToClass (Connection *self, PyObject *args)
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
+
+    debugprintf ("<- Connection_addPrinter() EXCEPTION\n");
     return NULL;
   }
 
   ippDelete (answer);
+  debugprintf ("<- Connection_addPrinter() = None\n");
   Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_deletePrinterFromClass (Connection *self, PyObject *args)
+Connection_setPrinterDevice (Connection *self, PyObject *args)
 {
-  const char *requested_attrs[] = {
-    "member-names",
-    "member-uris"
-  };
-  PyObject *printernameobj;
-  char *printername;
-  PyObject *classnameobj;
-  char *classname;
-  char classuri[HTTP_MAX_URI];
+  PyObject *nameobj;
+  PyObject *device_uriobj;
+  char *name;
+  char *device_uri;
   ipp_t *request, *answer;
-  ipp_attribute_t *printers;
-  int i;
 
-  if (!PyArg_ParseTuple (args, "OO", &printernameobj, &classnameobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&printername, printernameobj) == NULL)
+  if (!PyArg_ParseTuple (args, "OO", &nameobj, &device_uriobj))
     return NULL;
 
-  if (UTF8_from_PyObj (&classname, classnameobj) == NULL) {
-    free (printername);
+  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+    return NULL;
+
+  if (UTF8_from_PyObj (&device_uri, device_uriobj) == NULL) {
+    free (name);
     return NULL;
   }
 
-  // Does the class exist, and is the printer in it?
-  request = ippNewRequest (IPP_GET_PRINTER_ATTRIBUTES);
-  construct_uri (classuri, sizeof (classuri),
-		 "ipp://localhost/classes/", classname);
-  free (classname);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, classuri);
-  ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
-		 "requested-attributes",
-		 sizeof(requested_attrs) / sizeof(requested_attrs[0]),
-		 NULL, requested_attrs);
+  request = add_modify_printer_request (name);
+  free (name);
+  ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_URI,
+		"device-uri", NULL, device_uri);
+  free (device_uri);
   Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/");
+  answer = cupsDoRequest (self->http, request, "/admin/");
   Connection_end_allow_threads (self);
-  if (!answer) {
-    set_ipp_error (cupsLastError (), cupsLastErrorString ());
-    free (printername);
+  if (PyErr_Occurred ()) {
+    if (answer)
+      ippDelete (answer);
     return NULL;
   }
 
-  printers = ippFindAttribute (answer, "member-names", IPP_TAG_NAME);
-  for (i = 0; printers && i < ippGetCount (printers); i++)
-    if (!strcasecmp (ippGetString (printers, i, NULL), printername))
-      break;
-
-  free (printername);
-  if (!printers || i == ippGetCount (printers)) {
-    ippDelete (answer);
-    PyErr_SetString (PyExc_RuntimeError, "Printer not in class");
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
     return NULL;
   }
 
-  printers = ippFindAttribute (answer, "member-uris", IPP_TAG_URI);
-  if (!printers || i >= ippGetCount (printers)) {
-    ippDelete (answer);
-    PyErr_SetString (PyExc_RuntimeError, "No member URIs returned");
+  ippDelete (answer);
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+Connection_setPrinterInfo (Connection *self, PyObject *args)
+{
+  PyObject *nameobj;
+  PyObject *infoobj;
+  char *name;
+  char *info;
+  ipp_t *request, *answer;
+  int i;
+
+  if (Connection_check_idle (self) < 0)
     return NULL;
-  }
 
-  request = ippNewRequest (CUPS_ADD_CLASS);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, classuri);
+  if (!PyArg_ParseTuple (args, "OO", &nameobj, &infoobj))
+    return NULL;
 
-  // Only printer in class?  Delete the class.
-  if (ippGetCount (printers) == 1)
-    ippSetOperation (request, CUPS_DELETE_CLASS);
-  else {
-    // Trim the printer from the list.
-    ipp_attribute_t *newlist;
-    int j;
-    newlist = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_URI,
-			     "member-uris", ippGetCount (printers) - 1,
-			     NULL, NULL);
-    for (j = 0; j < i; j++)
-      ippSetString(request, &newlist, j,
-                   strdup (ippGetString (printers, j, NULL)));
-    for (j = i; j < ippGetCount(newlist); j++)
-      ippSetString(request, &newlist, j,
-                   strdup (ippGetString (printers, j+1, NULL)));
+  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+    return NULL;
+
+  if (UTF8_from_PyObj (&info, infoobj) == NULL) {
+    free (name);
+    return NULL;
   }
 
-  ippDelete (answer);
-  Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/admin/");
-  Connection_end_allow_threads (self);
-  if (PyErr_Occurred ()) {
-    if (answer)
+  request = add_modify_printer_request (name);
+  for (i = 0; i < 2; i++) {
+    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_TEXT,
+		  "printer-info", NULL, info);
+    Connection_begin_allow_threads (self);
+    answer = cupsDoRequest (self->http, request, "/admin/");
+    Connection_end_allow_threads (self);
+    if (PyErr_Occurred ()) {
+      if (answer)
+	ippDelete (answer);
+      return NULL;
+    }
+
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      // Perhaps it's a class, not a printer.
       ippDelete (answer);
-    return NULL;
+      request = add_modify_class_request (name);
+    } else break;
   }
 
+  free (name);
+  free (info);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
@@ -3702,28 +5152,51 @@ Connection_deletePrinterFromClass (Connection *self, PyObject *args)
 }
 
 static PyObject *
-Connection_deleteClass (Connection *self, PyObject *args)
+Connection_setPrinterLocation (Connection *self, PyObject *args)
 {
-  PyObject *classnameobj;
-  char *classname;
-  char classuri[HTTP_MAX_URI];
+  PyObject *nameobj;
+  PyObject *locationobj;
+  char *name;
+  char *location;
   ipp_t *request, *answer;
+  int i;
 
-  if (!PyArg_ParseTuple (args, "O", &classnameobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&classname, classnameobj) == NULL)
+  if (!PyArg_ParseTuple (args, "OO", &nameobj, &locationobj))
     return NULL;
 
-  request = ippNewRequest (CUPS_DELETE_CLASS);
-  construct_uri (classuri, sizeof (classuri),
-		 "ipp://localhost/classes/", classname);
-  free (classname);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, classuri);
-  Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/admin/");
-  Connection_end_allow_threads (self);
+  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+    return NULL;
+
+  if (UTF8_from_PyObj (&location, locationobj) == NULL) {
+    free (name);
+    return NULL;
+  }
+
+  request = add_modify_printer_request (name);
+  for (i = 0; i < 2; i++) {
+    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_TEXT,
+		  "printer-location", NULL, location);
+    Connection_begin_allow_threads (self);
+    answer = cupsDoRequest (self->http, request, "/admin/");
+    Connection_end_allow_threads (self);
+    if (PyErr_Occurred ()) {
+      if (answer)
+	ippDelete (answer);
+      return NULL;
+    }
+
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      // Perhaps it's a class, not a printer.
+      ippDelete (answer);
+      request = add_modify_class_request (name);
+    } else break;
+  }
+
+  free (name);
+  free (location);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
@@ -3737,315 +5210,432 @@ Connection_deleteClass (Connection *self, PyObject *args)
 }
 
 static PyObject *
-Connection_enablePrinter (Connection *self, PyObject *args, PyObject *kwds)
+Connection_setPrinterShared (Connection *self, PyObject *args)
 {
-  return do_printer_request (self, args, kwds, IPP_RESUME_PRINTER);
-}
+  PyObject *nameobj;
+  char *name;
+  int sharing;
+  ipp_t *request, *answer;
+  int i;
 
-static PyObject *
-Connection_disablePrinter (Connection *self, PyObject *args, PyObject *kwds)
-{
-  return do_printer_request (self, args, kwds, IPP_PAUSE_PRINTER);
-}
+  if (Connection_check_idle (self) < 0)
+    return NULL;
 
-static PyObject *
-Connection_acceptJobs (Connection *self, PyObject *args, PyObject *kwds)
-{
-  return do_printer_request (self, args, kwds, CUPS_ACCEPT_JOBS);
-}
+  if (!PyArg_ParseTuple (args, "Oi", &nameobj, &sharing))
+    return NULL;
 
-static PyObject *
-Connection_rejectJobs (Connection *self, PyObject *args, PyObject *kwds)
-{
-  return do_printer_request (self, args, kwds, CUPS_REJECT_JOBS);
-}
+  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+    return NULL;
 
-static PyObject *
-Connection_getDefault (Connection *self, PyObject *args)
-{
-  const char *def;
-  PyObject *ret;
-  debugprintf ("-> Connection_getDefault()\n");
-  Connection_begin_allow_threads (self);
-  def = cupsGetDefault2 (self->http);
-  Connection_end_allow_threads (self);
-  if (def == NULL) {
-    debugprintf ("<- Connection_getDefault() = None\n");
-    Py_RETURN_NONE;
-  } else {
-    debugprintf ("<- Connection_getDefault() = \"%s\"\n", def);
-    ret = PyUnicode_FromString (def);
+  request = add_modify_printer_request (name);
+  for (i = 0; i < 2; i++) {
+    ippAddBoolean (request, IPP_TAG_OPERATION, "printer-is-shared", sharing);
+    Connection_begin_allow_threads (self);
+    answer = cupsDoRequest (self->http, request, "/admin/");
+    Connection_end_allow_threads (self);
+    if (PyErr_Occurred ()) {
+      if (answer)
+	ippDelete (answer);
+      return NULL;
+    }
+
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      // Perhaps it's a class, not a printer.
+      ippDelete (answer);
+      request = add_modify_class_request (name);
+    } else break;
   }
 
-  return ret;
-}
+  free (name);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    return NULL;
+  }
 
-static PyObject *
-Connection_setDefault (Connection *self, PyObject *args, PyObject *kwds)
-{
-  return do_printer_request (self, args, kwds, CUPS_SET_DEFAULT);
+  ippDelete (answer);
+  Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_getPPD (Connection *self, PyObject *args)
+Connection_setPrinterJobSheets (Connection *self, PyObject *args)
 {
-  PyObject *ret;
-  PyObject *printerobj;
-  char *printer;
-  const char *ppdfile;
+  PyObject *nameobj;
+  PyObject *startobj;
+  PyObject *endobj;
+  char *name;
+  char *start;
+  char *end;
+  ipp_t *request, *answer;
+  ipp_attribute_t *a;
+  int i;
 
-  if (!PyArg_ParseTuple (args, "O", &printerobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&printer, printerobj) == NULL)
+  if (!PyArg_ParseTuple (args, "OOO", &nameobj, &startobj, &endobj))
     return NULL;
 
-  debugprintf ("-> Connection_getPPD()\n");
-  Connection_begin_allow_threads (self);
-  ppdfile = cupsGetPPD2 (self->http, printer);
-  Connection_end_allow_threads (self);
-  free (printer);
-  if (!ppdfile) {
-    ipp_status_t err = cupsLastError ();
-    if (err)
-      set_ipp_error (err, cupsLastErrorString ());
-    else
-      PyErr_SetString (PyExc_RuntimeError, "cupsGetPPD2 failed");
+  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+    return NULL;
 
-    debugprintf ("<- Connection_getPPD() (error)\n");
+  if (UTF8_from_PyObj (&start, startobj) == NULL) {
+    free (name);
     return NULL;
   }
 
-  ret = PyUnicode_FromString (ppdfile);
-  debugprintf ("<- Connection_getPPD() = %s\n", ppdfile);
-  return ret;
+  if (UTF8_from_PyObj (&end, endobj) == NULL) {
+    free (name);
+    free (start);
+    return NULL;
+  }
+
+  request = add_modify_printer_request (name);
+  for (i = 0; i < 2; i++) {
+    a = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
+		       "job-sheets-default", 2, NULL, NULL);
+    ippSetString(request, &a, 0, strdup (start));
+    ippSetString(request, &a, 1, strdup (end));
+    Connection_begin_allow_threads (self);
+    answer = cupsDoRequest (self->http, request, "/admin/");
+    Connection_end_allow_threads (self);
+    if (PyErr_Occurred ()) {
+      if (answer)
+	ippDelete (answer);
+      return NULL;
+    }
+
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      ippDelete (answer);
+      // Perhaps it's a class, not a printer.
+      request = add_modify_class_request (name);
+    } else break;
+  }
+
+  free (name);
+  free (start);
+  free (end);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    return NULL;
+  }
+
+  ippDelete (answer);
+  Py_RETURN_NONE;
 }
 
-#ifdef HAVE_CUPS_1_4
 static PyObject *
-Connection_getPPD3 (Connection *self, PyObject *args, PyObject *kwds)
+Connection_setPrinterErrorPolicy (Connection *self, PyObject *args)
 {
-  PyObject *ret, *obj;
-  PyObject *printerobj;
-  PyObject *fmodtime = NULL;
-  char *printer;
-  time_t modtime;
-  PyObject *filenameobj = NULL;
-  char *filename = NULL;
-  char fname[PATH_MAX];
-  http_status_t status;
-  static char *kwlist[] = { "name", "modtime", "filename", NULL };
+  PyObject *nameobj;
+  char *name;
+  PyObject *policyobj;
+  char *policy;
+  ipp_t *request, *answer;
+  int i;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|OO", kwlist,
-				    &printerobj, &fmodtime, &filenameobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&printer, printerobj) == NULL)
+  if (!PyArg_ParseTuple (args, "OO", &nameobj, &policyobj))
     return NULL;
 
-  if (fmodtime) {
-    double d = PyFloat_AsDouble (fmodtime);
-    if (PyErr_Occurred()) {
-      free (printer);
-      return NULL;
-    }
+  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+    return NULL;
 
-    modtime = (time_t) d;
-  } else
-    modtime = 0;
+  if (UTF8_from_PyObj (&policy, policyobj) == NULL) {
+    free (name);
+    return NULL;
+  }
 
-  if (filenameobj)
-    if (UTF8_from_PyObj (&filename, filenameobj) == NULL) {
-      free (printer);
-      return NULL;
-    }
-  if (filename) {
-    if (strlen (filename) > sizeof (fname)) {
-      PyErr_SetString (PyExc_TypeError, "overlength filename");
-      free (printer);
-      free (filename);
+  request = add_modify_printer_request (name);
+  for (i = 0; i < 2; i++) {
+    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
+		  "printer-error-policy", NULL, policy);
+    Connection_begin_allow_threads (self);
+    answer = cupsDoRequest (self->http, request, "/admin/");
+    Connection_end_allow_threads (self);
+    if (PyErr_Occurred ()) {
+      if (answer)
+	ippDelete (answer);
       return NULL;
     }
-    strcpy (fname, filename);
-  } else
-    fname[0] = '\0';
-
-  debugprintf ("-> Connection_getPPD3()\n");
-  Connection_begin_allow_threads (self);
-  status = cupsGetPPD3 (self->http, printer, &modtime,
-			fname, sizeof (fname));
-  Connection_end_allow_threads (self);
 
-  free (printer);
-  free (filename);
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      ippDelete (answer);
+      // Perhaps it's a class, not a printer.
+      request = add_modify_class_request (name);
+    } else break;
+  }
 
-  ret = PyTuple_New (3);
-  if (!ret)
+  free (name);
+  free (policy);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
     return NULL;
+  }
 
-#if PY_MAJOR_VERSION >= 3
-  obj = PyLong_FromLong ((long) status);
-#else
-  obj = PyInt_FromLong ((long) status);
-#endif
+  ippDelete (answer);
+  Py_RETURN_NONE;
+}
 
-  if (!obj) {
-    Py_DECREF (ret);
+static PyObject *
+Connection_setPrinterOpPolicy (Connection *self, PyObject *args)
+{
+  PyObject *nameobj;
+  char *name;
+  PyObject *policyobj;
+  char *policy;
+  ipp_t *request, *answer;
+  int i;
+
+  if (Connection_check_idle (self) < 0)
     return NULL;
-  }
 
-  PyTuple_SetItem (ret, 0, obj);
+  if (!PyArg_ParseTuple (args, "OO", &nameobj, &policyobj))
+    return NULL;
 
-  obj = PyFloat_FromDouble ((double) modtime);
-  if (!obj) {
-    Py_DECREF (ret);
+  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+    return NULL;
+
+  if (UTF8_from_PyObj (&policy, policyobj) == NULL) {
+    free (name);
     return NULL;
   }
 
-  PyTuple_SetItem (ret, 1, obj);
+  request = add_modify_printer_request (name);
+  for (i = 0; i < 2; i++) {
+    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
+		  "printer-op-policy", NULL, policy);
+    Connection_begin_allow_threads (self);
+    answer = cupsDoRequest (self->http, request, "/admin/");
+    Connection_end_allow_threads (self);
+    if (PyErr_Occurred ()) {
+      if (answer)
+	ippDelete (answer);
+      return NULL;
+    }
 
-  obj = PyUnicode_FromString (fname);
-  if (!obj) {
-    Py_DECREF (ret);
-    return NULL;
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      ippDelete (answer);
+      // Perhaps it's a class, not a printer.
+      request = add_modify_class_request (name);
+    } else break;
   }
 
-  PyTuple_SetItem (ret, 2, obj);
+  free (name);
+  free (policy);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    return NULL;
+  }
 
-  debugprintf ("<- Connection_getPPD3() = (%d,%ld,%s)\n",
-	       status, modtime, fname);
-  return ret;
+  ippDelete (answer);
+  Py_RETURN_NONE;
 }
-#endif /* HAVE_CUPS_1_4 */
 
 static PyObject *
-Connection_printTestPage (Connection *self, PyObject *args, PyObject *kwds)
+do_requesting_user_names (Connection *self, PyObject *args,
+			  const char *requeststr)
 {
-  PyObject *printerobj;
-  char *printer;
-  PyObject *fileobj = NULL;
-  char *file = NULL;
-  PyObject *titleobj = NULL;
-  char *title = NULL;
-  PyObject *formatobj = NULL;
-  char *format = NULL;
-  PyObject *userobj = NULL;
-  char *user = NULL;
-  const char *datadir;
-  char filename[PATH_MAX];
-  char uri[HTTP_MAX_URI];
+  PyObject *nameobj;
+  char *name;
+  char *tmp;
+  PyObject *users;
+  int num_users, i, j;
   ipp_t *request, *answer;
   ipp_attribute_t *attr;
-  char *resource;
-  int jobid = 0;
-  int i;
-  static char *kwlist[] = { "name", "file", "title", "format", "user", NULL };
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|OOOO", kwlist,
-				    &printerobj, &fileobj, &titleobj,
-				    &formatobj, &userobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&printer, printerobj) == NULL)
+  if (!PyArg_ParseTuple (args, "OO", &nameobj, &users))
     return NULL;
 
-  if ((fileobj && UTF8_from_PyObj (&file, fileobj) == NULL) ||
-      (titleobj && UTF8_from_PyObj (&title, titleobj) == NULL) ||
-      (formatobj && UTF8_from_PyObj (&format, formatobj) == NULL) ||
-      (userobj && UTF8_from_PyObj (&user, userobj) == NULL)) {
-    free (printer);
-    free (file);
-    free (title);
-    free (format);
-    free (user);
+  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+    return NULL;
+
+  if (!PyList_Check (users)) {
+    PyErr_SetString (PyExc_TypeError, "List required");
     return NULL;
   }
-    
-  if (!fileobj) {
-    const char *testprint[] = { "%s/data/testprint",
-				"%s/data/testprint.ps",
-				NULL };
-    if ((datadir = getenv ("CUPS_DATADIR")) != NULL) {
-      const char **pattern;
-      for (pattern = testprint; *pattern != NULL; pattern++) {
-	snprintf (filename, sizeof (filename), *pattern, datadir);
-	if (access (filename, R_OK) == 0)
-	  break;
-      }
-    } else {
-      const char *const dirs[] = { "/usr/share/cups",
-				   "/usr/local/share/cups",
-				   NULL };
-      int found = 0;
-      int i;
-      for (i = 0; (datadir = dirs[i]) != NULL; i++) {
-	const char **pattern;
-	for (pattern = testprint; *pattern != NULL; pattern++) {
-	  snprintf (filename, sizeof (filename), *pattern, datadir);
-	  if (access (filename, R_OK) == 0) {
-	    found = 1;
-	    break;
+  request = add_modify_printer_request (name);
+  for (i = 0; i < 2; i++) {
+    num_users = PyList_Size (users);
+    if (num_users) {
+      attr = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
+			    requeststr, num_users, NULL, NULL);
+      for (j = 0; j < num_users; j++) {
+	PyObject *username = PyList_GetItem (users, j); // borrowed ref
+	if (!PyUnicode_Check (username) && !PyBytes_Check (username)) {
+	  int k;
+	  PyErr_SetString (PyExc_TypeError, "String required");
+	  for (k = 0; k < j; k++) {
+	    free ((void *)ippGetString (attr, k, NULL));
+	    ippSetString(request, &attr, k, NULL);
 	  }
+	  ippDelete (request);
+	  return NULL;
 	}
-
-	if (found)
-	  break;
+	ippSetString(request, &attr, j, UTF8_from_PyObj (&tmp, username));
+	free(tmp);
       }
-
-      if (datadir == NULL)
-	/* We haven't found the testprint.ps file, so just pick a path
-	 * and try it.  This will certainly fail with
-	 * client-error-not-found, but we'll let that happen rather
-	 * than raising an exception so as to be consistent with the
-	 * case where CUPS_DATADIR is set and we trust it. */
-	snprintf (filename, sizeof (filename), testprint[0], dirs[0]);
+    } else {
+      attr = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
+			    requeststr, 1, NULL, NULL);
+      if (strstr (requeststr, "denied"))
+	ippSetString(request, &attr, 0, strdup ("none"));
+      else
+	ippSetString(request, &attr, 0, strdup ("all"));
+    }
+    Connection_begin_allow_threads (self);
+    answer = cupsDoRequest (self->http, request, "/admin/");
+    Connection_end_allow_threads (self);
+    if (PyErr_Occurred ()) {
+      if (answer)
+	ippDelete (answer);
+      return NULL;
     }
 
-    file = filename;
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      ippDelete (answer);
+      // Perhaps it's a class, not a printer.
+      request = add_modify_class_request (name);
+    } else break;
   }
 
-  if (!titleobj)
-    title = "Test Page";
+  free (name);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    return NULL;
+  }
 
-  if (!userobj)
-	  user = (char *) cupsUser();
+  ippDelete (answer);
+  Py_RETURN_NONE;
+}
 
-  construct_uri (uri, sizeof (uri),
-		 "ipp://localhost/printers/", printer);
-  resource = uri + strlen ("ipp://localhost");
+static PyObject *
+Connection_setPrinterUsersAllowed (Connection *self, PyObject *args)
+{
+  return do_requesting_user_names (self, args, "requesting-user-name-allowed");
+}
+
+static PyObject *
+Connection_setPrinterUsersDenied (Connection *self, PyObject *args)
+{
+  return do_requesting_user_names (self, args, "requesting-user-name-denied");
+}
+
+static char *
+PyObject_to_string (PyObject *pyvalue)
+{
+  char string[BUFSIZ];
+  char *value = "{unknown type}";
+
+  if (PyUnicode_Check (pyvalue) || PyBytes_Check (pyvalue)) {
+    UTF8_from_PyObj (&value, pyvalue);
+  } else if (PyBool_Check (pyvalue)) {
+    value = (pyvalue == Py_True) ? "true" : "false";
+  } else if (PyLong_Check (pyvalue)) {
+    long v = PyLong_AsLong (pyvalue);
+    snprintf (string, sizeof (string), "%ld", v);
+    value = string;
+#if PY_MAJOR_VERSION < 3
+  } else if (PyInt_Check (pyvalue)) {
+    long v = PyInt_AsLong (pyvalue);
+    snprintf (string, sizeof (string), "%ld", v);
+    value = string;
+#endif
+  } else if (PyFloat_Check (pyvalue)) {
+    double v = PyFloat_AsDouble (pyvalue);
+    snprintf (string, sizeof (string), "%f", v);
+    value = string;
+  }
+
+  return strdup (value);
+}
+
+static PyObject *
+Connection_addPrinterOptionDefault (Connection *self, PyObject *args)
+{
+  PyObject *nameobj;
+  char *name;
+  PyObject *optionobj;
+  char *option;
+  PyObject *pyvalue;
+  const char const suffix[] = "-default";
+  char *opt;
+  ipp_t *request, *answer;
+  int i;
+  size_t optionlen;
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTuple (args, "OOO", &nameobj, &optionobj, &pyvalue))
+    return NULL;
+
+  if (UTF8_from_PyObj (&name, nameobj) == NULL)
+    return NULL;
+
+  if (UTF8_from_PyObj (&option, optionobj) == NULL) {
+    free (name);
+    return NULL;
+  }
+
+  optionlen = strlen (option);
+  opt = malloc (optionlen + sizeof (suffix) + 1);
+  memcpy (opt, option, optionlen);
+  strcpy (opt + optionlen, suffix);
+  request = add_modify_printer_request (name);
   for (i = 0; i < 2; i++) {
-    request = ippNewRequest (IPP_PRINT_JOB);
-    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri",
-		  NULL, uri);
-    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		  "requesting-user-name", NULL, user);
-    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name",
-		  NULL, title);
-    if (format)
-      ippAddString (request, IPP_TAG_JOB, IPP_TAG_MIMETYPE, "document-format",
-		    NULL, format);
+    if (!PyUnicode_Check (pyvalue) && !PyBytes_Check (pyvalue) &&
+	PySequence_Check (pyvalue)) {
+      ipp_attribute_t *attr;
+      int len = PySequence_Size (pyvalue);
+      int j;
+      attr = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
+			    opt, len, NULL, NULL);
+      for (j = 0; j < len; j++) {
+	PyObject *each = PySequence_GetItem (pyvalue, j);
+	ippSetString(request, &attr, j, PyObject_to_string (each));
+      }
+    } else
+      ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_NAME,
+		    opt, NULL, PyObject_to_string (pyvalue));
 
     Connection_begin_allow_threads (self);
-    answer = cupsDoFileRequest (self->http, request, resource, file);
+    answer = cupsDoRequest (self->http, request, "/admin/");
     Connection_end_allow_threads (self);
+    if (PyErr_Occurred ()) {
+      if (answer)
+	ippDelete (answer);
+      return NULL;
+    }
+
     if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
       ippDelete (answer);
       // Perhaps it's a class, not a printer.
-      construct_uri (uri, sizeof (uri),
-		     "ipp://localhost/classes/", printer);
+      request = add_modify_class_request (name);
     } else break;
   }
 
-  free (printer);
-  if (fileobj)
-    free (file);
-  if (titleobj)
-    free (title);
-  if (formatobj)
-    free (format);
-  if (userobj)
-    free (user);
-
+  free (name);
+  free (option);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
@@ -4054,1774 +5644,6936 @@ Connection_printTestPage (Connection *self, PyObject *args, PyObject *kwds)
     return NULL;
   }
 
-  attr = ippFindAttribute (answer, "job-id", IPP_TAG_INTEGER);
-  if (attr)
-    jobid = ippGetInteger (attr, 0);
-
   ippDelete (answer);
-  return Py_BuildValue ("i", jobid);
+  Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_adminExportSamba (Connection *self, PyObject *args)
+Connection_deletePrinterOptionDefault (Connection *self, PyObject *args)
 {
-  int ret;
   PyObject *nameobj;
   char *name;
-  PyObject *serverobj;
-  char *server;
-  PyObject *userobj;
-  char  *user;
-  PyObject *passwordobj;
-  char *password;
-  char ppdfile[1024];
-  FILE *tmpfile(void);
-  FILE *tf;
-  char str[80];
+  PyObject *optionobj;
+  char *option;
+  const char const suffix[] = "-default";
+  char *opt;
+  ipp_t *request, *answer;
+  int i;
+  size_t optionlen;
 
-  if (!PyArg_ParseTuple (args, "OOOO", &nameobj, &serverobj, &userobj,
-                         &passwordobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&name, nameobj) == NULL ||
-      UTF8_from_PyObj (&server, serverobj) == NULL ||
-      UTF8_from_PyObj (&user, userobj) == NULL ||
-      UTF8_from_PyObj (&password, passwordobj) == NULL) {
-    free (name);
-    free (server);
-    free (user);
-    free (password);
-    PyErr_SetString(PyExc_RuntimeError,
-                    "name, samba_server, samba_username, samba_password "
-                    "must be specified");
+  if (!PyArg_ParseTuple (args, "OO", &nameobj, &optionobj))
     return NULL;
-  }
 
-  if (!cupsAdminCreateWindowsPPD(self->http, name, ppdfile, sizeof(ppdfile))) {
-    PyErr_SetString(PyExc_RuntimeError,
-                    "No PPD file found for the printer");
+  if (UTF8_from_PyObj (&name, nameobj) == NULL)
     return NULL;
-  }
 
-  debugprintf ("-> Connection_adminExportSamba()\n");
-  tf = tmpfile();
-  Connection_begin_allow_threads (self);
-  ret = cupsAdminExportSamba(name, ppdfile, server, user, password, tf);
-  Connection_end_allow_threads (self);
-
-  free (name);
-  free (server);
-  free (user);
-  free (password);
-  unlink (ppdfile);
-
-  if (!ret) {
-    rewind(tf);
-    // Read logfile line by line to get Exit status message on the last line.
-    while (fgets (str, sizeof(str), tf) != NULL) { }
-    fclose (tf);
-    if (str[strlen(str) -1] == '\n') {
-      str[strlen(str) -1] = '\0';
-    }
-    PyErr_SetString (PyExc_RuntimeError, str);
-    debugprintf ("<- Connection_adminExportSamba() EXCEPTION\n");
-    return NULL;
-  }
-  fclose (tf);
-  debugprintf ("<- Connection_adminExportSamba()\n");
-  Py_RETURN_NONE;
-}
-
-static PyObject *
-Connection_adminGetServerSettings (Connection *self)
-{
-  PyObject *ret = PyDict_New ();
-  int num_settings, i;
-  cups_option_t *settings;
-  debugprintf ("-> Connection_adminGetServerSettings()\n");
-  Connection_begin_allow_threads (self);
-  cupsAdminGetServerSettings (self->http, &num_settings, &settings);
-  Connection_end_allow_threads (self);
-  for (i = 0; i < num_settings; i++) {
-    PyObject *string = PyUnicode_FromString (settings[i].value);
-    PyDict_SetItemString (ret, settings[i].name, string);
-    Py_DECREF (string);
-  }
-
-  cupsFreeOptions (num_settings, settings);
-  debugprintf ("<- Connection_adminGetServerSettings()\n");
-  return ret;
-}
-
-static PyObject *
-Connection_adminSetServerSettings (Connection *self, PyObject *args)
-{
-  PyObject *dict, *key, *val;
-  int ret;
-  int num_settings = 0;
-  DICT_POS_TYPE pos = 0;
-  cups_option_t *settings = NULL;
-  if (!PyArg_ParseTuple (args, "O", &dict))
-    return NULL;
-  if (!PyDict_Check (dict)) {
-    PyErr_SetString (PyExc_TypeError, "Expecting dict");
+  if (UTF8_from_PyObj (&option, optionobj) == NULL) {
+    free (name);
     return NULL;
   }
 
-  debugprintf ("-> Connection_adminSetServerSettings()\n");
-  while (PyDict_Next (dict, &pos, &key, &val)) {
-    char *name, *value;
-    if ((!PyUnicode_Check (key) && !PyBytes_Check (key)) ||
-        (!PyUnicode_Check (val) && !PyBytes_Check (val))) {
-      cupsFreeOptions (num_settings, settings);
-      PyErr_SetString (PyExc_TypeError, "Keys and values must be strings");
-      debugprintf ("<- Connection_adminSetServerSettings() EXCEPTION\n");
+  optionlen = strlen (option);
+  opt = malloc (optionlen + sizeof (suffix) + 1);
+  memcpy (opt, option, optionlen);
+  strcpy (opt + optionlen, suffix);
+  request = add_modify_printer_request (name);
+  for (i = 0; i < 2; i++) {
+    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_DELETEATTR,
+		  opt, NULL, NULL);
+    Connection_begin_allow_threads (self);
+    answer = cupsDoRequest (self->http, request, "/admin/");
+    Connection_end_allow_threads (self);
+    if (PyErr_Occurred ()) {
+      if (answer)
+	ippDelete (answer);
       return NULL;
     }
 
-    UTF8_from_PyObj (&name, key);
-    UTF8_from_PyObj (&value, val);
-    debugprintf ("%s: %s\n", name, value);
-    num_settings = cupsAddOption (name,
-				  value,
-				  num_settings,
-				  &settings);
-    free (name);
-    free (value);
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      ippDelete (answer);
+      // Perhaps it's a class, not a printer.
+      request = add_modify_class_request (name);
+    } else break;
   }
 
-  debugprintf ("num_settings=%d, settings=%p\n", num_settings, settings);
-  Connection_begin_allow_threads (self);
-  ret = cupsAdminSetServerSettings (self->http, num_settings, settings);
-  Connection_end_allow_threads (self);
-  if (!ret) {
-    cupsFreeOptions (num_settings, settings);
-    PyErr_SetString (PyExc_RuntimeError, "Failed to set settings");
-    debugprintf ("<- Connection_adminSetServerSettings() EXCEPTION\n");
+  free (name);
+  free (option);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
     return NULL;
   }
 
-  cupsFreeOptions (num_settings, settings);
-  debugprintf ("<- Connection_adminSetServerSettings()\n");
+  ippDelete (answer);
   Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_getSubscriptions (Connection *self, PyObject *args, PyObject *kwds)
+Connection_deletePrinter (Connection *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *uriobj;
+  return do_printer_request (self, args, kwds, CUPS_DELETE_PRINTER);
+}
+
+static PyObject *
+do_getPrinterAttributes (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *ret;
+  PyObject *nameobj = NULL;
+  char *name;
+  PyObject *uriobj = NULL;
   char *uri;
-  PyObject *my_subscriptions = Py_False;
-  int job_id = -1;
+  PyObject *requested_attrs = NULL;
+  char **attrs = NULL; /* initialised to calm compiler */
+  size_t n_attrs = 0; /* initialised to calm compiler */
   ipp_t *request, *answer;
   ipp_attribute_t *attr;
-  PyObject *result, *subscription;
-  static char *kwlist[] = { "uri", "my_subscriptions", "job_id", NULL };
+  char consuri[HTTP_MAX_URI];
+  int i;
+  static char *kwlist[] = { "name", "uri", "requested_attributes", NULL };
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|Oi", kwlist,
-				    &uriobj, &my_subscriptions, &job_id))
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|OOO", kwlist,
+				    &nameobj, &uriobj, &requested_attrs))
     return NULL;
 
-  if (UTF8_from_PyObj (&uri, uriobj) == NULL)
+  if (nameobj && uriobj) {
+    PyErr_SetString (PyExc_RuntimeError,
+		     "name or uri must be specified but not both");
     return NULL;
+  }
 
-  if (my_subscriptions && !PyBool_Check (my_subscriptions)) {
-    PyErr_SetString (PyExc_TypeError, "my_subscriptions must be a bool");
+  if (nameobj) {
+    if (UTF8_from_PyObj (&name, nameobj) == NULL)
+      return NULL;
+  } else if (uriobj) {
+    if (UTF8_from_PyObj (&uri, uriobj) == NULL)
+      return NULL;
+  } else {
+    PyErr_SetString (PyExc_RuntimeError,
+		     "name or uri must be specified");
     return NULL;
   }
 
-  debugprintf ("-> Connection_getSubscriptions()\n");
-  request = ippNewRequest (IPP_GET_SUBSCRIPTIONS);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, uri);
-  free (uri);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		"requesting-user-name", NULL, cupsUser ());
+  if (requested_attrs) {
+    if (get_requested_attrs (requested_attrs, &n_attrs, &attrs) == -1) {
+      if (nameobj)
+	free (name);
+      else if (uriobj)
+	free (uri);
+      return NULL;
+    }
+  }
 
-  if (my_subscriptions == Py_True)
-    ippAddBoolean (request, IPP_TAG_OPERATION, "my-subscriptions", 1);
+  debugprintf ("-> Connection_getPrinterAttributes(%s)\n",
+	       nameobj ? name : uri);
 
-  if (job_id != -1)
-    ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-		   "job-id", job_id);
+  if (nameobj) {
+    construct_uri (consuri, sizeof (consuri),
+		   "ipp://localhost/printers/", name);
+    uri = consuri;
+  }
+
+  for (i = 0; i < 2; i++) {
+    request = ippNewRequest (IPP_GET_PRINTER_ATTRIBUTES);
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		  "printer-uri", NULL, uri);
+    if (requested_attrs)
+      ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		     "requested-attributes", n_attrs, NULL,
+		     (const char **) attrs);
+    debugprintf ("trying request with uri %s\n", uri);
+    Connection_begin_allow_threads (self);
+    answer = Connection_do_request (self, request, "/", 1);
+    Connection_end_allow_threads (self);
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      ippDelete (answer);
+      if (uriobj)
+	break;
+
+      // Perhaps it's a class, not a printer.
+      construct_uri (consuri, sizeof (consuri),
+		     "ipp://localhost/classes/", name);
+    } else break;
+  }
+
+  if (nameobj)
+    free (name);
+
+  if (uriobj)
+    free (uri);
+
+  if (requested_attrs)
+    free_requested_attrs (n_attrs, attrs);
 
-  Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/");
-  Connection_end_allow_threads (self);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
-    debugprintf ("<- Connection_getSubscriptions() EXCEPTION\n");
+
+    debugprintf ("<- Connection_getPrinterAttributes() (error)\n");
     return NULL;
   }
 
-  result = PyList_New (0);
-  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer))
-    if (ippGetGroupTag (attr) == IPP_TAG_SUBSCRIPTION)
-      break;
-
-  subscription = NULL;
-  for (; attr; attr = ippNextAttribute (answer)) {
-    PyObject *obj;
-    if (ippGetGroupTag (attr) == IPP_TAG_ZERO) {
-      // End of subscription.
-      if (subscription) {
-	PyList_Append (result, subscription);
-	Py_DECREF (subscription);
-      }
-
-      subscription = NULL;
-      continue;
-    }
+  ret = PyDict_New ();
+  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer)) {
+    while (attr && ippGetGroupTag (attr) != IPP_TAG_PRINTER)
+      attr = ippNextAttribute (answer);
 
-    if (ippGetCount (attr) > 1 || !strcmp (ippGetName (attr), "notify-events"))
-      obj = PyList_from_attr_values (attr);
-    else
-      obj = PyObject_from_attr_value (attr, 0);
+    if (!attr)
+      break;
 
-    if (!obj)
-      // Can't represent this.
-      continue;
+    for (; attr && ippGetGroupTag (attr) == IPP_TAG_PRINTER;
+	 attr = ippNextAttribute (answer)) {
+      const char *attrname = ippGetName (attr);
+      size_t namelen = strlen (attrname);
+      const attr_info_t *info;
+      PyObject *val = NULL;
 
-    if (!subscription)
-      subscription = PyDict_New ();
+      debugprintf ("Attribute: %s\n", attrname);
 
-    PyDict_SetItemString (subscription, ippGetName (attr), obj);
-    Py_DECREF (obj);
-  }
+      // Check for '-supported' suffix.  Any xxx-supported attribute
+      // that is a text type must be a list.  Other attributes known
+      // to allow multiple values are flagged ATTR_MULTIVALUE.
+      if ((namelen > 10 &&
+	   !strcmp (attrname + namelen - 10, "-supported")) ||
+	  ((info = lookup_attr_info (attrname)) != NULL &&
+	   (info->flags & ATTR_MULTIVALUE))) {
+	switch (ippGetValueTag (attr)) {
+	case IPP_TAG_NAME:
+	case IPP_TAG_TEXT:
+	case IPP_TAG_KEYWORD:
+	case IPP_TAG_URI:
+	case IPP_TAG_CHARSET:
+	case IPP_TAG_MIMETYPE:
+	case IPP_TAG_LANGUAGE:
+	case IPP_TAG_ENUM:
+	case IPP_TAG_INTEGER:
+	case IPP_TAG_RESOLUTION:
+	  val = PyList_from_attr_values (attr);
+	  break;
 
-  if (subscription) {
-    PyList_Append (result, subscription);
-    Py_DECREF (subscription);
+	default:
+	  break;
+	}
+      }
+
+      if (!val)
+	val = PyObject_from_attr (attr, lookup_attr_info (attrname),
+				  ATTR_CTX_PRINTER_ATTRS);
+
+      set_attr_item (ret, attr, val);
+      Py_DECREF (val);
+    }
+
+    if (!attr)
+      break;
   }
 
   ippDelete (answer);
-  debugprintf ("<- Connection_getSubscriptions()\n");
-  return result;
+  debugprintf ("<- Connection_getPrinterAttributes() = dict\n");
+  return ret;
 }
 
 static PyObject *
-Connection_createSubscription (Connection *self, PyObject *args,
-			       PyObject *kwds)
+Connection_getPrinterAttributes (Connection *self, PyObject *args,
+				 PyObject *kwds)
 {
-  PyObject *resource_uriobj;
-  char *resource_uri;
-  PyObject *events = NULL;
-  int job_id = -1, lease_duration = -1, time_interval = -1;
-  PyObject *recipient_uriobj = NULL, *user_dataobj = NULL;
-  char *recipient_uri = NULL, *user_data = NULL;
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  Connection_call_begin (self);
+  return Connection_call_end (self, "getPrinterAttributes",
+			      do_getPrinterAttributes (self, args, kwds));
+}
+
+static PyObject *
+Connection_addPrinterToClass (Connection *self, PyObject *args)
+{
+  PyObject *printernameobj;
+  char *printername;
+  PyObject *classnameobj;
+  char *classname;
+  char classuri[HTTP_MAX_URI];
+  char printeruri[HTTP_MAX_URI];
   ipp_t *request, *answer;
-  int i, n = 0;
-  char *tmp;
-  ipp_attribute_t *attr;
-  static char *kwlist[] = { "uri", "events", "job_id", "recipient_uri",
-			    "lease_duration", "time_interval", "user_data",
-			    NULL };
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|OiOiiO", kwlist,
-				    &resource_uriobj, &events, &job_id,
-				    &recipient_uriobj, &lease_duration,
-				    &time_interval, &user_dataobj))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (UTF8_from_PyObj (&resource_uri, resource_uriobj) == NULL)
+  if (!PyArg_ParseTuple (args, "OO", &printernameobj, &classnameobj))
     return NULL;
 
-  if (recipient_uriobj &&
-      UTF8_from_PyObj (&recipient_uri, recipient_uriobj) == NULL) {
-    free (resource_uri);
+  if (UTF8_from_PyObj (&printername, printernameobj) == NULL)
     return NULL;
-  }
 
-  if (user_dataobj && UTF8_from_PyObj (&user_data, user_dataobj) == NULL) {
-    free (resource_uri);
-    if (recipient_uriobj)
-      free (recipient_uri);
+  if (UTF8_from_PyObj (&classname, classnameobj) == NULL) {
+    free (printername);
     return NULL;
   }
 
-  if (events) {
-    if (!PyList_Check (events)) {
-      PyErr_SetString (PyExc_TypeError, "events must be a list");
-      return NULL;
-    }
-
-    n = PyList_Size (events);
-    for (i = 0; i < n; i++) {
-      PyObject *event = PyList_GetItem (events, i);
-      if (!PyUnicode_Check (event) && !PyBytes_Check (event)) {
-	PyErr_SetString (PyExc_TypeError, "events must be a list of strings");
-	return NULL;
+  // Does the class exist, and is the printer already in it?
+  request = ippNewRequest (IPP_GET_PRINTER_ATTRIBUTES);
+  construct_uri (classuri, sizeof (classuri),
+		 "ipp://localhost/classes/", classname);
+	    
+  free (classname);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, classuri);
+  Connection_begin_allow_threads (self);
+  answer = cupsDoRequest (self->http, request, "/");
+  Connection_end_allow_threads (self);
+  if (answer) {
+    ipp_attribute_t *printers;
+    printers = ippFindAttribute (answer, "member-names", IPP_TAG_NAME);
+    if (printers) {
+      int i;
+      for (i = 0; i < ippGetCount (printers); i++) {
+	if (!strcasecmp (ippGetString (printers, i, NULL), printername)) {
+	  ippDelete (answer);
+	  PyErr_SetString (PyExc_RuntimeError, "Printer already in class");
+	  free (printername);
+	  return NULL;
+	}
       }
     }
   }
 
-  debugprintf ("-> Connection_createSubscription(%s)\n", resource_uri);
-  request = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
+  request = ippNewRequest (CUPS_ADD_CLASS);
   ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, resource_uri);
-  ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
-		"notify-pull-method", NULL, "ippget");
-  ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_CHARSET,
-		"notify-charset", NULL, "utf-8");
-  ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_NAME,
-		"requesting-user-name", NULL, cupsUser ());
-
-  if (recipient_uriobj) {
-    ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI,
-		  "notify-recipient-uri", NULL, recipient_uri);
-    free (recipient_uri);
-  }
-
-  if (user_dataobj) {
-    ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_STRING,
-		  "notify-user-data", NULL, user_data);
-    free (user_data);
-  }
+		"printer-uri", NULL, classuri);
+  construct_uri (printeruri, sizeof (printeruri),
+		 "ipp://localhost/printers/", printername);
+  free (printername);
+  if (answer) {
+    ipp_attribute_t *printers;
+    printers = ippFindAttribute (answer, "member-uris", IPP_TAG_URI);
+    if (printers) {
+      ipp_attribute_t *attr;
+      int i;
+      attr = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_URI,
+			    "member-uris", ippGetCount (printers) + 1,
+			    NULL, NULL);
+      for (i = 0; i < ippGetCount (printers); i++)
+        ippSetString(request, &attr, i,
+                     strdup (ippGetString (printers, i, NULL)));
+      ippSetString(request, &attr, ippGetCount (printers), strdup (printeruri));
 
-  if (events) {
-    attr = ippAddStrings (request, IPP_TAG_SUBSCRIPTION,
-			  IPP_TAG_KEYWORD, "notify-events",
-			  n, NULL, NULL);
-    for (i = 0; i < n; i++) {
-      PyObject *event = PyList_GetItem (events, i);
-      ippSetString(request, &attr, i, UTF8_from_PyObj (&tmp, event));
-      free(tmp);
     }
-  }
-
-  if (lease_duration != -1)
-    ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
-		   "notify-lease-duration", lease_duration);
 
-  if (time_interval != -1)
-    ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
-		   "notify-time-interval", time_interval);
+    ippDelete (answer);
+  }
 
-  if (job_id != -1)
-    ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
-		   "notify-job-id", job_id);
+  // If the class didn't exist, create a new one.
+  if (!ippFindAttribute (request, "member-uris", IPP_TAG_URI))
+    ippAddString (request, IPP_TAG_PRINTER, IPP_TAG_URI,
+		  "member-uris", NULL, printeruri);
 
   Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/");
+  answer = cupsDoRequest (self->http, request, "/admin/");
   Connection_end_allow_threads (self);
+  if (PyErr_Occurred ()) {
+    if (answer)
+      ippDelete (answer);
+    return NULL;
+  }
+
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
-    debugprintf ("<- Connection_createSubscription() EXCEPTION\n");
     return NULL;
   }
 
-  i = -1;
-  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer)) {
-    if (ippGetGroupTag (attr) == IPP_TAG_SUBSCRIPTION) {
-      if (ippGetValueTag (attr) == IPP_TAG_INTEGER &&
-	  !strcmp (ippGetName (attr), "notify-subscription-id"))
-	i = ippGetInteger (attr, 0);
-      else if (ippGetValueTag (attr) == IPP_TAG_ENUM &&
-	       !strcmp (ippGetName (attr), "notify-status-code"))
-	debugprintf ("notify-status-code = %d\n", ippGetInteger (attr, 0));
-    }
-  }
-
   ippDelete (answer);
-  debugprintf ("<- Connection_createSubscription() = %d\n", i);
-#if PY_MAJOR_VERSION >= 3
-  return PyLong_FromLong (i);
-#else
-  return PyInt_FromLong (i);
-#endif
+  Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_getNotifications (Connection *self, PyObject *args, PyObject *kwds)
+Connection_deletePrinterFromClass (Connection *self, PyObject *args)
 {
-  PyObject *subscription_ids, *sequence_numbers = NULL;
+  const char *requested_attrs[] = {
+    "member-names",
+    "member-uris"
+  };
+  PyObject *printernameobj;
+  char *printername;
+  PyObject *classnameobj;
+  char *classname;
+  char classuri[HTTP_MAX_URI];
   ipp_t *request, *answer;
-  int i, num_ids, num_seqs = 0;
-  ipp_attribute_t *attr;
-  PyObject *result, *events, *event;
-  static char *kwlist[] = { "subscription_ids", "sequence_numbers", NULL };
+  ipp_attribute_t *printers;
+  int i;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|O", kwlist,
-				    &subscription_ids, &sequence_numbers))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  if (!PyList_Check (subscription_ids)) {
-    PyErr_SetString (PyExc_TypeError, "subscriptions_ids must be a list");
+  if (!PyArg_ParseTuple (args, "OO", &printernameobj, &classnameobj))
     return NULL;
-  }
 
-  num_ids = PyList_Size (subscription_ids);
-  for (i = 0; i < num_ids; i++) {
-    PyObject *id = PyList_GetItem (subscription_ids, i);
-#if PY_MAJOR_VERSION >= 3
-    if (!PyLong_Check (id)) {
-#else
-    if (!PyInt_Check (id)) {
-#endif
-      PyErr_SetString (PyExc_TypeError, "subscription_ids must be a list "
-		       "of integers");
-      return NULL;
-    }
-  }
+  if (UTF8_from_PyObj (&printername, printernameobj) == NULL)
+    return NULL;
 
-  if (sequence_numbers) {
-    if (!PyList_Check (sequence_numbers)) {
-      PyErr_SetString (PyExc_TypeError, "sequence_numbers must be a list");
-      return NULL;
-    }
+  if (UTF8_from_PyObj (&classname, classnameobj) == NULL) {
+    free (printername);
+    return NULL;
+  }
 
-    num_seqs = PyList_Size (sequence_numbers);
-    for (i = 0; i < num_seqs; i++) {
-      PyObject *id = PyList_GetItem (sequence_numbers, i);
-#if PY_MAJOR_VERSION >= 3
-      if (!PyLong_Check (id)) {
-#else
-      if (!PyInt_Check (id)) {
-#endif
-	PyErr_SetString (PyExc_TypeError, "sequence_numbers must be a list "
-			 "of integers");
-	return NULL;
-      }
-    }
-  }
-
-  debugprintf ("-> Connection_getNotifications()\n");
-  request = ippNewRequest (IPP_GET_NOTIFICATIONS);
+  // Does the class exist, and is the printer in it?
+  request = ippNewRequest (IPP_GET_PRINTER_ATTRIBUTES);
+  construct_uri (classuri, sizeof (classuri),
+		 "ipp://localhost/classes/", classname);
+  free (classname);
   ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, "/");
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		"requesting-user-name", NULL, cupsUser ());
-
-  attr = ippAddIntegers (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-			 "notify-subscription-ids", num_ids, NULL);
-  for (i = 0; i < num_ids; i++) {
-    PyObject *id = PyList_GetItem (subscription_ids, i);
-#if PY_MAJOR_VERSION >= 3
-    ippSetInteger (request, &attr, i, PyLong_AsLong (id));
-#else
-    ippSetInteger (request, &attr, i, PyInt_AsLong (id));
-#endif
-  }
-
-  if (sequence_numbers) {
-    attr = ippAddIntegers (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-			   "notify-sequence-numbers", num_seqs, NULL);
-    for (i = 0; i < num_seqs; i++) {
-      PyObject *num = PyList_GetItem (sequence_numbers, i);
-#if PY_MAJOR_VERSION >= 3
-      ippSetInteger (request, &attr, i, PyLong_AsLong (num));
-#else
-      ippSetInteger (request, &attr, i, PyInt_AsLong (num));
-#endif
-    }
-  }
-  
+		"printer-uri", NULL, classuri);
+  ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		 "requested-attributes",
+		 sizeof(requested_attrs) / sizeof(requested_attrs[0]),
+		 NULL, requested_attrs);
   Connection_begin_allow_threads (self);
   answer = cupsDoRequest (self->http, request, "/");
   Connection_end_allow_threads (self);
-  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
-    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
-		   answer ? NULL : cupsLastErrorString ());
-    if (answer)
-      ippDelete (answer);
-    debugprintf ("<- Connection_getNotifications() EXCEPTION\n");
+  if (!answer) {
+    set_ipp_error (cupsLastError (), cupsLastErrorString ());
+    free (printername);
     return NULL;
   }
 
-  result = PyDict_New ();
-
-  // Result-wide attributes.
-  attr = ippFindAttribute (answer, "notify-get-interval", IPP_TAG_INTEGER);
-  if (attr) {
-#if PY_MAJOR_VERSION >= 3
-    PyObject *val = PyLong_FromLong (ippGetInteger (attr, 0));
-#else
-    PyObject *val = PyInt_FromLong (ippGetInteger (attr, 0));
-#endif
-    PyDict_SetItemString (result, ippGetName (attr), val);
-    Py_DECREF (val);
-  }
-
-  attr = ippFindAttribute (answer, "printer-up-time", IPP_TAG_INTEGER);
-  if (attr) {
-#if PY_MAJOR_VERSION >= 3
-    PyObject *val = PyLong_FromLong (ippGetInteger (attr, 0));
-#else
-    PyObject *val = PyInt_FromLong (ippGetInteger (attr, 0));
-#endif
-    PyDict_SetItemString (result, ippGetName (attr), val);
-    Py_DECREF (val);
-  }
-
-  events = PyList_New (0);
-  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer))
-    if (ippGetGroupTag (attr) == IPP_TAG_EVENT_NOTIFICATION)
+  printers = ippFindAttribute (answer, "member-names", IPP_TAG_NAME);
+  for (i = 0; printers && i < ippGetCount (printers); i++)
+    if (!strcasecmp (ippGetString (printers, i, NULL), printername))
       break;
 
-  event = NULL;
-  for (; attr; attr = ippNextAttribute (answer)) {
-    PyObject *obj;
-    if (ippGetGroupTag (attr) == IPP_TAG_ZERO) {
-      // End of event notification.
-      if (event) {
-	PyList_Append (events, event);
-	Py_DECREF (event);
-      }
-
-      event = NULL;
-      continue;
-    }
-
-    if (ippGetCount (attr) > 1 ||
-	!strcmp (ippGetName (attr), "notify-events") ||
-	!strcmp (ippGetName (attr), "printer-state-reasons") ||
-	!strcmp (ippGetName (attr), "job-printer-state-reasons"))
-      obj = PyList_from_attr_values (attr);
-    else
-      obj = PyObject_from_attr_value (attr, 0);
-
-    if (!obj)
-      // Can't represent this.
-      continue;
-
-    if (!event)
-      event = PyDict_New ();
-
-    PyDict_SetItemString (event, ippGetName (attr), obj);
-    Py_DECREF (obj);
-  }
-
-  if (event) {
-    PyList_Append (events, event);
-    Py_DECREF (event);
+  free (printername);
+  if (!printers || i == ippGetCount (printers)) {
+    ippDelete (answer);
+    PyErr_SetString (PyExc_RuntimeError, "Printer not in class");
+    return NULL;
   }
 
-  ippDelete (answer);
-  PyDict_SetItemString (result, "events", events);
-  Py_DECREF (events);
-  debugprintf ("<- Connection_getNotifications()\n");
-  return result;
-}
-
-static PyObject *
-Connection_renewSubscription (Connection *self, PyObject *args, PyObject *kwds)
-{
-  int id;
-  int lease_duration = -1;
-  ipp_t *request, *answer;
-  static char *kwlist[] = { "id", "lease_duration", NULL };
-
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "i|i", kwlist,
-				    &id, &lease_duration))
+  printers = ippFindAttribute (answer, "member-uris", IPP_TAG_URI);
+  if (!printers || i >= ippGetCount (printers)) {
+    ippDelete (answer);
+    PyErr_SetString (PyExc_RuntimeError, "No member URIs returned");
     return NULL;
+  }
 
-  debugprintf ("-> Connection_renewSubscription()\n");
-  request = ippNewRequest (IPP_RENEW_SUBSCRIPTION);
+  request = ippNewRequest (CUPS_ADD_CLASS);
   ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, "/");
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		"requesting-user-name", NULL, cupsUser ());
-  ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-		 "notify-subscription-id", id);
+		"printer-uri", NULL, classuri);
 
-  if (lease_duration != -1)
-    ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-		   "notify-lease-duration", lease_duration);
+  // Only printer in class?  Delete the class.
+  if (ippGetCount (printers) == 1)
+    ippSetOperation (request, CUPS_DELETE_CLASS);
+  else {
+    // Trim the printer from the list.
+    ipp_attribute_t *newlist;
+    int j;
+    newlist = ippAddStrings (request, IPP_TAG_PRINTER, IPP_TAG_URI,
+			     "member-uris", ippGetCount (printers) - 1,
+			     NULL, NULL);
+    for (j = 0; j < i; j++)
+      ippSetString(request, &newlist, j,
+                   strdup (ippGetString (printers, j, NULL)));
+    for (j = i; j < ippGetCount(newlist); j++)
+      ippSetString(request, &newlist, j,
+                   strdup (ippGetString (printers, j+1, NULL)));
+  }
 
+  ippDelete (answer);
   Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/");
+  answer = cupsDoRequest (self->http, request, "/admin/");
   Connection_end_allow_threads (self);
+  if (PyErr_Occurred ()) {
+    if (answer)
+      ippDelete (answer);
+    return NULL;
+  }
+
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
-    debugprintf ("<- Connection_renewSubscription() EXCEPTION\n");
     return NULL;
   }
 
   ippDelete (answer);
-  debugprintf ("<- Connection_renewSubscription()\n");
   Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_cancelSubscription (Connection *self, PyObject *args)
+Connection_deleteClass (Connection *self, PyObject *args)
 {
-  int id;
+  PyObject *classnameobj;
+  char *classname;
+  char classuri[HTTP_MAX_URI];
   ipp_t *request, *answer;
 
-  if (!PyArg_ParseTuple (args, "i", &id))
+  if (Connection_check_idle (self) < 0)
     return NULL;
 
-  debugprintf ("-> Connection_cancelSubscription()\n");
-  request = ippNewRequest (IPP_CANCEL_SUBSCRIPTION);
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-		"printer-uri", NULL, "/");
-  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-		"requesting-user-name", NULL, cupsUser ());
-  ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-		"notify-subscription-id", id);
+  if (!PyArg_ParseTuple (args, "O", &classnameobj))
+    return NULL;
 
+  if (UTF8_from_PyObj (&classname, classnameobj) == NULL)
+    return NULL;
+
+  request = ippNewRequest (CUPS_DELETE_CLASS);
+  construct_uri (classuri, sizeof (classuri),
+		 "ipp://localhost/classes/", classname);
+  free (classname);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, classuri);
   Connection_begin_allow_threads (self);
-  answer = cupsDoRequest (self->http, request, "/");
+  answer = cupsDoRequest (self->http, request, "/admin/");
   Connection_end_allow_threads (self);
   if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
     set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
 		   answer ? NULL : cupsLastErrorString ());
     if (answer)
       ippDelete (answer);
-    debugprintf ("<- Connection_cancelSubscription() EXCEPTION\n");
     return NULL;
   }
 
   ippDelete (answer);
-  debugprintf ("<- Connection_cancelSubscription()\n");
   Py_RETURN_NONE;
 }
 
 static PyObject *
-Connection_printFile (Connection *self, PyObject *args, PyObject *kwds)
+Connection_enablePrinter (Connection *self, PyObject *args, PyObject *kwds)
 {
-  static char *kwlist[] = { "printer", "filename", "title", "options", NULL };
-  PyObject *printer_obj;
-  char *printer;
-  PyObject *filename_obj;
-  char *filename;
-  PyObject *title_obj;
-  char *title;
-  PyObject *options_obj, *key, *val;
-  int num_settings = 0;
-  DICT_POS_TYPE pos = 0;
-  cups_option_t *settings = NULL;
-  int jobid;
+  return do_printer_request (self, args, kwds, IPP_RESUME_PRINTER);
+}
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "OOOO", kwlist,
-				    &printer_obj, &filename_obj, &title_obj,
-				    &options_obj))
-    return NULL;
+static PyObject *
+Connection_disablePrinter (Connection *self, PyObject *args, PyObject *kwds)
+{
+  return do_printer_request (self, args, kwds, IPP_PAUSE_PRINTER);
+}
 
-  if (UTF8_from_PyObj (&printer, printer_obj) == NULL)
-    return NULL;
-  if (UTF8_from_PyObj (&filename, filename_obj) == NULL) {
-    free (printer);
-    return NULL;
-  }
-  if (UTF8_from_PyObj (&title, title_obj) == NULL) {
-    free (filename);
-    free (printer);
-    return NULL;
-  }
+static PyObject *
+Connection_acceptJobs (Connection *self, PyObject *args, PyObject *kwds)
+{
+  return do_printer_request (self, args, kwds, CUPS_ACCEPT_JOBS);
+}
 
-  if (!PyDict_Check (options_obj)) {
-    free (title);
-    free (filename);
-    free (printer);
-    PyErr_SetString (PyExc_TypeError, "options must be a dict");
+static PyObject *
+Connection_rejectJobs (Connection *self, PyObject *args, PyObject *kwds)
+{
+  return do_printer_request (self, args, kwds, CUPS_REJECT_JOBS);
+}
+
+static PyObject *
+Connection_getDefault (Connection *self, PyObject *args)
+{
+  const char *def;
+  PyObject *ret;
+  if (Connection_check_idle (self) < 0)
     return NULL;
+  debugprintf ("-> Connection_getDefault()\n");
+  Connection_begin_allow_threads (self);
+  def = cupsGetDefault2 (self->http);
+  Connection_end_allow_threads (self);
+  if (def == NULL) {
+    debugprintf ("<- Connection_getDefault() = None\n");
+    Py_RETURN_NONE;
+  } else {
+    debugprintf ("<- Connection_getDefault() = \"%s\"\n", def);
+    ret = PyUnicode_FromString (def);
   }
-  while (PyDict_Next (options_obj, &pos, &key, &val)) {
-    char *name, *value;
-    if ((!PyUnicode_Check (key) && !PyBytes_Check (key)) ||
-        (!PyUnicode_Check (val) && !PyBytes_Check (val))) {
-      cupsFreeOptions (num_settings, settings);
-      free (title);
-      free (filename);
-      free (printer);
-      PyErr_SetString (PyExc_TypeError, "Keys and values must be strings");
-      return NULL;
-    }
 
-    num_settings = cupsAddOption (UTF8_from_PyObj (&name, key),
-				  UTF8_from_PyObj (&value, val),
-				  num_settings,
-				  &settings);
-    free (name);
-    free (value);
-  }
+  return ret;
+}
 
-  Connection_begin_allow_threads (self);
-  jobid = cupsPrintFile2 (self->http, printer, filename, title, num_settings,
-                          settings);
-  Connection_end_allow_threads (self);
+static PyObject *
+Connection_setDefault (Connection *self, PyObject *args, PyObject *kwds)
+{
+  return do_printer_request (self, args, kwds, CUPS_SET_DEFAULT);
+}
 
-  if (jobid == 0) {
-    cupsFreeOptions (num_settings, settings);
-    free (title);
-    free (filename);
-    free (printer);
-    set_ipp_error (cupsLastError (), cupsLastErrorString ());
-    return NULL;
+/*
+ * On-disk PPD cache, shared by getPPD and getPPD3.  Entries are named
+ * after the server and queue; the mtime of each file is the server's
+ * modification time for it, so a conditional request can be made
+ * with it, and the atime records when it was last used, for trimming
+ * the cache to its size limit.
+ */
+
+static char *ppd_cache_dir = NULL;
+static long ppd_cache_max = 0;		/* bytes, 0 for no limit */
+
+int
+Connection_set_ppd_cache (const char *dir, long max_size)
+{
+  char *copy = NULL;
+
+  if (dir) {
+    if (mkdir (dir, 0700) < 0 && errno != EEXIST)
+      return -1;
+
+    copy = strdup (dir);
+    if (!copy)
+      return -1;
   }
 
-  cupsFreeOptions (num_settings, settings);
-  free (title);
-  free (filename);
-  free (printer);
-#if PY_MAJOR_VERSION >= 3
-  return PyLong_FromLong (jobid);
-#else
-  return PyInt_FromLong (jobid);
-#endif
+  free (ppd_cache_dir);
+  ppd_cache_dir = copy;
+  ppd_cache_max = max_size;
+  return 0;
 }
 
-static void
-free_string_list (int num_string, char **strings)
+const char *
+Connection_get_ppd_cache (long *max_size)
 {
-  int i;
-  for (i = 0; i < num_string; ++i) {
-    free (strings[i]);
+  *max_size = ppd_cache_max;
+  return ppd_cache_dir;
+}
+
+#ifdef HAVE_CUPS_1_4
+static int
+ppd_cache_escape (char **out, size_t *left, const char *s)
+{
+  for (; *s; s++) {
+    int n;
+    if (isalnum ((unsigned char) *s) || *s == '.' || *s == '-')
+      n = snprintf (*out, *left, "%c", *s);
+    else
+      n = snprintf (*out, *left, "%%%02X", (unsigned char) *s);
+
+    if (n < 0 || n >= *left)
+      return -1;
+
+    *out += n;
+    *left -= n;
   }
-  free (strings);
+
+  return 0;
 }
 
-static PyObject *
-Connection_printFiles (Connection *self, PyObject *args, PyObject *kwds)
+/* Fills in the cache file name for a queue; -1 if not caching. */
+static int
+ppd_cache_path (Connection *self, const char *printer,
+		char *path, size_t len)
 {
-  static char *kwlist[] = { "printer", "filenames", "title", "options", NULL };
-  PyObject *printer_obj;
-  char *printer;
-  PyObject *filenames_obj;
-  int num_filenames;
-  char **filenames;
-  PyObject *title_obj;
-  char *title;
-  PyObject *options_obj, *key, *val;
-  int num_settings = 0;
-  DICT_POS_TYPE pos = 0;
-  cups_option_t *settings = NULL;
-  int jobid;
+  char *p = path;
+  size_t left = len;
+  int n;
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "OOOO", kwlist,
-				    &printer_obj, &filenames_obj, &title_obj,
-				    &options_obj))
-    return NULL;
+  if (!ppd_cache_dir)
+    return -1;
 
-  if (UTF8_from_PyObj (&printer, printer_obj) == NULL)
-    return NULL;
+  n = snprintf (p, left, "%s/", ppd_cache_dir);
+  if (n < 0 || n >= left)
+    return -1;
 
-  if (!PyList_Check (filenames_obj)) {
-    free (printer);
-    PyErr_SetString (PyExc_TypeError, "filenames must be a list");
-    return NULL;
-  }
-  num_filenames = PyList_Size (filenames_obj);
-  if (num_filenames == 0) {
-    free (printer);
-    PyErr_SetString (PyExc_RuntimeError, "filenames list is empty");
-    return NULL;
-  }
-  filenames = malloc (num_filenames * sizeof(char*));
-  for (pos = 0; pos < num_filenames; ++pos) {
-    PyObject *filename_obj = PyList_GetItem(filenames_obj, pos);
-    if (UTF8_from_PyObj (&filenames[pos], filename_obj) == NULL) {
-      free_string_list (pos, filenames);
-      free (printer);
-      return NULL;
-    }
-  }
-  if (UTF8_from_PyObj (&title, title_obj) == NULL) {
-    free_string_list (num_filenames, filenames);
-    free (printer);
-    return NULL;
-  }
+  p += n;
+  left -= n;
+  if (ppd_cache_escape (&p, &left, self->host ? self->host : "") < 0)
+    return -1;
 
-  if (!PyDict_Check (options_obj)) {
-    free (title);
-    free_string_list (num_filenames, filenames);
-    free (printer);
-    PyErr_SetString (PyExc_TypeError, "options must be a dict");
-    return NULL;
-  }
-  while (PyDict_Next (options_obj, &pos, &key, &val)) {
-    char *name, *value;
-    if ((!PyUnicode_Check (key) && !PyBytes_Check (key)) ||
-        (!PyUnicode_Check (val) && !PyBytes_Check (val))) {
-      cupsFreeOptions (num_settings, settings);
-      free (title);
-      free_string_list (num_filenames, filenames);
-      free (printer);
-      PyErr_SetString (PyExc_TypeError, "Keys and values must be strings");
-      return NULL;
+  n = snprintf (p, left, "_%d_", self->port);
+  if (n < 0 || n >= left)
+    return -1;
+
+  p += n;
+  left -= n;
+  if (ppd_cache_escape (&p, &left, printer) < 0)
+    return -1;
+
+  n = snprintf (p, left, ".ppd");
+  if (n < 0 || n >= left)
+    return -1;
+
+  return 0;
+}
+
+static int
+copy_fd (int in, int out)
+{
+  char buf[BUFSIZ];
+  ssize_t got;
+
+  while ((got = read (in, buf, sizeof (buf))) != 0) {
+    char *p = buf;
+
+    if (got < 0) {
+      if (errno == EINTR)
+	continue;
+
+      return -1;
     }
 
-    num_settings = cupsAddOption (UTF8_from_PyObj (&name, key),
-				  UTF8_from_PyObj (&value, key),
-				  num_settings,
-				  &settings);
-    free (name);
-    free (value);
+    while (got > 0) {
+      ssize_t wrote = write (out, p, got);
+      if (wrote < 0) {
+	if (errno == EINTR)
+	  continue;
+
+	return -1;
+      }
+
+      p += wrote;
+      got -= wrote;
+    }
   }
 
-  Connection_begin_allow_threads (self);
-  jobid = cupsPrintFiles2 (self->http, printer, num_filenames,
-                           (const char **) filenames, title, num_settings,
-						   settings);
-  Connection_end_allow_threads (self);
+  return 0;
+}
 
-  if (jobid < 0) {
-    cupsFreeOptions (num_settings, settings);
-    free (title);
-    free_string_list (num_filenames, filenames);
-    free (printer);
-    set_ipp_error (cupsLastError (), cupsLastErrorString ());
-    return NULL;
+/* Copy a cached PPD to fname, or to a new temporary file if fname is
+ * empty. */
+static int
+ppd_cache_copy_out (const char *cached, char *fname, size_t fnamelen)
+{
+  int in, out, ret;
+
+  in = open (cached, O_RDONLY);
+  if (in < 0)
+    return -1;
+
+  if (fname[0])
+    out = open (fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  else
+    out = cupsTempFd (fname, fnamelen);
+
+  if (out < 0) {
+    close (in);
+    return -1;
   }
 
-  cupsFreeOptions (num_settings, settings);
-  free (title);
-  free_string_list (num_filenames, filenames);
-  free (printer);
-#if PY_MAJOR_VERSION >= 3
-  return PyLong_FromLong (jobid);
-#else
-  return PyInt_FromLong (jobid);
-#endif
+  ret = copy_fd (in, out);
+  close (in);
+  if (close (out) < 0)
+    ret = -1;
+
+  return ret;
 }
 
-PyMethodDef Connection_methods[] =
-  {
-    { "getPrinters",
-      (PyCFunction) Connection_getPrinters, METH_NOARGS,
-      "getPrinters() -> dict\n\n"
-      "@return: a dict, indexed by name, of dicts representing\n"
-      "queues, indexed by attribute.\n"
-      "@raise IPPError: IPP problem" },
+static void
+ppd_cache_touch (const char *cached, time_t modtime)
+{
+  struct utimbuf times;
 
-    { "getDests",
-      (PyCFunction) Connection_getDests, METH_NOARGS,
-      "getDests() -> dict\n\n"
-      "@return: a dict representing available destinations.  Each \n"
-      "dictionary key is a pair of (queue, instance) strings, and the \n"
-      "dictionary value is a L{cups.Dest} object.  In addition to the \n"
-      "available destinations, a special dictionary key (None,None) is \n"
-      "provided for looking up the default destination; this destination \n"
-      "will also be available under its own key.\n"
-      "@raise IPPError: IPP problem" },
+  times.actime = time (NULL);
+  times.modtime = modtime;
+  utime (cached, &times);
+}
 
-    { "getClasses",
-      (PyCFunction) Connection_getClasses, METH_NOARGS,
-      "getClasses() -> dict\n\n"
-      "@return: a dict, indexed by name, of objects representing\n"
-      "classes.  Each class object is either a string, in which case it\n"
-      "is for the remote class; or a list, in which case it is a list of\n"
-      "queue names.\n"
-      "@raise IPPError: IPP problem" },
+typedef struct
+{
+  char *name;
+  off_t size;
+  time_t used;
+} ppd_cache_entry_t;
 
-    { "getPPDs",
-      (PyCFunction) Connection_getPPDs, METH_VARARGS | METH_KEYWORDS,
-      "getPPDs(limit=0, exclude_schemes=None, include_schemes=None, \n"
-      "ppd_natural_language=None, ppd_device_id=None, ppd_make=None, \n"
-      "ppd_make_and_model=None, ppd_model_number=-1, ppd_product=None, \n"
-      "ppd_psversion=None, ppd_type=None) -> dict\n\n"
-      "@type limit: integer\n"
-      "@param limit: maximum number of PPDs to return\n"
-      "@type exclude_schemes: string list\n"
-      "@param exclude_schemes: list of PPD schemes to exclude\n"
+static int
+ppd_cache_entry_cmp (const void *a, const void *b)
+{
+  const ppd_cache_entry_t *ea = a, *eb = b;
+  return (ea->used > eb->used) - (ea->used < eb->used);
+}
+
+/* Remove the least recently used entries until the cache fits. */
+static void
+ppd_cache_trim (const char *dir, long max_size)
+{
+  ppd_cache_entry_t *entries = NULL;
+  size_t n = 0, alloc = 0, i;
+  long long total = 0;
+  struct dirent *d;
+  DIR *dp;
+
+  if (max_size <= 0)
+    return;
+
+  dp = opendir (dir);
+  if (!dp)
+    return;
+
+  while ((d = readdir (dp)) != NULL) {
+    size_t len = strlen (d->d_name);
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (len < 4 || strcmp (d->d_name + len - 4, ".ppd"))
+      continue;
+
+    snprintf (path, sizeof (path), "%s/%s", dir, d->d_name);
+    if (stat (path, &st) < 0)
+      continue;
+
+    if (n == alloc) {
+      size_t newalloc = alloc ? 2 * alloc : 64;
+      ppd_cache_entry_t *e = realloc (entries, newalloc * sizeof (*e));
+      if (!e)
+	break;
+
+      entries = e;
+      alloc = newalloc;
+    }
+
+    entries[n].name = strdup (path);
+    if (!entries[n].name)
+      break;
+
+    entries[n].size = st.st_size;
+    entries[n].used = st.st_atime;
+    total += st.st_size;
+    n++;
+  }
+
+  closedir (dp);
+  if (total > max_size) {
+    qsort (entries, n, sizeof (entries[0]), ppd_cache_entry_cmp);
+    for (i = 0; i < n && total > max_size; i++) {
+      debugprintf ("PPD cache: removing %s\n", entries[i].name);
+      if (unlink (entries[i].name) == 0)
+	total -= entries[i].size;
+    }
+  }
+
+  for (i = 0; i < n; i++)
+    free (entries[i].name);
+
+  free (entries);
+}
+
+/* Replace the cached PPD with a copy of fname.  The new file is
+ * written alongside and renamed into place so that other processes
+ * sharing the cache never see it half-written. */
+static void
+ppd_cache_store (const char *cached, const char *fname, time_t modtime,
+		 const char *dir, long max_size)
+{
+  char tmp[PATH_MAX];
+  int in, out;
+
+  if (snprintf (tmp, sizeof (tmp), "%s.XXXXXX", cached) >= sizeof (tmp))
+    return;
+
+  in = open (fname, O_RDONLY);
+  if (in < 0)
+    return;
+
+  out = mkstemp (tmp);
+  if (out < 0) {
+    close (in);
+    return;
+  }
+
+  if (copy_fd (in, out) < 0 || close (out) < 0) {
+    close (in);
+    unlink (tmp);
+    return;
+  }
+
+  close (in);
+  ppd_cache_touch (tmp, modtime);
+  if (rename (tmp, cached) < 0) {
+    unlink (tmp);
+    return;
+  }
+
+  ppd_cache_trim (dir, max_size);
+}
+
+/*
+ * As cupsGetPPD3, but going through the PPD cache when one is set.
+ * The conditional request is made with the newer of the caller's
+ * modification time and the cached one; if the server's copy matches
+ * the cache but the caller's is older, the cached file is copied to
+ * the caller instead of being downloaded again.
+ */
+static http_status_t
+get_ppd_cached (Connection *self, const char *printer, time_t *modtime,
+		char *fname, size_t fnamelen)
+{
+  char cached[PATH_MAX];
+  char *dir = NULL;
+  long max_size = ppd_cache_max;
+  struct stat st;
+  time_t cache_mtime = 0, want;
+  http_status_t status;
+
+  if (ppd_cache_path (self, printer, cached, sizeof (cached)) < 0) {
+    Connection_begin_allow_threads (self);
+    status = cupsGetPPD3 (self->http, printer, modtime, fname, fnamelen);
+    Connection_end_allow_threads (self);
+    return status;
+  }
+
+  // Keep our own copy of the directory while the GIL is released.
+  dir = strdup (ppd_cache_dir);
+  if (!dir) {
+    PyErr_NoMemory ();
+    return HTTP_ERROR;
+  }
+
+  Connection_begin_allow_threads (self);
+  if (stat (cached, &st) == 0)
+    cache_mtime = st.st_mtime;
+
+  want = *modtime > cache_mtime ? *modtime : cache_mtime;
+  status = cupsGetPPD3 (self->http, printer, &want, fname, fnamelen);
+  if (status == HTTP_OK) {
+    debugprintf ("PPD cache: storing %s\n", cached);
+    ppd_cache_store (cached, fname, want, dir, max_size);
+    *modtime = want;
+  } else if (status == HTTP_NOT_MODIFIED && cache_mtime > *modtime) {
+    if (ppd_cache_copy_out (cached, fname, fnamelen) == 0) {
+      debugprintf ("PPD cache: hit for %s\n", cached);
+      ppd_cache_touch (cached, cache_mtime);
+      *modtime = cache_mtime;
+      status = HTTP_OK;
+    } else {
+      // Entry went away underneath us; fetch it properly.
+      debugprintf ("PPD cache: lost %s\n", cached);
+      status = cupsGetPPD3 (self->http, printer, modtime, fname, fnamelen);
+      if (status == HTTP_OK)
+	ppd_cache_store (cached, fname, *modtime, dir, max_size);
+    }
+  }
+
+  Connection_end_allow_threads (self);
+  free (dir);
+  return status;
+}
+#endif /* HAVE_CUPS_1_4 */
+
+static PyObject *
+Connection_getPPD (Connection *self, PyObject *args)
+{
+  PyObject *ret;
+  PyObject *printerobj;
+  char *printer;
+  const char *ppdfile;
+#ifdef HAVE_CUPS_1_4
+  char fname[PATH_MAX];
+  time_t modtime;
+#endif /* HAVE_CUPS_1_4 */
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTuple (args, "O", &printerobj))
+    return NULL;
+
+  if (UTF8_from_PyObj (&printer, printerobj) == NULL)
+    return NULL;
+
+  debugprintf ("-> Connection_getPPD()\n");
+#ifdef HAVE_CUPS_1_4
+  modtime = 0;
+  fname[0] = '\0';
+  if (get_ppd_cached (self, printer, &modtime,
+		      fname, sizeof (fname)) == HTTP_OK)
+    ppdfile = fname;
+  else
+    ppdfile = NULL;
+#else /* !HAVE_CUPS_1_4 */
+  Connection_begin_allow_threads (self);
+  ppdfile = cupsGetPPD2 (self->http, printer);
+  Connection_end_allow_threads (self);
+#endif /* !HAVE_CUPS_1_4 */
+  free (printer);
+  if (!ppdfile) {
+    ipp_status_t err = cupsLastError ();
+    if (err)
+      set_ipp_error (err, cupsLastErrorString ());
+    else if (!PyErr_Occurred ())
+      PyErr_SetString (PyExc_RuntimeError, "cupsGetPPD2 failed");
+
+    debugprintf ("<- Connection_getPPD() (error)\n");
+    return NULL;
+  }
+
+  ret = PyUnicode_FromString (ppdfile);
+  debugprintf ("<- Connection_getPPD() = %s\n", ppdfile);
+  return ret;
+}
+
+#ifdef HAVE_CUPS_1_4
+static PyObject *
+Connection_getPPD3 (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *ret, *obj;
+  PyObject *printerobj;
+  PyObject *fmodtime = NULL;
+  char *printer;
+  time_t modtime;
+  PyObject *filenameobj = NULL;
+  char *filename = NULL;
+  char fname[PATH_MAX];
+  http_status_t status;
+  static char *kwlist[] = { "name", "modtime", "filename", NULL };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|OO", kwlist,
+				    &printerobj, &fmodtime, &filenameobj))
+    return NULL;
+
+  if (UTF8_from_PyObj (&printer, printerobj) == NULL)
+    return NULL;
+
+  if (fmodtime) {
+    double d = PyFloat_AsDouble (fmodtime);
+    if (PyErr_Occurred()) {
+      free (printer);
+      return NULL;
+    }
+
+    modtime = (time_t) d;
+  } else
+    modtime = 0;
+
+  if (filenameobj)
+    if (UTF8_from_PyObj (&filename, filenameobj) == NULL) {
+      free (printer);
+      return NULL;
+    }
+  if (filename) {
+    if (strlen (filename) > sizeof (fname)) {
+      PyErr_SetString (PyExc_TypeError, "overlength filename");
+      free (printer);
+      free (filename);
+      return NULL;
+    }
+    strcpy (fname, filename);
+  } else
+    fname[0] = '\0';
+
+  debugprintf ("-> Connection_getPPD3()\n");
+  status = get_ppd_cached (self, printer, &modtime, fname, sizeof (fname));
+  free (printer);
+  free (filename);
+  if (PyErr_Occurred ())
+    return NULL;
+
+  ret = PyTuple_New (3);
+  if (!ret)
+    return NULL;
+
+#if PY_MAJOR_VERSION >= 3
+  obj = PyLong_FromLong ((long) status);
+#else
+  obj = PyInt_FromLong ((long) status);
+#endif
+
+  if (!obj) {
+    Py_DECREF (ret);
+    return NULL;
+  }
+
+  PyTuple_SetItem (ret, 0, obj);
+
+  obj = PyFloat_FromDouble ((double) modtime);
+  if (!obj) {
+    Py_DECREF (ret);
+    return NULL;
+  }
+
+  PyTuple_SetItem (ret, 1, obj);
+
+  obj = PyUnicode_FromString (fname);
+  if (!obj) {
+    Py_DECREF (ret);
+    return NULL;
+  }
+
+  PyTuple_SetItem (ret, 2, obj);
+
+  debugprintf ("<- Connection_getPPD3() = (%d,%ld,%s)\n",
+	       status, modtime, fname);
+  return ret;
+}
+#endif /* HAVE_CUPS_1_4 */
+
+static PyObject *
+Connection_printTestPage (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *printerobj;
+  char *printer;
+  PyObject *fileobj = NULL;
+  char *file = NULL;
+  PyObject *titleobj = NULL;
+  char *title = NULL;
+  PyObject *formatobj = NULL;
+  char *format = NULL;
+  PyObject *userobj = NULL;
+  char *user = NULL;
+  const char *datadir;
+  char filename[PATH_MAX];
+  char uri[HTTP_MAX_URI];
+  ipp_t *request, *answer;
+  ipp_attribute_t *attr;
+  char *resource;
+  int jobid = 0;
+  int i;
+  static char *kwlist[] = { "name", "file", "title", "format", "user", NULL };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|OOOO", kwlist,
+				    &printerobj, &fileobj, &titleobj,
+				    &formatobj, &userobj))
+    return NULL;
+
+  if (UTF8_from_PyObj (&printer, printerobj) == NULL)
+    return NULL;
+
+  if ((fileobj && UTF8_from_PyObj (&file, fileobj) == NULL) ||
+      (titleobj && UTF8_from_PyObj (&title, titleobj) == NULL) ||
+      (formatobj && UTF8_from_PyObj (&format, formatobj) == NULL) ||
+      (userobj && UTF8_from_PyObj (&user, userobj) == NULL)) {
+    free (printer);
+    free (file);
+    free (title);
+    free (format);
+    free (user);
+    return NULL;
+  }
+    
+  if (!fileobj) {
+    const char *testprint[] = { "%s/data/testprint",
+				"%s/data/testprint.ps",
+				NULL };
+    if ((datadir = getenv ("CUPS_DATADIR")) != NULL) {
+      const char **pattern;
+      for (pattern = testprint; *pattern != NULL; pattern++) {
+	snprintf (filename, sizeof (filename), *pattern, datadir);
+	if (access (filename, R_OK) == 0)
+	  break;
+      }
+    } else {
+      const char *const dirs[] = { "/usr/share/cups",
+				   "/usr/local/share/cups",
+				   NULL };
+      int found = 0;
+      int i;
+      for (i = 0; (datadir = dirs[i]) != NULL; i++) {
+	const char **pattern;
+	for (pattern = testprint; *pattern != NULL; pattern++) {
+	  snprintf (filename, sizeof (filename), *pattern, datadir);
+	  if (access (filename, R_OK) == 0) {
+	    found = 1;
+	    break;
+	  }
+	}
+
+	if (found)
+	  break;
+      }
+
+      if (datadir == NULL)
+	/* We haven't found the testprint.ps file, so just pick a path
+	 * and try it.  This will certainly fail with
+	 * client-error-not-found, but we'll let that happen rather
+	 * than raising an exception so as to be consistent with the
+	 * case where CUPS_DATADIR is set and we trust it. */
+	snprintf (filename, sizeof (filename), testprint[0], dirs[0]);
+    }
+
+    file = filename;
+  }
+
+  if (!titleobj)
+    title = "Test Page";
+
+  if (!userobj)
+	  user = (char *) cupsUser();
+
+  construct_uri (uri, sizeof (uri),
+		 "ipp://localhost/printers/", printer);
+  resource = uri + strlen ("ipp://localhost");
+  for (i = 0; i < 2; i++) {
+    request = ippNewRequest (IPP_PRINT_JOB);
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri",
+		  NULL, uri);
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		  "requesting-user-name", NULL, user);
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name",
+		  NULL, title);
+    if (format)
+      ippAddString (request, IPP_TAG_JOB, IPP_TAG_MIMETYPE, "document-format",
+		    NULL, format);
+
+    Connection_begin_allow_threads (self);
+    answer = cupsDoFileRequest (self->http, request, resource, file);
+    Connection_end_allow_threads (self);
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_POSSIBLE) {
+      ippDelete (answer);
+      // Perhaps it's a class, not a printer.
+      construct_uri (uri, sizeof (uri),
+		     "ipp://localhost/classes/", printer);
+    } else break;
+  }
+
+  free (printer);
+  if (fileobj)
+    free (file);
+  if (titleobj)
+    free (title);
+  if (formatobj)
+    free (format);
+  if (userobj)
+    free (user);
+
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    return NULL;
+  }
+
+  attr = ippFindAttribute (answer, "job-id", IPP_TAG_INTEGER);
+  if (attr)
+    jobid = ippGetInteger (attr, 0);
+
+  ippDelete (answer);
+  return Py_BuildValue ("i", jobid);
+}
+
+static PyObject *
+Connection_adminExportSamba (Connection *self, PyObject *args)
+{
+  int ret;
+  PyObject *nameobj;
+  char *name;
+  PyObject *serverobj;
+  char *server;
+  PyObject *userobj;
+  char  *user;
+  PyObject *passwordobj;
+  char *password;
+  char ppdfile[1024];
+  FILE *tmpfile(void);
+  FILE *tf;
+  char str[80];
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTuple (args, "OOOO", &nameobj, &serverobj, &userobj,
+                         &passwordobj))
+    return NULL;
+
+  if (UTF8_from_PyObj (&name, nameobj) == NULL ||
+      UTF8_from_PyObj (&server, serverobj) == NULL ||
+      UTF8_from_PyObj (&user, userobj) == NULL ||
+      UTF8_from_PyObj (&password, passwordobj) == NULL) {
+    free (name);
+    free (server);
+    free (user);
+    free (password);
+    PyErr_SetString(PyExc_RuntimeError,
+                    "name, samba_server, samba_username, samba_password "
+                    "must be specified");
+    return NULL;
+  }
+
+  if (!cupsAdminCreateWindowsPPD(self->http, name, ppdfile, sizeof(ppdfile))) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "No PPD file found for the printer");
+    return NULL;
+  }
+
+  debugprintf ("-> Connection_adminExportSamba()\n");
+  tf = tmpfile();
+  Connection_begin_allow_threads (self);
+  ret = cupsAdminExportSamba(name, ppdfile, server, user, password, tf);
+  Connection_end_allow_threads (self);
+
+  free (name);
+  free (server);
+  free (user);
+  free (password);
+  unlink (ppdfile);
+
+  if (!ret) {
+    rewind(tf);
+    // Read logfile line by line to get Exit status message on the last line.
+    while (fgets (str, sizeof(str), tf) != NULL) { }
+    fclose (tf);
+    if (str[strlen(str) -1] == '\n') {
+      str[strlen(str) -1] = '\0';
+    }
+    PyErr_SetString (PyExc_RuntimeError, str);
+    debugprintf ("<- Connection_adminExportSamba() EXCEPTION\n");
+    return NULL;
+  }
+  fclose (tf);
+  debugprintf ("<- Connection_adminExportSamba()\n");
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+Connection_adminGetServerSettings (Connection *self)
+{
+  PyObject *ret;
+  int num_settings, i;
+  cups_option_t *settings;
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+  ret = PyDict_New ();
+  debugprintf ("-> Connection_adminGetServerSettings()\n");
+  Connection_begin_allow_threads (self);
+  cupsAdminGetServerSettings (self->http, &num_settings, &settings);
+  Connection_end_allow_threads (self);
+  for (i = 0; i < num_settings; i++) {
+    PyObject *string = PyUnicode_FromString (settings[i].value);
+    PyDict_SetItemString (ret, settings[i].name, string);
+    Py_DECREF (string);
+  }
+
+  cupsFreeOptions (num_settings, settings);
+  debugprintf ("<- Connection_adminGetServerSettings()\n");
+  return ret;
+}
+
+static PyObject *
+Connection_adminSetServerSettings (Connection *self, PyObject *args)
+{
+  PyObject *dict, *key, *val;
+  int ret;
+  int num_settings = 0;
+  DICT_POS_TYPE pos = 0;
+  cups_option_t *settings = NULL;
+  if (!PyArg_ParseTuple (args, "O", &dict))
+    return NULL;
+  if (!PyDict_Check (dict)) {
+    PyErr_SetString (PyExc_TypeError, "Expecting dict");
+    return NULL;
+  }
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  debugprintf ("-> Connection_adminSetServerSettings()\n");
+  while (PyDict_Next (dict, &pos, &key, &val)) {
+    char *name, *value;
+    if ((!PyUnicode_Check (key) && !PyBytes_Check (key)) ||
+        (!PyUnicode_Check (val) && !PyBytes_Check (val))) {
+      cupsFreeOptions (num_settings, settings);
+      PyErr_SetString (PyExc_TypeError, "Keys and values must be strings");
+      debugprintf ("<- Connection_adminSetServerSettings() EXCEPTION\n");
+      return NULL;
+    }
+
+    UTF8_from_PyObj (&name, key);
+    UTF8_from_PyObj (&value, val);
+    debugprintf ("%s: %s\n", name, value);
+    num_settings = cupsAddOption (name,
+				  value,
+				  num_settings,
+				  &settings);
+    free (name);
+    free (value);
+  }
+
+  debugprintf ("num_settings=%d, settings=%p\n", num_settings, settings);
+  Connection_begin_allow_threads (self);
+  ret = cupsAdminSetServerSettings (self->http, num_settings, settings);
+  Connection_end_allow_threads (self);
+  if (!ret) {
+    cupsFreeOptions (num_settings, settings);
+    PyErr_SetString (PyExc_RuntimeError, "Failed to set settings");
+    debugprintf ("<- Connection_adminSetServerSettings() EXCEPTION\n");
+    return NULL;
+  }
+
+  cupsFreeOptions (num_settings, settings);
+  debugprintf ("<- Connection_adminSetServerSettings()\n");
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+Connection_getSubscriptions (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *uriobj;
+  char *uri;
+  PyObject *my_subscriptions = Py_False;
+  int job_id = -1;
+  ipp_t *request, *answer;
+  ipp_attribute_t *attr;
+  PyObject *result, *subscription;
+  static char *kwlist[] = { "uri", "my_subscriptions", "job_id", NULL };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|Oi", kwlist,
+				    &uriobj, &my_subscriptions, &job_id))
+    return NULL;
+
+  if (UTF8_from_PyObj (&uri, uriobj) == NULL)
+    return NULL;
+
+  if (my_subscriptions && !PyBool_Check (my_subscriptions)) {
+    PyErr_SetString (PyExc_TypeError, "my_subscriptions must be a bool");
+    return NULL;
+  }
+
+  debugprintf ("-> Connection_getSubscriptions()\n");
+  request = ippNewRequest (IPP_GET_SUBSCRIPTIONS);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, uri);
+  free (uri);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+
+  if (my_subscriptions == Py_True)
+    ippAddBoolean (request, IPP_TAG_OPERATION, "my-subscriptions", 1);
+
+  if (job_id != -1)
+    ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+		   "job-id", job_id);
+
+  Connection_begin_allow_threads (self);
+  answer = cupsDoRequest (self->http, request, "/");
+  Connection_end_allow_threads (self);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    debugprintf ("<- Connection_getSubscriptions() EXCEPTION\n");
+    return NULL;
+  }
+
+  result = PyList_New (0);
+  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer))
+    if (ippGetGroupTag (attr) == IPP_TAG_SUBSCRIPTION)
+      break;
+
+  subscription = NULL;
+  for (; attr; attr = ippNextAttribute (answer)) {
+    PyObject *obj;
+    if (ippGetGroupTag (attr) == IPP_TAG_ZERO) {
+      // End of subscription.
+      if (subscription) {
+	PyList_Append (result, subscription);
+	Py_DECREF (subscription);
+      }
+
+      subscription = NULL;
+      continue;
+    }
+
+    obj = PyObject_from_attr (attr, lookup_attr_info (ippGetName (attr)), ATTR_CTX_SUBSCRIPTIONS);
+
+    if (!obj)
+      // Can't represent this.
+      continue;
+
+    if (!subscription)
+      subscription = PyDict_New ();
+
+    set_attr_item (subscription, attr, obj);
+    Py_DECREF (obj);
+  }
+
+  if (subscription) {
+    PyList_Append (result, subscription);
+    Py_DECREF (subscription);
+  }
+
+  ippDelete (answer);
+  debugprintf ("<- Connection_getSubscriptions()\n");
+  return result;
+}
+
+static PyObject *
+Connection_createSubscription (Connection *self, PyObject *args,
+			       PyObject *kwds)
+{
+  PyObject *resource_uriobj;
+  char *resource_uri;
+  PyObject *events = NULL;
+  int job_id = -1, lease_duration = -1, time_interval = -1;
+  PyObject *recipient_uriobj = NULL, *user_dataobj = NULL;
+  char *recipient_uri = NULL, *user_data = NULL;
+  ipp_t *request, *answer;
+  int i, n = 0;
+  char *tmp;
+  ipp_attribute_t *attr;
+  static char *kwlist[] = { "uri", "events", "job_id", "recipient_uri",
+			    "lease_duration", "time_interval", "user_data",
+			    NULL };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|OiOiiO", kwlist,
+				    &resource_uriobj, &events, &job_id,
+				    &recipient_uriobj, &lease_duration,
+				    &time_interval, &user_dataobj))
+    return NULL;
+
+  if (UTF8_from_PyObj (&resource_uri, resource_uriobj) == NULL)
+    return NULL;
+
+  if (recipient_uriobj &&
+      UTF8_from_PyObj (&recipient_uri, recipient_uriobj) == NULL) {
+    free (resource_uri);
+    return NULL;
+  }
+
+  if (user_dataobj && UTF8_from_PyObj (&user_data, user_dataobj) == NULL) {
+    free (resource_uri);
+    if (recipient_uriobj)
+      free (recipient_uri);
+    return NULL;
+  }
+
+  if (events) {
+    if (!PyList_Check (events)) {
+      PyErr_SetString (PyExc_TypeError, "events must be a list");
+      return NULL;
+    }
+
+    n = PyList_Size (events);
+    for (i = 0; i < n; i++) {
+      PyObject *event = PyList_GetItem (events, i);
+      if (!PyUnicode_Check (event) && !PyBytes_Check (event)) {
+	PyErr_SetString (PyExc_TypeError, "events must be a list of strings");
+	return NULL;
+      }
+    }
+  }
+
+  debugprintf ("-> Connection_createSubscription(%s)\n", resource_uri);
+  request = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, resource_uri);
+  ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
+		"notify-pull-method", NULL, "ippget");
+  ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_CHARSET,
+		"notify-charset", NULL, "utf-8");
+  ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+
+  if (recipient_uriobj) {
+    ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI,
+		  "notify-recipient-uri", NULL, recipient_uri);
+    free (recipient_uri);
+  }
+
+  if (user_dataobj) {
+    ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_STRING,
+		  "notify-user-data", NULL, user_data);
+    free (user_data);
+  }
+
+  if (events) {
+    attr = ippAddStrings (request, IPP_TAG_SUBSCRIPTION,
+			  IPP_TAG_KEYWORD, "notify-events",
+			  n, NULL, NULL);
+    for (i = 0; i < n; i++) {
+      PyObject *event = PyList_GetItem (events, i);
+      ippSetString(request, &attr, i, UTF8_from_PyObj (&tmp, event));
+      free(tmp);
+    }
+  }
+
+  if (lease_duration != -1)
+    ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
+		   "notify-lease-duration", lease_duration);
+
+  if (time_interval != -1)
+    ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
+		   "notify-time-interval", time_interval);
+
+  if (job_id != -1)
+    ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
+		   "notify-job-id", job_id);
+
+  Connection_begin_allow_threads (self);
+  answer = cupsDoRequest (self->http, request, "/");
+  Connection_end_allow_threads (self);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    debugprintf ("<- Connection_createSubscription() EXCEPTION\n");
+    return NULL;
+  }
+
+  i = -1;
+  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer)) {
+    if (ippGetGroupTag (attr) == IPP_TAG_SUBSCRIPTION) {
+      if (ippGetValueTag (attr) == IPP_TAG_INTEGER &&
+	  !strcmp (ippGetName (attr), "notify-subscription-id"))
+	i = ippGetInteger (attr, 0);
+      else if (ippGetValueTag (attr) == IPP_TAG_ENUM &&
+	       !strcmp (ippGetName (attr), "notify-status-code"))
+	debugprintf ("notify-status-code = %d\n", ippGetInteger (attr, 0));
+    }
+  }
+
+  ippDelete (answer);
+  debugprintf ("<- Connection_createSubscription() = %d\n", i);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (i);
+#else
+  return PyInt_FromLong (i);
+#endif
+}
+
+/*
+ * Decode the event notification groups of a Get-Notifications
+ * response into a list of dicts.
+ */
+static PyObject *
+events_from_answer (ipp_t *answer)
+{
+  ipp_attribute_t *attr;
+  PyObject *events, *event;
+
+  events = PyList_New (0);
+  for (attr = ippFirstAttribute (answer); attr; attr = ippNextAttribute (answer))
+    if (ippGetGroupTag (attr) == IPP_TAG_EVENT_NOTIFICATION)
+      break;
+
+  event = NULL;
+  for (; attr; attr = ippNextAttribute (answer)) {
+    PyObject *obj;
+    if (ippGetGroupTag (attr) == IPP_TAG_ZERO) {
+      // End of event notification.
+      if (event) {
+	PyList_Append (events, event);
+	Py_DECREF (event);
+      }
+
+      event = NULL;
+      continue;
+    }
+
+    obj = PyObject_from_attr (attr, lookup_attr_info (ippGetName (attr)), ATTR_CTX_NOTIFICATIONS);
+
+    if (!obj)
+      // Can't represent this.
+      continue;
+
+    if (!event)
+      event = PyDict_New ();
+
+    set_attr_item (event, attr, obj);
+    Py_DECREF (obj);
+  }
+
+  if (event) {
+    PyList_Append (events, event);
+    Py_DECREF (event);
+  }
+
+  return events;
+}
+
+static PyObject *
+Connection_getNotifications (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *subscription_ids, *sequence_numbers = NULL;
+  ipp_t *request, *answer;
+  int i, num_ids, num_seqs = 0;
+  ipp_attribute_t *attr;
+  PyObject *result, *events;
+  static char *kwlist[] = { "subscription_ids", "sequence_numbers", NULL };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|O", kwlist,
+				    &subscription_ids, &sequence_numbers))
+    return NULL;
+
+  if (!PyList_Check (subscription_ids)) {
+    PyErr_SetString (PyExc_TypeError, "subscriptions_ids must be a list");
+    return NULL;
+  }
+
+  num_ids = PyList_Size (subscription_ids);
+  for (i = 0; i < num_ids; i++) {
+    PyObject *id = PyList_GetItem (subscription_ids, i);
+#if PY_MAJOR_VERSION >= 3
+    if (!PyLong_Check (id)) {
+#else
+    if (!PyInt_Check (id)) {
+#endif
+      PyErr_SetString (PyExc_TypeError, "subscription_ids must be a list "
+		       "of integers");
+      return NULL;
+    }
+  }
+
+  if (sequence_numbers) {
+    if (!PyList_Check (sequence_numbers)) {
+      PyErr_SetString (PyExc_TypeError, "sequence_numbers must be a list");
+      return NULL;
+    }
+
+    num_seqs = PyList_Size (sequence_numbers);
+    for (i = 0; i < num_seqs; i++) {
+      PyObject *id = PyList_GetItem (sequence_numbers, i);
+#if PY_MAJOR_VERSION >= 3
+      if (!PyLong_Check (id)) {
+#else
+      if (!PyInt_Check (id)) {
+#endif
+	PyErr_SetString (PyExc_TypeError, "sequence_numbers must be a list "
+			 "of integers");
+	return NULL;
+      }
+    }
+  }
+
+  debugprintf ("-> Connection_getNotifications()\n");
+  request = ippNewRequest (IPP_GET_NOTIFICATIONS);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, "/");
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+
+  attr = ippAddIntegers (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+			 "notify-subscription-ids", num_ids, NULL);
+  for (i = 0; i < num_ids; i++) {
+    PyObject *id = PyList_GetItem (subscription_ids, i);
+#if PY_MAJOR_VERSION >= 3
+    ippSetInteger (request, &attr, i, PyLong_AsLong (id));
+#else
+    ippSetInteger (request, &attr, i, PyInt_AsLong (id));
+#endif
+  }
+
+  if (sequence_numbers) {
+    attr = ippAddIntegers (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+			   "notify-sequence-numbers", num_seqs, NULL);
+    for (i = 0; i < num_seqs; i++) {
+      PyObject *num = PyList_GetItem (sequence_numbers, i);
+#if PY_MAJOR_VERSION >= 3
+      ippSetInteger (request, &attr, i, PyLong_AsLong (num));
+#else
+      ippSetInteger (request, &attr, i, PyInt_AsLong (num));
+#endif
+    }
+  }
+  
+  Connection_begin_allow_threads (self);
+  answer = cupsDoRequest (self->http, request, "/");
+  Connection_end_allow_threads (self);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    debugprintf ("<- Connection_getNotifications() EXCEPTION\n");
+    return NULL;
+  }
+
+  result = PyDict_New ();
+
+  // Result-wide attributes.
+  attr = ippFindAttribute (answer, "notify-get-interval", IPP_TAG_INTEGER);
+  if (attr) {
+#if PY_MAJOR_VERSION >= 3
+    PyObject *val = PyLong_FromLong (ippGetInteger (attr, 0));
+#else
+    PyObject *val = PyInt_FromLong (ippGetInteger (attr, 0));
+#endif
+    set_attr_item (result, attr, val);
+    Py_DECREF (val);
+  }
+
+  attr = ippFindAttribute (answer, "printer-up-time", IPP_TAG_INTEGER);
+  if (attr) {
+#if PY_MAJOR_VERSION >= 3
+    PyObject *val = PyLong_FromLong (ippGetInteger (attr, 0));
+#else
+    PyObject *val = PyInt_FromLong (ippGetInteger (attr, 0));
+#endif
+    set_attr_item (result, attr, val);
+    Py_DECREF (val);
+  }
+
+  events = events_from_answer (answer);
+  ippDelete (answer);
+  PyDict_SetItemString (result, "events", events);
+  Py_DECREF (events);
+  debugprintf ("<- Connection_getNotifications()\n");
+  return result;
+}
+
+static PyObject *
+Connection_renewSubscription (Connection *self, PyObject *args, PyObject *kwds)
+{
+  int id;
+  int lease_duration = -1;
+  ipp_t *request, *answer;
+  static char *kwlist[] = { "id", "lease_duration", NULL };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "i|i", kwlist,
+				    &id, &lease_duration))
+    return NULL;
+
+  debugprintf ("-> Connection_renewSubscription()\n");
+  request = ippNewRequest (IPP_RENEW_SUBSCRIPTION);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, "/");
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+  ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+		 "notify-subscription-id", id);
+
+  if (lease_duration != -1)
+    ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+		   "notify-lease-duration", lease_duration);
+
+  Connection_begin_allow_threads (self);
+  answer = cupsDoRequest (self->http, request, "/");
+  Connection_end_allow_threads (self);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    debugprintf ("<- Connection_renewSubscription() EXCEPTION\n");
+    return NULL;
+  }
+
+  ippDelete (answer);
+  debugprintf ("<- Connection_renewSubscription()\n");
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+Connection_cancelSubscription (Connection *self, PyObject *args)
+{
+  int id;
+  ipp_t *request, *answer;
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTuple (args, "i", &id))
+    return NULL;
+
+  debugprintf ("-> Connection_cancelSubscription()\n");
+  request = ippNewRequest (IPP_CANCEL_SUBSCRIPTION);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, "/");
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+  ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+		"notify-subscription-id", id);
+
+  Connection_begin_allow_threads (self);
+  answer = cupsDoRequest (self->http, request, "/");
+  Connection_end_allow_threads (self);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    debugprintf ("<- Connection_cancelSubscription() EXCEPTION\n");
+    return NULL;
+  }
+
+  ippDelete (answer);
+  debugprintf ("<- Connection_cancelSubscription()\n");
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+Connection_printFile (Connection *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = { "printer", "filename", "title", "options",
+			    "mmap", "progress", NULL };
+  PyObject *printer_obj;
+  char *printer;
+  PyObject *filename_obj;
+  char *filename;
+  PyObject *title_obj;
+  char *title;
+  PyObject *options_obj, *key, *val;
+  char use_mmap = 0;
+  PyObject *progress_cb = NULL;
+  int num_settings = 0;
+  DICT_POS_TYPE pos = 0;
+  cups_option_t *settings = NULL;
+  int jobid;
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "OOOO|bO", kwlist,
+				    &printer_obj, &filename_obj, &title_obj,
+				    &options_obj, &use_mmap, &progress_cb))
+    return NULL;
+
+  if (progress_cb == Py_None)
+    progress_cb = NULL;
+
+  if (progress_cb && !PyCallable_Check (progress_cb)) {
+    PyErr_SetString (PyExc_TypeError, "progress must be callable");
+    return NULL;
+  }
+
+  if (UTF8_from_PyObj (&printer, printer_obj) == NULL)
+    return NULL;
+  if (UTF8_from_PyObj (&filename, filename_obj) == NULL) {
+    free (printer);
+    return NULL;
+  }
+  if (UTF8_from_PyObj (&title, title_obj) == NULL) {
+    free (filename);
+    free (printer);
+    return NULL;
+  }
+
+  if (!PyDict_Check (options_obj)) {
+    free (title);
+    free (filename);
+    free (printer);
+    PyErr_SetString (PyExc_TypeError, "options must be a dict");
+    return NULL;
+  }
+  while (PyDict_Next (options_obj, &pos, &key, &val)) {
+    char *name, *value;
+    if ((!PyUnicode_Check (key) && !PyBytes_Check (key)) ||
+        (!PyUnicode_Check (val) && !PyBytes_Check (val))) {
+      cupsFreeOptions (num_settings, settings);
+      free (title);
+      free (filename);
+      free (printer);
+      PyErr_SetString (PyExc_TypeError, "Keys and values must be strings");
+      return NULL;
+    }
+
+    num_settings = cupsAddOption (UTF8_from_PyObj (&name, key),
+				  UTF8_from_PyObj (&value, val),
+				  num_settings,
+				  &settings);
+    free (name);
+    free (value);
+  }
+
+  if (use_mmap || progress_cb)
+    jobid = print_mapped_files (self, printer, 1, &filename, title,
+				num_settings, settings, progress_cb);
+  else {
+    Connection_begin_allow_threads (self);
+    jobid = cupsPrintFile2 (self->http, printer, filename, title,
+			    num_settings, settings);
+    Connection_end_allow_threads (self);
+    if (jobid == 0)
+      set_ipp_error (cupsLastError (), cupsLastErrorString ());
+  }
+
+  if (jobid == 0) {
+    cupsFreeOptions (num_settings, settings);
+    free (title);
+    free (filename);
+    free (printer);
+    return NULL;
+  }
+
+  cupsFreeOptions (num_settings, settings);
+  free (title);
+  free (filename);
+  free (printer);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (jobid);
+#else
+  return PyInt_FromLong (jobid);
+#endif
+}
+
+static void
+free_string_list (int num_string, char **strings)
+{
+  int i;
+  for (i = 0; i < num_string; ++i) {
+    free (strings[i]);
+  }
+  free (strings);
+}
+
+static PyObject *
+Connection_printFiles (Connection *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = { "printer", "filenames", "title", "options",
+			    "mmap", "progress", NULL };
+  PyObject *printer_obj;
+  char *printer;
+  PyObject *filenames_obj;
+  int num_filenames;
+  char **filenames;
+  PyObject *title_obj;
+  char *title;
+  PyObject *options_obj, *key, *val;
+  char use_mmap = 0;
+  PyObject *progress_cb = NULL;
+  int num_settings = 0;
+  DICT_POS_TYPE pos = 0;
+  cups_option_t *settings = NULL;
+  int jobid;
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "OOOO|bO", kwlist,
+				    &printer_obj, &filenames_obj, &title_obj,
+				    &options_obj, &use_mmap, &progress_cb))
+    return NULL;
+
+  if (progress_cb == Py_None)
+    progress_cb = NULL;
+
+  if (progress_cb && !PyCallable_Check (progress_cb)) {
+    PyErr_SetString (PyExc_TypeError, "progress must be callable");
+    return NULL;
+  }
+
+  if (UTF8_from_PyObj (&printer, printer_obj) == NULL)
+    return NULL;
+
+  if (!PyList_Check (filenames_obj)) {
+    free (printer);
+    PyErr_SetString (PyExc_TypeError, "filenames must be a list");
+    return NULL;
+  }
+  num_filenames = PyList_Size (filenames_obj);
+  if (num_filenames == 0) {
+    free (printer);
+    PyErr_SetString (PyExc_RuntimeError, "filenames list is empty");
+    return NULL;
+  }
+  filenames = malloc (num_filenames * sizeof(char*));
+  for (pos = 0; pos < num_filenames; ++pos) {
+    PyObject *filename_obj = PyList_GetItem(filenames_obj, pos);
+    if (UTF8_from_PyObj (&filenames[pos], filename_obj) == NULL) {
+      free_string_list (pos, filenames);
+      free (printer);
+      return NULL;
+    }
+  }
+  if (UTF8_from_PyObj (&title, title_obj) == NULL) {
+    free_string_list (num_filenames, filenames);
+    free (printer);
+    return NULL;
+  }
+
+  if (!PyDict_Check (options_obj)) {
+    free (title);
+    free_string_list (num_filenames, filenames);
+    free (printer);
+    PyErr_SetString (PyExc_TypeError, "options must be a dict");
+    return NULL;
+  }
+  while (PyDict_Next (options_obj, &pos, &key, &val)) {
+    char *name, *value;
+    if ((!PyUnicode_Check (key) && !PyBytes_Check (key)) ||
+        (!PyUnicode_Check (val) && !PyBytes_Check (val))) {
+      cupsFreeOptions (num_settings, settings);
+      free (title);
+      free_string_list (num_filenames, filenames);
+      free (printer);
+      PyErr_SetString (PyExc_TypeError, "Keys and values must be strings");
+      return NULL;
+    }
+
+    num_settings = cupsAddOption (UTF8_from_PyObj (&name, key),
+				  UTF8_from_PyObj (&value, key),
+				  num_settings,
+				  &settings);
+    free (name);
+    free (value);
+  }
+
+  if (use_mmap || progress_cb)
+    jobid = print_mapped_files (self, printer, num_filenames, filenames,
+				title, num_settings, settings, progress_cb);
+  else {
+    Connection_begin_allow_threads (self);
+    jobid = cupsPrintFiles2 (self->http, printer, num_filenames,
+			     (const char **) filenames, title, num_settings,
+			     settings);
+    Connection_end_allow_threads (self);
+    if (jobid <= 0)
+      set_ipp_error (cupsLastError (), cupsLastErrorString ());
+  }
+
+  if (jobid <= 0) {
+    cupsFreeOptions (num_settings, settings);
+    free (title);
+    free_string_list (num_filenames, filenames);
+    free (printer);
+    return NULL;
+  }
+
+  cupsFreeOptions (num_settings, settings);
+  free (title);
+  free_string_list (num_filenames, filenames);
+  free (printer);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (jobid);
+#else
+  return PyInt_FromLong (jobid);
+#endif
+}
+
+static PyObject *
+Connection_doRequests (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *requests_obj;
+  PyObject *requests;
+  PyObject *result;
+  PyObject *resourceobj = NULL;
+  char *resource = NULL;
+  ipp_t **answers;
+  Py_ssize_t n, i;
+  ipp_status_t last_error = IPP_OK;
+  char *last_error_string = NULL;
+  Py_ssize_t failed = -1;
+  static char *kwlist[] = { "requests", "resource", NULL };
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|O", kwlist,
+				    &requests_obj, &resourceobj))
+    return NULL;
+
+  // Take a snapshot so the list can't change under us while the
+  // GIL is released.
+  requests = PySequence_Tuple (requests_obj);
+  if (!requests)
+    return NULL;
+
+  n = PyTuple_Size (requests);
+  for (i = 0; i < n; i++) {
+    PyObject *obj = PyTuple_GetItem (requests, i);
+    if (!PyObject_TypeCheck (obj, &cups_IPPRequestType)) {
+      Py_DECREF (requests);
+      PyErr_SetString (PyExc_TypeError, "List of IPPRequest objects required");
+      return NULL;
+    }
+  }
+
+  if (resourceobj) {
+    if (UTF8_from_PyObj (&resource, resourceobj) == NULL) {
+      Py_DECREF (requests);
+      return NULL;
+    }
+  }
+
+  answers = calloc (n ? n : 1, sizeof (ipp_t *));
+  if (!answers) {
+    Py_DECREF (requests);
+    free (resource);
+    return PyErr_NoMemory ();
+  }
+
+  debugprintf ("-> Connection_doRequests(%zd requests, \"%s\")\n",
+	       n, resource ? resource : "/");
+
+  // Send each request in turn over the same HTTP connection,
+  // releasing the GIL once for the whole batch.  The requests stay
+  // with the caller's IPPRequest objects, so they can be sent again.
+  Connection_begin_allow_threads (self);
+  for (i = 0; i < n; i++) {
+    IPPRequest *req = (IPPRequest *) PyTuple_GetItem (requests, i);
+    answers[i] = do_request_keep (self->http, req->ipp,
+				  resource ? resource : "/");
+    if (!answers[i]) {
+      last_error = cupsLastError ();
+      last_error_string = strdup (cupsLastErrorString ());
+      failed = i;
+      break;
+    }
+  }
+  Connection_end_allow_threads (self);
+
+  Py_DECREF (requests);
+  free (resource);
+
+  if (failed != -1) {
+    for (i = 0; i < failed; i++)
+      ippDelete (answers[i]);
+
+    free (answers);
+    set_ipp_error (last_error, last_error_string);
+    free (last_error_string);
+    debugprintf ("<- Connection_doRequests() (error)\n");
+    return NULL;
+  }
+
+  result = PyList_New (n);
+  if (!result) {
+    for (i = 0; i < n; i++)
+      ippDelete (answers[i]);
+
+    free (answers);
+    debugprintf ("<- Connection_doRequests() (error)\n");
+    return NULL;
+  }
+
+  for (i = 0; i < n; i++) {
+    IPPRequest *answer = build_IPPRequest (answers[i]);
+    if (!answer) {
+      Py_ssize_t j;
+      for (j = i; j < n; j++)
+	ippDelete (answers[j]);
+
+      free (answers);
+      Py_DECREF (result);
+      debugprintf ("<- Connection_doRequests() (error)\n");
+      return NULL;
+    }
+
+    PyList_SET_ITEM (result, i, (PyObject *) answer);
+  }
+
+  free (answers);
+  debugprintf ("<- Connection_doRequests() = list\n");
+  return result;
+}
+
+static PyObject *
+Connection_fileno (Connection *self)
+{
+  int fd = httpGetFd (self->http);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (fd);
+#else
+  return PyInt_FromLong (fd);
+#endif
+}
+
+static PyObject *
+Connection_sendRequest (Connection *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *requestobj;
+  PyObject *resourceobj = NULL;
+  IPPRequest *request;
+  char *resource = NULL;
+  http_status_t status;
+  static char *kwlist[] = { "request", "resource", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O!|O", kwlist,
+				    &cups_IPPRequestType, &requestobj,
+				    &resourceobj))
+    return NULL;
+
+  if (Connection_check_idle (self) < 0)
+    return NULL;
+
+  if (resourceobj) {
+    if (UTF8_from_PyObj (&resource, resourceobj) == NULL)
+      return NULL;
+  } else
+    resource = strdup ("/");
+
+  request = (IPPRequest *) requestobj;
+  debugprintf ("-> Connection_sendRequest(\"%s\")\n", resource);
+  Connection_begin_allow_threads (self);
+  status = cupsSendRequest (self->http, request->ipp, resource,
+			    ippLength (request->ipp));
+  Connection_end_allow_threads (self);
+
+  if (status != HTTP_CONTINUE && status != HTTP_OK) {
+    free (resource);
+    Connection_begin_allow_threads (self);
+    httpFlush (self->http);
+    Connection_end_allow_threads (self);
+    set_http_error (status);
+    debugprintf ("<- Connection_sendRequest() (error)\n");
+    return NULL;
+  }
+
+  // The response is collected by pollResponse.
+  self->pending_resource = resource;
+  debugprintf ("<- Connection_sendRequest() = %d\n", (int) status);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (status);
+#else
+  return PyInt_FromLong (status);
+#endif
+}
+
+static PyObject *
+Connection_pollResponse (Connection *self, PyObject *args, PyObject *kwds)
+{
+  double timeout = 0.0;
+  int ready;
+  ipp_t *answer;
+  static char *kwlist[] = { "timeout", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|d", kwlist, &timeout))
+    return NULL;
+
+  if (!self->pending_resource) {
+    PyErr_SetString (PyExc_RuntimeError, "no request pending");
+    return NULL;
+  }
+
+  debugprintf ("-> Connection_pollResponse(%f)\n", timeout);
+  Connection_begin_allow_threads (self);
+  ready = httpWait (self->http, (int) (timeout * 1000));
+  Connection_end_allow_threads (self);
+  if (!ready) {
+    debugprintf ("<- Connection_pollResponse() = None\n");
+    Py_RETURN_NONE;
+  }
+
+  Connection_begin_allow_threads (self);
+  answer = cupsGetResponse (self->http, self->pending_resource);
+  Connection_end_allow_threads (self);
+
+  free (self->pending_resource);
+  self->pending_resource = NULL;
+  if (!answer) {
+    set_ipp_error (cupsLastError (), cupsLastErrorString ());
+    debugprintf ("<- Connection_pollResponse() (error)\n");
+    return NULL;
+  }
+
+  debugprintf ("<- Connection_pollResponse() = IPPRequest\n");
+  return (PyObject *) build_IPPRequest (answer);
+}
+
+static PyObject *
+Connection_setTraceCallback (Connection *self, PyObject *args)
+{
+  PyObject *cb;
+
+  if (!PyArg_ParseTuple (args, "O", &cb))
+    return NULL;
+
+  if (cb == Py_None)
+    cb = NULL;
+  else if (!PyCallable_Check (cb)) {
+    PyErr_SetString (PyExc_TypeError, "callback must be callable or None");
+    return NULL;
+  }
+
+  Py_XINCREF (cb);
+  Py_XDECREF (self->trace_cb);
+  self->trace_cb = cb;
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+Connection_getLastRequestStats (Connection *self, void *closure)
+{
+  if (!self->last_stats)
+    Py_RETURN_NONE;
+
+  Py_INCREF (self->last_stats);
+  return self->last_stats;
+}
+
+PyGetSetDef Connection_getseters[] =
+  {
+    { "lastRequestStats",
+      (getter) Connection_getLastRequestStats, (setter) NULL,
+      "Metrics for the most recent getPrinters, getJobs, "
+      "getJobAttributes, getPrinterAttributes, getPPDs or getPPDs2 "
+      "call, as a dict, or None", NULL },
+
+    { NULL }
+  };
+
+PyMethodDef Connection_methods[] =
+  {
+    { "getPrinters",
+      (PyCFunction) Connection_getPrinters, METH_VARARGS | METH_KEYWORDS,
+      "getPrinters(lazy=False) -> dict\n\n"
+      "@type lazy: boolean\n"
+      "@param lazy: if true, return a read-only L{ResultMap} which \n"
+      "keeps the IPP response and decodes attributes on demand\n"
+      "@return: a dict, indexed by name, of dicts representing\n"
+      "queues, indexed by attribute.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getDests",
+      (PyCFunction) Connection_getDests, METH_NOARGS,
+      "getDests() -> dict\n\n"
+      "@return: a dict representing available destinations.  Each \n"
+      "dictionary key is a pair of (queue, instance) strings, and the \n"
+      "dictionary value is a L{cups.Dest} object.  In addition to the \n"
+      "available destinations, a special dictionary key (None,None) is \n"
+      "provided for looking up the default destination; this destination \n"
+      "will also be available under its own key.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getClasses",
+      (PyCFunction) Connection_getClasses, METH_NOARGS,
+      "getClasses() -> dict\n\n"
+      "@return: a dict, indexed by name, of objects representing\n"
+      "classes.  Each class object is either a string, in which case it\n"
+      "is for the remote class; or a list, in which case it is a list of\n"
+      "queue names.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getPPDs",
+      (PyCFunction) Connection_getPPDs, METH_VARARGS | METH_KEYWORDS,
+      "getPPDs(limit=0, exclude_schemes=None, include_schemes=None, \n"
+      "ppd_natural_language=None, ppd_device_id=None, ppd_make=None, \n"
+      "ppd_make_and_model=None, ppd_model_number=-1, ppd_product=None, \n"
+      "ppd_psversion=None, ppd_type=None, requested_attributes=None) \n"
+      "-> dict\n\n"
+      "@type limit: integer\n"
+      "@param limit: maximum number of PPDs to return\n"
+      "@type exclude_schemes: string list\n"
+      "@param exclude_schemes: list of PPD schemes to exclude\n"
+      "@type include_schemes: string list\n"
+      "@param include_schemes: list of PPD schemes to include\n"
+      "@type ppd_natural_language: string\n"
+      "@param ppd_natural_language: required language\n"
+      "@type ppd_device_id: string\n"
+      "@param ppd_device_id: IEEE 1284 Device ID to match against\n"
+      "@type ppd_make: string\n"
+      "@param ppd_make: required printer manufacturer\n"
+      "@type ppd_make_and_model: string\n"
+      "@param ppd_make_and_model: required make and model\n"
+      "@type ppd_model_number: integer\n"
+      "@param ppd_model_number: model number required (from cupsModelNumber \n"
+      "in PPD file)\n"
+      "@type ppd_product: string\n"
+      "@param ppd_product: required PostScript product string (Product)\n"
+      "@type ppd_psversion: string\n"
+      "@param ppd_psversion: required PostScript version (PSVersion)\n"
+      "@type ppd_type: string\n"
+      "@param ppd_type: required type of PPD. Valid values are fax; pdf; \n"
+      "postscript; raster; unknown.\n"
+      "@type requested_attributes: string list\n"
+      "@param requested_attributes: list of requested attribute names\n"
+      "@return: a dict, indexed by PPD name, of dicts representing\n"
+      "PPDs, indexed by attribute.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getPPDs2",
+      (PyCFunction) Connection_getPPDs2, METH_VARARGS | METH_KEYWORDS,
+      "getPPDs2(limit=0, exclude_schemes=None, include_schemes=None, \n"
+      "ppd_natural_language=None, ppd_device_id=None, ppd_make=None, \n"
+      "ppd_make_and_model=None, ppd_model_number=-1, ppd_product=None, \n"
+      "ppd_psversion=None, ppd_type=None, requested_attributes=None) \n"
+      "-> dict\n\n"
+      "@type limit: integer\n"
+      "@param limit: maximum number of PPDs to return\n"
+      "@type exclude_schemes: string list\n"
+      "@param exclude_schemes: list of PPD schemes to exclude\n"
+      "@type include_schemes: string list\n"
+      "@param include_schemes: list of PPD schemes to include\n"
+      "@type ppd_natural_language: string\n"
+      "@param ppd_natural_language: required language\n"
+      "@type ppd_device_id: string\n"
+      "@param ppd_device_id: IEEE 1284 Device ID to match against\n"
+      "@type ppd_make: string\n"
+      "@param ppd_make: required printer manufacturer\n"
+      "@type ppd_make_and_model: string\n"
+      "@param ppd_make_and_model: required make and model\n"
+      "@type ppd_model_number: integer\n"
+      "@param ppd_model_number: model number required (from cupsModelNumber \n"
+      "in PPD file)\n"
+      "@type ppd_product: string\n"
+      "@param ppd_product: required PostScript product string (Product)\n"
+      "@type ppd_psversion: string\n"
+      "@param ppd_psversion: required PostScript version (PSVersion)\n"
+      "@type ppd_type: string\n"
+      "@param ppd_type: required type of PPD. Valid values are fax; pdf; \n"
+      "postscript; raster; unknown.\n"
+      "@type requested_attributes: string list\n"
+      "@param requested_attributes: list of requested attribute names\n"
+      "@return: a dict, indexed by PPD name, of dicts representing\n"
+      "PPDs, indexed by attribute.  All attribute values are lists.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "iterPPDs",
+      (PyCFunction) Connection_iterPPDs, METH_VARARGS | METH_KEYWORDS,
+      "iterPPDs(limit=0, exclude_schemes=None, include_schemes=None, \n"
+      "ppd_natural_language=None, ppd_device_id=None, ppd_make=None, \n"
+      "ppd_make_and_model=None, ppd_model_number=-1, ppd_product=None, \n"
+      "ppd_psversion=None, ppd_type=None, requested_attributes=None, \n"
+      "all_lists=False) -> iterator\n\n"
+      "As L{getPPDs}, but each PPD is decoded as it is reached rather \n"
+      "than all of them being collected into one dict first.  Ask for \n"
+      "only the attributes needed, for example \n"
+      "requested_attributes=['ppd-make-and-model'], to keep the \n"
+      "response small.\n\n"
+      "@type all_lists: boolean\n"
+      "@param all_lists: whether all attribute values should be lists, \n"
+      "as for L{getPPDs2}\n"
+      "@return: an iterator of (PPD name, dict) tuples\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getServerPPD",
+      (PyCFunction) Connection_getServerPPD, METH_VARARGS,
+      "getServerPPD(ppd_name) -> string\n\n"
+      "Fetches the named PPD and stores it in a temporary file.\n\n"
+      "@type ppd_name: string\n"
+      "@param ppd_name: the ppd-name of a PPD\n"
+      "@return: temporary filename holding the PPD\n"
+      "@raise RuntimeError: Not supported in libcups until 1.3\n"
+      "@raise IPPError: IPP problem" },
+    
+    { "getDocument",
+      (PyCFunction) Connection_getDocument, METH_VARARGS,
+      "getDocument(printer_uri, job_id, document_number) -> dict\n\n"
+      "Fetches the job document and stores it in a temporary file.\n\n"
+      "@type printer_uri: string\n"
+      "@param printer_uri: the printer-uri for the printer\n"
+      "@type job_id: integer\n"
+      "@param job_id: the job ID\n"
+      "@type document_number: integer\n"
+      "@param document_number: the document number to retrieve\n"
+      "@return: a dict with the following keys: "
+      " 'file' (string), temporary filename holding the job document; "
+      " 'document-format' (string), its MIME type.  There may also be a "
+      " 'document-name' key, in which case this is for the document name.\n"
+      "@raise RuntimeError: Not supported in libcups until 1.4\n"
+      "@raise IPPError: IPP problem" },
+    
+    { "getDevices",
+      (PyCFunction) Connection_getDevices, METH_VARARGS | METH_KEYWORDS,
+      "getDevices(limit=0, exclude_schemes=None, include_schemes=None, timeout=0, cache_ttl=0) -> dict\n\n"
+      "@type limit: integer\n"
+      "@param limit: maximum number of devices to return\n"
+      "@type exclude_schemes: string list\n"
+      "@param exclude_schemes: URI schemes to exclude\n"
       "@type include_schemes: string list\n"
-      "@param include_schemes: list of PPD schemes to include\n"
-      "@type ppd_natural_language: string\n"
-      "@param ppd_natural_language: required language\n"
-      "@type ppd_device_id: string\n"
-      "@param ppd_device_id: IEEE 1284 Device ID to match against\n"
-      "@type ppd_make: string\n"
-      "@param ppd_make: required printer manufacturer\n"
-      "@type ppd_make_and_model: string\n"
-      "@param ppd_make_and_model: required make and model\n"
-      "@type ppd_model_number: integer\n"
-      "@param ppd_model_number: model number required (from cupsModelNumber \n"
-      "in PPD file)\n"
-      "@type ppd_product: string\n"
-      "@param ppd_product: required PostScript product string (Product)\n"
-      "@type ppd_psversion: string\n"
-      "@param ppd_psversion: required PostScript version (PSVersion)\n"
-      "@type ppd_type: string\n"
-      "@param ppd_type: required type of PPD. Valid values are fax; pdf; \n"
-      "postscript; raster; unknown.\n"
-      "@return: a dict, indexed by PPD name, of dicts representing\n"
-      "PPDs, indexed by attribute.\n"
+      "@param include_schemes: URI schemes to include\n"
+      "@type timeout: integer\n"
+      "@param timeout: seconds the server should wait for backends\n"
+      "@type cache_ttl: float\n"
+      "@param cache_ttl: if positive, return the devices found by an\n"
+      "earlier call with the same server, limit and schemes if that was\n"
+      "less than this many seconds ago, and remember the result of this\n"
+      "call otherwise.  See L{cups.clearDeviceCache}.\n"
+      "@return: a dict, indexed by device URI, of dicts representing\n"
+      "devices, indexed by attribute.\n"
+      "@raise IPPError: IPP problem" },    
+
+    { "streamDevices",
+      (PyCFunction) Connection_streamDevices, METH_VARARGS | METH_KEYWORDS,
+      "streamDevices(callback, exclude_schemes=None, include_schemes=None, timeout=0, cache_ttl=0) -> dict\n\n"
+      "Like L{getDevices}, but calls callback(device_uri, device) for\n"
+      "each device as soon as the server reports it, rather than\n"
+      "waiting for all backends to finish.  If callback raises an\n"
+      "exception, later devices are discarded and the exception is\n"
+      "raised once the server has finished.\n\n"
+      "@type callback: callable\n"
+      "@param callback: function to call for each device\n"
+      "@type exclude_schemes: string list\n"
+      "@param exclude_schemes: URI schemes to exclude\n"
+      "@type include_schemes: string list\n"
+      "@param include_schemes: URI schemes to include\n"
+      "@type timeout: integer\n"
+      "@param timeout: seconds the server should wait for backends\n"
+      "@type cache_ttl: float\n"
+      "@param cache_ttl: as for L{getDevices}; cached devices are\n"
+      "passed to callback straight away\n"
+      "@return: a dict, indexed by device URI, of dicts representing\n"
+      "devices, indexed by attribute.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getJobs",
+      (PyCFunction) Connection_getJobs, METH_VARARGS | METH_KEYWORDS,
+      "getJobs(which_jobs='not-completed', my_jobs=False, limit=-1, first_job_id=-1, requested_attributes=None, lazy=False) -> dict\n"
+      "Fetch a list of jobs.\n"
+      "@type which_jobs: string\n"
+      "@param which_jobs: which jobs to fetch; possible values: \n"
+      "'completed', 'not-completed', 'all'\n"
+      "@type my_jobs: boolean\n"
+      "@param my_jobs: whether to restrict the returned jobs to those \n"
+      "owned by the current CUPS user (as set by L{cups.setUser}).\n"
+      "@return: a dict, indexed by job ID, of dicts representing job\n"
+      "attributes.\n"
+      "@type limit: integer\n"
+      "@param limit: maximum number of jobs to return\n"
+      "@type first_job_id: integer\n"
+      "@param first_job_id: lowest job ID to return\n"
+      "@type requested_attributes: string list\n"
+      "@param requested_attributes: list of requested attribute names\n"
+      "@type lazy: boolean\n"
+      "@param lazy: if true, return a read-only L{ResultMap} which \n"
+      "keeps the IPP response and decodes attributes on demand\n"
+      "@raise IPPError: IPP problem" },
+
+    { "iterJobs",
+      (PyCFunction) Connection_iterJobs, METH_VARARGS | METH_KEYWORDS,
+      "iterJobs(which_jobs='not-completed', my_jobs=False, page_size=100, requested_attributes=None) -> iterator\n"
+      "Iterate over jobs, fetching them page_size at a time.  While \n"
+      "one page is being consumed the request for the next is already \n"
+      "with the server, so only about one page is held in memory.\n"
+      "Paging relies on the server returning jobs in job ID order, \n"
+      "which CUPS guarantees only for 'completed' and 'all'.  For \n"
+      "other which_jobs values, which it orders by priority, the job \n"
+      "IDs are listed first and the jobs then fetched page_size IDs \n"
+      "at a time, in the server's order.\n"
+      "@type which_jobs: string\n"
+      "@param which_jobs: which jobs to fetch; possible values: \n"
+      "'completed', 'not-completed', 'all'\n"
+      "@type my_jobs: boolean\n"
+      "@param my_jobs: whether to restrict the returned jobs to those \n"
+      "owned by the current CUPS user (as set by L{cups.setUser}).\n"
+      "@type page_size: integer\n"
+      "@param page_size: number of jobs to fetch per request\n"
+      "@type requested_attributes: string list\n"
+      "@param requested_attributes: list of requested attribute names\n"
+      "@return: an iterator of (job ID, dict) tuples, the dicts being \n"
+      "as for L{getJobs}.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getJobsColumnar",
+      (PyCFunction) Connection_getJobsColumnar, METH_VARARGS | METH_KEYWORDS,
+      "getJobsColumnar(attrs, which_jobs='not-completed', my_jobs=False, limit=-1, first_job_id=-1) -> dict\n"
+      "Fetch job attributes as columns rather than one dict per job.\n"
+      "Integer, enum and boolean attributes known to pycups (such as \n"
+      "job-k-octets and time-at-creation) are returned as \n"
+      "array.array('q') objects, with -1 where a job has no value.  \n"
+      "Other attributes are returned as lists, with None where a job \n"
+      "has no value.  The job-id column is always included.\n"
+      "@type attrs: string list\n"
+      "@param attrs: attribute names, one column for each\n"
+      "@type which_jobs: string\n"
+      "@param which_jobs: which jobs to fetch; possible values: \n"
+      "'completed', 'not-completed', 'all'\n"
+      "@type my_jobs: boolean\n"
+      "@param my_jobs: whether to restrict the returned jobs to those \n"
+      "owned by the current CUPS user (as set by L{cups.setUser}).\n"
+      "@type limit: integer\n"
+      "@param limit: maximum number of jobs to return\n"
+      "@type first_job_id: integer\n"
+      "@param first_job_id: lowest job ID to return\n"
+      "@return: a dict, indexed by attribute name, of columns, all \n"
+      "having one entry per job in the same order.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getJobAttributes",
+      (PyCFunction) Connection_getJobAttributes, METH_VARARGS | METH_KEYWORDS,
+      "getJobAttributes(jobid, requested_attributes=None) -> dict\n\n"
+      "Fetch job attributes.\n"
+      "@type jobid: integer\n"
+      "@param jobid: job ID\n"
+      "@type requested_attributes: string list\n"
+      "@param requested_attributes: list of requested attribute names\n"
+      "@return: a dict representing job attributes.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "cancelJob",
+      (PyCFunction) Connection_cancelJob, METH_VARARGS | METH_KEYWORDS,
+      "cancelJob(jobid, purge_job=False) -> None\n\n"
+      "@type jobid: integer\n"
+      "@param jobid: job ID to cancel\n"
+      "@type purge_job: boolean\n"
+      "@param purge_job: whether to remove data and control files\n"
+      "@raise IPPError: IPP problem" },
+
+    { "cancelAllJobs",
+      (PyCFunction) Connection_cancelAllJobs, METH_VARARGS | METH_KEYWORDS,
+      "cancelAllJobs(name=None, uri=None, my_jobs=False, purge_jobs=True) -> None\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type uri: string\n"
+      "@param uri: printer URI\n"
+      "@type my_jobs: boolean\n"
+      "@param my_jobs: whether to restrict operation to jobs owned by \n"
+      "the current CUPS user (as set by L{cups.setUser}).\n"
+      "@type purge_jobs: boolean\n"
+      "@param purge_jobs: whether to remove data and control files\n"
+      "@raise IPPError: IPP problem" },
+
+    { "moveJob",
+      (PyCFunction) Connection_moveJob, METH_VARARGS | METH_KEYWORDS,
+      "moveJob(printer_uri=None, job_id=-1, job_printer_uri) -> None\n\n"
+      "Move a job specified by printer_uri and jobid (only one need be given)\n"
+      "to the printer specified by job_printer_uri.\n\n"
+      "@type job_id: integer\n"
+      "@param job_id: job ID to move\n"
+      "@type printer_uri: string\n"
+      "@param printer_uri: printer to move job(s) from\n"
+      "@type job_printer_uri: string\n"
+      "@param job_printer_uri: printer to move job(s) to\n"
+      "@raise IPPError: IPP problem" },
+
+    { "authenticateJob",
+      (PyCFunction) Connection_authenticateJob, METH_VARARGS,
+      "authenticateJob(jobid, auth_info=None) -> None\n\n"
+      "@type jobid: integer\n"
+      "@param jobid: job ID to authenticate\n"
+      "@type auth_info: optional string list\n"
+      "@param auth_info: authentication details\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setJobHoldUntil",
+      (PyCFunction) Connection_setJobHoldUntil, METH_VARARGS,
+      "setJobHoldUntil(jobid, job_hold_until) -> None\n\n"
+      "Specifies when a job should be printed.\n"
+      "@type jobid: integer\n"
+      "@param jobid: job ID to adjust\n"
+      "@type job_hold_until: string\n"
+      "@param job_hold_until: when to print the job; examples: 'hold', \n"
+      "'immediate', 'restart', resume'\n"
+      "@raise IPPError: IPP problem"},
+    
+    { "restartJob",
+      (PyCFunction) Connection_restartJob, METH_VARARGS | METH_KEYWORDS,
+      "restartJob(job_id, job_hold_until=None) -> None\n\n"
+      "Restart a job.\n\n"
+      "@type job_id: integer\n"
+      "@param job_id: job ID to restart\n"
+      "@type job_hold_until: string\n"
+      "@param job_hold_until: new job-hold-until value for job\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setTraceCallback",
+      (PyCFunction) Connection_setTraceCallback, METH_VARARGS,
+      "setTraceCallback(fn) -> None\n\n"
+      "Set a function to be called after each call that records\n"
+      "L{lastRequestStats}, with the Connection and the new stats as\n"
+      "arguments.  The stats dict has keys 'operation', 'wall' and\n"
+      "'released' (seconds elapsed and seconds spent without the GIL),\n"
+      "'request_bytes' and 'response_bytes' (IPP message sizes),\n"
+      "'attributes' (attributes in the responses) and 'failed'.\n\n"
+      "@type fn: callable or None\n"
+      "@param fn: trace function, or None to remove it" },
+
+    { "cancelJobs",
+      (PyCFunction) Connection_cancelJobs, METH_VARARGS | METH_KEYWORDS,
+      "cancelJobs(job_ids, purge_job=False) -> dict\n\n"
+      "Cancel several jobs.  A single Cancel-Jobs request is tried \n"
+      "first; if the server refuses it, each job is cancelled in \n"
+      "turn, all without reacquiring the global interpreter lock.\n\n"
+      "@type job_ids: integer list\n"
+      "@param job_ids: job IDs to cancel\n"
+      "@type purge_job: boolean\n"
+      "@param purge_job: whether to remove data and control files\n"
+      "@return: dict indexed by job ID of IPP status codes" },
+
+    { "holdJobs",
+      (PyCFunction) Connection_holdJobs, METH_VARARGS | METH_KEYWORDS,
+      "holdJobs(job_ids, job_hold_until='indefinite') -> dict\n\n"
+      "Hold several jobs.\n\n"
+      "@type job_ids: integer list\n"
+      "@param job_ids: job IDs to hold\n"
+      "@type job_hold_until: string\n"
+      "@param job_hold_until: job-hold-until value for the jobs\n"
+      "@return: dict indexed by job ID of IPP status codes" },
+
+    { "releaseJobs",
+      (PyCFunction) Connection_releaseJobs, METH_VARARGS | METH_KEYWORDS,
+      "releaseJobs(job_ids) -> dict\n\n"
+      "Release several held jobs.\n\n"
+      "@type job_ids: integer list\n"
+      "@param job_ids: job IDs to release\n"
+      "@return: dict indexed by job ID of IPP status codes" },
+
+    { "moveJobs",
+      (PyCFunction) Connection_moveJobs, METH_VARARGS | METH_KEYWORDS,
+      "moveJobs(job_ids, job_printer_uri) -> dict\n\n"
+      "Move several jobs to another destination.\n\n"
+      "@type job_ids: integer list\n"
+      "@param job_ids: job IDs to move\n"
+      "@type job_printer_uri: string\n"
+      "@param job_printer_uri: new printer URI\n"
+      "@return: dict indexed by job ID of IPP status codes" },
+
+    { "getFile",
+      (PyCFunction) Connection_getFile, METH_VARARGS | METH_KEYWORDS,
+      "getFile(resource, filename=None, fd=-1, file=None) -> None\n\n"
+      "Fetch a CUPS server resource to a local file.\n\n"
+      "This is for obtaining CUPS server configuration files and \n"
+      "log files.\n\n"
+      "@type resource: string\n"
+      "@param resource: resource name\n"
+      "@type filename: string\n"
+      "@param filename: name of local file for storage\n"
+      "@type fd: int\n"
+      "@param fd: file descriptor of local file\n"
+      "@type file: file\n"
+      "@param file: Python file object for local file\n"
+      "@raise HTTPError: HTTP problem" },
+
+    { "putFile",
+      (PyCFunction) Connection_putFile, METH_VARARGS | METH_KEYWORDS,
+      "putFile(resource, filename=None, fd=-1, file=None, mmap=False,\n"
+      "progress=None) -> None\n\n"
+      "This is for uploading new configuration files for the CUPS \n"
+      "server.  Note: L{adminSetServerSettings} is a way of \n"
+      "adjusting server settings without needing to parse the \n"
+      "configuration file.\n"
+      "@type resource: string\n"
+      "@param resource: resource name\n"
+      "@type filename: string\n"
+      "@param filename: name of local file to upload\n"
+      "@type fd: int\n"
+      "@param fd: file descriptor of local file\n"
+      "@type file: file\n"
+      "@param file: Python file object for local file\n"
+      "@type mmap: boolean\n"
+      "@param mmap: send the file from a memory mapping rather than\n"
+      "reading it through a buffer; the file must be a regular file\n"
+      "@type progress: callable\n"
+      "@param progress: function called as progress(sent, total, rate)\n"
+      "with byte counts and bytes per second as the file is sent;\n"
+      "implies mmap\n"
+      "@raise HTTPError: HTTP problem"},
+
+    { "addPrinter",
+      (PyCFunction) Connection_addPrinter, METH_VARARGS | METH_KEYWORDS,
+      "addPrinter(name) -> None\n\n"
+      "Add or adjust a print queue.  Several parameters can select which\n"
+      "PPD to use (filename, ppdname, and ppd) but only one may be\n"
+      "given.\n\n"
+      "@type filename: string\n"
+      "@keyword filename: local filename of PPD file\n"
+      "@type ppdname: string\n"
+      "@keyword ppdname: filename from L{getPPDs}\n"
+      "@type info: string\n"
+      "@keyword info: human-readable information about the printer\n"
+      "@type location: string\n"
+      "@keyword location: human-readable printer location\n"
+      "@type device: string\n"
+      "@keyword device: device URI string\n"
+      "@type ppd: L{cups.PPD} instance\n"
+      "@keyword ppd: PPD object\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setPrinterDevice",
+      (PyCFunction) Connection_setPrinterDevice, METH_VARARGS,
+      "setPrinterDevice(name, device_uri) -> None\n\n"
+      "Set the device URI for a printer.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type device_uri: string\n"
+      "@param device_uri: device URI\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setPrinterInfo",
+      (PyCFunction) Connection_setPrinterInfo, METH_VARARGS,
+      "setPrinterInfo(name, info) -> None\n\n"
+      "Set the human-readable information about a printer.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type info: string\n"
+      "@param info: human-readable information about the printer\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setPrinterLocation",
+      (PyCFunction) Connection_setPrinterLocation, METH_VARARGS,
+      "setPrinterLocation(name, location) -> None\n\n"
+      "Set the human-readable printer location\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type location: string\n"
+      "@param location: human-readable printer location\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setPrinterShared",
+      (PyCFunction) Connection_setPrinterShared, METH_VARARGS,
+      "setPrinterShared(name, shared) -> None\n\n"
+      "Set whether a printer is shared with other people.  This works \n"
+      "with CUPS servers of at least version 1.2, by setting the \n"
+      "printer-is-shared printer attribute.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type shared: boolean\n"
+      "@param shared: whether printer should be shared\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setPrinterJobSheets",
+      (PyCFunction) Connection_setPrinterJobSheets, METH_VARARGS,
+      "setPrinterJobSheets(name, start, end) -> None\n\n"
+      "Specifies job sheets for a printer.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type start: string\n"
+      "@param start: name of a sheet to print before each job\n"
+      "@type end: string\n"
+      "@param end: name of a sheet to print after each job\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setPrinterErrorPolicy",
+      (PyCFunction) Connection_setPrinterErrorPolicy, METH_VARARGS,
+      "setPrinterErrorPolicy(name, policy) -> None\n\n"
+      "Set the printer's error policy.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type policy: string\n"
+      "@param policy: policy name; supported policy names can be found \n"
+      "by using the L{getPrinterAttributes} function and looking for the \n"
+      "'printer-error-policy-supported' attribute\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setPrinterOpPolicy",
+      (PyCFunction) Connection_setPrinterOpPolicy, METH_VARARGS,
+      "setPrinterOpPolicy(name, policy) -> None\n\n"
+      "Set the printer's operation policy.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type policy: string\n"
+      "@param policy: policy name; supported policy names can be found \n"
+      "by using the L{getPrinterAttributes} function and looking for the \n"
+      "'printer-op-policy-supported' attribute\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setPrinterUsersAllowed",
+      (PyCFunction) Connection_setPrinterUsersAllowed, METH_VARARGS,
+      "setPrinterUsersAllowed(name, allowed) -> None\n\n"
+      "Set the list of users allowed to use a printer.  This works \n"
+      "with CUPS server of at least version 1.2, by setting the \n"
+      "requesting-user-name-allowed printer attribute.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type allowed: string list\n"
+      "@param allowed: list of allowed users; ['all'] \n"
+      "means there will be no user-name restriction.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "setPrinterUsersDenied",
+      (PyCFunction) Connection_setPrinterUsersDenied, METH_VARARGS,
+      "setPrinterUsersDenied(name, denied) -> None\n\n"
+      "Set the list of users denied the use of a printer.  This works \n"
+      "with CUPS servers of at least version 1.2, by setting the \n"
+      "requesting-user-name-denied printer attribute.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type denied: string list\n"
+      "@param denied: list of denied users; ['none'] \n"
+      "means there will be no user-name restriction.\n"
+      "@raise IPPError: IPP problem" },
+
+    { "addPrinterOptionDefault",
+      (PyCFunction) Connection_addPrinterOptionDefault, METH_VARARGS,
+      "addPrinterOptionDefault(name, option, value) -> None\n\n"
+      "Set a network default option.  Jobs submitted to the named queue \n"
+      "will have the job option added if it is not already present in the \n"
+      "job.  This works with CUPS servers of at least version 1.2.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type option: string\n"
+      "@param option: option name, for example 'job-priority'\n"
+      "@type value: string\n"
+      "@param value: option value as a string\n"
+      "@raise IPPError: IPP problem" },
+
+    { "deletePrinterOptionDefault",
+      (PyCFunction) Connection_deletePrinterOptionDefault, METH_VARARGS,
+      "deletePrinterOptionDefault(name, option) -> None\n\n"
+      "Removes a network default option.  See L{addPrinterOptionDefault}.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type option: string\n"
+      "@param option: option name, for example 'job-priority'\n"
+      "@raise IPPError: IPP problem" },
+
+    { "deletePrinter",
+      (PyCFunction) Connection_deletePrinter, METH_VARARGS | METH_KEYWORDS,
+      "deletePrinter(name) -> None\n\n"
+      "Delete a printer.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getPrinterAttributes",
+      (PyCFunction) Connection_getPrinterAttributes,
+      METH_VARARGS | METH_KEYWORDS,
+      "getPrinterAttributes(name=None, uri=None, requested_attributes=None) -> dict\n"
+      "Fetch the attributes for a printer, specified either by name or by \n"
+      "uri but not both.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type uri: string\n"
+      "@param uri: queue URI\n"
+      "@type requested_attributes: string list\n"
+      "@param requested_attributes: list of requested attribute names\n"
+      "@return: a dict, indexed by attribute, of printer attributes\n"
+      "for the specified printer.\n\n"
+      "Attributes:\n"
+      "  - 'job-sheets-supported': list of strings\n"
+      "  - 'job-sheets-default': tuple of strings (start, end)\n"
+      "  - 'printer-error-policy-supported': if present, list of strings\n"
+      "  - 'printer-error-policy': if present, string\n"
+      "  - 'printer-op-policy-supported': if present, list of strings\n"
+      "  - 'printer-op-policy': if present, string\n\n"
+      "There are other attributes; the exact list of attributes returned \n"
+      "will depend on the IPP server.\n"
+      "@raise IPPError: IPP problem"},
+
+    { "addPrinterToClass",
+      (PyCFunction) Connection_addPrinterToClass, METH_VARARGS,
+      "addPrinterToClass(name, class) -> None\n\n"
+      "Add a printer to a class.  If the class does not yet exist, \n"
+      "it is created.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type class: string\n"
+      "@param class: class name\n"
+      "@raise IPPError: IPP problem" },
+
+    { "deletePrinterFromClass",
+      (PyCFunction) Connection_deletePrinterFromClass, METH_VARARGS,
+      "deletePrinterFromClass(name, class) -> None\n\n"
+      "Remove a printer from a class.  If the class would be left empty, \n"
+      "it is removed.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type class: string\n"
+      "@param class: class name\n"
+      "@raise IPPError: IPP problem" },
+
+    { "deleteClass",
+      (PyCFunction) Connection_deleteClass, METH_VARARGS,
+      "deleteClass(class) -> None\n\n"
+      "Delete a class.\n\n"
+      "@type class: string\n"
+      "@param class: class name\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getDefault",
+      (PyCFunction) Connection_getDefault, METH_NOARGS,
+      "getDefault() -> string or None\n\n"
+      "Get the system default printer.\n\n"
+      "@return: default printer name or None" },
+
+    { "setDefault",
+      (PyCFunction) Connection_setDefault, METH_VARARGS | METH_KEYWORDS,
+      "setDefault(name) -> None\n\n"
+      "Set the system default printer.  Note that this can be over-ridden \n"
+      "on a per-user basis using the lpoptions command.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getPPD",
+      (PyCFunction) Connection_getPPD, METH_VARARGS,
+      "getPPD(name) -> string\n\n"
+      "Fetch a printer's PPD.  If a PPD cache has been set with \n"
+      "L{cups.setPPDCache}, the PPD is copied from there when the \n"
+      "server's copy has not changed.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@return: temporary PPD file name\n"
+      "@raise IPPError: IPP problem" },
+
+#ifdef HAVE_CUPS_1_4
+    { "getPPD3",
+      (PyCFunction) Connection_getPPD3, METH_VARARGS | METH_KEYWORDS,
+      "getPPD3(name[, modtime, filename]) -> (status,modtime,filename)\n\n"
+      "Fetch a printer's PPD if it is newer.  With a PPD cache (see \n"
+      "L{cups.setPPDCache}), a PPD that is newer than the caller's but \n"
+      "unchanged on the server is copied from the cache.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type modtime: float\n"
+      "@param modtime: modification time of existing file\n"
+      "@type filename: string\n"
+      "@param filename: filename of existing file\n"
+      "@return: tuple of HTTP status, modification time, and filename\n" },
+#endif /* HAVE_CUPS_1_4 */
+
+    { "enablePrinter",
+      (PyCFunction) Connection_enablePrinter, METH_VARARGS | METH_KEYWORDS,
+      "enablePrinter(name) -> None\n\n"
+      "Enable printer.  This allows the printer to process its job queue.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@raise IPPError: IPP problem" },
+
+    { "disablePrinter",
+      (PyCFunction) Connection_disablePrinter, METH_VARARGS | METH_KEYWORDS,
+      "disablePrinter(name) -> None\n\n"
+      "Disable printer.  This prevents the printer from processing its \n"
+      "job queue.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type reason: string\n"
+      "@keyword reason: optional human-readable reason for disabling the \n"
+      "printer\n"
+      "@raise IPPError: IPP problem" },
+
+    { "acceptJobs",
+      (PyCFunction) Connection_acceptJobs, METH_VARARGS | METH_KEYWORDS,
+      "acceptJobs(name) -> None\n\n"
+      "Cause printer to accept jobs.\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@raise IPPError: IPP problem" },
+
+    { "rejectJobs",
+      (PyCFunction) Connection_rejectJobs, METH_VARARGS | METH_KEYWORDS,
+      "rejectJobs(name)\n\n"
+      "Cause printer to reject jobs.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type reason: string\n"
+      "@keyword reason: optional human-readable reason for rejecting jobs\n"
+      "@raise IPPError: IPP problem" },
+
+    { "printTestPage",
+      (PyCFunction) Connection_printTestPage, METH_VARARGS | METH_KEYWORDS,
+      "printTestPage(name) -> job ID\n\n"
+      "Print a test page.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type file: string\n"
+      "@keyword file: input file (default is CUPS test page)\n"
+      "@type title: string\n"
+      "@keyword title: job title (default 'Test Page')\n"
+      "@type format: string\n"
+      "@keyword format: document format (default 'application/postscript')\n"
+      "@type user: string\n"
+      "@keyword user: user to submit the job as\n"
+      "@raise IPPError: IPP problem" },
+
+    { "adminExportSamba",
+      (PyCFunction) Connection_adminExportSamba, METH_VARARGS,
+      "adminExportSamba(name, samba_server, samba_username,\n"
+      "                 samba_password) -> None\n\n"
+      "Export a printer to Samba.\n\n"
+      "@type name: string\n"
+      "@param name: queue name\n"
+      "@type samba_server: string\n"
+      "@param samba_server: samba server\n"
+      "@type samba_username: string\n"
+      "@param samba_username: samba username\n"
+      "@type samba_password: string\n"
+      "@param samba_password: samba password\n"
+      "@raise IPPError: IPP problem" },
+
+    { "adminGetServerSettings",
+      (PyCFunction) Connection_adminGetServerSettings, METH_NOARGS,
+      "adminGetServerSettings() -> dict\n\n"
+      "Get server settings.\n\n"
+      "@return: dict representing server settings; keywords include \n"
+      "L{CUPS_SERVER_DEBUG_LOGGING}, L{CUPS_SERVER_REMOTE_ADMIN}, \n"
+      "L{CUPS_SERVER_REMOTE_PRINTERS}, L{CUPS_SERVER_SHARE_PRINTERS}, \n"
+      "L{CUPS_SERVER_USER_CANCEL_ANY}\n"
+      "@see: L{adminSetServerSettings}\n"
+      "@raise IPPError: IPP problem" },
+
+    { "adminSetServerSettings",
+      (PyCFunction) Connection_adminSetServerSettings, METH_VARARGS,
+      "adminSetServerSettings(settings) -> None\n\n"
+      "Set server settings.\n\n"
+      "@type settings: dict\n"
+      "@param settings: dict of server settings\n"
+      "@see: L{adminGetServerSettings}\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getSubscriptions",
+      (PyCFunction) Connection_getSubscriptions, METH_VARARGS | METH_KEYWORDS,
+      "getSubscriptions(uri) -> integer list\n\n"
+      "Get subscriptions.\n\n"
+      "@type uri: string\n"
+      "@param uri: URI for object\n"
+      "@type my_subscriptions: boolean\n"
+      "@keyword my_subscriptions: only return subscriptions belonging to \n"
+      "the current user (default False)\n"
+      "@type job_id: integer\n"
+      "@keyword job_id: only return subscriptions relating to this job\n"
+      "@return: list of subscriptions\n"
+      "@raise IPPError: IPP problem" },
+
+    { "createSubscription",
+      (PyCFunction) Connection_createSubscription,
+      METH_VARARGS | METH_KEYWORDS,
+      "createSubscription(uri, events=[], job_id=-1, recipient_uri="",\n"
+      "                   lease_duration=-1, time_interval=-1,\n"
+      "                   user_data="") -> integer\n\n"
+      "Create a subscription.\n\n"
+      "@type uri: string\n"
+      "@param uri: URI for object\n"
+      "@type events: string list\n"
+      "@keyword events: events to receive notifications for\n"
+      "@type job_id: integer\n"
+      "@keyword job_id: job ID to receive notifications for\n"
+      "@type recipient_uri: string\n"
+      "@keyword recipient_uri: URI for notifications recipient\n"
+      "@type lease_duration: integer\n"
+      "@keyword lease_duration: lease duration in seconds\n"
+      "@type time_interval: integer\n"
+      "@keyword time_interval: time interval\n"
+      "@type user_data: string\n"
+      "@keyword user_data: user data to receieve with notifications\n"
+      "@return: subscription ID\n"
+      "@raise IPPError: IPP problem" },
+
+    { "getNotifications",
+      (PyCFunction) Connection_getNotifications, METH_VARARGS | METH_KEYWORDS,
+      "getNotifications(subscription_ids) -> list\n\n"
+      "Get notifications for subscribed events.\n\n"
+      "@type subscription_ids: integer list\n"
+      "@param subscription_ids: list of subscription IDs to receive \n"
+      "notifications for\n"
+      "@return: list of dicts, each representing an event\n"
+      "@raise IPPError: IPP problem" },
+
+    { "cancelSubscription",
+      (PyCFunction) Connection_cancelSubscription, METH_VARARGS,
+      "cancelSubscription(id) -> None\n\n"
+      "Cancel a subscription.\n\n"
+      "@type id: integer\n"
+      "@param id: subscription ID\n"
+      "@raise IPPError: IPP problem" },
+
+    { "renewSubscription",
+      (PyCFunction) Connection_renewSubscription, METH_VARARGS | METH_KEYWORDS,
+      "renewSubscription(id, lease_duration=-1) -> None\n\n"
+      "Renew a subscription.\n\n"
+      "@type id: integer\n"
+      "@param id: subscription ID\n"
+      "@type lease_duration: integer\n"
+      "@param lease_duration: lease duration in seconds\n"
+      "@raise IPPError: IPP problem" },
+
+    { "createJob",
+      (PyCFunction) Connection_createJob, METH_VARARGS | METH_KEYWORDS,
+      "createJob(printer, title, options) -> integer\n\n"
+      "Create an empty job for streaming.\n\n"
+      "@type printer: string\n"
+      "@param printer: queue name\n"
+      "@type title: string\n"
+      "@param title: title of the print job\n"
+      "@type options: dict\n"
+      "@param options: dict of options\n"
+      "@return: job ID\n"
+      "@raise IPPError: IPP problem" },
+
+    { "startDocument",
+      (PyCFunction) Connection_startDocument, METH_VARARGS | METH_KEYWORDS,
+      "startDocument(printer, job_id, doc_name, format, last_document) -> integer\n\n"
+      "Add a document to a job created with createJob.\n\n"
+      "@type printer: string\n"
+      "@param printer: queue name\n"
+      "@type job_id: integer\n"
+      "@param job_id: job ID to create document\n"
+      "@type doc_name: string\n"
+      "@param doc_name: name of the document\n"
+      "@type format: string\n"
+      "@param format: MIME type\n"
+      "@type last_document: integer\n"
+      "@param last_document: 1 for last document of job, 0 otherwise\n"
+      "@return: HTTP status\n"
+      "@raise IPPError: IPP problem" },
+
+    { "writeRequestData",
+      (PyCFunction) Connection_writeRequestData, METH_VARARGS | METH_KEYWORDS,
+      "writeRequestData(buffer, length=-1) -> integer\n\n"
+      "Write data after an IPP request.\n\n"
+      "@type buffer: bytes-like object\n"
+      "@param buffer: bytes to write; any object supporting the buffer\n"
+      "protocol, such as bytes, bytearray, memoryview or mmap\n"
+      "@type length: integer\n"
+      "@param length: number of bytes to write, or -1 for all of them\n"
+      "@return: HTTP status\n"
+      "@raise IPPError: IPP problem" },
+
+    { "finishDocument",
+      (PyCFunction) Connection_finishDocument, METH_VARARGS | METH_KEYWORDS,
+      "finishDocument(printer) -> integer\n\n"
+      "Finish sending a document.\n\n"
+      "@type printer: string\n"
+      "@param printer: queue name\n"
+      "@return: HTTP status\n"
+      "@raise IPPError: IPP problem" },
+
+    { "printFile",
+      (PyCFunction) Connection_printFile, METH_VARARGS | METH_KEYWORDS,
+      "printFile(printer, filename, title, options, mmap=False,\n"
+      "progress=None) -> integer\n\n"
+      "Print a file.\n\n"
+      "@type printer: string\n"
+      "@param printer: queue name\n"
+      "@type filename: string\n"
+      "@param filename: local file path to the document\n"
+      "@type title: string\n"
+      "@param title: title of the print job\n"
+      "@type options: dict\n"
+      "@param options: dict of options\n"
+      "@type mmap: boolean\n"
+      "@param mmap: send the document from a memory mapping rather\n"
+      "than reading it through a buffer\n"
+      "@type progress: callable\n"
+      "@param progress: function called as progress(sent, total, rate)\n"
+      "with byte counts and bytes per second as the document is sent;\n"
+      "implies mmap\n"
+      "@return: job ID\n"
+      "@raise IPPError: IPP problem" },
+
+    { "printFiles",
+      (PyCFunction) Connection_printFiles, METH_VARARGS | METH_KEYWORDS,
+      "printFiles(printer, filenames, title, options, mmap=False,\n"
+      "progress=None) -> integer\n\n"
+      "Print a list of files.\n\n"
+      "@type printer: string\n"
+      "@param printer: queue name\n"
+      "@type filenames: list\n"
+      "@param filenames: list of local file paths to the documents\n"
+      "@type title: string\n"
+      "@param title: title of the print job\n"
+      "@type options: dict\n"
+      "@param options: dict of options\n"
+      "@type mmap: boolean\n"
+      "@param mmap: send the documents from memory mappings rather\n"
+      "than reading them through a buffer\n"
+      "@type progress: callable\n"
+      "@param progress: function called as progress(sent, total, rate)\n"
+      "with byte counts for the whole job and bytes per second;\n"
+      "implies mmap\n"
+      "@return: job ID\n"
+      "@raise IPPError: IPP problem" },
+
+    { "doRequests",
+      (PyCFunction) Connection_doRequests, METH_VARARGS | METH_KEYWORDS,
+      "doRequests(requests, resource='/') -> list\n\n"
+      "Perform a batch of IPP requests over this connection, reading\n"
+      "the responses in order.  The requests are not modified.\n\n"
+      "@type requests: L{IPPRequest} list\n"
+      "@param requests: requests to send\n"
+      "@type resource: string\n"
+      "@param resource: HTTP resource to post the requests to\n"
+      "@return: list of L{IPPRequest} responses, one per request.  The\n"
+      "IPP status of each is available as its statuscode attribute.\n"
       "@raise IPPError: IPP problem" },
 
-    { "getPPDs2",
-      (PyCFunction) Connection_getPPDs2, METH_VARARGS | METH_KEYWORDS,
-      "getPPDs2(limit=0, exclude_schemes=None, include_schemes=None, \n"
-      "ppd_natural_language=None, ppd_device_id=None, ppd_make=None, \n"
-      "ppd_make_and_model=None, ppd_model_number=-1, ppd_product=None, \n"
-      "ppd_psversion=None, ppd_type=None) -> dict\n\n"
-      "@type limit: integer\n"
-      "@param limit: maximum number of PPDs to return\n"
-      "@type exclude_schemes: string list\n"
-      "@param exclude_schemes: list of PPD schemes to exclude\n"
-      "@type include_schemes: string list\n"
-      "@param include_schemes: list of PPD schemes to include\n"
-      "@type ppd_natural_language: string\n"
-      "@param ppd_natural_language: required language\n"
-      "@type ppd_device_id: string\n"
-      "@param ppd_device_id: IEEE 1284 Device ID to match against\n"
-      "@type ppd_make: string\n"
-      "@param ppd_make: required printer manufacturer\n"
-      "@type ppd_make_and_model: string\n"
-      "@param ppd_make_and_model: required make and model\n"
-      "@type ppd_model_number: integer\n"
-      "@param ppd_model_number: model number required (from cupsModelNumber \n"
-      "in PPD file)\n"
-      "@type ppd_product: string\n"
-      "@param ppd_product: required PostScript product string (Product)\n"
-      "@type ppd_psversion: string\n"
-      "@param ppd_psversion: required PostScript version (PSVersion)\n"
-      "@type ppd_type: string\n"
-      "@param ppd_type: required type of PPD. Valid values are fax; pdf; \n"
-      "postscript; raster; unknown.\n"
-      "@return: a dict, indexed by PPD name, of dicts representing\n"
-      "PPDs, indexed by attribute.  All attribute values are lists.\n"
-      "@raise IPPError: IPP problem" },
+    { "fileno",
+      (PyCFunction) Connection_fileno, METH_NOARGS,
+      "fileno() -> integer\n\n"
+      "@return: file descriptor of the underlying HTTP connection,\n"
+      "suitable for select() or an event loop reader" },
+
+    { "sendRequest",
+      (PyCFunction) Connection_sendRequest, METH_VARARGS | METH_KEYWORDS,
+      "sendRequest(request, resource='/') -> integer\n\n"
+      "Send an IPP request without waiting for the response, which\n"
+      "must then be collected using L{pollResponse}.  Only one\n"
+      "request may be outstanding on a connection at a time, and\n"
+      "until it has been collected other methods that talk to the\n"
+      "server raise RuntimeError.\n\n"
+      "@type request: L{IPPRequest}\n"
+      "@param request: request to send\n"
+      "@type resource: string\n"
+      "@param resource: HTTP resource to post the request to\n"
+      "@return: HTTP status\n"
+      "@raise HTTPError: HTTP problem" },
+
+    { "pollResponse",
+      (PyCFunction) Connection_pollResponse, METH_VARARGS | METH_KEYWORDS,
+      "pollResponse(timeout=0) -> L{IPPRequest} or None\n\n"
+      "Collect the response to a request sent with L{sendRequest}.\n"
+      "Once the start of the response has arrived this reads all of\n"
+      "it before returning, blocking (without the GIL) for as long as\n"
+      "that takes; event loops should call it from a worker thread.\n\n"
+      "@type timeout: float\n"
+      "@param timeout: seconds to wait for the response to start\n"
+      "arriving\n"
+      "@return: the response, or None if it has not arrived yet.\n"
+      "The IPP status is available as its statuscode attribute.\n"
+      "@raise IPPError: IPP problem" },
+
+    { NULL } /* Sentinel */
+  };
+
+PyTypeObject cups_ConnectionType =
+  {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cups.Connection",         /*tp_name*/
+    sizeof(Connection),        /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)Connection_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    (reprfunc)Connection_repr, /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_BASETYPE,       /*tp_flags*/
+    "CUPS connection\n"
+    "===============\n\n"
+
+    "  A connection to the CUPS server.  Before it is created the \n"
+    "  connection server and username should be set using \n"
+    "  L{cups.setServer} and L{cups.setUser}; otherwise the defaults will \n"
+    "  be used.  When a Connection object is instantiated it results in a \n"
+    "  call to the libcups function httpConnectEncrypt().\n\n"
+    "  The constructor takes optional arguments host, port, and encryption, \n"
+    "  which default to the values of L{cups.getServer}(), \n"
+    "  L{cups.getPort}(), and L{cups.getEncryption}().\n"
+    "",         /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    Connection_methods,        /* tp_methods */
+    0,                         /* tp_members */
+    Connection_getseters,      /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)Connection_init, /* tp_init */
+    0,                         /* tp_alloc */
+    Connection_new,            /* tp_new */
+  };
+
+//////////
+// Dest //
+//////////
+
+static PyObject *
+Dest_new (PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+  Dest *self;
+  self = (Dest *) type->tp_alloc (type, 0);
+  return (PyObject *) self;
+}
+
+static int
+Dest_init (Dest *self, PyObject *args, PyObject *kwds)
+{    
+  self->num_options = 0;
+  return 0;
+}
+
+static void
+Dest_dealloc (Dest *self)
+{
+  Py_XDECREF (self->options_dict);
+  dest_arena_release (self->arena);
+  ((PyObject *)self)->ob_type->tp_free ((PyObject *) self);
+}
+
+static PyObject *
+Dest_repr (Dest *self)
+{
+  char buffer[256];
+  snprintf (buffer, 256, "<cups.Dest %s%s%s%s>",
+			  self->destname,
+			  self->instance ? "/" : "",
+			  self->instance ? self->instance : "",
+			  self->is_default ? " (default)" : "");
+#if PY_MAJOR_VERSION >= 3
+  return PyUnicode_FromString (buffer);
+#else
+  return PyBytes_FromString (buffer);
+#endif
+}
+
+//////////
+// Dest // ATTRIBUTES
+//////////
+
+static PyObject *
+Dest_getName (Dest *self, void *closure)
+{
+  return PyUnicode_FromString (self->destname);
+}
+
+static PyObject *
+Dest_getInstance (Dest *self, void *closure)
+{
+  if (self->instance)
+    return PyUnicode_FromString (self->instance);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+Dest_getIsDefault (Dest *self, void *closure)
+{
+  return PyBool_FromLong (self->is_default);
+}
+
+static PyObject *
+Dest_getOptions (Dest *self, void *closure)
+{
+  int i;
+
+  if (!self->options_dict) {
+    PyObject *pyoptions = PyDict_New ();
+    for (i = 0; i < self->num_options; i++) {
+      PyObject *string = PyUnicode_FromString (self->options[i].value);
+      PyDict_SetItemString (pyoptions, self->options[i].name, string);
+      Py_DECREF (string);
+    }
+
+    self->options_dict = pyoptions;
+  }
+
+  // A copy, as callers may change it.
+  return PyDict_Copy (self->options_dict);
+}
+
+PyGetSetDef Dest_getseters[] =
+  {
+    { "name",
+      (getter) Dest_getName, (setter) NULL,
+      "name", NULL },
+
+    { "instance",
+      (getter) Dest_getInstance, (setter) NULL,
+      "instance", NULL },
+
+    { "is_default",
+      (getter) Dest_getIsDefault, (setter) NULL,
+      "is_default", NULL },
+  
+    { "options",
+      (getter) Dest_getOptions, (setter) NULL,
+      "options", NULL },
+
+    { NULL }
+  };
+
+PyTypeObject cups_DestType =
+  {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cups.Dest",               /*tp_name*/
+    sizeof(Dest),              /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)Dest_dealloc,  /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    (reprfunc)Dest_repr,       /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "CUPS destination\n"
+    "================\n\n"
+    "  A destination print queue, as returned by L{Connection.getDests}.\n\n"
+    "@type name: string\n"
+    "@ivar name: destination queue name\n"
+    "@type instance: string\n"
+    "@ivar instance: destination instance name\n"
+    "@type is_default: boolean\n"
+    "@ivar is_default: whether this is the default destination\n"
+    "@type options: dict\n"
+    "@ivar options: string:string dict of default options for this \n"
+    "destination, indexed by option name\n"
+    "",        /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    0,                         /* tp_methods */
+    0,                         /* tp_members */
+    Dest_getseters,            /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)Dest_init,       /* tp_init */
+    0,                         /* tp_alloc */
+    Dest_new,                  /* tp_new */
+  };
+
+/////////////
+// Fan-out //
+/////////////
+
+struct fanout_host
+{
+  char *host;
+  ipp_t *answer;
+  ipp_status_t status;
+  char *message;
+  int connected;
+};
+
+struct fanout_batch
+{
+  struct fanout_host *hosts;
+  Py_ssize_t n_hosts;
+  Py_ssize_t next;
+  ipp_op_t op;
+  size_t n_attrs;
+  char **attrs;
+  int port;
+  http_encryption_t encryption;
+  char *user;
+  pthread_mutex_t lock;
+};
+
+// Build the batch's request; cupsDoRequest() frees the one it is
+// given, so each host gets its own.
+static ipp_t *
+fanout_new_request (struct fanout_batch *batch)
+{
+  ipp_t *request;
+
+  if (batch->op == IPP_GET_JOBS)
+    return new_get_jobs_request (NULL, 0, -1, -1,
+				 batch->n_attrs, batch->attrs);
+
+  request = ippNewRequest (CUPS_GET_PRINTERS);
+  if (batch->attrs)
+    ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		   "requested-attributes", batch->n_attrs, NULL,
+		   (const char **) batch->attrs);
+  else
+    ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		   "requested-attributes", NUM_PRINTER_SUMMARY_ATTRS,
+		   NULL, printer_summary_attrs);
+
+  return request;
+}
+
+#ifdef HAVE_CUPS_1_4
+static const char *
+fanout_no_password (const char *prompt, http_t *http, const char *method,
+		    const char *resource, void *user_data)
+{
+  return NULL;
+}
+#else /* !HAVE_CUPS_1_4 */
+static const char *
+fanout_no_password (const char *prompt)
+{
+  return NULL;
+}
+#endif /* !HAVE_CUPS_1_4 */
+
+static void *
+fanout_worker (void *data)
+{
+  struct fanout_batch *batch = data;
+
+  // libcups keeps the user, password callback and last error per
+  // thread.  There is no GIL to call the Python callback with, so
+  // authentication is refused rather than prompted for.
+  if (batch->user)
+    cupsSetUser (batch->user);
+
+#ifdef HAVE_CUPS_1_4
+  cupsSetPasswordCB2 (fanout_no_password, NULL);
+#else /* !HAVE_CUPS_1_4 */
+  cupsSetPasswordCB (fanout_no_password);
+#endif /* !HAVE_CUPS_1_4 */
+
+  for (;;) {
+    struct fanout_host *h;
+    http_t *http;
+
+    pthread_mutex_lock (&batch->lock);
+    h = batch->next < batch->n_hosts ? &batch->hosts[batch->next++] : NULL;
+    pthread_mutex_unlock (&batch->lock);
+    if (!h)
+      break;
+
+    debugprintf ("fanout: httpConnectEncrypt(%s)\n", h->host);
+    http = httpConnectEncrypt (h->host, batch->port, batch->encryption);
+    if (!http)
+      continue;
+
+    h->connected = 1;
+    h->answer = cupsDoRequest (http, fanout_new_request (batch), "/");
+    h->status = h->answer ? ippGetStatusCode (h->answer) : cupsLastError ();
+    if (cupsLastErrorString ())
+      h->message = strdup (cupsLastErrorString ());
+
+    httpClose (http);
+  }
+
+  return NULL;
+}
+
+// Run the request against every host, at most concurrency at once.
+// Called without the GIL.  Workers always get threads of their own,
+// as they change the calling thread's libcups user and password
+// callback; returns -1 if not even one thread could be started.
+static int
+fanout_run (struct fanout_batch *batch, int concurrency)
+{
+  pthread_t *threads;
+  int i, started = 0;
+
+  if (batch->n_hosts == 0)
+    return 0;
+
+  if (concurrency > batch->n_hosts)
+    concurrency = batch->n_hosts;
+
+  threads = calloc (concurrency, sizeof (pthread_t));
+  if (threads)
+    for (i = 0; i < concurrency; i++) {
+      if (pthread_create (&threads[i], NULL, fanout_worker, batch) != 0)
+	break;
+
+      started++;
+    }
+
+  for (i = 0; i < started; i++)
+    pthread_join (threads[i], NULL);
+
+  free (threads);
+  return started ? 0 : -1;
+}
+
+static PyObject *
+fanout_exception (PyObject *type, PyObject *args)
+{
+  PyObject *exc;
+
+  if (!args)
+    return NULL;
+
+  exc = PyObject_CallObject (type, args);
+  Py_DECREF (args);
+  return exc;
+}
+
+static PyObject *
+fanout_result (struct fanout_host *h, ipp_op_t op)
+{
+  if (!h->connected)
+    return fanout_exception (PyExc_RuntimeError,
+			     Py_BuildValue ("(s)",
+					    "failed to connect to server"));
+
+  if (!h->answer || h->status > IPP_OK_CONFLICT) {
+    const char *message;
+
+    if (op == CUPS_GET_PRINTERS && h->answer && h->status == IPP_NOT_FOUND)
+      // No printers.
+      return PyDict_New ();
+
+    message = h->message ? h->message : ippErrorString (h->status);
+    return fanout_exception (IPPError,
+			     Py_BuildValue ("(iN)", h->status,
+					    PyObj_from_UTF8 (message)));
+  }
+
+  if (op == CUPS_GET_PRINTERS)
+    return printers_from_answer (h->answer);
+
+  return jobs_from_answer (h->answer);
+}
+
+PyObject *
+Connection_fanout (PyObject *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *hostsobj, *opobj;
+  PyObject *requested_attrs = NULL;
+  PyObject *hostseq = NULL;
+  PyObject *result = NULL;
+  int concurrency = 8;
+  int port = ippPort ();
+  int encryption = (http_encryption_t) cupsEncryption ();
+  char *operation = NULL;
+  char **attrs = NULL;
+  size_t n_attrs = 0;
+  struct fanout_batch batch;
+  ipp_op_t op;
+  Py_ssize_t i;
+  int ran;
+  static char *kwlist[] = { "hosts", "operation", "requested_attributes",
+			    "concurrency", "port", "encryption", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "OO|Oiii", kwlist,
+				    &hostsobj, &opobj, &requested_attrs,
+				    &concurrency, &port, &encryption))
+    return NULL;
+
+  if (UTF8_from_PyObj (&operation, opobj) == NULL)
+    return NULL;
+
+  debugprintf ("-> Connection_fanout(%s)\n", operation);
+  if (!strcmp (operation, "getPrinters"))
+    op = CUPS_GET_PRINTERS;
+  else if (!strcmp (operation, "getJobs"))
+    op = IPP_GET_JOBS;
+  else {
+    PyErr_SetString (PyExc_ValueError,
+		     "operation must be 'getPrinters' or 'getJobs'");
+    free (operation);
+    debugprintf ("<- Connection_fanout() EXCEPTION\n");
+    return NULL;
+  }
+
+  free (operation);
+  if (concurrency < 1) {
+    PyErr_SetString (PyExc_ValueError, "concurrency must be at least 1");
+    debugprintf ("<- Connection_fanout() EXCEPTION\n");
+    return NULL;
+  }
+
+  hostseq = PySequence_Fast (hostsobj, "hosts must be a sequence");
+  if (!hostseq) {
+    debugprintf ("<- Connection_fanout() EXCEPTION\n");
+    return NULL;
+  }
+
+  if (requested_attrs && requested_attrs != Py_None &&
+      get_requested_attrs (requested_attrs, &n_attrs, &attrs) == -1) {
+    Py_DECREF (hostseq);
+    debugprintf ("<- Connection_fanout() EXCEPTION\n");
+    return NULL;
+  }
+
+  memset (&batch, 0, sizeof (batch));
+  batch.n_hosts = PySequence_Fast_GET_SIZE (hostseq);
+  batch.hosts = calloc (batch.n_hosts ? batch.n_hosts : 1,
+			sizeof (struct fanout_host));
+  if (!batch.hosts) {
+    PyErr_NoMemory ();
+    goto out;
+  }
+
+  for (i = 0; i < batch.n_hosts; i++) {
+    PyObject *hostobj = PySequence_Fast_GET_ITEM (hostseq, i);
+    if (!PyUnicode_Check (hostobj) && !PyBytes_Check (hostobj)) {
+      PyErr_SetString (PyExc_TypeError, "hosts must be strings");
+      goto out;
+    }
+
+    if (UTF8_from_PyObj (&batch.hosts[i].host, hostobj) == NULL)
+      goto out;
+  }
+
+  batch.op = op;
+  batch.n_attrs = n_attrs;
+  batch.attrs = attrs;
+  batch.port = port;
+  batch.encryption = (http_encryption_t) encryption;
+  batch.user = strdup (cupsUser ());
+  pthread_mutex_init (&batch.lock, NULL);
+
+  Py_BEGIN_ALLOW_THREADS;
+  ran = fanout_run (&batch, concurrency);
+  Py_END_ALLOW_THREADS;
+
+  pthread_mutex_destroy (&batch.lock);
+  if (ran < 0) {
+    PyErr_SetString (PyExc_RuntimeError, "cannot start fan-out threads");
+    goto out;
+  }
+
+  result = PyDict_New ();
+  for (i = 0; result && i < batch.n_hosts; i++) {
+    PyObject *hostobj = PySequence_Fast_GET_ITEM (hostseq, i);
+    PyObject *value = fanout_result (&batch.hosts[i], op);
+    if (!value) {
+      Py_CLEAR (result);
+      break;
+    }
+
+    PyDict_SetItem (result, hostobj, value);
+    Py_DECREF (value);
+  }
+
+ out:
+  if (batch.hosts)
+    for (i = 0; i < batch.n_hosts; i++) {
+      free (batch.hosts[i].host);
+      free (batch.hosts[i].message);
+      if (batch.hosts[i].answer)
+	ippDelete (batch.hosts[i].answer);
+    }
+
+  free (batch.hosts);
+  free (batch.user);
+
+  if (attrs)
+    free_requested_attrs (n_attrs, attrs);
+
+  Py_DECREF (hostseq);
+  debugprintf ("<- Connection_fanout()%s\n", result ? "" : " EXCEPTION");
+  return result;
+}
+
+////////////////////
+// ConnectionPool //
+////////////////////
+
+typedef struct
+{
+  PyObject_HEAD
+  char *host;
+  int port;
+  int encryption;
+  int max_size;
+  int in_use;
+
+  /* Python list of idle Connection objects */
+  PyObject *idle;
+
+  /* Python set of the Connection objects currently acquired */
+  PyObject *checked_out;
+
+  /* Signalled (under the GIL) whenever a connection is released */
+  pthread_mutex_t lock;
+  pthread_cond_t released;
+  unsigned long generation;
+} ConnectionPool;
+
+static int
+ConnectionPool_init (ConnectionPool *self, PyObject *args, PyObject *kwds)
+{
+  const char *host = cupsServer ();
+  int port = ippPort ();
+  int encryption = (http_encryption_t) cupsEncryption ();
+  int max_size = 8;
+  static char *kwlist[] = { "host", "port", "encryption", "max_size", NULL };
+
+  if (self->idle) {
+    PyErr_SetString (PyExc_RuntimeError, "pool already initialised");
+    return -1;
+  }
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|siii", kwlist,
+				    &host, &port, &encryption, &max_size))
+    return -1;
+
+  if (max_size < 1) {
+    PyErr_SetString (PyExc_ValueError, "max_size must be positive");
+    return -1;
+  }
+
+  debugprintf ("-> ConnectionPool_init(host=%s, max_size=%d)\n",
+	       host, max_size);
+  self->host = strdup (host);
+  if (!self->host) {
+    PyErr_NoMemory ();
+    return -1;
+  }
+
+  self->idle = PyList_New (0);
+  self->checked_out = PySet_New (NULL);
+  if (!self->idle || !self->checked_out) {
+    Py_CLEAR (self->idle);
+    Py_CLEAR (self->checked_out);
+    free (self->host);
+    self->host = NULL;
+    return -1;
+  }
+
+  self->port = port;
+  self->encryption = encryption;
+  self->max_size = max_size;
+  self->in_use = 0;
+  self->generation = 0;
+  pthread_mutex_init (&self->lock, NULL);
+  pthread_cond_init (&self->released, NULL);
+  debugprintf ("<- ConnectionPool_init() = 0\n");
+  return 0;
+}
+
+static void
+ConnectionPool_dealloc (ConnectionPool *self)
+{
+  if (self->idle) {
+    Py_DECREF (self->idle);
+    pthread_mutex_destroy (&self->lock);
+    pthread_cond_destroy (&self->released);
+  }
+
+  Py_XDECREF (self->checked_out);
+  free (self->host);
+  ((PyObject *)self)->ob_type->tp_free ((PyObject *) self);
+}
+
+static PyObject *
+ConnectionPool_repr (ConnectionPool *self)
+{
+  char buffer[256];
+  snprintf (buffer, 256, "<cups.ConnectionPool for %s (%d in use) at %p>",
+			  self->host ? self->host : "(uninitialised)",
+			  self->in_use, self);
+#if PY_MAJOR_VERSION >= 3
+  return PyUnicode_FromString (buffer);
+#else
+  return PyBytes_FromString (buffer);
+#endif
+}
+
+/*
+ * Cheap health check for an idle keep-alive connection.  Nothing
+ * should be waiting to be read on it, so a readable socket means the
+ * server has closed its end.  In that case try to reconnect.
+ * Returns 1 if the connection can be used.
+ */
+static int
+ConnectionPool_check (Connection *conn)
+{
+  int ok;
+  Connection_begin_allow_threads (conn);
+  if (httpGetFd (conn->http) >= 0 && !httpWait (conn->http, 0))
+    ok = 1;
+  else {
+    debugprintf ("pooled connection %p went stale, reconnecting\n", conn);
+    ok = !httpReconnect (conn->http);
+  }
+  Connection_end_allow_threads (conn);
+  return ok;
+}
+
+static PyObject *
+ConnectionPool_acquire (ConnectionPool *self, PyObject *args, PyObject *kwds)
+{
+  double timeout = -1.0;
+  struct timespec deadline;
+  static char *kwlist[] = { "timeout", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|d", kwlist, &timeout))
+    return NULL;
+
+  if (!self->idle) {
+    PyErr_SetString (PyExc_RuntimeError, "pool not initialised");
+    return NULL;
+  }
+
+  if (timeout > 0) {
+    struct timeval now;
+    gettimeofday (&now, NULL);
+    deadline.tv_sec = now.tv_sec + (time_t) timeout;
+    deadline.tv_nsec = now.tv_usec * 1000 +
+      (long) ((timeout - (time_t) timeout) * 1000000000);
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+  }
+
+  debugprintf ("-> ConnectionPool_acquire()\n");
+  for (;;) {
+    unsigned long generation;
+    int timed_out = 0;
+
+    while (PyList_Size (self->idle) > 0) {
+      Py_ssize_t last = PyList_Size (self->idle) - 1;
+      PyObject *conn = PyList_GetItem (self->idle, last);
+      Py_INCREF (conn);
+      PyList_SetSlice (self->idle, last, last + 1, NULL);
+      if (ConnectionPool_check ((Connection *) conn)) {
+	if (PySet_Add (self->checked_out, conn) < 0) {
+	  Py_DECREF (conn);
+	  debugprintf ("<- ConnectionPool_acquire() (error)\n");
+	  return NULL;
+	}
+
+	self->in_use++;
+	debugprintf ("<- ConnectionPool_acquire() = %p (reused)\n", conn);
+	return conn;
+      }
+
+      Py_DECREF (conn);
+    }
+
+    if (self->in_use < self->max_size) {
+      PyObject *conn;
+      self->in_use++;
+      conn = PyObject_CallFunction ((PyObject *) &cups_ConnectionType,
+				    "sii", self->host, self->port,
+				    self->encryption);
+      if (!conn || PySet_Add (self->checked_out, conn) < 0) {
+	Py_XDECREF (conn);
+	self->in_use--;
+	debugprintf ("<- ConnectionPool_acquire() (error)\n");
+	return NULL;
+      }
+
+      debugprintf ("<- ConnectionPool_acquire() = %p (new)\n", conn);
+      return conn;
+    }
+
+    if (timeout == 0) {
+      PyErr_SetString (PyExc_RuntimeError, "connection pool exhausted");
+      debugprintf ("<- ConnectionPool_acquire() (exhausted)\n");
+      return NULL;
+    }
+
+    // Wait for another thread to release a connection.  The
+    // generation counter is only changed with the GIL held, so
+    // reading it here cannot miss a wake-up.
+    generation = self->generation;
+    Py_BEGIN_ALLOW_THREADS;
+    pthread_mutex_lock (&self->lock);
+    while (self->generation == generation && !timed_out) {
+      if (timeout > 0)
+	timed_out = (pthread_cond_timedwait (&self->released, &self->lock,
+					     &deadline) == ETIMEDOUT);
+      else
+	pthread_cond_wait (&self->released, &self->lock);
+    }
+    pthread_mutex_unlock (&self->lock);
+    Py_END_ALLOW_THREADS;
+
+    if (timed_out) {
+      PyErr_SetString (PyExc_RuntimeError, "connection pool exhausted");
+      debugprintf ("<- ConnectionPool_acquire() (timed out)\n");
+      return NULL;
+    }
+  }
+}
+
+static PyObject *
+ConnectionPool_release (ConnectionPool *self, PyObject *args)
+{
+  PyObject *connobj;
+  Connection *conn;
+
+  if (!PyArg_ParseTuple (args, "O!", &cups_ConnectionType, &connobj))
+    return NULL;
+
+  if (!self->idle) {
+    PyErr_SetString (PyExc_RuntimeError, "pool not initialised");
+    return NULL;
+  }
+
+  conn = (Connection *) connobj;
+  debugprintf ("-> ConnectionPool_release(%p)\n", conn);
+  switch (PySet_Contains (self->checked_out, connobj)) {
+  case -1:
+    return NULL;
+  case 0:
+    PyErr_SetString (PyExc_ValueError,
+		     "connection is not checked out from this pool");
+    debugprintf ("<- ConnectionPool_release() (not ours)\n");
+    return NULL;
+  }
+
+  if (PySet_Discard (self->checked_out, connobj) < 0)
+    return NULL;
+
+  self->in_use--;
+
+  // Only keep connections that are in a known state.
+  if (!conn->pending_resource && conn->http &&
+      PyList_Size (self->idle) < self->max_size)
+    PyList_Append (self->idle, connobj);
+
+  pthread_mutex_lock (&self->lock);
+  self->generation++;
+  pthread_cond_signal (&self->released);
+  pthread_mutex_unlock (&self->lock);
+
+  debugprintf ("<- ConnectionPool_release()\n");
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+ConnectionPool_getMaxSize (ConnectionPool *self, void *closure)
+{
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (self->max_size);
+#else
+  return PyInt_FromLong (self->max_size);
+#endif
+}
+
+static PyObject *
+ConnectionPool_getInUse (ConnectionPool *self, void *closure)
+{
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (self->in_use);
+#else
+  return PyInt_FromLong (self->in_use);
+#endif
+}
+
+static PyObject *
+ConnectionPool_getIdle (ConnectionPool *self, void *closure)
+{
+  Py_ssize_t idle = self->idle ? PyList_Size (self->idle) : 0;
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromSsize_t (idle);
+#else
+  return PyInt_FromSsize_t (idle);
+#endif
+}
+
+PyGetSetDef ConnectionPool_getseters[] =
+  {
+    { "max_size",
+      (getter) ConnectionPool_getMaxSize, (setter) NULL,
+      "max_size", NULL },
+
+    { "in_use",
+      (getter) ConnectionPool_getInUse, (setter) NULL,
+      "in_use", NULL },
+
+    { "idle",
+      (getter) ConnectionPool_getIdle, (setter) NULL,
+      "idle", NULL },
+
+    { NULL }
+  };
+
+PyMethodDef ConnectionPool_methods[] =
+  {
+    { "acquire",
+      (PyCFunction) ConnectionPool_acquire, METH_VARARGS | METH_KEYWORDS,
+      "acquire(timeout=-1) -> L{Connection}\n\n"
+      "Take a connection from the pool.  Idle connections are checked\n"
+      "and reconnected if the server has closed them.  If max_size\n"
+      "connections are already in use, wait for one to be released.\n\n"
+      "@type timeout: float\n"
+      "@param timeout: seconds to wait, or -1 to wait indefinitely\n"
+      "@return: a connection to be handed back with L{release}\n"
+      "@raise RuntimeError: failed to connect, or pool exhausted" },
+
+    { "release",
+      (PyCFunction) ConnectionPool_release, METH_VARARGS,
+      "release(connection) -> None\n\n"
+      "Return a connection to the pool.  It must not be used again\n"
+      "until it is next acquired.\n\n"
+      "@type connection: L{Connection}\n"
+      "@param connection: connection obtained from L{acquire}\n"
+      "@raise ValueError: connection was not acquired from this pool,\n"
+      "or has already been released" },
+
+    { NULL } /* Sentinel */
+  };
+
+PyTypeObject cups_ConnectionPoolType =
+  {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cups.ConnectionPool",     /*tp_name*/
+    sizeof(ConnectionPool),    /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)ConnectionPool_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    (reprfunc)ConnectionPool_repr, /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "CUPS connection pool\n"
+    "====================\n\n"
+    "  A pool of connections to one CUPS server, for sharing between\n"
+    "  threads.  Each thread should L{acquire} its own L{Connection}\n"
+    "  and L{release} it when done, so that the HTTP connection can be\n"
+    "  kept alive and reused.\n\n"
+    "  The constructor takes optional arguments host, port, encryption\n"
+    "  and max_size.  The first three are passed to L{Connection}; \n"
+    "  max_size (default 8) limits the number of connections in use.\n\n"
+    "@type max_size: integer\n"
+    "@ivar max_size: maximum number of connections in use at once\n"
+    "@type in_use: integer\n"
+    "@ivar in_use: number of connections currently acquired\n"
+    "@type idle: integer\n"
+    "@ivar idle: number of idle connections held by the pool\n"
+    "",                        /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    ConnectionPool_methods,    /* tp_methods */
+    0,                         /* tp_members */
+    ConnectionPool_getseters,  /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)ConnectionPool_init, /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+  };
+
+//////////////////
+// Lazy results //
+//////////////////
+
+/*
+ * getPrinters(lazy=True) and getJobs(lazy=True) keep the IPP response
+ * and only decode attributes when they are looked up.  Building the
+ * view is a single pass over the response recording, for each printer
+ * or job, which attributes belong to it and what its key is.
+ */
+
+typedef struct
+{
+  PyObject_HEAD
+  ipp_t *answer;
+  ipp_attribute_t **attrs;	/* attributes of all entries, in order */
+  size_t *starts;		/* entry i is attrs[starts[i]..starts[i+1]) */
+  size_t num_entries;
+  PyObject *index;		/* key -> entry number */
+  unsigned int ctx;		/* ATTR_CTX_PRINTERS or ATTR_CTX_JOBS */
+} ResultMap;
+
+typedef struct
+{
+  PyObject_HEAD
+  ResultMap *map;
+  size_t entry;
+} ResultEntry;
+
+static PyObject *
+ResultMap_decode (ResultMap *map, ipp_attribute_t *attr)
+{
+  return PyObject_from_attr (attr, attr_info_for_value (attr), map->ctx);
+}
+
+static PyObject *
+build_ResultMap (ipp_t *answer, ipp_tag_t group)
+{
+  PyObject *largs = Py_BuildValue ("()");
+  PyObject *lkwlist = Py_BuildValue ("{}");
+  ResultMap *map;
+  ipp_attribute_t *attr;
+  size_t num_attrs = 0, max_entries = 0;
+  size_t n = 0;
+  ipp_tag_t last = IPP_TAG_ZERO;
+
+  debugprintf ("-> build_ResultMap()\n");
+  for (attr = ippFirstAttribute (answer); attr;
+       attr = ippNextAttribute (answer)) {
+    num_attrs++;
+    if (ippGetGroupTag (attr) == group && last != group)
+      max_entries++;
+
+    last = ippGetGroupTag (attr);
+  }
+
+  map = (ResultMap *) PyType_GenericNew (&cups_ResultMapType,
+					 largs, lkwlist);
+  Py_DECREF (largs);
+  Py_DECREF (lkwlist);
+  if (!map) {
+    ippDelete (answer);
+    return NULL;
+  }
+
+  map->answer = answer;
+  map->ctx = (group == IPP_TAG_PRINTER ? ATTR_CTX_PRINTERS : ATTR_CTX_JOBS);
+  map->attrs = malloc ((num_attrs + 1) * sizeof (ipp_attribute_t *));
+  map->starts = malloc ((max_entries + 1) * sizeof (size_t));
+  map->index = PyDict_New ();
+  if (!map->attrs || !map->starts || !map->index) {
+    Py_DECREF (map);
+    return PyErr_NoMemory ();
+  }
+
+  for (attr = ippFirstAttribute (answer); attr;
+       attr = ippNextAttribute (answer)) {
+    PyObject *key = NULL;
+
+    while (attr && ippGetGroupTag (attr) != group)
+      attr = ippNextAttribute (answer);
+
+    if (!attr)
+      break;
+
+    map->starts[map->num_entries] = n;
+    for (; attr && ippGetGroupTag (attr) == group;
+	 attr = ippNextAttribute (answer)) {
+      const attr_info_t *info = attr_info_for_value (attr);
+
+      if (group == IPP_TAG_PRINTER) {
+	// Same selection as the eager getPrinters().
+	if (!info || !(info->flags & ATTR_PRINTERS))
+	  continue;
+
+	if (info->flags & ATTR_PRINTER_KEY) {
+	  Py_XDECREF (key);
+	  key = PyObj_from_UTF8 (ippGetString (attr, 0, NULL));
+	  continue;
+	}
+      } else if (info && (info->flags & ATTR_JOB_KEY)) {
+	Py_XDECREF (key);
+#if PY_MAJOR_VERSION >= 3
+	key = PyLong_FromLong (ippGetInteger (attr, 0));
+#else
+	key = PyInt_FromLong (ippGetInteger (attr, 0));
+#endif
+	continue;
+      }
+
+      map->attrs[n++] = attr;
+    }
+
+    if (key) {
+#if PY_MAJOR_VERSION >= 3
+      PyObject *entry = PyLong_FromSize_t (map->num_entries);
+#else
+      PyObject *entry = PyInt_FromSize_t (map->num_entries);
+#endif
+      PyDict_SetItem (map->index, key, entry);
+      Py_DECREF (entry);
+      Py_DECREF (key);
+      map->num_entries++;
+    } else
+      // No key: drop this entry's attributes.
+      n = map->starts[map->num_entries];
+
+    if (!attr)
+      break;
+  }
+
+  map->starts[map->num_entries] = n;
+  debugprintf ("<- build_ResultMap() = %zu entries\n", map->num_entries);
+  return (PyObject *) map;
+}
+
+static void
+ResultMap_dealloc (ResultMap *self)
+{
+  if (self->answer)
+    ippDelete (self->answer);
+
+  free (self->attrs);
+  free (self->starts);
+  Py_XDECREF (self->index);
+  Py_TYPE(self)->tp_free ((PyObject *) self);
+}
+
+static PyObject *
+ResultMap_getEntry (ResultMap *self, PyObject *key)
+{
+  PyObject *largs, *lkwlist;
+  PyObject *entryobj = PyDict_GetItem (self->index, key);
+  ResultEntry *entry;
+
+  if (!entryobj)
+    return NULL;
+
+  largs = Py_BuildValue ("()");
+  lkwlist = Py_BuildValue ("{}");
+  entry = (ResultEntry *) PyType_GenericNew (&cups_ResultEntryType,
+					     largs, lkwlist);
+  Py_DECREF (largs);
+  Py_DECREF (lkwlist);
+  if (!entry)
+    return NULL;
+
+#if PY_MAJOR_VERSION >= 3
+  entry->entry = PyLong_AsSize_t (entryobj);
+#else
+  entry->entry = PyInt_AsSsize_t (entryobj);
+#endif
+  Py_INCREF (self);
+  entry->map = self;
+  return (PyObject *) entry;
+}
+
+static Py_ssize_t
+ResultMap_length (ResultMap *self)
+{
+  return PyDict_Size (self->index);
+}
+
+static PyObject *
+ResultMap_subscript (ResultMap *self, PyObject *key)
+{
+  PyObject *entry = ResultMap_getEntry (self, key);
+  if (!entry && !PyErr_Occurred ())
+    PyErr_SetObject (PyExc_KeyError, key);
+
+  return entry;
+}
+
+static int
+ResultMap_contains (ResultMap *self, PyObject *key)
+{
+  return PyDict_Contains (self->index, key);
+}
+
+static PyObject *
+ResultMap_iter (ResultMap *self)
+{
+  return PyObject_GetIter (self->index);
+}
+
+static PyObject *
+ResultMap_keys (ResultMap *self)
+{
+  return PyDict_Keys (self->index);
+}
+
+static PyObject *
+ResultMap_values (ResultMap *self)
+{
+  PyObject *keys = PyDict_Keys (self->index);
+  PyObject *ret;
+  Py_ssize_t i;
+
+  if (!keys)
+    return NULL;
+
+  ret = PyList_New (0);
+  for (i = 0; ret && i < PyList_Size (keys); i++) {
+    PyObject *entry = ResultMap_getEntry (self, PyList_GetItem (keys, i));
+    if (!entry) {
+      Py_DECREF (ret);
+      ret = NULL;
+      break;
+    }
+
+    PyList_Append (ret, entry);
+    Py_DECREF (entry);
+  }
+
+  Py_DECREF (keys);
+  return ret;
+}
+
+static PyObject *
+ResultMap_items (ResultMap *self)
+{
+  PyObject *keys = PyDict_Keys (self->index);
+  PyObject *ret;
+  Py_ssize_t i;
+
+  if (!keys)
+    return NULL;
+
+  ret = PyList_New (0);
+  for (i = 0; ret && i < PyList_Size (keys); i++) {
+    PyObject *key = PyList_GetItem (keys, i);
+    PyObject *entry = ResultMap_getEntry (self, key);
+    PyObject *item;
+    if (!entry) {
+      Py_DECREF (ret);
+      ret = NULL;
+      break;
+    }
+
+    item = Py_BuildValue ("(ON)", key, entry);
+    PyList_Append (ret, item);
+    Py_DECREF (item);
+  }
+
+  Py_DECREF (keys);
+  return ret;
+}
+
+static PyObject *
+ResultMap_get (ResultMap *self, PyObject *args)
+{
+  PyObject *key, *def = Py_None;
+  PyObject *entry;
+
+  if (!PyArg_ParseTuple (args, "O|O", &key, &def))
+    return NULL;
+
+  entry = ResultMap_getEntry (self, key);
+  if (!entry && !PyErr_Occurred ()) {
+    Py_INCREF (def);
+    return def;
+  }
+
+  return entry;
+}
+
+static PyObject *
+ResultMap_repr (ResultMap *self)
+{
+  char buffer[256];
+  snprintf (buffer, 256, "<cups.ResultMap of %zd entries at %p>",
+	    PyDict_Size (self->index), self);
+#if PY_MAJOR_VERSION >= 3
+  return PyUnicode_FromString (buffer);
+#else
+  return PyBytes_FromString (buffer);
+#endif
+}
+
+PyMethodDef ResultMap_methods[] =
+  {
+    { "keys",
+      (PyCFunction) ResultMap_keys, METH_NOARGS,
+      "keys() -> list\n\n"
+      "@return: list of keys" },
+
+    { "values",
+      (PyCFunction) ResultMap_values, METH_NOARGS,
+      "values() -> list\n\n"
+      "@return: list of L{ResultEntry} objects" },
+
+    { "items",
+      (PyCFunction) ResultMap_items, METH_NOARGS,
+      "items() -> list\n\n"
+      "@return: list of (key, L{ResultEntry}) tuples" },
+
+    { "get",
+      (PyCFunction) ResultMap_get, METH_VARARGS,
+      "get(key, default=None) -> L{ResultEntry}\n\n"
+      "@return: the entry for key, or default if there is none" },
+
+    { NULL } /* Sentinel */
+  };
+
+static PyMappingMethods ResultMap_as_mapping =
+  {
+    (lenfunc) ResultMap_length,          /* mp_length */
+    (binaryfunc) ResultMap_subscript,    /* mp_subscript */
+    0,                                   /* mp_ass_subscript */
+  };
+
+static PySequenceMethods ResultMap_as_sequence =
+  {
+    0,                                   /* sq_length */
+    0,                                   /* sq_concat */
+    0,                                   /* sq_repeat */
+    0,                                   /* sq_item */
+    0,                                   /* sq_slice */
+    0,                                   /* sq_ass_item */
+    0,                                   /* sq_ass_slice */
+    (objobjproc) ResultMap_contains,     /* sq_contains */
+  };
+
+PyTypeObject cups_ResultMapType =
+  {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cups.ResultMap",          /*tp_name*/
+    sizeof(ResultMap),         /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)ResultMap_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    (reprfunc)ResultMap_repr,  /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &ResultMap_as_sequence,    /*tp_as_sequence*/
+    &ResultMap_as_mapping,     /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Lazy result mapping\n"
+    "===================\n\n"
+    "  A read-only mapping returned by L{Connection.getPrinters} and\n"
+    "  L{Connection.getJobs} when called with lazy=True.  It holds\n"
+    "  the IPP response, and each value is a L{ResultEntry} whose\n"
+    "  attributes are decoded only when they are looked up.\n\n"
+    "",                        /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    (getiterfunc)ResultMap_iter, /* tp_iter */
+    0,                         /* tp_iternext */
+    ResultMap_methods,         /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                         /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+  };
+
+static void
+ResultEntry_dealloc (ResultEntry *self)
+{
+  Py_XDECREF (self->map);
+  Py_TYPE(self)->tp_free ((PyObject *) self);
+}
+
+static ipp_attribute_t *
+ResultEntry_find (ResultEntry *self, PyObject *key)
+{
+  ResultMap *map = self->map;
+  ipp_attribute_t *found = NULL;
+  char *name;
+  size_t i;
+
+#if PY_MAJOR_VERSION >= 3
+  if (!PyUnicode_Check (key))
+#else
+  if (!PyUnicode_Check (key) && !PyString_Check (key))
+#endif
+    return NULL;
+
+  if (UTF8_from_PyObj (&name, key) == NULL)
+    return NULL;
+
+  for (i = map->starts[self->entry]; i < map->starts[self->entry + 1]; i++)
+    if (!strcmp (ippGetName (map->attrs[i]), name)) {
+      found = map->attrs[i];
+      // Later values replace earlier ones, as in a dict.
+    }
+
+  free (name);
+  return found;
+}
+
+/*
+ * Whether attrs[i] is hidden by a later attribute of the same name in
+ * the entry.  Only the last one is visible through the mapping, as
+ * with ResultEntry_find().
+ */
+static int
+ResultEntry_shadowed (ResultEntry *self, size_t i)
+{
+  ResultMap *map = self->map;
+  const char *name = ippGetName (map->attrs[i]);
+  size_t j;
+
+  for (j = i + 1; j < map->starts[self->entry + 1]; j++)
+    if (!strcmp (ippGetName (map->attrs[j]), name))
+      return 1;
+
+  return 0;
+}
+
+static Py_ssize_t
+ResultEntry_length (ResultEntry *self)
+{
+  ResultMap *map = self->map;
+  Py_ssize_t n = 0;
+  size_t i;
+
+  for (i = map->starts[self->entry]; i < map->starts[self->entry + 1]; i++)
+    if (!ResultEntry_shadowed (self, i))
+      n++;
+
+  return n;
+}
+
+static PyObject *
+ResultEntry_subscript (ResultEntry *self, PyObject *key)
+{
+  ipp_attribute_t *attr = ResultEntry_find (self, key);
+  if (!attr) {
+    if (!PyErr_Occurred ())
+      PyErr_SetObject (PyExc_KeyError, key);
+
+    return NULL;
+  }
+
+  return ResultMap_decode (self->map, attr);
+}
+
+static int
+ResultEntry_contains (ResultEntry *self, PyObject *key)
+{
+  if (ResultEntry_find (self, key))
+    return 1;
+
+  return PyErr_Occurred () ? -1 : 0;
+}
+
+static PyObject *
+ResultEntry_items_list (ResultEntry *self, int what)
+{
+  ResultMap *map = self->map;
+  PyObject *ret = PyList_New (0);
+  size_t i;
+
+  for (i = map->starts[self->entry];
+       ret && i < map->starts[self->entry + 1];
+       i++) {
+    ipp_attribute_t *attr = map->attrs[i];
+    PyObject *key = NULL, *val = NULL, *item;
+
+    if (ResultEntry_shadowed (self, i))
+      continue;
+
+    if (what != 1 && !(key = PyObj_from_interned_UTF8 (ippGetName (attr))))
+      goto fail;
+
+    if (what != 0 && !(val = ResultMap_decode (map, attr))) {
+      Py_XDECREF (key);
+      goto fail;
+    }
+
+    if (what == 0)
+      item = key;
+    else if (what == 1)
+      item = val;
+    else
+      item = Py_BuildValue ("(NN)", key, val);
+
+    PyList_Append (ret, item);
+    Py_DECREF (item);
+  }
+
+  return ret;
+
+ fail:
+  Py_DECREF (ret);
+  return NULL;
+}
+
+static PyObject *
+ResultEntry_keys (ResultEntry *self)
+{
+  return ResultEntry_items_list (self, 0);
+}
+
+static PyObject *
+ResultEntry_values (ResultEntry *self)
+{
+  return ResultEntry_items_list (self, 1);
+}
+
+static PyObject *
+ResultEntry_items (ResultEntry *self)
+{
+  return ResultEntry_items_list (self, 2);
+}
+
+static PyObject *
+ResultEntry_iter (ResultEntry *self)
+{
+  PyObject *keys = ResultEntry_items_list (self, 0);
+  PyObject *iter;
+
+  if (!keys)
+    return NULL;
+
+  iter = PyObject_GetIter (keys);
+  Py_DECREF (keys);
+  return iter;
+}
+
+static PyObject *
+ResultEntry_get (ResultEntry *self, PyObject *args)
+{
+  PyObject *key, *def = Py_None;
+  ipp_attribute_t *attr;
+
+  if (!PyArg_ParseTuple (args, "O|O", &key, &def))
+    return NULL;
+
+  attr = ResultEntry_find (self, key);
+  if (!attr) {
+    if (PyErr_Occurred ())
+      return NULL;
+
+    Py_INCREF (def);
+    return def;
+  }
+
+  return ResultMap_decode (self->map, attr);
+}
+
+static PyObject *
+ResultEntry_copy (ResultEntry *self)
+{
+  PyObject *items = ResultEntry_items_list (self, 2);
+  PyObject *dict;
+  Py_ssize_t i;
+
+  if (!items)
+    return NULL;
+
+  dict = PyDict_New ();
+  for (i = 0; i < PyList_Size (items); i++) {
+    PyObject *item = PyList_GetItem (items, i);
+    PyDict_SetItem (dict, PyTuple_GetItem (item, 0),
+		    PyTuple_GetItem (item, 1));
+  }
+
+  Py_DECREF (items);
+  return dict;
+}
+
+PyMethodDef ResultEntry_methods[] =
+  {
+    { "keys",
+      (PyCFunction) ResultEntry_keys, METH_NOARGS,
+      "keys() -> list\n\n"
+      "@return: list of attribute names" },
+
+    { "values",
+      (PyCFunction) ResultEntry_values, METH_NOARGS,
+      "values() -> list\n\n"
+      "@return: list of decoded attribute values" },
+
+    { "items",
+      (PyCFunction) ResultEntry_items, METH_NOARGS,
+      "items() -> list\n\n"
+      "@return: list of (name, value) tuples" },
+
+    { "get",
+      (PyCFunction) ResultEntry_get, METH_VARARGS,
+      "get(name, default=None) -> value\n\n"
+      "@return: the decoded attribute value, or default if there is none" },
+
+    { "copy",
+      (PyCFunction) ResultEntry_copy, METH_NOARGS,
+      "copy() -> dict\n\n"
+      "@return: a dict of all attributes, as the non-lazy methods return" },
+
+    { NULL } /* Sentinel */
+  };
+
+static PyMappingMethods ResultEntry_as_mapping =
+  {
+    (lenfunc) ResultEntry_length,        /* mp_length */
+    (binaryfunc) ResultEntry_subscript,  /* mp_subscript */
+    0,                                   /* mp_ass_subscript */
+  };
+
+static PySequenceMethods ResultEntry_as_sequence =
+  {
+    0,                                   /* sq_length */
+    0,                                   /* sq_concat */
+    0,                                   /* sq_repeat */
+    0,                                   /* sq_item */
+    0,                                   /* sq_slice */
+    0,                                   /* sq_ass_item */
+    0,                                   /* sq_ass_slice */
+    (objobjproc) ResultEntry_contains,   /* sq_contains */
+  };
+
+PyTypeObject cups_ResultEntryType =
+  {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cups.ResultEntry",        /*tp_name*/
+    sizeof(ResultEntry),       /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)ResultEntry_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &ResultEntry_as_sequence,  /*tp_as_sequence*/
+    &ResultEntry_as_mapping,   /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Lazy result entry\n"
+    "=================\n\n"
+    "  A read-only mapping of attribute names to values for one\n"
+    "  printer or job in a L{ResultMap}.  Values are decoded from\n"
+    "  the IPP response each time they are looked up.\n\n"
+    "",                        /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    (getiterfunc)ResultEntry_iter, /* tp_iter */
+    0,                         /* tp_iternext */
+    ResultEntry_methods,       /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                         /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+  };
+
+/////////////////
+// JobIterator //
+/////////////////
+
+static void
+JobIterator_dealloc (JobIterator *self)
+{
+  if (self->page)
+    ippDelete (self->page);
+
+  if (self->attrs)
+    free_requested_attrs (self->n_attrs, self->attrs);
+
+  free (self->ids);
+  free (self->which);
+  Py_XDECREF (self->conn);
+  Py_TYPE(self)->tp_free ((PyObject *) self);
+}
+
+/* The number of listed job IDs the next page's request asks for. */
+static int
+JobIterator_span (JobIterator *self)
+{
+  int left = self->n_ids - self->next_id;
+
+  if (self->next_id < self->single_end)
+    return 1;
+
+  return left < self->page_size ? left : self->page_size;
+}
+
+static ipp_t *
+JobIterator_request (JobIterator *self)
+{
+  ipp_t *request;
+
+  if (!self->by_id)
+    return new_get_jobs_request (self->which, self->my_jobs,
+				 self->page_size, self->first_job_id,
+				 self->n_attrs, self->attrs);
+
+  // CUPS refuses which-jobs and first-job-id alongside job-ids.
+  request = ippNewRequest (IPP_GET_JOBS);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri",
+		NULL, "ipp://localhost/printers/");
+  ippAddIntegers (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-ids",
+		  JobIterator_span (self), self->ids + self->next_id);
+  ippAddBoolean (request, IPP_TAG_OPERATION, "my-jobs", self->my_jobs);
+  if (self->my_jobs)
+    ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		  "requesting-user-name", NULL, cupsUser());
+
+  if (self->n_attrs > 0)
+    ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		   "requested-attributes", self->n_attrs, NULL,
+		   (const char **) self->attrs);
+
+  return request;
+}
+
+/* Fetch the IDs of the jobs to page through by ID. */
+static int
+JobIterator_list (JobIterator *self)
+{
+  char *job_id = "job-id";
+  ipp_t *request = new_get_jobs_request (self->which, self->my_jobs, 0, 0,
+					 1, &job_id);
+  ipp_t *answer;
+  ipp_attribute_t *attr;
+  int n = 0;
+
+  debugprintf ("-> JobIterator_list()\n");
+  Connection_begin_allow_threads (self->conn);
+  answer = cupsDoRequest (self->conn->http, request, "/");
+  Connection_end_allow_threads (self->conn);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_FOUND) {
+      // No jobs.
+      ippDelete (answer);
+      debugprintf ("<- JobIterator_list() = 0 (no jobs)\n");
+      return 0;
+    }
+
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+
+    debugprintf ("<- JobIterator_list() = -1\n");
+    return -1;
+  }
+
+  for (attr = ippFirstAttribute (answer); attr;
+       attr = ippNextAttribute (answer))
+    if (ippGetGroupTag (attr) == IPP_TAG_JOB &&
+	ippGetValueTag (attr) == IPP_TAG_INTEGER &&
+	!strcmp (ippGetName (attr), "job-id"))
+      n++;
+
+  if (n > 0) {
+    self->ids = malloc (n * sizeof (int));
+    if (!self->ids) {
+      ippDelete (answer);
+      PyErr_NoMemory ();
+      debugprintf ("<- JobIterator_list() = -1 (no memory)\n");
+      return -1;
+    }
+
+    for (attr = ippFirstAttribute (answer); attr;
+	 attr = ippNextAttribute (answer))
+      if (ippGetGroupTag (attr) == IPP_TAG_JOB &&
+	  ippGetValueTag (attr) == IPP_TAG_INTEGER &&
+	  !strcmp (ippGetName (attr), "job-id"))
+	self->ids[self->n_ids++] = ippGetInteger (attr, 0);
+  }
+
+  ippDelete (answer);
+  debugprintf ("<- JobIterator_list() = %d jobs\n", self->n_ids);
+  return 0;
+}
+
+/*
+ * Send the request for the next page without waiting for the
+ * response, so that the server works on it while the current page is
+ * being consumed.  Failure just means the page is fetched the slow
+ * way later.
+ */
+static void
+JobIterator_send (JobIterator *self)
+{
+  ipp_t *request = JobIterator_request (self);
+  http_status_t status;
+
+  debugprintf ("-> JobIterator_send(first_job_id=%d)\n",
+	       self->first_job_id);
+  Connection_begin_allow_threads (self->conn);
+  status = cupsSendRequest (self->conn->http, request, "/",
+			    ippLength (request));
+  Connection_end_allow_threads (self->conn);
+  ippDelete (request);
+
+  self->prefetching = (status == HTTP_CONTINUE || status == HTTP_OK);
+  if (!self->prefetching)
+    httpFlush (self->conn->http);
+
+  debugprintf ("<- JobIterator_send() = %d\n", status);
+}
+
+static int
+JobIterator_load (JobIterator *self)
+{
+  ipp_t *answer = NULL;
+  ipp_attribute_t *attr;
+  int num_jobs = 0;
+  int last_id = -1;
+  int span;
+
+  debugprintf ("-> JobIterator_load()\n");
+  if (self->by_id && !self->ids) {
+    if (JobIterator_list (self) < 0) {
+      debugprintf ("<- JobIterator_load() = -1\n");
+      return -1;
+    }
+
+    if (!self->n_ids) {
+      self->last_page = 1;
+      debugprintf ("<- JobIterator_load() = 0 (no jobs)\n");
+      return 0;
+    }
+  }
+
+  // Any request sent ahead was for this span.
+  span = JobIterator_span (self);
+  if (self->prefetching) {
+    Connection_begin_allow_threads (self->conn);
+    answer = cupsGetResponse (self->conn->http, "/");
+    Connection_end_allow_threads (self->conn);
+    self->prefetching = 0;
+  }
+
+  if (!answer) {
+    // Not sent ahead, or it needed authentication.
+    ipp_t *request = JobIterator_request (self);
+    Connection_begin_allow_threads (self->conn);
+    answer = cupsDoRequest (self->conn->http, request, "/");
+    Connection_end_allow_threads (self->conn);
+  }
+
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_FOUND) {
+      ippDelete (answer);
+      if (self->by_id) {
+	// A listed job has gone since.  Ask for the rest of the page
+	// one at a time to find which, and skip it.
+	if (span > 1)
+	  self->single_end = self->next_id + span;
+	else
+	  self->next_id++;
+
+	self->last_page = (self->next_id >= self->n_ids);
+	debugprintf ("<- JobIterator_load() = 0 (job gone)\n");
+	return 0;
+      }
+
+      // No jobs.
+      self->last_page = 1;
+      debugprintf ("<- JobIterator_load() = 0 (no jobs)\n");
+      return 0;
+    }
+
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+
+    debugprintf ("<- JobIterator_load() = -1\n");
+    return -1;
+  }
+
+  for (attr = ippFirstAttribute (answer); attr;
+       attr = ippNextAttribute (answer))
+    if (ippGetGroupTag (attr) == IPP_TAG_JOB &&
+	ippGetValueTag (attr) == IPP_TAG_INTEGER &&
+	!strcmp (ippGetName (attr), "job-id")) {
+      num_jobs++;
+      last_id = ippGetInteger (attr, 0);
+    }
+
+  if (self->by_id) {
+    // More jobs than asked for means the server ignored job-ids and
+    // sent them all.
+    self->next_id += span;
+    self->last_page = (self->next_id >= self->n_ids || num_jobs > span);
+  } else {
+    // The next page starts after the last job of this one, which is
+    // the highest ID so far as the jobs come in ID order.  A short
+    // page is the last one.  So is one that gets us no further, in
+    // case a server ignores first-job-id.
+    self->last_page = (num_jobs < self->page_size ||
+		       last_id < self->first_job_id);
+    if (!self->last_page)
+      self->first_job_id = last_id + 1;
+  }
+
+  self->page = answer;
+  self->attr = ippFirstAttribute (answer);
+  if (!self->last_page)
+    JobIterator_send (self);
+
+  debugprintf ("<- JobIterator_load() = %d jobs\n", num_jobs);
+  return 0;
+}
+
+static PyObject *
+JobIterator_next (JobIterator *self)
+{
+  for (;;) {
+    if (self->page) {
+      ipp_attribute_t *attr = self->attr;
+      while (attr && ippGetGroupTag (attr) != IPP_TAG_JOB)
+	attr = ippNextAttribute (self->page);
+
+      if (attr) {
+	PyObject *dict;
+	int job_id;
+
+	self->attr = job_dict_from_group (self->page, attr, &dict, &job_id);
+	if (job_id == -1) {
+	  Py_DECREF (dict);
+	  continue;
+	}
+
+	return Py_BuildValue ("(iN)", job_id, dict);
+      }
+
+      ippDelete (self->page);
+      self->page = NULL;
+    }
+
+    if (self->last_page || !self->conn)
+      return NULL;
+
+    if (JobIterator_load (self) < 0) {
+      self->last_page = 1;
+      return NULL;
+    }
+  }
+}
+
+PyTypeObject cups_JobIteratorType =
+  {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cups.JobIterator",        /*tp_name*/
+    sizeof(JobIterator),       /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)JobIterator_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Job iterator\n"
+    "============\n\n"
+    "  An iterator over jobs, returned by L{Connection.iterJobs}.\n"
+    "  Each item is a (job ID, dict) tuple.\n\n"
+    "",                        /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    PyObject_SelfIter,         /* tp_iter */
+    (iternextfunc)JobIterator_next, /* tp_iternext */
+    0,                         /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                         /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+  };
+
+/////////////////
+// PPDIterator //
+/////////////////
+
+static void
+PPDIterator_dealloc (PPDIterator *self)
+{
+  if (self->answer)
+    ippDelete (self->answer);
+
+  Py_TYPE(self)->tp_free ((PyObject *) self);
+}
+
+static PyObject *
+PPDIterator_next (PPDIterator *self)
+{
+  while (self->answer) {
+    ipp_attribute_t *attr = self->attr;
+    const char *ppdname;
+    PyObject *dict;
+
+    while (attr && ippGetGroupTag (attr) != IPP_TAG_PRINTER)
+      attr = ippNextAttribute (self->answer);
+
+    if (!attr) {
+      // Done; let the response go now rather than with the iterator.
+      ippDelete (self->answer);
+      self->answer = NULL;
+      break;
+    }
+
+    self->attr = ppd_dict_from_group (self->answer, attr, self->all_lists,
+				      &dict, &ppdname);
+    if (ppdname)
+      return Py_BuildValue ("(NN)", PyObj_from_UTF8 (ppdname), dict);
+
+    Py_DECREF (dict);
+  }
+
+  return NULL;
+}
+
+PyTypeObject cups_PPDIteratorType =
+  {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cups.PPDIterator",        /*tp_name*/
+    sizeof(PPDIterator),       /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)PPDIterator_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "PPD iterator\n"
+    "============\n\n"
+    "  An iterator over PPDs, returned by L{Connection.iterPPDs}.\n"
+    "  Each item is a (PPD name, dict) tuple.\n\n"
+    "",                        /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    PyObject_SelfIter,         /* tp_iter */
+    (iternextfunc)PPDIterator_next, /* tp_iternext */
+    0,                         /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                         /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+  };
+
+///////////////////////
+// PrinterStateCache //
+///////////////////////
+
+/*
+ * A getPrinters() snapshot kept current by a printer event
+ * subscription.  Each update() pulls the events since the last one
+ * and re-fetches just the printers they mention.  If events were lost
+ * (the server keeps a limited number per subscription) or the
+ * subscription has gone, the whole snapshot is reloaded.
+ */
+
+typedef struct
+{
+  PyObject_HEAD
+  Connection *conn;
+  PyObject *printers;		/* name -> dict, as from getPrinters() */
+  PyObject *dests;		/* as from getDests(), or NULL if stale */
+  int subscription_id;
+  int sequence;			/* last notify-sequence-number applied */
+  int lease_duration;
+  time_t renew_at;
+  int interval;			/* server's notify-get-interval */
+} PrinterStateCache;
+
+static const char *printer_state_events[] = {
+  "printer-added",
+  "printer-deleted",
+  "printer-modified",
+  "printer-state-changed",
+};
+
+#define NUM_PRINTER_STATE_EVENTS \
+  (sizeof (printer_state_events) / sizeof (printer_state_events[0]))
+
+/*
+ * Send a Get-Notifications request for the given subscriptions,
+ * asking for events from the given sequence numbers on.  Returns the
+ * response, which the caller must check and delete.
+ */
+static ipp_t *
+do_get_notifications (Connection *conn, int num_ids, const int *ids,
+		      const int *seqs)
+{
+  ipp_t *request, *answer;
+  ipp_attribute_t *attr;
+  int i;
+
+  request = ippNewRequest (IPP_GET_NOTIFICATIONS);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, "/");
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+		"requesting-user-name", NULL, cupsUser ());
+  attr = ippAddIntegers (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+			 "notify-subscription-ids", num_ids, NULL);
+  for (i = 0; i < num_ids; i++)
+    ippSetInteger (request, &attr, i, ids[i]);
+
+  attr = ippAddIntegers (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+			 "notify-sequence-numbers", num_ids, NULL);
+  for (i = 0; i < num_ids; i++)
+    ippSetInteger (request, &attr, i, seqs[i]);
+
+  Connection_begin_allow_threads (conn);
+  answer = cupsDoRequest (conn->http, request, "/");
+  Connection_end_allow_threads (conn);
+  return answer;
+}
+
+/* Guesses at the URI an event without notify-printer-uri refers to:
+ * a printer or, failing that, a class. */
+#define PRINTERS_URI "ipp://localhost/printers/"
+#define CLASSES_URI "ipp://localhost/classes/"
+
+/*
+ * Fetch one printer's attributes in the form getPrinters() gives.
+ * Returns a new dict, or NULL with an exception set, or NULL with
+ * *not_found set if the printer no longer exists.
+ */
+static PyObject *
+fetch_printer_summary (Connection *conn, const char *uri, int *not_found)
+{
+  ipp_t *request, *answer;
+  ipp_attribute_t *attr;
+  PyObject *dict = NULL;
+  const char *name;
+
+  *not_found = 0;
+  request = ippNewRequest (IPP_GET_PRINTER_ATTRIBUTES);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+		"printer-uri", NULL, uri);
+  ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+		 "requested-attributes", NUM_PRINTER_SUMMARY_ATTRS,
+		 NULL, printer_summary_attrs);
+  Connection_begin_allow_threads (conn);
+  answer = cupsDoRequest (conn->http, request, "/");
+  Connection_end_allow_threads (conn);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_FOUND)
+      *not_found = 1;
+    else
+      set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		     answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    return NULL;
+  }
+
+  for (attr = ippFirstAttribute (answer); attr;
+       attr = ippNextAttribute (answer))
+    if (ippGetGroupTag (attr) == IPP_TAG_PRINTER) {
+      printer_dict_from_group (answer, attr, &dict, &name);
+      break;
+    }
+
+  ippDelete (answer);
+  if (!dict)
+    *not_found = 1;
+
+  return dict;
+}
+
+static void
+PrinterStateCache_cancel (PrinterStateCache *self)
+{
+  PyObject *ret;
+
+  if (self->subscription_id <= 0 || !self->conn)
+    return;
+
+  ret = PyObject_CallMethod ((PyObject *) self->conn, "cancelSubscription",
+			     "i", self->subscription_id);
+  Py_XDECREF (ret);
+  PyErr_Clear ();
+  self->subscription_id = -1;
+}
+
+static int
+PrinterStateCache_subscribe (PrinterStateCache *self)
+{
+  PyObject *method, *events, *args, *kwds, *ret;
+  size_t i;
+
+  PrinterStateCache_cancel (self);
+  events = PyList_New (0);
+  for (i = 0; i < NUM_PRINTER_STATE_EVENTS; i++) {
+    PyObject *event = PyUnicode_FromString (printer_state_events[i]);
+    PyList_Append (events, event);
+    Py_DECREF (event);
+  }
+
+  method = PyObject_GetAttrString ((PyObject *) self->conn,
+				  "createSubscription");
+  if (!method) {
+    Py_DECREF (events);
+    return -1;
+  }
+
+  args = Py_BuildValue ("(s)", "/");
+  kwds = Py_BuildValue ("{sNsi}", "events", events,
+			"lease_duration", self->lease_duration);
+  ret = PyObject_Call (method, args, kwds);
+  Py_DECREF (method);
+  Py_DECREF (args);
+  Py_DECREF (kwds);
+  if (!ret)
+    return -1;
+
+#if PY_MAJOR_VERSION >= 3
+  self->subscription_id = PyLong_AsLong (ret);
+#else
+  self->subscription_id = PyInt_AsLong (ret);
+#endif
+  Py_DECREF (ret);
+  if (PyErr_Occurred ())
+    return -1;
+
+  self->sequence = 0;
+  self->renew_at = time (NULL) + self->lease_duration / 2;
+  debugprintf ("PrinterStateCache: subscription %d\n",
+	       self->subscription_id);
+  return 0;
+}
+
+static int
+PrinterStateCache_snapshot (PrinterStateCache *self)
+{
+  PyObject *printers;
+  printers = PyObject_CallMethod ((PyObject *) self->conn, "getPrinters",
+				  NULL);
+  if (!printers)
+    return -1;
+
+  Py_XDECREF (self->printers);
+  self->printers = printers;
+  Py_CLEAR (self->dests);
+  return 0;
+}
+
+static int
+PrinterStateCache_resync (PrinterStateCache *self)
+{
+  debugprintf ("PrinterStateCache: resync\n");
+  if (PrinterStateCache_subscribe (self) < 0)
+    return -1;
+
+  return PrinterStateCache_snapshot (self);
+}
+
+static void
+PrinterStateCache_dealloc (PrinterStateCache *self)
+{
+  PyObject *type, *value, *tb;
+
+  PyErr_Fetch (&type, &value, &tb);
+  PrinterStateCache_cancel (self);
+  PyErr_Restore (type, value, tb);
+  Py_XDECREF (self->conn);
+  Py_XDECREF (self->printers);
+  Py_XDECREF (self->dests);
+  Py_TYPE(self)->tp_free ((PyObject *) self);
+}
+
+static int
+PrinterStateCache_init (PrinterStateCache *self, PyObject *args,
+			PyObject *kwds)
+{
+  PyObject *connobj;
+  int lease_duration = 3600;
+  static char *kwlist[] = { "connection", "lease_duration", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O!|i", kwlist,
+				    &cups_ConnectionType, &connobj,
+				    &lease_duration))
+    return -1;
+
+  if (lease_duration < 0) {
+    PyErr_SetString (PyExc_ValueError, "invalid lease_duration");
+    return -1;
+  }
+
+  debugprintf ("-> PrinterStateCache_init()\n");
+  PrinterStateCache_cancel (self);
+  Py_XDECREF (self->conn);
+  Py_INCREF (connobj);
+  self->conn = (Connection *) connobj;
+  self->lease_duration = lease_duration;
+  self->subscription_id = -1;
+  self->interval = -1;
+
+  // Subscribe first so that no change can fall between the snapshot
+  // and the first event.
+  if (PrinterStateCache_resync (self) < 0) {
+    debugprintf ("<- PrinterStateCache_init() = -1\n");
+    return -1;
+  }
+
+  debugprintf ("<- PrinterStateCache_init() = 0\n");
+  return 0;
+}
+
+static int
+PrinterStateCache_check (PrinterStateCache *self)
+{
+  if (!self->conn || !self->printers) {
+    PyErr_SetString (PyExc_RuntimeError, "PrinterStateCache not initialised");
+    return -1;
+  }
+
+  return 0;
+}
+
+static const char *
+event_string (PyObject *event, const char *name, char **buf)
+{
+  PyObject *obj = PyDict_GetItemString (event, name);
+  *buf = NULL;
+  if (!obj || !UTF8_from_PyObj (buf, obj)) {
+    PyErr_Clear ();
+    return NULL;
+  }
+
+  return *buf;
+}
+
+static PyObject *
+PrinterStateCache_update (PrinterStateCache *self)
+{
+  ipp_t *answer;
+  ipp_attribute_t *attr;
+  PyObject *events, *changed, *name, *uri;
+  Py_ssize_t i, pos;
+  int seq, gap = 0, applied = 0;
+
+  if (PrinterStateCache_check (self) < 0 ||
+      Connection_check_idle (self->conn) < 0)
+    return NULL;
+
+  debugprintf ("-> PrinterStateCache_update()\n");
+  if (self->lease_duration > 0 && time (NULL) >= self->renew_at) {
+    PyObject *ret = PyObject_CallMethod ((PyObject *) self->conn,
+					 "renewSubscription", "ii",
+					 self->subscription_id,
+					 self->lease_duration);
+    if (ret) {
+      Py_DECREF (ret);
+      self->renew_at = time (NULL) + self->lease_duration / 2;
+    } else
+      // Subscription probably expired; catch up from scratch.
+      PyErr_Clear ();
+  }
+
+  if (self->subscription_id <= 0) {
+    // Closed: start again.
+    if (PrinterStateCache_resync (self) < 0)
+      return NULL;
+
+#if PY_MAJOR_VERSION >= 3
+    return PyLong_FromLong (0);
+#else
+    return PyInt_FromLong (0);
+#endif
+  }
+
+  seq = self->sequence + 1;
+  answer = do_get_notifications (self->conn, 1, &self->subscription_id,
+				 &seq);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    if (answer && ippGetStatusCode (answer) == IPP_NOT_FOUND) {
+      ippDelete (answer);
+      if (PrinterStateCache_resync (self) < 0)
+	return NULL;
+
+      debugprintf ("<- PrinterStateCache_update() = 0 (resync)\n");
+#if PY_MAJOR_VERSION >= 3
+      return PyLong_FromLong (0);
+#else
+      return PyInt_FromLong (0);
+#endif
+    }
+
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    debugprintf ("<- PrinterStateCache_update() EXCEPTION\n");
+    return NULL;
+  }
+
+  attr = ippFindAttribute (answer, "notify-get-interval", IPP_TAG_INTEGER);
+  if (attr)
+    self->interval = ippGetInteger (attr, 0);
+
+  events = events_from_answer (answer);
+  ippDelete (answer);
+
+  // Collect the printers to re-fetch, so that a burst of events for
+  // one printer costs one request.
+  changed = PyDict_New ();
+  for (i = 0; i < PyList_Size (events); i++) {
+    PyObject *event = PyList_GetItem (events, i);
+    PyObject *seqobj = PyDict_GetItemString (event, "notify-sequence-number");
+    char *what, *printer;
+    long n;
+
+    if (!seqobj)
+      continue;
+
+#if PY_MAJOR_VERSION >= 3
+    n = PyLong_AsLong (seqobj);
+#else
+    n = PyInt_AsLong (seqobj);
+#endif
+    if (n <= self->sequence)
+      continue;
+
+    if (n > self->sequence + 1)
+      gap = 1;
+
+    self->sequence = n;
+    applied++;
+
+    name = PyDict_GetItemString (event, "printer-name");
+    if (!name)
+      continue;
+
+    event_string (event, "notify-subscribed-event", &what);
+    if (what && !strcmp (what, "printer-deleted")) {
+      if (PyDict_DelItem (self->printers, name) < 0)
+	PyErr_Clear ();
+      if (PyDict_DelItem (changed, name) < 0)
+	PyErr_Clear ();
+    } else {
+      uri = PyDict_GetItemString (event, "notify-printer-uri");
+      if (!uri && event_string (event, "printer-name", &printer)) {
+	char consuri[HTTP_MAX_URI];
+	construct_uri (consuri, sizeof (consuri), PRINTERS_URI, printer);
+	free (printer);
+	uri = PyUnicode_FromString (consuri);
+	PyDict_SetItem (changed, name, uri);
+	Py_DECREF (uri);
+      } else if (uri)
+	PyDict_SetItem (changed, name, uri);
+    }
+
+    free (what);
+  }
+
+  Py_DECREF (events);
+  if (gap) {
+    debugprintf ("PrinterStateCache: events lost\n");
+    Py_DECREF (changed);
+    if (PrinterStateCache_snapshot (self) < 0)
+      return NULL;
+  } else {
+    pos = 0;
+    while (PyDict_Next (changed, &pos, &name, &uri)) {
+      PyObject *dict;
+      char *uristr;
+      int not_found;
+
+      if (!UTF8_from_PyObj (&uristr, uri)) {
+	Py_DECREF (changed);
+	return NULL;
+      }
+
+      dict = fetch_printer_summary (self->conn, uristr, &not_found);
+      if (!dict && not_found &&
+	  !strncmp (uristr, PRINTERS_URI, strlen (PRINTERS_URI))) {
+	// Perhaps it's a class, not a printer.
+	char classuri[HTTP_MAX_URI];
+	snprintf (classuri, sizeof (classuri), "%s%s", CLASSES_URI,
+		  uristr + strlen (PRINTERS_URI));
+	dict = fetch_printer_summary (self->conn, classuri, &not_found);
+      }
+
+      free (uristr);
+      if (dict) {
+	PyDict_SetItem (self->printers, name, dict);
+	Py_DECREF (dict);
+      } else if (not_found) {
+	if (PyDict_DelItem (self->printers, name) < 0)
+	  PyErr_Clear ();
+      } else {
+	Py_DECREF (changed);
+	return NULL;
+      }
+    }
+
+    Py_DECREF (changed);
+  }
+
+  if (applied)
+    Py_CLEAR (self->dests);
+
+  debugprintf ("<- PrinterStateCache_update() = %d\n", applied);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (applied);
+#else
+  return PyInt_FromLong (applied);
+#endif
+}
+
+static PyObject *
+PrinterStateCache_resyncMethod (PrinterStateCache *self)
+{
+  if (PrinterStateCache_check (self) < 0 ||
+      PrinterStateCache_resync (self) < 0)
+    return NULL;
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+PrinterStateCache_close (PrinterStateCache *self)
+{
+  PrinterStateCache_cancel (self);
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+PrinterStateCache_snapshotMethod (PrinterStateCache *self)
+{
+  if (PrinterStateCache_check (self) < 0)
+    return NULL;
+
+  return PyDict_Copy (self->printers);
+}
+
+static PyObject *
+PrinterStateCache_getDests (PrinterStateCache *self)
+{
+  if (PrinterStateCache_check (self) < 0)
+    return NULL;
+
+  if (!self->dests) {
+    debugprintf ("PrinterStateCache: fetching dests\n");
+    self->dests = PyObject_CallMethod ((PyObject *) self->conn, "getDests",
+				       NULL);
+    if (!self->dests)
+      return NULL;
+  }
+
+  return PyDict_Copy (self->dests);
+}
+
+static PyObject *
+PrinterStateCache_keys (PrinterStateCache *self)
+{
+  if (PrinterStateCache_check (self) < 0)
+    return NULL;
+
+  return PyDict_Keys (self->printers);
+}
+
+static PyObject *
+PrinterStateCache_get (PrinterStateCache *self, PyObject *args)
+{
+  PyObject *key, *def = Py_None, *val;
+
+  if (!PyArg_ParseTuple (args, "O|O", &key, &def) ||
+      PrinterStateCache_check (self) < 0)
+    return NULL;
+
+  val = PyDict_GetItem (self->printers, key);
+  if (!val)
+    val = def;
+
+  Py_INCREF (val);
+  return val;
+}
+
+static Py_ssize_t
+PrinterStateCache_length (PrinterStateCache *self)
+{
+  if (PrinterStateCache_check (self) < 0)
+    return -1;
+
+  return PyDict_Size (self->printers);
+}
+
+static PyObject *
+PrinterStateCache_subscript (PrinterStateCache *self, PyObject *key)
+{
+  PyObject *val;
+
+  if (PrinterStateCache_check (self) < 0)
+    return NULL;
+
+  val = PyDict_GetItem (self->printers, key);
+  if (!val) {
+    PyErr_SetObject (PyExc_KeyError, key);
+    return NULL;
+  }
+
+  Py_INCREF (val);
+  return val;
+}
+
+static int
+PrinterStateCache_contains (PrinterStateCache *self, PyObject *key)
+{
+  if (PrinterStateCache_check (self) < 0)
+    return -1;
+
+  return PyDict_Contains (self->printers, key);
+}
+
+static PyObject *
+PrinterStateCache_iter (PrinterStateCache *self)
+{
+  PyObject *keys, *iter;
+
+  if (PrinterStateCache_check (self) < 0)
+    return NULL;
+
+  // Iterate over a copy of the keys, so update() may run meanwhile.
+  keys = PyDict_Keys (self->printers);
+  if (!keys)
+    return NULL;
+
+  iter = PyObject_GetIter (keys);
+  Py_DECREF (keys);
+  return iter;
+}
+
+static PyObject *
+PrinterStateCache_getSubscriptionId (PrinterStateCache *self, void *closure)
+{
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (self->subscription_id);
+#else
+  return PyInt_FromLong (self->subscription_id);
+#endif
+}
+
+static PyObject *
+PrinterStateCache_getSequence (PrinterStateCache *self, void *closure)
+{
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (self->sequence);
+#else
+  return PyInt_FromLong (self->sequence);
+#endif
+}
+
+static PyObject *
+PrinterStateCache_getInterval (PrinterStateCache *self, void *closure)
+{
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (self->interval);
+#else
+  return PyInt_FromLong (self->interval);
+#endif
+}
 
-    { "getServerPPD",
-      (PyCFunction) Connection_getServerPPD, METH_VARARGS,
-      "getServerPPD(ppd_name) -> string\n\n"
-      "Fetches the named PPD and stores it in a temporary file.\n\n"
-      "@type ppd_name: string\n"
-      "@param ppd_name: the ppd-name of a PPD\n"
-      "@return: temporary filename holding the PPD\n"
-      "@raise RuntimeError: Not supported in libcups until 1.3\n"
-      "@raise IPPError: IPP problem" },
-    
-    { "getDocument",
-      (PyCFunction) Connection_getDocument, METH_VARARGS,
-      "getDocument(printer_uri, job_id, document_number) -> dict\n\n"
-      "Fetches the job document and stores it in a temporary file.\n\n"
-      "@type printer_uri: string\n"
-      "@param printer_uri: the printer-uri for the printer\n"
-      "@type job_id: integer\n"
-      "@param job_id: the job ID\n"
-      "@type document_number: integer\n"
-      "@param document_number: the document number to retrieve\n"
-      "@return: a dict with the following keys: "
-      " 'file' (string), temporary filename holding the job document; "
-      " 'document-format' (string), its MIME type.  There may also be a "
-      " 'document-name' key, in which case this is for the document name.\n"
-      "@raise RuntimeError: Not supported in libcups until 1.4\n"
+PyMethodDef PrinterStateCache_methods[] =
+  {
+    { "update",
+      (PyCFunction) PrinterStateCache_update, METH_NOARGS,
+      "update() -> integer\n\n"
+      "Apply the printer events received since the last update.\n\n"
+      "@return: number of events applied\n"
       "@raise IPPError: IPP problem" },
-    
-    { "getDevices",
-      (PyCFunction) Connection_getDevices, METH_VARARGS | METH_KEYWORDS,
-      "getDevices(limit=0, exclude_schemes=None, include_schemes=None) -> dict\n\n"
-      "@type limit: integer\n"
-      "@param limit: maximum number of devices to return\n"
-      "@type exclude_schemes: string list\n"
-      "@param exclude_schemes: URI schemes to exclude\n"
-      "@type include_schemes: string list\n"
-      "@param include_schemes: URI schemes to include\n"
-      "@return: a dict, indexed by device URI, of dicts representing\n"
-      "devices, indexed by attribute.\n"
-      "@raise IPPError: IPP problem" },    
 
-    { "getJobs",
-      (PyCFunction) Connection_getJobs, METH_VARARGS | METH_KEYWORDS,
-      "getJobs(which_jobs='not-completed', my_jobs=False, limit=-1, first_job_id=-1, requested_attributes=None) -> dict\n"
-      "Fetch a list of jobs.\n"
-      "@type which_jobs: string\n"
-      "@param which_jobs: which jobs to fetch; possible values: \n"
-      "'completed', 'not-completed', 'all'\n"
-      "@type my_jobs: boolean\n"
-      "@param my_jobs: whether to restrict the returned jobs to those \n"
-      "owned by the current CUPS user (as set by L{cups.setUser}).\n"
-      "@return: a dict, indexed by job ID, of dicts representing job\n"
-      "attributes.\n"
-      "@type limit: integer\n"
-      "@param limit: maximum number of jobs to return\n"
-      "@type first_job_id: integer\n"
-      "@param first_job_id: lowest job ID to return\n"
-      "@type requested_attributes: string list\n"
-      "@param requested_attributes: list of requested attribute names\n"
+    { "resync",
+      (PyCFunction) PrinterStateCache_resyncMethod, METH_NOARGS,
+      "resync() -> None\n\n"
+      "Re-subscribe and reload the whole snapshot.\n\n"
       "@raise IPPError: IPP problem" },
 
-    { "getJobAttributes",
-      (PyCFunction) Connection_getJobAttributes, METH_VARARGS | METH_KEYWORDS,
-      "getJobAttributes(jobid, requested_attributes=None) -> dict\n\n"
-      "Fetch job attributes.\n"
-      "@type jobid: integer\n"
-      "@param jobid: job ID\n"
-      "@type requested_attributes: string list\n"
-      "@param requested_attributes: list of requested attribute names\n"
-      "@return: a dict representing job attributes.\n"
-      "@raise IPPError: IPP problem" },
+    { "close",
+      (PyCFunction) PrinterStateCache_close, METH_NOARGS,
+      "close() -> None\n\n"
+      "Cancel the subscription.  The cached printers stay readable \n"
+      "but update() will reload them on next use." },
 
-    { "cancelJob",
-      (PyCFunction) Connection_cancelJob, METH_VARARGS | METH_KEYWORDS,
-      "cancelJob(jobid, purge_job=False) -> None\n\n"
-      "@type jobid: integer\n"
-      "@param jobid: job ID to cancel\n"
-      "@type purge_job: boolean\n"
-      "@param purge_job: whether to remove data and control files\n"
-      "@raise IPPError: IPP problem" },
+    { "snapshot",
+      (PyCFunction) PrinterStateCache_snapshotMethod, METH_NOARGS,
+      "snapshot() -> dict\n\n"
+      "@return: a copy of the cached dict, as from \n"
+      "L{Connection.getPrinters}" },
 
-    { "cancelAllJobs",
-      (PyCFunction) Connection_cancelAllJobs, METH_VARARGS | METH_KEYWORDS,
-      "cancelAllJobs(name=None, uri=None, my_jobs=False, purge_jobs=True) -> None\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type uri: string\n"
-      "@param uri: printer URI\n"
-      "@type my_jobs: boolean\n"
-      "@param my_jobs: whether to restrict operation to jobs owned by \n"
-      "the current CUPS user (as set by L{cups.setUser}).\n"
-      "@type purge_jobs: boolean\n"
-      "@param purge_jobs: whether to remove data and control files\n"
+    { "getDests",
+      (PyCFunction) PrinterStateCache_getDests, METH_NOARGS,
+      "getDests() -> dict\n\n"
+      "Destinations as from L{Connection.getDests}, fetched again only \n"
+      "after update() has seen a printer event or the cache has been \n"
+      "reloaded.  Changes to lpoptions files are not noticed until \n"
+      "then.\n\n"
+      "@return: a copy of the cached dict\n"
       "@raise IPPError: IPP problem" },
 
-    { "moveJob",
-      (PyCFunction) Connection_moveJob, METH_VARARGS | METH_KEYWORDS,
-      "moveJob(printer_uri=None, job_id=-1, job_printer_uri) -> None\n\n"
-      "Move a job specified by printer_uri and jobid (only one need be given)\n"
-      "to the printer specified by job_printer_uri.\n\n"
-      "@type job_id: integer\n"
-      "@param job_id: job ID to move\n"
-      "@type printer_uri: string\n"
-      "@param printer_uri: printer to move job(s) from\n"
-      "@type job_printer_uri: string\n"
-      "@param job_printer_uri: printer to move job(s) to\n"
-      "@raise IPPError: IPP problem" },
+    { "keys",
+      (PyCFunction) PrinterStateCache_keys, METH_NOARGS,
+      "keys() -> list\n\n"
+      "@return: list of printer names" },
 
-    { "authenticateJob",
-      (PyCFunction) Connection_authenticateJob, METH_VARARGS,
-      "authenticateJob(jobid, auth_info=None) -> None\n\n"
-      "@type jobid: integer\n"
-      "@param jobid: job ID to authenticate\n"
-      "@type auth_info: optional string list\n"
-      "@param auth_info: authentication details\n"
-      "@raise IPPError: IPP problem" },
+    { "get",
+      (PyCFunction) PrinterStateCache_get, METH_VARARGS,
+      "get(name, default=None) -> dict\n\n"
+      "@return: the cached attributes of the named printer, or default" },
 
-    { "setJobHoldUntil",
-      (PyCFunction) Connection_setJobHoldUntil, METH_VARARGS,
-      "setJobHoldUntil(jobid, job_hold_until) -> None\n\n"
-      "Specifies when a job should be printed.\n"
-      "@type jobid: integer\n"
-      "@param jobid: job ID to adjust\n"
-      "@type job_hold_until: string\n"
-      "@param job_hold_until: when to print the job; examples: 'hold', \n"
-      "'immediate', 'restart', resume'\n"
-      "@raise IPPError: IPP problem"},
-    
-    { "restartJob",
-      (PyCFunction) Connection_restartJob, METH_VARARGS | METH_KEYWORDS,
-      "restartJob(job_id, job_hold_until=None) -> None\n\n"
-      "Restart a job.\n\n"
-      "@type job_id: integer\n"
-      "@param job_id: job ID to restart\n"
-      "@type job_hold_until: string\n"
-      "@param job_hold_until: new job-hold-until value for job\n"
-      "@raise IPPError: IPP problem" },
+    { NULL } /* Sentinel */
+  };
+
+PyGetSetDef PrinterStateCache_getseters[] =
+  {
+    { "subscription_id",
+      (getter) PrinterStateCache_getSubscriptionId, (setter) NULL,
+      "subscription ID", NULL },
+
+    { "sequence",
+      (getter) PrinterStateCache_getSequence, (setter) NULL,
+      "sequence number of the last event applied", NULL },
+
+    { "interval",
+      (getter) PrinterStateCache_getInterval, (setter) NULL,
+      "seconds the server suggests between updates, or -1", NULL },
+
+    { NULL }
+  };
+
+static PyMappingMethods PrinterStateCache_as_mapping =
+  {
+    (lenfunc) PrinterStateCache_length,       /* mp_length */
+    (binaryfunc) PrinterStateCache_subscript, /* mp_subscript */
+    0,                                        /* mp_ass_subscript */
+  };
+
+static PySequenceMethods PrinterStateCache_as_sequence =
+  {
+    0,                                        /* sq_length */
+    0,                                        /* sq_concat */
+    0,                                        /* sq_repeat */
+    0,                                        /* sq_item */
+    0,                                        /* sq_slice */
+    0,                                        /* sq_ass_item */
+    0,                                        /* sq_ass_slice */
+    (objobjproc) PrinterStateCache_contains,  /* sq_contains */
+  };
+
+PyTypeObject cups_PrinterStateCacheType =
+  {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cups.PrinterStateCache",  /*tp_name*/
+    sizeof(PrinterStateCache), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)PrinterStateCache_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &PrinterStateCache_as_sequence, /*tp_as_sequence*/
+    &PrinterStateCache_as_mapping, /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Printer state cache\n"
+    "===================\n\n"
+    "  A read-only mapping of printer names to attribute dicts, as\n"
+    "  returned by L{Connection.getPrinters}, kept current by a\n"
+    "  subscription to printer events.  Lookups never touch the\n"
+    "  network; call L{update} periodically (every L{interval}\n"
+    "  seconds, say) to apply changes.\n\n"
+    "  The constructor takes a L{Connection} and an optional\n"
+    "  lease_duration in seconds (default 3600; 0 for no expiry).\n"
+    "  The subscription is renewed as needed and cancelled when the\n"
+    "  cache is closed or destroyed.\n\n"
+    "",                        /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    (getiterfunc)PrinterStateCache_iter, /* tp_iter */
+    0,                         /* tp_iternext */
+    PrinterStateCache_methods, /* tp_methods */
+    0,                         /* tp_members */
+    PrinterStateCache_getseters, /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)PrinterStateCache_init, /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+  };
+
+//////////////////////
+// NotificationPump //
+//////////////////////
+
+/*
+ * Pulls events for a set of subscriptions, keeping the sequence
+ * numbers itself.  Events go to a callback or, without one, to a
+ * bounded queue where the oldest are dropped once it is full.  run()
+ * polls at the notify-get-interval the server asks for, sleeping
+ * without the GIL in between.
+ */
+
+#define PUMP_DEFAULT_INTERVAL 10 /* seconds, if the server gives none */
+
+typedef struct
+{
+  PyObject_HEAD
+  Connection *conn;
+  PyObject *callback;
+  int num_subs;
+  int *ids;
+  int *seqs;			/* last sequence number delivered */
+  char *owned;			/* created by us, so cancel on close */
+  PyObject *expired;		/* IDs the server no longer knows */
+  int interval;			/* server's notify-get-interval, or -1 */
+  PyObject **queue;		/* ring of max_queued events */
+  size_t max_queued;
+  size_t queue_head;
+  size_t queue_len;
+  unsigned long dropped;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int stopping;
+} NotificationPump;
+
+static int
+NotificationPump_check (NotificationPump *self)
+{
+  if (!self->conn) {
+    PyErr_SetString (PyExc_RuntimeError, "NotificationPump not initialised");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+NotificationPump_track (NotificationPump *self, int id, int owned)
+{
+  int *ids, *seqs;
+  char *own;
+  int i;
+
+  for (i = 0; i < self->num_subs; i++)
+    if (self->ids[i] == id)
+      return 0;
+
+  ids = realloc (self->ids, (self->num_subs + 1) * sizeof (int));
+  if (ids)
+    self->ids = ids;
+  seqs = realloc (self->seqs, (self->num_subs + 1) * sizeof (int));
+  if (seqs)
+    self->seqs = seqs;
+  own = realloc (self->owned, (self->num_subs + 1) * sizeof (char));
+  if (own)
+    self->owned = own;
+  if (!ids || !seqs || !own) {
+    PyErr_NoMemory ();
+    return -1;
+  }
+
+  ids[self->num_subs] = id;
+  seqs[self->num_subs] = 0;
+  own[self->num_subs] = owned;
+  self->num_subs++;
+  return 0;
+}
+
+static void
+NotificationPump_untrack (NotificationPump *self, int i)
+{
+  if (self->owned[i]) {
+    PyObject *ret = PyObject_CallMethod ((PyObject *) self->conn,
+					 "cancelSubscription", "i",
+					 self->ids[i]);
+    Py_XDECREF (ret);
+    PyErr_Clear ();
+  }
+
+  self->num_subs--;
+  memmove (&self->ids[i], &self->ids[i + 1],
+	   (self->num_subs - i) * sizeof (int));
+  memmove (&self->seqs[i], &self->seqs[i + 1],
+	   (self->num_subs - i) * sizeof (int));
+  memmove (&self->owned[i], &self->owned[i + 1],
+	   (self->num_subs - i) * sizeof (char));
+}
+
+static void
+NotificationPump_dealloc (NotificationPump *self)
+{
+  PyObject *type, *value, *tb;
+  size_t i;
+
+  if (self->conn) {
+    PyErr_Fetch (&type, &value, &tb);
+    while (self->num_subs > 0)
+      NotificationPump_untrack (self, self->num_subs - 1);
+    PyErr_Restore (type, value, tb);
+
+    for (i = 0; i < self->queue_len; i++)
+      Py_DECREF (self->queue[(self->queue_head + i) % self->max_queued]);
+
+    pthread_mutex_destroy (&self->lock);
+    pthread_cond_destroy (&self->wake);
+    Py_DECREF (self->conn);
+  }
+
+  free (self->ids);
+  free (self->seqs);
+  free (self->owned);
+  free (self->queue);
+  Py_XDECREF (self->expired);
+  Py_XDECREF (self->callback);
+  Py_TYPE(self)->tp_free ((PyObject *) self);
+}
+
+static int
+NotificationPump_init (NotificationPump *self, PyObject *args,
+		       PyObject *kwds)
+{
+  PyObject *connobj, *callback = NULL;
+  int max_queued = 1000;
+  static char *kwlist[] = { "connection", "callback", "max_queued", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O!|Oi", kwlist,
+				    &cups_ConnectionType, &connobj,
+				    &callback, &max_queued))
+    return -1;
+
+  if (self->conn) {
+    PyErr_SetString (PyExc_RuntimeError, "already initialised");
+    return -1;
+  }
+
+  if (callback == Py_None)
+    callback = NULL;
+
+  if (callback && !PyCallable_Check (callback)) {
+    PyErr_SetString (PyExc_TypeError, "callback must be callable");
+    return -1;
+  }
+
+  if (max_queued < 1) {
+    PyErr_SetString (PyExc_ValueError, "max_queued must be positive");
+    return -1;
+  }
+
+  self->expired = PyList_New (0);
+  if (!self->expired)
+    return -1;
+
+  self->queue = calloc (max_queued, sizeof (PyObject *));
+  if (!self->queue) {
+    Py_CLEAR (self->expired);
+    PyErr_NoMemory ();
+    return -1;
+  }
+
+  Py_INCREF (connobj);
+  self->conn = (Connection *) connobj;
+  Py_XINCREF (callback);
+  self->callback = callback;
+  self->max_queued = max_queued;
+  self->interval = -1;
+  pthread_mutex_init (&self->lock, NULL);
+  pthread_cond_init (&self->wake, NULL);
+  return 0;
+}
+
+static int
+NotificationPump_deliver (NotificationPump *self, PyObject *event)
+{
+  if (self->callback) {
+    PyObject *ret = PyObject_CallFunctionObjArgs (self->callback, event,
+						  NULL);
+    if (!ret)
+      return -1;
+
+    Py_DECREF (ret);
+    return 0;
+  }
+
+  if (self->queue_len == self->max_queued) {
+    // Full: drop the oldest.
+    Py_DECREF (self->queue[self->queue_head]);
+    self->queue_head = (self->queue_head + 1) % self->max_queued;
+    self->queue_len--;
+    self->dropped++;
+  }
+
+  Py_INCREF (event);
+  self->queue[(self->queue_head + self->queue_len) % self->max_queued] = event;
+  self->queue_len++;
+  return 0;
+}
+
+/*
+ * Get-Notifications fails as a whole with NOT_FOUND if any one of
+ * its subscriptions has gone (cancelled, or its lease expired).  Ask
+ * about each on its own, and stop pumping those the server no longer
+ * knows, recording them in self->expired.  Returns -1 on error.
+ */
+static int
+NotificationPump_expire (NotificationPump *self)
+{
+  int i;
+
+  for (i = self->num_subs - 1; i >= 0; i--) {
+    int next = self->seqs[i] + 1;
+    ipp_t *answer = do_get_notifications (self->conn, 1, &self->ids[i],
+					  &next);
+    if (!answer) {
+      set_ipp_error (cupsLastError (), cupsLastErrorString ());
+      return -1;
+    }
+
+    if (ippGetStatusCode (answer) == IPP_NOT_FOUND) {
+#if PY_MAJOR_VERSION >= 3
+      PyObject *id = PyLong_FromLong (self->ids[i]);
+#else
+      PyObject *id = PyInt_FromLong (self->ids[i]);
+#endif
+      if (!id || PyList_Append (self->expired, id) < 0) {
+	Py_XDECREF (id);
+	ippDelete (answer);
+	return -1;
+      }
 
-    { "getFile",
-      (PyCFunction) Connection_getFile, METH_VARARGS | METH_KEYWORDS,
-      "getFile(resource, filename=None, fd=-1, file=None) -> None\n\n"
-      "Fetch a CUPS server resource to a local file.\n\n"
-      "This is for obtaining CUPS server configuration files and \n"
-      "log files.\n\n"
-      "@type resource: string\n"
-      "@param resource: resource name\n"
-      "@type filename: string\n"
-      "@param filename: name of local file for storage\n"
-      "@type fd: int\n"
-      "@param fd: file descriptor of local file\n"
-      "@type file: file\n"
-      "@param file: Python file object for local file\n"
-      "@raise HTTPError: HTTP problem" },
+      Py_DECREF (id);
+      debugprintf ("NotificationPump: subscription %d gone\n",
+		   self->ids[i]);
+      // Nothing left to cancel.
+      self->owned[i] = 0;
+      NotificationPump_untrack (self, i);
+    }
 
-    { "putFile",
-      (PyCFunction) Connection_putFile, METH_VARARGS | METH_KEYWORDS,
-      "putFile(resource, filename=None, fd=-1, file=None) -> None\n\n"
-      "This is for uploading new configuration files for the CUPS \n"
-      "server.  Note: L{adminSetServerSettings} is a way of \n"
-      "adjusting server settings without needing to parse the \n"
-      "configuration file.\n"
-      "@type resource: string\n"
-      "@param resource: resource name\n"
-      "@type filename: string\n"
-      "@param filename: name of local file to upload\n"
-      "@type fd: int\n"
-      "@param fd: file descriptor of local file\n"
-      "@type file: file\n"
-      "@param file: Python file object for local file\n"
-      "@raise HTTPError: HTTP problem"},
+    ippDelete (answer);
+  }
 
-    { "addPrinter",
-      (PyCFunction) Connection_addPrinter, METH_VARARGS | METH_KEYWORDS,
-      "addPrinter(name) -> None\n\n"
-      "Add or adjust a print queue.  Several parameters can select which\n"
-      "PPD to use (filename, ppdname, and ppd) but only one may be\n"
-      "given.\n\n"
-      "@type filename: string\n"
-      "@keyword filename: local filename of PPD file\n"
-      "@type ppdname: string\n"
-      "@keyword ppdname: filename from L{getPPDs}\n"
-      "@type info: string\n"
-      "@keyword info: human-readable information about the printer\n"
-      "@type location: string\n"
-      "@keyword location: human-readable printer location\n"
-      "@type device: string\n"
-      "@keyword device: device URI string\n"
-      "@type ppd: L{cups.PPD} instance\n"
-      "@keyword ppd: PPD object\n"
-      "@raise IPPError: IPP problem" },
+  return 0;
+}
 
-    { "setPrinterDevice",
-      (PyCFunction) Connection_setPrinterDevice, METH_VARARGS,
-      "setPrinterDevice(name, device_uri) -> None\n\n"
-      "Set the device URI for a printer.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type device_uri: string\n"
-      "@param device_uri: device URI\n"
-      "@raise IPPError: IPP problem" },
+/* Returns the number of events delivered, or -1 on error. */
+static int
+NotificationPump_pollOnce (NotificationPump *self)
+{
+  ipp_t *answer;
+  ipp_attribute_t *attr;
+  PyObject *events;
+  int *next;
+  int i, delivered = 0;
+  Py_ssize_t e;
 
-    { "setPrinterInfo",
-      (PyCFunction) Connection_setPrinterInfo, METH_VARARGS,
-      "setPrinterInfo(name, info) -> None\n\n"
-      "Set the human-readable information about a printer.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type info: string\n"
-      "@param info: human-readable information about the printer\n"
-      "@raise IPPError: IPP problem" },
+  if (self->num_subs == 0)
+    return 0;
 
-    { "setPrinterLocation",
-      (PyCFunction) Connection_setPrinterLocation, METH_VARARGS,
-      "setPrinterLocation(name, location) -> None\n\n"
-      "Set the human-readable printer location\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type location: string\n"
-      "@param location: human-readable printer location\n"
-      "@raise IPPError: IPP problem" },
+  if (Connection_check_idle (self->conn) < 0)
+    return -1;
 
-    { "setPrinterShared",
-      (PyCFunction) Connection_setPrinterShared, METH_VARARGS,
-      "setPrinterShared(name, shared) -> None\n\n"
-      "Set whether a printer is shared with other people.  This works \n"
-      "with CUPS servers of at least version 1.2, by setting the \n"
-      "printer-is-shared printer attribute.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type shared: boolean\n"
-      "@param shared: whether printer should be shared\n"
-      "@raise IPPError: IPP problem" },
+  next = malloc (self->num_subs * sizeof (int));
+  if (!next) {
+    PyErr_NoMemory ();
+    return -1;
+  }
 
-    { "setPrinterJobSheets",
-      (PyCFunction) Connection_setPrinterJobSheets, METH_VARARGS,
-      "setPrinterJobSheets(name, start, end) -> None\n\n"
-      "Specifies job sheets for a printer.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type start: string\n"
-      "@param start: name of a sheet to print before each job\n"
-      "@type end: string\n"
-      "@param end: name of a sheet to print after each job\n"
-      "@raise IPPError: IPP problem" },
+  for (i = 0; i < self->num_subs; i++)
+    next[i] = self->seqs[i] + 1;
 
-    { "setPrinterErrorPolicy",
-      (PyCFunction) Connection_setPrinterErrorPolicy, METH_VARARGS,
-      "setPrinterErrorPolicy(name, policy) -> None\n\n"
-      "Set the printer's error policy.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type policy: string\n"
-      "@param policy: policy name; supported policy names can be found \n"
-      "by using the L{getPrinterAttributes} function and looking for the \n"
-      "'printer-error-policy-supported' attribute\n"
-      "@raise IPPError: IPP problem" },
+  answer = do_get_notifications (self->conn, self->num_subs, self->ids, next);
+  if (answer && ippGetStatusCode (answer) == IPP_NOT_FOUND) {
+    ippDelete (answer);
+    if (NotificationPump_expire (self) < 0) {
+      free (next);
+      return -1;
+    }
 
-    { "setPrinterOpPolicy",
-      (PyCFunction) Connection_setPrinterOpPolicy, METH_VARARGS,
-      "setPrinterOpPolicy(name, policy) -> None\n\n"
-      "Set the printer's operation policy.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type policy: string\n"
-      "@param policy: policy name; supported policy names can be found \n"
-      "by using the L{getPrinterAttributes} function and looking for the \n"
-      "'printer-op-policy-supported' attribute\n"
-      "@raise IPPError: IPP problem" },
+    if (self->num_subs == 0) {
+      free (next);
+      return 0;
+    }
 
-    { "setPrinterUsersAllowed",
-      (PyCFunction) Connection_setPrinterUsersAllowed, METH_VARARGS,
-      "setPrinterUsersAllowed(name, allowed) -> None\n\n"
-      "Set the list of users allowed to use a printer.  This works \n"
-      "with CUPS server of at least version 1.2, by setting the \n"
-      "requesting-user-name-allowed printer attribute.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type allowed: string list\n"
-      "@param allowed: list of allowed users; ['all'] \n"
-      "means there will be no user-name restriction.\n"
-      "@raise IPPError: IPP problem" },
+    for (i = 0; i < self->num_subs; i++)
+      next[i] = self->seqs[i] + 1;
 
-    { "setPrinterUsersDenied",
-      (PyCFunction) Connection_setPrinterUsersDenied, METH_VARARGS,
-      "setPrinterUsersDenied(name, denied) -> None\n\n"
-      "Set the list of users denied the use of a printer.  This works \n"
-      "with CUPS servers of at least version 1.2, by setting the \n"
-      "requesting-user-name-denied printer attribute.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type denied: string list\n"
-      "@param denied: list of denied users; ['none'] \n"
-      "means there will be no user-name restriction.\n"
-      "@raise IPPError: IPP problem" },
+    answer = do_get_notifications (self->conn, self->num_subs, self->ids,
+				   next);
+  }
 
-    { "addPrinterOptionDefault",
-      (PyCFunction) Connection_addPrinterOptionDefault, METH_VARARGS,
-      "addPrinterOptionDefault(name, option, value) -> None\n\n"
-      "Set a network default option.  Jobs submitted to the named queue \n"
-      "will have the job option added if it is not already present in the \n"
-      "job.  This works with CUPS servers of at least version 1.2.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type option: string\n"
-      "@param option: option name, for example 'job-priority'\n"
-      "@type value: string\n"
-      "@param value: option value as a string\n"
-      "@raise IPPError: IPP problem" },
+  free (next);
+  if (!answer || ippGetStatusCode (answer) > IPP_OK_CONFLICT) {
+    set_ipp_error (answer ? ippGetStatusCode (answer) : cupsLastError (),
+		   answer ? NULL : cupsLastErrorString ());
+    if (answer)
+      ippDelete (answer);
+    return -1;
+  }
 
-    { "deletePrinterOptionDefault",
-      (PyCFunction) Connection_deletePrinterOptionDefault, METH_VARARGS,
-      "deletePrinterOptionDefault(name, option) -> None\n\n"
-      "Removes a network default option.  See L{addPrinterOptionDefault}.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type option: string\n"
-      "@param option: option name, for example 'job-priority'\n"
-      "@raise IPPError: IPP problem" },
+  attr = ippFindAttribute (answer, "notify-get-interval", IPP_TAG_INTEGER);
+  if (attr)
+    self->interval = ippGetInteger (attr, 0);
 
-    { "deletePrinter",
-      (PyCFunction) Connection_deletePrinter, METH_VARARGS | METH_KEYWORDS,
-      "deletePrinter(name) -> None\n\n"
-      "Delete a printer.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@raise IPPError: IPP problem" },
+  events = events_from_answer (answer);
+  ippDelete (answer);
+  for (e = 0; e < PyList_Size (events); e++) {
+    PyObject *event = PyList_GetItem (events, e);
+    PyObject *idobj = PyDict_GetItemString (event, "notify-subscription-id");
+    PyObject *seqobj = PyDict_GetItemString (event, "notify-sequence-number");
+    long id, seq;
 
-    { "getPrinterAttributes",
-      (PyCFunction) Connection_getPrinterAttributes,
-      METH_VARARGS | METH_KEYWORDS,
-      "getPrinterAttributes(name=None, uri=None, requested_attributes=None) -> dict\n"
-      "Fetch the attributes for a printer, specified either by name or by \n"
-      "uri but not both.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type uri: string\n"
-      "@param uri: queue URI\n"
-      "@type requested_attributes: string list\n"
-      "@param requested_attributes: list of requested attribute names\n"
-      "@return: a dict, indexed by attribute, of printer attributes\n"
-      "for the specified printer.\n\n"
-      "Attributes:\n"
-      "  - 'job-sheets-supported': list of strings\n"
-      "  - 'job-sheets-default': tuple of strings (start, end)\n"
-      "  - 'printer-error-policy-supported': if present, list of strings\n"
-      "  - 'printer-error-policy': if present, string\n"
-      "  - 'printer-op-policy-supported': if present, list of strings\n"
-      "  - 'printer-op-policy': if present, string\n\n"
-      "There are other attributes; the exact list of attributes returned \n"
-      "will depend on the IPP server.\n"
-      "@raise IPPError: IPP problem"},
+    if (!idobj || !seqobj)
+      continue;
 
-    { "addPrinterToClass",
-      (PyCFunction) Connection_addPrinterToClass, METH_VARARGS,
-      "addPrinterToClass(name, class) -> None\n\n"
-      "Add a printer to a class.  If the class does not yet exist, \n"
-      "it is created.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type class: string\n"
-      "@param class: class name\n"
-      "@raise IPPError: IPP problem" },
+#if PY_MAJOR_VERSION >= 3
+    id = PyLong_AsLong (idobj);
+    seq = PyLong_AsLong (seqobj);
+#else
+    id = PyInt_AsLong (idobj);
+    seq = PyInt_AsLong (seqobj);
+#endif
+    for (i = 0; i < self->num_subs; i++)
+      if (self->ids[i] == id)
+	break;
 
-    { "deletePrinterFromClass",
-      (PyCFunction) Connection_deletePrinterFromClass, METH_VARARGS,
-      "deletePrinterFromClass(name, class) -> None\n\n"
-      "Remove a printer from a class.  If the class would be left empty, \n"
-      "it is removed.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type class: string\n"
-      "@param class: class name\n"
-      "@raise IPPError: IPP problem" },
+    if (i == self->num_subs || seq <= self->seqs[i])
+      // Not ours, or already delivered.
+      continue;
+
+    self->seqs[i] = seq;
+    if (NotificationPump_deliver (self, event) < 0) {
+      Py_DECREF (events);
+      return -1;
+    }
+
+    delivered++;
+  }
 
-    { "deleteClass",
-      (PyCFunction) Connection_deleteClass, METH_VARARGS,
-      "deleteClass(class) -> None\n\n"
-      "Delete a class.\n\n"
-      "@type class: string\n"
-      "@param class: class name\n"
-      "@raise IPPError: IPP problem" },
+  Py_DECREF (events);
+  return delivered;
+}
 
-    { "getDefault",
-      (PyCFunction) Connection_getDefault, METH_NOARGS,
-      "getDefault() -> string or None\n\n"
-      "Get the system default printer.\n\n"
-      "@return: default printer name or None" },
+static PyObject *
+NotificationPump_subscribe (NotificationPump *self, PyObject *args,
+			    PyObject *kwds)
+{
+  PyObject *method, *ret;
+  long id;
 
-    { "setDefault",
-      (PyCFunction) Connection_setDefault, METH_VARARGS | METH_KEYWORDS,
-      "setDefault(name) -> None\n\n"
-      "Set the system default printer.  Note that this can be over-ridden \n"
-      "on a per-user basis using the lpoptions command.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@raise IPPError: IPP problem" },
+  if (NotificationPump_check (self) < 0)
+    return NULL;
 
-    { "getPPD",
-      (PyCFunction) Connection_getPPD, METH_VARARGS,
-      "getPPD(name) -> string\n\n"
-      "Fetch a printer's PPD.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@return: temporary PPD file name\n"
-      "@raise IPPError: IPP problem" },
+  method = PyObject_GetAttrString ((PyObject *) self->conn,
+				  "createSubscription");
+  if (!method)
+    return NULL;
 
-#ifdef HAVE_CUPS_1_4
-    { "getPPD3",
-      (PyCFunction) Connection_getPPD3, METH_VARARGS | METH_KEYWORDS,
-      "getPPD3(name[, modtime, filename]) -> (status,modtime,filename)\n\n"
-      "Fetch a printer's PPD if it is newer.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type modtime: float\n"
-      "@param modtime: modification time of existing file\n"
-      "@type filename: string\n"
-      "@param filename: filename of existing file\n"
-      "@return: tuple of HTTP status, modification time, and filename\n" },
-#endif /* HAVE_CUPS_1_4 */
+  ret = PyObject_Call (method, args, kwds);
+  Py_DECREF (method);
+  if (!ret)
+    return NULL;
 
-    { "enablePrinter",
-      (PyCFunction) Connection_enablePrinter, METH_VARARGS | METH_KEYWORDS,
-      "enablePrinter(name) -> None\n\n"
-      "Enable printer.  This allows the printer to process its job queue.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@raise IPPError: IPP problem" },
+#if PY_MAJOR_VERSION >= 3
+  id = PyLong_AsLong (ret);
+#else
+  id = PyInt_AsLong (ret);
+#endif
+  if (PyErr_Occurred () || NotificationPump_track (self, id, 1) < 0) {
+    Py_DECREF (ret);
+    return NULL;
+  }
 
-    { "disablePrinter",
-      (PyCFunction) Connection_disablePrinter, METH_VARARGS | METH_KEYWORDS,
-      "disablePrinter(name) -> None\n\n"
-      "Disable printer.  This prevents the printer from processing its \n"
-      "job queue.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type reason: string\n"
-      "@keyword reason: optional human-readable reason for disabling the \n"
-      "printer\n"
-      "@raise IPPError: IPP problem" },
+  return ret;
+}
 
-    { "acceptJobs",
-      (PyCFunction) Connection_acceptJobs, METH_VARARGS | METH_KEYWORDS,
-      "acceptJobs(name) -> None\n\n"
-      "Cause printer to accept jobs.\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@raise IPPError: IPP problem" },
+static PyObject *
+NotificationPump_add (NotificationPump *self, PyObject *args)
+{
+  int id, seq = 0;
 
-    { "rejectJobs",
-      (PyCFunction) Connection_rejectJobs, METH_VARARGS | METH_KEYWORDS,
-      "rejectJobs(name)\n\n"
-      "Cause printer to reject jobs.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type reason: string\n"
-      "@keyword reason: optional human-readable reason for rejecting jobs\n"
-      "@raise IPPError: IPP problem" },
+  if (!PyArg_ParseTuple (args, "i|i", &id, &seq) ||
+      NotificationPump_check (self) < 0)
+    return NULL;
 
-    { "printTestPage",
-      (PyCFunction) Connection_printTestPage, METH_VARARGS | METH_KEYWORDS,
-      "printTestPage(name) -> job ID\n\n"
-      "Print a test page.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type file: string\n"
-      "@keyword file: input file (default is CUPS test page)\n"
-      "@type title: string\n"
-      "@keyword title: job title (default 'Test Page')\n"
-      "@type format: string\n"
-      "@keyword format: document format (default 'application/postscript')\n"
-      "@type user: string\n"
-      "@keyword user: user to submit the job as\n"
-      "@raise IPPError: IPP problem" },
+  if (NotificationPump_track (self, id, 0) < 0)
+    return NULL;
 
-    { "adminExportSamba",
-      (PyCFunction) Connection_adminExportSamba, METH_VARARGS,
-      "adminExportSamba(name, samba_server, samba_username,\n"
-      "                 samba_password) -> None\n\n"
-      "Export a printer to Samba.\n\n"
-      "@type name: string\n"
-      "@param name: queue name\n"
-      "@type samba_server: string\n"
-      "@param samba_server: samba server\n"
-      "@type samba_username: string\n"
-      "@param samba_username: samba username\n"
-      "@type samba_password: string\n"
-      "@param samba_password: samba password\n"
-      "@raise IPPError: IPP problem" },
+  if (seq > 0) {
+    int i;
+    for (i = 0; i < self->num_subs; i++)
+      if (self->ids[i] == id)
+	self->seqs[i] = seq - 1;
+  }
 
-    { "adminGetServerSettings",
-      (PyCFunction) Connection_adminGetServerSettings, METH_NOARGS,
-      "adminGetServerSettings() -> dict\n\n"
-      "Get server settings.\n\n"
-      "@return: dict representing server settings; keywords include \n"
-      "L{CUPS_SERVER_DEBUG_LOGGING}, L{CUPS_SERVER_REMOTE_ADMIN}, \n"
-      "L{CUPS_SERVER_REMOTE_PRINTERS}, L{CUPS_SERVER_SHARE_PRINTERS}, \n"
-      "L{CUPS_SERVER_USER_CANCEL_ANY}\n"
-      "@see: L{adminSetServerSettings}\n"
-      "@raise IPPError: IPP problem" },
+  Py_RETURN_NONE;
+}
 
-    { "adminSetServerSettings",
-      (PyCFunction) Connection_adminSetServerSettings, METH_VARARGS,
-      "adminSetServerSettings(settings) -> None\n\n"
-      "Set server settings.\n\n"
-      "@type settings: dict\n"
-      "@param settings: dict of server settings\n"
-      "@see: L{adminGetServerSettings}\n"
-      "@raise IPPError: IPP problem" },
+static PyObject *
+NotificationPump_remove (NotificationPump *self, PyObject *args)
+{
+  int id, i;
 
-    { "getSubscriptions",
-      (PyCFunction) Connection_getSubscriptions, METH_VARARGS | METH_KEYWORDS,
-      "getSubscriptions(uri) -> integer list\n\n"
-      "Get subscriptions.\n\n"
-      "@type uri: string\n"
-      "@param uri: URI for object\n"
-      "@type my_subscriptions: boolean\n"
-      "@keyword my_subscriptions: only return subscriptions belonging to \n"
-      "the current user (default False)\n"
-      "@type job_id: integer\n"
-      "@keyword job_id: only return subscriptions relating to this job\n"
-      "@return: list of subscriptions\n"
-      "@raise IPPError: IPP problem" },
+  if (!PyArg_ParseTuple (args, "i", &id) ||
+      NotificationPump_check (self) < 0)
+    return NULL;
 
-    { "createSubscription",
-      (PyCFunction) Connection_createSubscription,
-      METH_VARARGS | METH_KEYWORDS,
-      "createSubscription(uri, events=[], job_id=-1, recipient_uri="",\n"
-      "                   lease_duration=-1, time_interval=-1,\n"
-      "                   user_data="") -> integer\n\n"
-      "Create a subscription.\n\n"
-      "@type uri: string\n"
-      "@param uri: URI for object\n"
-      "@type events: string list\n"
-      "@keyword events: events to receive notifications for\n"
-      "@type job_id: integer\n"
-      "@keyword job_id: job ID to receive notifications for\n"
-      "@type recipient_uri: string\n"
-      "@keyword recipient_uri: URI for notifications recipient\n"
-      "@type lease_duration: integer\n"
-      "@keyword lease_duration: lease duration in seconds\n"
-      "@type time_interval: integer\n"
-      "@keyword time_interval: time interval\n"
-      "@type user_data: string\n"
-      "@keyword user_data: user data to receieve with notifications\n"
-      "@return: subscription ID\n"
-      "@raise IPPError: IPP problem" },
+  for (i = 0; i < self->num_subs; i++)
+    if (self->ids[i] == id) {
+      NotificationPump_untrack (self, i);
+      Py_RETURN_NONE;
+    }
 
-    { "getNotifications",
-      (PyCFunction) Connection_getNotifications, METH_VARARGS | METH_KEYWORDS,
-      "getNotifications(subscription_ids) -> list\n\n"
-      "Get notifications for subscribed events.\n\n"
-      "@type subscription_ids: integer list\n"
-      "@param subscription_ids: list of subscription IDs to receive \n"
-      "notifications for\n"
-      "@return: list of dicts, each representing an event\n"
-      "@raise IPPError: IPP problem" },
+  PyErr_SetString (PyExc_KeyError, "no such subscription");
+  return NULL;
+}
 
-    { "cancelSubscription",
-      (PyCFunction) Connection_cancelSubscription, METH_VARARGS,
-      "cancelSubscription(id) -> None\n\n"
-      "Cancel a subscription.\n\n"
-      "@type id: integer\n"
-      "@param id: subscription ID\n"
-      "@raise IPPError: IPP problem" },
+static PyObject *
+NotificationPump_close (NotificationPump *self)
+{
+  if (NotificationPump_check (self) < 0)
+    return NULL;
 
-    { "renewSubscription",
-      (PyCFunction) Connection_renewSubscription, METH_VARARGS | METH_KEYWORDS,
-      "renewSubscription(id, lease_duration=-1) -> None\n\n"
-      "Renew a subscription.\n\n"
-      "@type id: integer\n"
-      "@param id: subscription ID\n"
-      "@type lease_duration: integer\n"
-      "@param lease_duration: lease duration in seconds\n"
-      "@raise IPPError: IPP problem" },
+  while (self->num_subs > 0)
+    NotificationPump_untrack (self, self->num_subs - 1);
 
-    { "createJob",
-      (PyCFunction) Connection_createJob, METH_VARARGS | METH_KEYWORDS,
-      "createJob(printer, title, options) -> integer\n\n"
-      "Create an empty job for streaming.\n\n"
-      "@type printer: string\n"
-      "@param printer: queue name\n"
-      "@type title: string\n"
-      "@param title: title of the print job\n"
-      "@type options: dict\n"
-      "@param options: dict of options\n"
-      "@return: job ID\n"
-      "@raise IPPError: IPP problem" },
+  Py_RETURN_NONE;
+}
 
-    { "startDocument",
-      (PyCFunction) Connection_startDocument, METH_VARARGS | METH_KEYWORDS,
-      "startDocument(printer, job_id, doc_name, format, last_document) -> integer\n\n"
-      "Add a document to a job created with createJob.\n\n"
-      "@type printer: string\n"
-      "@param printer: queue name\n"
-      "@type job_id: integer\n"
-      "@param job_id: job ID to create document\n"
-      "@type doc_name: string\n"
-      "@param doc_name: name of the document\n"
-      "@type format: string\n"
-      "@param format: MIME type\n"
-      "@type last_document: integer\n"
-      "@param last_document: 1 for last document of job, 0 otherwise\n"
-      "@return: HTTP status\n"
-      "@raise IPPError: IPP problem" },
+static PyObject *
+NotificationPump_poll (NotificationPump *self)
+{
+  int n;
+
+  if (NotificationPump_check (self) < 0)
+    return NULL;
+
+  n = NotificationPump_pollOnce (self);
+  if (n < 0)
+    return NULL;
+
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (n);
+#else
+  return PyInt_FromLong (n);
+#endif
+}
 
-    { "writeRequestData",
-      (PyCFunction) Connection_writeRequestData, METH_VARARGS | METH_KEYWORDS,
-      "writeRequestData(buffer, length) -> integer\n\n"
-      "Write data after an IPP request.\n\n"
-      "@type buffer: string\n"
-      "@param buffer: bytes to write\n"
-      "@type length: integer\n"
-      "@param length: number of bytes to write\n"
-      "@return: HTTP status\n"
-      "@raise IPPError: IPP problem" },
+static PyObject *
+NotificationPump_run (NotificationPump *self, PyObject *args,
+		      PyObject *kwds)
+{
+  double timeout = -1;
+  struct timeval now;
+  double end = 0;
+  static char *kwlist[] = { "timeout", NULL };
 
-    { "finishDocument",
-      (PyCFunction) Connection_finishDocument, METH_VARARGS | METH_KEYWORDS,
-      "finishDocument(printer) -> integer\n\n"
-      "Finish sending a document.\n\n"
-      "@type printer: string\n"
-      "@param printer: queue name\n"
-      "@return: HTTP status\n"
-      "@raise IPPError: IPP problem" },
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "|d", kwlist, &timeout) ||
+      NotificationPump_check (self) < 0)
+    return NULL;
 
-    { "printFile",
-      (PyCFunction) Connection_printFile, METH_VARARGS | METH_KEYWORDS,
-      "printFile(printer, filename, title, options) -> integer\n\n"
-      "Print a file.\n\n"
-      "@type printer: string\n"
-      "@param printer: queue name\n"
-      "@type filename: string\n"
-      "@param filename: local file path to the document\n"
-      "@type title: string\n"
-      "@param title: title of the print job\n"
-      "@type options: dict\n"
-      "@param options: dict of options\n"
-      "@return: job ID\n"
-      "@raise IPPError: IPP problem" },
+  debugprintf ("-> NotificationPump_run(%f)\n", timeout);
+  gettimeofday (&now, NULL);
+  if (timeout >= 0)
+    end = now.tv_sec + now.tv_usec / 1000000.0 + timeout;
 
-    { "printFiles",
-      (PyCFunction) Connection_printFiles, METH_VARARGS | METH_KEYWORDS,
-      "printFiles(printer, filenames, title, options) -> integer\n\n"
-      "Print a list of files.\n\n"
-      "@type printer: string\n"
-      "@param printer: queue name\n"
-      "@type filenames: list\n"
-      "@param filenames: list of local file paths to the documents\n"
-      "@type title: string\n"
-      "@param title: title of the print job\n"
-      "@type options: dict\n"
-      "@param options: dict of options\n"
-      "@return: job ID\n"
-      "@raise IPPError: IPP problem" },
+  for (;;) {
+    struct timespec deadline;
+    double wait, t;
 
-    { NULL } /* Sentinel */
-  };
+    if (NotificationPump_pollOnce (self) < 0) {
+      debugprintf ("<- NotificationPump_run() EXCEPTION\n");
+      return NULL;
+    }
 
-PyTypeObject cups_ConnectionType =
-  {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "cups.Connection",         /*tp_name*/
-    sizeof(Connection),        /*tp_basicsize*/
-    0,                         /*tp_itemsize*/
-    (destructor)Connection_dealloc, /*tp_dealloc*/
-    0,                         /*tp_print*/
-    0,                         /*tp_getattr*/
-    0,                         /*tp_setattr*/
-    0,                         /*tp_compare*/
-    (reprfunc)Connection_repr, /*tp_repr*/
-    0,                         /*tp_as_number*/
-    0,                         /*tp_as_sequence*/
-    0,                         /*tp_as_mapping*/
-    0,                         /*tp_hash */
-    0,                         /*tp_call*/
-    0,                         /*tp_str*/
-    0,                         /*tp_getattro*/
-    0,                         /*tp_setattro*/
-    0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT |
-    Py_TPFLAGS_BASETYPE,       /*tp_flags*/
-    "CUPS connection\n"
-    "===============\n\n"
+    wait = self->interval > 0 ? self->interval : PUMP_DEFAULT_INTERVAL;
+    gettimeofday (&now, NULL);
+    t = now.tv_sec + now.tv_usec / 1000000.0;
+    if (timeout >= 0 && t + wait > end)
+      wait = end - t;
 
-    "  A connection to the CUPS server.  Before it is created the \n"
-    "  connection server and username should be set using \n"
-    "  L{cups.setServer} and L{cups.setUser}; otherwise the defaults will \n"
-    "  be used.  When a Connection object is instantiated it results in a \n"
-    "  call to the libcups function httpConnectEncrypt().\n\n"
-    "  The constructor takes optional arguments host, port, and encryption, \n"
-    "  which default to the values of L{cups.getServer}(), \n"
-    "  L{cups.getPort}(), and L{cups.getEncryption}().\n"
-    "",         /* tp_doc */
-    0,                         /* tp_traverse */
-    0,                         /* tp_clear */
-    0,                         /* tp_richcompare */
-    0,                         /* tp_weaklistoffset */
-    0,                         /* tp_iter */
-    0,                         /* tp_iternext */
-    Connection_methods,        /* tp_methods */
-    0,                         /* tp_members */
-    0,                         /* tp_getset */
-    0,                         /* tp_base */
-    0,                         /* tp_dict */
-    0,                         /* tp_descr_get */
-    0,                         /* tp_descr_set */
-    0,                         /* tp_dictoffset */
-    (initproc)Connection_init, /* tp_init */
-    0,                         /* tp_alloc */
-    Connection_new,            /* tp_new */
-  };
+    if (self->stopping || wait <= 0)
+      break;
 
-//////////
-// Dest //
-//////////
+    // Sleep until the next poll is due, a second at a time so that
+    // signals (KeyboardInterrupt) are noticed, or until stop().
+    while (wait > 0 && !self->stopping) {
+      double slice = wait < 1 ? wait : 1;
+      t += slice;
+      deadline.tv_sec = (time_t) t;
+      deadline.tv_nsec = (long) ((t - (time_t) t) * 1000000000);
+      Py_BEGIN_ALLOW_THREADS;
+      pthread_mutex_lock (&self->lock);
+      if (!self->stopping)
+	pthread_cond_timedwait (&self->wake, &self->lock, &deadline);
+      pthread_mutex_unlock (&self->lock);
+      Py_END_ALLOW_THREADS;
+
+      if (PyErr_CheckSignals () < 0) {
+	debugprintf ("<- NotificationPump_run() (signal)\n");
+	return NULL;
+      }
+
+      wait -= slice;
+    }
+
+    if (self->stopping)
+      break;
+  }
+
+  // Only now is the stop() handled: one made before run() was
+  // called, or while it polled, is not lost.
+  Py_BEGIN_ALLOW_THREADS;
+  pthread_mutex_lock (&self->lock);
+  self->stopping = 0;
+  pthread_mutex_unlock (&self->lock);
+  Py_END_ALLOW_THREADS;
+  debugprintf ("<- NotificationPump_run()\n");
+  Py_RETURN_NONE;
+}
 
 static PyObject *
-Dest_new (PyTypeObject *type, PyObject *args, PyObject *kwds)
+NotificationPump_stop (NotificationPump *self)
 {
-  Dest *self;
-  self = (Dest *) type->tp_alloc (type, 0);
-  return (PyObject *) self;
+  if (NotificationPump_check (self) < 0)
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS;
+  pthread_mutex_lock (&self->lock);
+  self->stopping = 1;
+  pthread_cond_broadcast (&self->wake);
+  pthread_mutex_unlock (&self->lock);
+  Py_END_ALLOW_THREADS;
+  Py_RETURN_NONE;
 }
 
-static int
-Dest_init (Dest *self, PyObject *args, PyObject *kwds)
-{    
-  self->num_options = 0;
-  return 0;
+static PyObject *
+NotificationPump_get (NotificationPump *self)
+{
+  PyObject *event;
+
+  if (NotificationPump_check (self) < 0)
+    return NULL;
+
+  if (self->queue_len == 0)
+    Py_RETURN_NONE;
+
+  event = self->queue[self->queue_head];
+  self->queue[self->queue_head] = NULL;
+  self->queue_head = (self->queue_head + 1) % self->max_queued;
+  self->queue_len--;
+  return event;
 }
 
-static void
-Dest_dealloc (Dest *self)
+static PyObject *
+NotificationPump_drain (NotificationPump *self)
 {
-  if (self->num_options) {
-    int i;
-    for (i = 0; i < self->num_options; i++) {
-      free (self->name[i]);
-      free (self->value[i]);
-    }
+  PyObject *list;
+
+  if (NotificationPump_check (self) < 0)
+    return NULL;
 
-    free (self->name);
-    free (self->value);
-    self->num_options = 0;
+  list = PyList_New (self->queue_len);
+  if (!list)
+    return NULL;
 
-    free (self->destname);
-    free (self->instance);
+  while (self->queue_len > 0) {
+    PyList_SET_ITEM (list, PyList_GET_SIZE (list) - self->queue_len,
+		     self->queue[self->queue_head]);
+    self->queue[self->queue_head] = NULL;
+    self->queue_head = (self->queue_head + 1) % self->max_queued;
+    self->queue_len--;
   }
-  ((PyObject *)self)->ob_type->tp_free ((PyObject *) self);
+
+  return list;
+}
+
+static Py_ssize_t
+NotificationPump_length (NotificationPump *self)
+{
+  return self->queue_len;
 }
 
 static PyObject *
-Dest_repr (Dest *self)
+NotificationPump_getSubscriptions (NotificationPump *self, void *closure)
 {
-  char buffer[256];
-  snprintf (buffer, 256, "<cups.Dest %s%s%s%s>",
-			  self->destname,
-			  self->instance ? "/" : "",
-			  self->instance ? self->instance : "",
-			  self->is_default ? " (default)" : "");
+  PyObject *list = PyList_New (0);
+  int i;
+
+  for (i = 0; list && i < self->num_subs; i++) {
 #if PY_MAJOR_VERSION >= 3
-  return PyUnicode_FromString (buffer);
+    PyObject *id = PyLong_FromLong (self->ids[i]);
 #else
-  return PyBytes_FromString (buffer);
+    PyObject *id = PyInt_FromLong (self->ids[i]);
 #endif
-}
+    PyList_Append (list, id);
+    Py_DECREF (id);
+  }
 
-//////////
-// Dest // ATTRIBUTES
-//////////
+  return list;
+}
 
 static PyObject *
-Dest_getName (Dest *self, void *closure)
+NotificationPump_getSequenceNumbers (NotificationPump *self, void *closure)
 {
-  return PyUnicode_FromString (self->destname);
+  PyObject *dict = PyDict_New ();
+  int i;
+
+  for (i = 0; dict && i < self->num_subs; i++) {
+#if PY_MAJOR_VERSION >= 3
+    PyObject *id = PyLong_FromLong (self->ids[i]);
+    PyObject *seq = PyLong_FromLong (self->seqs[i]);
+#else
+    PyObject *id = PyInt_FromLong (self->ids[i]);
+    PyObject *seq = PyInt_FromLong (self->seqs[i]);
+#endif
+    PyDict_SetItem (dict, id, seq);
+    Py_DECREF (id);
+    Py_DECREF (seq);
+  }
+
+  return dict;
 }
 
 static PyObject *
-Dest_getInstance (Dest *self, void *closure)
+NotificationPump_getInterval (NotificationPump *self, void *closure)
 {
-  if (self->instance)
-    return PyUnicode_FromString (self->instance);
-
-  Py_RETURN_NONE;
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (self->interval);
+#else
+  return PyInt_FromLong (self->interval);
+#endif
 }
 
 static PyObject *
-Dest_getIsDefault (Dest *self, void *closure)
+NotificationPump_getExpired (NotificationPump *self, void *closure)
 {
-  return PyBool_FromLong (self->is_default);
+  if (!self->expired)
+    return PyList_New (0);
+
+  return PyList_GetSlice (self->expired, 0, PyList_Size (self->expired));
 }
 
 static PyObject *
-Dest_getOptions (Dest *self, void *closure)
+NotificationPump_getDropped (NotificationPump *self, void *closure)
 {
-  PyObject *pyoptions = PyDict_New ();
-  int i;
-  for (i = 0; i < self->num_options; i++) {
-    PyObject *string = PyUnicode_FromString (self->value[i]);
-    PyDict_SetItemString (pyoptions, self->name[i], string);
-    Py_DECREF (string);
-  }
-
-  return pyoptions;
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromUnsignedLong (self->dropped);
+#else
+  return PyInt_FromSize_t (self->dropped);
+#endif
 }
 
-PyGetSetDef Dest_getseters[] =
+PyMethodDef NotificationPump_methods[] =
   {
-    { "name",
-      (getter) Dest_getName, (setter) NULL,
-      "name", NULL },
+    { "subscribe",
+      (PyCFunction) NotificationPump_subscribe,
+      METH_VARARGS | METH_KEYWORDS,
+      "subscribe(uri, events=[], job_id=-1, recipient_uri=None, "
+      "lease_duration=-1, time_interval=-1, user_data=None) -> integer\n\n"
+      "Create a subscription, as L{Connection.createSubscription} does, \n"
+      "and pump its events.  It is cancelled when removed or on \n"
+      "L{close}.\n\n"
+      "@return: subscription ID\n"
+      "@raise IPPError: IPP problem" },
 
-    { "instance",
-      (getter) Dest_getInstance, (setter) NULL,
-      "instance", NULL },
+    { "add",
+      (PyCFunction) NotificationPump_add, METH_VARARGS,
+      "add(id, first_sequence_number=1) -> None\n\n"
+      "Pump the events of an existing subscription.  It is not \n"
+      "cancelled when removed.\n\n"
+      "@type id: integer\n"
+      "@param id: subscription ID\n"
+      "@type first_sequence_number: integer\n"
+      "@param first_sequence_number: first event to deliver" },
 
-    { "is_default",
-      (getter) Dest_getIsDefault, (setter) NULL,
-      "is_default", NULL },
-  
-    { "options",
-      (getter) Dest_getOptions, (setter) NULL,
-      "options", NULL },
+    { "remove",
+      (PyCFunction) NotificationPump_remove, METH_VARARGS,
+      "remove(id) -> None\n\n"
+      "Stop pumping events for a subscription.\n\n"
+      "@type id: integer\n"
+      "@param id: subscription ID" },
+
+    { "close",
+      (PyCFunction) NotificationPump_close, METH_NOARGS,
+      "close() -> None\n\n"
+      "Remove all subscriptions, cancelling those created by \n"
+      "L{subscribe}." },
+
+    { "poll",
+      (PyCFunction) NotificationPump_poll, METH_NOARGS,
+      "poll() -> integer\n\n"
+      "Fetch and deliver new events once, without waiting.  \n"
+      "Subscriptions the server no longer knows are removed and \n"
+      "listed in L{expired}.\n\n"
+      "@return: number of events delivered\n"
+      "@raise IPPError: IPP problem" },
+
+    { "run",
+      (PyCFunction) NotificationPump_run, METH_VARARGS | METH_KEYWORDS,
+      "run(timeout=-1) -> None\n\n"
+      "Poll repeatedly, waiting the server's notify-get-interval \n"
+      "between polls without holding the GIL, until L{stop} is called \n"
+      "(from the callback or another thread), the timeout expires, or \n"
+      "the callback raises an exception.\n\n"
+      "@type timeout: float\n"
+      "@param timeout: seconds to run for, or -1 for no limit\n"
+      "@raise IPPError: IPP problem" },
+
+    { "stop",
+      (PyCFunction) NotificationPump_stop, METH_NOARGS,
+      "stop() -> None\n\n"
+      "Make L{run} return, or the next call to it return after one \n"
+      "poll if it is not running." },
+
+    { "get",
+      (PyCFunction) NotificationPump_get, METH_NOARGS,
+      "get() -> dict\n\n"
+      "@return: the oldest queued event, or None" },
+
+    { "drain",
+      (PyCFunction) NotificationPump_drain, METH_NOARGS,
+      "drain() -> list\n\n"
+      "@return: all queued events, oldest first" },
+
+    { NULL } /* Sentinel */
+  };
+
+PyGetSetDef NotificationPump_getseters[] =
+  {
+    { "subscriptions",
+      (getter) NotificationPump_getSubscriptions, (setter) NULL,
+      "list of subscription IDs", NULL },
+
+    { "sequence_numbers",
+      (getter) NotificationPump_getSequenceNumbers, (setter) NULL,
+      "dict of last sequence number delivered, by subscription ID", NULL },
+
+    { "interval",
+      (getter) NotificationPump_getInterval, (setter) NULL,
+      "server's notify-get-interval in seconds, or -1", NULL },
+
+    { "dropped",
+      (getter) NotificationPump_getDropped, (setter) NULL,
+      "number of events dropped because the queue was full", NULL },
+
+    { "expired",
+      (getter) NotificationPump_getExpired, (setter) NULL,
+      "list of subscription IDs no longer pumped because the server "
+      "no longer knows them", NULL },
 
     { NULL }
   };
 
-PyTypeObject cups_DestType =
+static PySequenceMethods NotificationPump_as_sequence =
+  {
+    (lenfunc) NotificationPump_length,   /* sq_length */
+  };
+
+PyTypeObject cups_NotificationPumpType =
   {
     PyVarObject_HEAD_INIT(NULL, 0)
-    "cups.Dest",               /*tp_name*/
-    sizeof(Dest),              /*tp_basicsize*/
+    "cups.NotificationPump",   /*tp_name*/
+    sizeof(NotificationPump),  /*tp_basicsize*/
     0,                         /*tp_itemsize*/
-    (destructor)Dest_dealloc,  /*tp_dealloc*/
+    (destructor)NotificationPump_dealloc, /*tp_dealloc*/
     0,                         /*tp_print*/
     0,                         /*tp_getattr*/
     0,                         /*tp_setattr*/
     0,                         /*tp_compare*/
-    (reprfunc)Dest_repr,       /*tp_repr*/
+    0,                         /*tp_repr*/
     0,                         /*tp_as_number*/
-    0,                         /*tp_as_sequence*/
+    &NotificationPump_as_sequence, /*tp_as_sequence*/
     0,                         /*tp_as_mapping*/
     0,                         /*tp_hash */
     0,                         /*tp_call*/
@@ -5830,34 +12582,31 @@ PyTypeObject cups_DestType =
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
     Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-    "CUPS destination\n"
-    "================\n\n"
-    "  A destination print queue, as returned by L{Connection.getDests}.\n\n"
-    "@type name: string\n"
-    "@ivar name: destination queue name\n"
-    "@type instance: string\n"
-    "@ivar instance: destination instance name\n"
-    "@type is_default: boolean\n"
-    "@ivar is_default: whether this is the default destination\n"
-    "@type options: dict\n"
-    "@ivar options: string:string dict of default options for this \n"
-    "destination, indexed by option name\n"
-    "",        /* tp_doc */
+    "Notification pump\n"
+    "=================\n\n"
+    "  Pulls events for a set of subscriptions, keeping track of\n"
+    "  their sequence numbers.  The constructor takes a\n"
+    "  L{Connection}, an optional callback called with each event\n"
+    "  dict (as in L{Connection.getNotifications}), and max_queued\n"
+    "  (default 1000).  Without a callback, events are queued for\n"
+    "  L{get} or L{drain}; when the queue is full the oldest event\n"
+    "  is dropped.  len() gives the number of queued events.\n\n"
+    "",                        /* tp_doc */
     0,                         /* tp_traverse */
     0,                         /* tp_clear */
     0,                         /* tp_richcompare */
     0,                         /* tp_weaklistoffset */
     0,                         /* tp_iter */
     0,                         /* tp_iternext */
-    0,                         /* tp_methods */
+    NotificationPump_methods,  /* tp_methods */
     0,                         /* tp_members */
-    Dest_getseters,            /* tp_getset */
+    NotificationPump_getseters, /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
     0,                         /* tp_descr_set */
     0,                         /* tp_dictoffset */
-    (initproc)Dest_init,       /* tp_init */
+    (initproc)NotificationPump_init, /* tp_init */
     0,                         /* tp_alloc */
-    Dest_new,                  /* tp_new */
+    0,                         /* tp_new */
   };
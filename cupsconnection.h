@@ -28,18 +28,60 @@
 extern PyMethodDef Connection_methods[];
 extern PyTypeObject cups_ConnectionType;
 extern PyTypeObject cups_DestType;
+extern PyTypeObject cups_ConnectionPoolType;
+extern PyTypeObject cups_ResultMapType;
+extern PyTypeObject cups_ResultEntryType;
+extern PyTypeObject cups_JobIteratorType;
+extern PyTypeObject cups_PPDIteratorType;
+extern PyTypeObject cups_PrinterStateCacheType;
+extern PyTypeObject cups_NotificationPumpType;
+
+extern int Connection_init_interned (void);
+extern int Connection_set_ppd_cache (const char *dir, long max_size);
+extern const char *Connection_get_ppd_cache (long *max_size);
+extern PyObject *Connection_fanout (PyObject *self, PyObject *args,
+				    PyObject *kwds);
+extern PyObject *Connection_clearDeviceCache (PyObject *self, PyObject *args);
 
 typedef struct
 {
   PyObject_HEAD
   http_t *http;
   char *host; /* for repr */
+  int port;
+  int encryption;
 #ifdef HAVE_CUPS_1_4
   char *cb_password;
 #endif /* HAVE_CUPS_1_4 */
   PyThreadState *tstate;
+
+  /* For sendRequest/pollResponse */
+  char *pending_resource;
+
+  /* Reused by getJobAttributes when no attributes are requested */
+  ipp_t *job_attrs_request;
+
+  /* Metrics for the call in progress, for lastRequestStats */
+  int in_call;
+  unsigned long long call_start;
+  unsigned long long released_start;
+  unsigned long long released_ns;
+  size_t request_bytes;
+  size_t response_bytes;
+  size_t num_attrs;
+  PyObject *last_stats;
+  PyObject *trace_cb;
 } Connection;
 
+/* One allocation holding the names, instances and options of the
+   Dests made from one cupsGetDests2() call.  Freed with the last of
+   them. */
+typedef struct
+{
+  size_t refcount;
+  char *next;			/* first unused byte after this header */
+} DestArena;
+
 typedef struct
 {
   PyObject_HEAD
@@ -47,10 +89,11 @@ typedef struct
   char *destname;
   char *instance;
 
-  // Options
+  // Options, in arena
   int num_options;
-  char **name;
-  char **value;
+  cups_option_t *options;
+  DestArena *arena;
+  PyObject *options_dict;	/* built on first use */
 } Dest;
 
 extern PyObject *HTTPError;
@@ -326,6 +326,22 @@ IPPRequest_dealloc (IPPRequest *self)
   ((PyObject *)self)->ob_type->tp_free ((PyObject *) self);
 }
 
+IPPRequest *
+build_IPPRequest (ipp_t *ipp)
+{
+  IPPRequest *req;
+  PyObject *largs = Py_BuildValue ("()");
+  PyObject *lkwlist = Py_BuildValue ("{}");
+  req = (IPPRequest *) PyType_GenericNew (&cups_IPPRequestType,
+					  largs, lkwlist);
+  Py_DECREF (largs);
+  Py_DECREF (lkwlist);
+  if (req)
+    req->ipp = ipp;
+
+  return req;
+}
+
 static IPPAttribute *
 build_IPPAttribute (ipp_attribute_t *attr)
 {
@@ -453,6 +469,21 @@ out:
   return attribute;
 }
 
+// As build_IPPAttribute(), but with an exception for values it
+// cannot convert.
+static IPPAttribute *
+build_attribute_or_raise (ipp_attribute_t *attr)
+{
+  IPPAttribute *attribute = build_IPPAttribute (attr);
+  if (!attribute && !PyErr_Occurred ())
+    PyErr_Format (PyExc_ValueError, "unable to convert attribute %s",
+		  ippGetName (attr) ? ippGetName (attr) : "");
+
+  return attribute;
+}
+
+static PyObject *IPPAttributeSequence_build (IPPRequest *request);
+
 static PyObject *
 IPPRequest_addSeparator (IPPRequest *self)
 {
@@ -595,8 +626,9 @@ cupsipp_iocb_read (PyObject *callable, ipp_uchar_t *buffer, size_t len)
 {
   PyObject *args = Py_BuildValue ("(i)", len);
   PyObject *result;
+  PyObject *stringobj = NULL;
+  Py_buffer view;
   Py_ssize_t got = -1;
-  char *gotbuffer;
 
   debugprintf ("-> cupsipp_iocb_read\n");
 
@@ -613,23 +645,31 @@ cupsipp_iocb_read (PyObject *callable, ipp_uchar_t *buffer, size_t len)
     goto out;
   }
 
-  if (PyUnicode_Check (result) || PyBytes_Check (result)) {
-    if (PyUnicode_Check (result)) {
-      PyObject *stringobj = PyUnicode_AsUTF8String (result);
-      PyBytes_AsStringAndSize (stringobj, &gotbuffer, &got);
-    } else {
-      PyBytes_AsStringAndSize (result, &gotbuffer, &got);
+  if (PyUnicode_Check (result)) {
+    stringobj = PyUnicode_AsUTF8String (result);
+    if (!stringobj) {
+      debugprintf ("Failed to encode result\n");
+      Py_DECREF (result);
+      goto out;
     }
+  }
 
+  // Accept any object supporting the buffer protocol.
+  if (PyObject_GetBuffer (stringobj ? stringobj : result,
+			  &view, PyBUF_SIMPLE) == 0) {
+    got = view.len;
     if (got > len) {
       debugprintf ("More data returned than requested!  Truncated...\n");
       got = len;
     }
-    memcpy (buffer, gotbuffer, got);
+    memcpy (buffer, view.buf, got);
+    PyBuffer_Release (&view);
   } else {
+    PyErr_Clear ();
     debugprintf ("Unknown result object type!\n");
   }
 
+  Py_XDECREF (stringobj);
   Py_DECREF (result);
 
  out:
@@ -637,6 +677,67 @@ cupsipp_iocb_read (PyObject *callable, ipp_uchar_t *buffer, size_t len)
   return got;
 }
 
+static ssize_t
+cupsipp_iocb_readinto (PyObject *callable, ipp_uchar_t *buffer, size_t len)
+{
+  PyObject *view;
+  PyObject *result;
+  Py_ssize_t got = -1;
+
+  debugprintf ("-> cupsipp_iocb_readinto\n");
+
+  // Let the callback fill libcups' own buffer directly.
+#if PY_MAJOR_VERSION >= 3
+  view = PyMemoryView_FromMemory ((char *) buffer, len, PyBUF_WRITE);
+#else
+  view = PyBuffer_FromReadWriteMemory (buffer, len);
+#endif
+  if (!view) {
+    debugprintf ("Failed to create buffer view\n");
+    goto out;
+  }
+
+  result = PyObject_CallFunctionObjArgs (callable, view, NULL);
+
+#if PY_MAJOR_VERSION >= 3
+  // The memory belongs to libcups, so make sure the callback
+  // cannot keep using it.
+  {
+    PyObject *released = PyObject_CallMethod (view, "release", NULL);
+    if (released)
+      Py_DECREF (released);
+    else
+      PyErr_Clear ();
+  }
+#endif
+  Py_DECREF (view);
+
+  if (result == NULL) {
+    debugprintf ("Exception in readinto callback\n");
+    goto out;
+  }
+
+  if (PyLong_Check (result))
+    got = PyLong_AsSsize_t (result);
+#if PY_MAJOR_VERSION < 3
+  else if (PyInt_Check (result))
+    got = PyInt_AsSsize_t (result);
+#endif
+  else
+    debugprintf ("Bad return value\n");
+
+  if (got > (Py_ssize_t) len) {
+    debugprintf ("More data claimed than buffer size!\n");
+    got = -1;
+  }
+
+  Py_DECREF (result);
+
+ out:
+  debugprintf ("<- cupsipp_iocb_readinto() == %zd\n", got);
+  return got;
+}
+
 static ssize_t
 cupsipp_iocb_write (PyObject *callable, ipp_uchar_t *buffer, size_t len)
 {
@@ -683,11 +784,12 @@ IPPRequest_readIO (IPPRequest *self, PyObject *args, PyObject *kwds)
 {
   PyObject *cb;
   char blocking = 1;
+  char readinto = 0;
   ipp_state_t state;
-  static char *kwlist[] = { "read_fn", "blocking", NULL };
+  static char *kwlist[] = { "read_fn", "blocking", "readinto", NULL };
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|b", kwlist,
-				    &cb, &blocking))
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|bb", kwlist,
+				    &cb, &blocking, &readinto))
     return NULL;
 
   if (!PyCallable_Check (cb)) {
@@ -695,7 +797,9 @@ IPPRequest_readIO (IPPRequest *self, PyObject *args, PyObject *kwds)
     return NULL;
   }
 
-  state = ippReadIO (cb, (ipp_iocb_t) cupsipp_iocb_read,
+  state = ippReadIO (cb, (ipp_iocb_t) (readinto ?
+				       cupsipp_iocb_readinto :
+				       cupsipp_iocb_read),
 		     blocking, NULL, self->ipp);
 #if PY_MAJOR_VERSION >= 3
   return PyLong_FromLong (state);
@@ -730,6 +834,196 @@ IPPRequest_writeIO (IPPRequest *self, PyObject *args, PyObject *kwds)
 #endif
 }
 
+// An in-memory IPP message for ippReadIO().
+struct cupsipp_mem
+{
+  const ipp_uchar_t *data;
+  size_t len;
+  size_t pos;
+};
+
+static ssize_t
+cupsipp_iocb_mem (struct cupsipp_mem *mem, ipp_uchar_t *buffer, size_t len)
+{
+  size_t left = mem->len - mem->pos;
+  if (len > left)
+    len = left;
+
+  memcpy (buffer, mem->data + mem->pos, len);
+  mem->pos += len;
+  return len;
+}
+
+// Parse one whole message from memory.  Called without the GIL.
+static ipp_state_t
+cupsipp_read_mem (ipp_t *ipp, const void *data, size_t len)
+{
+  struct cupsipp_mem mem;
+  mem.data = data;
+  mem.len = len;
+  mem.pos = 0;
+  return ippReadIO (&mem, (ipp_iocb_t) cupsipp_iocb_mem, 1, NULL, ipp);
+}
+
+static PyObject *
+IPPRequest_readFrom (IPPRequest *self, PyObject *args)
+{
+  PyObject *source;
+  ipp_state_t state;
+
+  if (!PyArg_ParseTuple (args, "O", &source))
+    return NULL;
+
+  if (PyObject_CheckBuffer (source)) {
+    Py_buffer view;
+
+    if (PyObject_GetBuffer (source, &view, PyBUF_SIMPLE) != 0)
+      return NULL;
+
+    debugprintf ("-> IPPRequest_readFrom(%zd bytes)\n", view.len);
+    Py_BEGIN_ALLOW_THREADS;
+    state = cupsipp_read_mem (self->ipp, view.buf, view.len);
+    Py_END_ALLOW_THREADS;
+    PyBuffer_Release (&view);
+  } else {
+    int fd = PyObject_AsFileDescriptor (source);
+    if (fd == -1)
+      return NULL;
+
+    debugprintf ("-> IPPRequest_readFrom(fd=%d)\n", fd);
+    Py_BEGIN_ALLOW_THREADS;
+    state = ippReadFile (fd, self->ipp);
+    Py_END_ALLOW_THREADS;
+  }
+
+  debugprintf ("<- IPPRequest_readFrom() = %d\n", (int) state);
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (state);
+#else
+  return PyInt_FromLong (state);
+#endif
+}
+
+struct cupsipp_parse_job
+{
+  Py_buffer *views;
+  ipp_t **ipps;
+  Py_ssize_t first;
+  Py_ssize_t end;
+};
+
+static void *
+cupsipp_parse_many (void *data)
+{
+  struct cupsipp_parse_job *job = data;
+  Py_ssize_t i;
+
+  for (i = job->first; i < job->end; i++) {
+    ipp_t *ipp = ippNew ();
+    if (ipp &&
+	cupsipp_read_mem (ipp, job->views[i].buf,
+			  job->views[i].len) != IPP_DATA) {
+      ippDelete (ipp);
+      ipp = NULL;
+    }
+
+    job->ipps[i] = ipp;
+  }
+
+  return NULL;
+}
+
+static PyObject *
+IPPRequest_parseMany (PyObject *cls, PyObject *args, PyObject *kwds)
+{
+  PyObject *buffersobj;
+  PyObject *seq;
+  PyObject *ret = NULL;
+  Py_buffer *views = NULL;
+  ipp_t **ipps = NULL;
+  struct cupsipp_parse_job *jobs = NULL;
+  Py_ssize_t n, got = 0, i;
+  int num_threads = 1, t;
+  static char *kwlist[] = { "buffers", "threads", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|i", kwlist,
+				    &buffersobj, &num_threads))
+    return NULL;
+
+  seq = PySequence_Fast (buffersobj, "buffers must be a sequence");
+  if (!seq)
+    return NULL;
+
+  n = PySequence_Fast_GET_SIZE (seq);
+  if (num_threads < 1)
+    num_threads = 1;
+  if (num_threads > n)
+    num_threads = n ? n : 1;
+
+  views = calloc (n ? n : 1, sizeof (*views));
+  ipps = calloc (n ? n : 1, sizeof (*ipps));
+  jobs = calloc (num_threads, sizeof (*jobs));
+  if (!views || !ipps || !jobs) {
+    PyErr_NoMemory ();
+    goto out;
+  }
+
+  for (got = 0; got < n; got++)
+    if (PyObject_GetBuffer (PySequence_Fast_GET_ITEM (seq, got),
+			    &views[got], PyBUF_SIMPLE) != 0)
+      goto out;
+
+  for (t = 0; t < num_threads; t++) {
+    jobs[t].views = views;
+    jobs[t].ipps = ipps;
+    jobs[t].first = (long long) n * t / num_threads;
+    jobs[t].end = (long long) n * (t + 1) / num_threads;
+  }
+
+  debugprintf ("-> IPPRequest_parseMany(%zd buffers, %d threads)\n",
+	       n, num_threads);
+  Py_BEGIN_ALLOW_THREADS;
+  run_in_threads (cupsipp_parse_many, jobs, sizeof (*jobs), num_threads);
+  Py_END_ALLOW_THREADS;
+
+  ret = PyList_New (n);
+  for (i = 0; ret && i < n; i++) {
+    PyObject *obj;
+
+    if (ipps[i]) {
+      obj = (PyObject *) build_IPPRequest (ipps[i]);
+      if (!obj) {
+	Py_CLEAR (ret);
+	break;
+      }
+
+      ipps[i] = NULL;
+    } else {
+      Py_INCREF (Py_None);
+      obj = Py_None;
+    }
+
+    PyList_SET_ITEM (ret, i, obj);
+  }
+
+  debugprintf ("<- IPPRequest_parseMany()\n");
+
+ out:
+  for (i = 0; i < got; i++)
+    PyBuffer_Release (&views[i]);
+
+  if (ipps)
+    for (i = 0; i < n; i++)
+      if (ipps[i])
+	ippDelete (ipps[i]);
+
+  free (views);
+  free (ipps);
+  free (jobs);
+  Py_DECREF (seq);
+  return ret;
+}
+
 /* Request properties */
 
 static PyObject *
@@ -754,6 +1048,187 @@ IPPRequest_getAttributes (IPPRequest *self, void *closure)
   return NULL;
 }
 
+static PyObject *
+IPPRequest_getAttributeSequence (IPPRequest *self, void *closure)
+{
+  return IPPAttributeSequence_build (self);
+}
+
+// Find the first attribute called name, in the group given as a
+// Python integer or None for any.  Returns -1 with an exception set
+// if groupobj is not valid.
+static int
+find_attribute (IPPRequest *self, const char *name, PyObject *groupobj,
+		ipp_attribute_t **found)
+{
+  long group = IPP_TAG_ZERO;
+  ipp_attribute_t *attr;
+
+  if (groupobj && groupobj != Py_None) {
+#if PY_MAJOR_VERSION >= 3
+    group = PyLong_AsLong (groupobj);
+#else
+    group = PyInt_AsLong (groupobj);
+#endif
+    if (group == -1 && PyErr_Occurred ())
+      return -1;
+  }
+
+  for (attr = ippFindAttribute (self->ipp, name, IPP_TAG_ZERO);
+       attr && group != IPP_TAG_ZERO && ippGetGroupTag (attr) != group;
+       attr = ippFindNextAttribute (self->ipp, name, IPP_TAG_ZERO))
+    ;
+
+  *found = attr;
+  return 0;
+}
+
+static PyObject *
+IPPRequest_findAttribute (IPPRequest *self, PyObject *args, PyObject *kwds)
+{
+  const char *name;
+  PyObject *groupobj = Py_None;
+  ipp_attribute_t *attr;
+  static char *kwlist[] = { "name", "group", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "s|O", kwlist,
+				    &name, &groupobj))
+    return NULL;
+
+  if (find_attribute (self, name, groupobj, &attr) == -1)
+    return NULL;
+
+  if (!attr)
+    Py_RETURN_NONE;
+
+  return (PyObject *) build_attribute_or_raise (attr);
+}
+
+static PyObject *
+IPPRequest_setValue (IPPRequest *self, PyObject *args, PyObject *kwds)
+{
+  const char *name;
+  PyObject *value;
+  PyObject *groupobj = Py_None;
+  int element = 0;
+  ipp_attribute_t *attr;
+  long intvalue;
+  char *str;
+  static char *kwlist[] = { "name", "value", "element", "group", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "sO|iO", kwlist,
+				    &name, &value, &element, &groupobj))
+    return NULL;
+
+  if (find_attribute (self, name, groupobj, &attr) == -1)
+    return NULL;
+
+  if (!attr) {
+    PyErr_SetString (PyExc_KeyError, name);
+    return NULL;
+  }
+
+  if (element < 0 || element >= ippGetCount (attr)) {
+    PyErr_SetString (PyExc_IndexError, "value index out of range");
+    return NULL;
+  }
+
+  debugprintf ("-> IPPRequest_setValue(%s, %d)\n", name, element);
+  switch (ippGetValueTag (attr)) {
+  case IPP_TAG_INTEGER:
+  case IPP_TAG_ENUM:
+    if (PyLong_Check (value))
+      intvalue = PyLong_AsLong (value);
+#if PY_MAJOR_VERSION < 3
+    else if (PyInt_Check (value))
+      intvalue = PyInt_AsLong (value);
+#endif
+    else {
+      PyErr_SetString (PyExc_TypeError, "value must be an integer");
+      return NULL;
+    }
+
+    if (intvalue == -1 && PyErr_Occurred ())
+      return NULL;
+
+    ippSetInteger (self->ipp, &attr, element, intvalue);
+    break;
+
+  case IPP_TAG_BOOLEAN:
+    if (!PyBool_Check (value)) {
+      PyErr_SetString (PyExc_TypeError, "value must be a boolean");
+      return NULL;
+    }
+
+    ippSetBoolean (self->ipp, &attr, element, value == Py_True);
+    break;
+
+  case IPP_TAG_TEXT:
+  case IPP_TAG_NAME:
+  case IPP_TAG_KEYWORD:
+  case IPP_TAG_URI:
+  case IPP_TAG_MIMETYPE:
+  case IPP_TAG_CHARSET:
+  case IPP_TAG_LANGUAGE:
+    if (!PyUnicode_Check (value) && !PyBytes_Check (value)) {
+      PyErr_SetString (PyExc_TypeError, "value must be a string");
+      return NULL;
+    }
+
+    if (UTF8_from_PyObj (&str, value) == NULL)
+      return NULL;
+
+    copy_ipp_string (self->ipp, &attr, element, str);
+    free (str);
+    break;
+
+  default:
+    PyErr_Format (PyExc_TypeError, "cannot set values of value tag %d",
+		  (int) ippGetValueTag (attr));
+    return NULL;
+  }
+
+  debugprintf ("<- IPPRequest_setValue()\n");
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+IPPRequest_getRequestId (IPPRequest *self, void *closure)
+{
+#if PY_MAJOR_VERSION >= 3
+  return PyLong_FromLong (ippGetRequestId (self->ipp));
+#else
+  return PyInt_FromLong (ippGetRequestId (self->ipp));
+#endif
+}
+
+static int
+IPPRequest_setRequestId (IPPRequest *self, PyObject *value, void *closure)
+{
+  int request_id;
+
+  if (value == NULL)
+  {
+    PyErr_SetString(PyExc_TypeError, "Cannot delete requestid");
+    return -1;
+  }
+
+  if (PyLong_Check(value))
+    request_id = PyLong_AsLong (value);
+#if PY_MAJOR_VERSION < 3
+  else if (PyInt_Check(value))
+    request_id = PyInt_AsLong (value);
+#endif
+  else
+  {
+    PyErr_SetString(PyExc_TypeError, "requestid must be an integer");
+    return -1;
+  }
+
+  ippSetRequestId (self->ipp, request_id);
+  return 0;
+}
+
 static PyObject *
 IPPRequest_getOperation (IPPRequest *self, void *closure)
 {
@@ -844,10 +1319,20 @@ PyGetSetDef IPPRequest_getseters[] =
       (getter) IPPRequest_getAttributes, (setter) NULL,
       "IPP request attributes", NULL },
 
+    { "attributeSequence",
+      (getter) IPPRequest_getAttributeSequence, (setter) NULL,
+      "IPP request attributes, converted only as they are indexed",
+      NULL },
+
     { "operation",
       (getter) IPPRequest_getOperation, (setter) NULL,
       "IPP request operation", NULL },
 
+    { "requestid",
+      (getter) IPPRequest_getRequestId,
+      (setter) IPPRequest_setRequestId,
+      "IPP request ID", NULL },
+
     { "state",
       (getter) IPPRequest_getState,
       (setter) IPPRequest_setState,
@@ -875,17 +1360,72 @@ PyMethodDef IPPRequest_methods[] =
       "@param attr: Attribute to add to the request\n"
       "@return: IPP request attribute" },
 
+    { "findAttribute",
+      (PyCFunction) IPPRequest_findAttribute, METH_VARARGS | METH_KEYWORDS,
+      "findAttribute(name, group=None) -> IPPAttribute or None\n\n"
+      "@type name: string\n"
+      "@param name: attribute name\n"
+      "@type group: integer\n"
+      "@param group: IPP group tag, or None for any group\n"
+      "@return: the first attribute of that name, or None" },
+
+    { "setValue",
+      (PyCFunction) IPPRequest_setValue, METH_VARARGS | METH_KEYWORDS,
+      "setValue(name, value, element=0, group=None) -> None\n\n"
+      "Change one value of an attribute already in the request, \n"
+      "in place.  L{Connection.doRequests} sends requests without \n"
+      "freeing them, so a request can be built once, patched with \n"
+      "this, and sent many times.\n\n"
+      "@type name: string\n"
+      "@param name: attribute name\n"
+      "@param value: new value, of the attribute's type\n"
+      "@type element: integer\n"
+      "@param element: index of the value to change\n"
+      "@type group: integer\n"
+      "@param group: IPP group tag, or None for any group\n"
+      "@raise KeyError: no such attribute\n"
+      "@raise IndexError: no such value\n"
+      "@raise TypeError: value of the wrong type" },
+
     { "readIO",
       (PyCFunction) IPPRequest_readIO, METH_VARARGS | METH_KEYWORDS,
-      "readIO(read_fn, blocking=True) -> IPP state\n\n"
+      "readIO(read_fn, blocking=True, readinto=False) -> IPP state\n\n"
       "@type read_fn: Callable function\n"
       "@param read_fn: A callback, taking a single integer argument for\n"
-      "'size', for reading IPP data\n"
+      "'size', for reading IPP data.  It may return any bytes-like object.\n"
       "@type blocking: Boolean\n"
       "@param blocking: whether to continue reading until a complete\n"
       "request is read\n"
+      "@type readinto: Boolean\n"
+      "@param readinto: if true, read_fn is instead given a writable\n"
+      "buffer, which is only valid during the call, and must fill it\n"
+      "and return the number of bytes read, like io.RawIOBase.readinto\n"
+      "@return: IPP state value" },
+
+    { "readFrom",
+      (PyCFunction) IPPRequest_readFrom, METH_VARARGS,
+      "readFrom(source) -> IPP state\n\n"
+      "Read a whole IPP message without calling back into Python, \n"
+      "and without holding the global interpreter lock.\n\n"
+      "@type source: file descriptor or bytes-like object\n"
+      "@param source: file descriptor (or object with a fileno() \n"
+      "method) to read until the message is complete, or a buffer \n"
+      "holding the message\n"
       "@return: IPP state value" },
 
+    { "parseMany",
+      (PyCFunction) IPPRequest_parseMany,
+      METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+      "parseMany(buffers, threads=1) -> list\n\n"
+      "Parse several independent IPP messages at once, without \n"
+      "holding the global interpreter lock.\n\n"
+      "@type buffers: sequence of bytes-like objects\n"
+      "@param buffers: one IPP message in each\n"
+      "@type threads: integer\n"
+      "@param threads: number of threads to share the work between\n"
+      "@return: list, in step with buffers, of L{IPPRequest} objects, \n"
+      "or None for each buffer not holding a complete message" },
+
     { "writeIO",
       (PyCFunction) IPPRequest_writeIO, METH_VARARGS | METH_KEYWORDS,
       "writeIO(write_fn, blocking=True) -> IPP state\n\n"
@@ -945,3 +1485,129 @@ PyTypeObject cups_IPPRequestType =
     0,                         /* tp_alloc */
     IPPRequest_new,          /* tp_new */
   };
+
+//////////////////////////
+// IPPAttributeSequence //
+//////////////////////////
+
+typedef struct
+{
+  PyObject_HEAD
+  IPPRequest *request;
+  Py_ssize_t n;
+  ipp_attribute_t **attrs;
+
+  /* IPPAttribute objects, built as they are first asked for */
+  PyObject **objs;
+} IPPAttributeSequence;
+
+static PyObject *
+IPPAttributeSequence_build (IPPRequest *request)
+{
+  IPPAttributeSequence *seq;
+  ipp_attribute_t *attr;
+  Py_ssize_t n = 0;
+
+  seq = PyObject_New (IPPAttributeSequence, &cups_IPPAttributeSequenceType);
+  if (!seq)
+    return NULL;
+
+  for (attr = ippFirstAttribute (request->ipp); attr;
+       attr = ippNextAttribute (request->ipp))
+    n++;
+
+  Py_INCREF (request);
+  seq->request = request;
+  seq->n = n;
+  seq->attrs = calloc (n ? n : 1, sizeof (ipp_attribute_t *));
+  seq->objs = calloc (n ? n : 1, sizeof (PyObject *));
+  if (!seq->attrs || !seq->objs) {
+    seq->n = 0;
+    Py_DECREF (seq);
+    return PyErr_NoMemory ();
+  }
+
+  n = 0;
+  for (attr = ippFirstAttribute (request->ipp); attr;
+       attr = ippNextAttribute (request->ipp))
+    seq->attrs[n++] = attr;
+
+  return (PyObject *) seq;
+}
+
+static void
+IPPAttributeSequence_dealloc (IPPAttributeSequence *self)
+{
+  Py_ssize_t i;
+
+  if (self->objs)
+    for (i = 0; i < self->n; i++)
+      Py_XDECREF (self->objs[i]);
+
+  free (self->objs);
+  free (self->attrs);
+  Py_XDECREF (self->request);
+  PyObject_Del (self);
+}
+
+static Py_ssize_t
+IPPAttributeSequence_length (IPPAttributeSequence *self)
+{
+  return self->n;
+}
+
+static PyObject *
+IPPAttributeSequence_item (IPPAttributeSequence *self, Py_ssize_t i)
+{
+  if (i < 0 || i >= self->n) {
+    PyErr_SetString (PyExc_IndexError, "attribute index out of range");
+    return NULL;
+  }
+
+  if (!self->objs[i]) {
+    self->objs[i] = (PyObject *) build_attribute_or_raise (self->attrs[i]);
+    if (!self->objs[i])
+      return NULL;
+  }
+
+  Py_INCREF (self->objs[i]);
+  return self->objs[i];
+}
+
+static PySequenceMethods IPPAttributeSequence_sequence =
+  {
+    (lenfunc) IPPAttributeSequence_length, /* sq_length */
+    0,                                     /* sq_concat */
+    0,                                     /* sq_repeat */
+    (ssizeargfunc) IPPAttributeSequence_item, /* sq_item */
+  };
+
+PyTypeObject cups_IPPAttributeSequenceType =
+  {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cups.IPPAttributeSequence", /*tp_name*/
+    sizeof(IPPAttributeSequence), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)IPPAttributeSequence_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &IPPAttributeSequence_sequence, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "IPP attribute sequence\n"
+    "======================\n"
+    "  The attributes of an L{IPPRequest}, as they were when the\n"
+    "sequence was made.  Each L{IPPAttribute} is only built when it is\n"
+    "first indexed.\n\n"
+    "",                        /* tp_doc */
+  };
@@ -30,6 +30,8 @@ extern PyTypeObject cups_IPPRequestType;
 extern PyMethodDef IPPAttribute_methods[];
 extern PyTypeObject cups_IPPAttributeType;
 
+extern PyTypeObject cups_IPPAttributeSequenceType;
+
 typedef struct
 {
   PyObject_HEAD
@@ -49,4 +51,7 @@ typedef struct
   PyObject *values;
 } IPPAttribute;
 
+/* Wrap an existing ipp_t (ownership is transferred) */
+extern IPPRequest *build_IPPRequest (ipp_t *ipp);
+
 #endif /* HAVE_CUPSIPP_H */
@@ -25,8 +25,10 @@
 
 #include "cupsmodule.h"
 
+#include <limits.h>
 #include <locale.h>
 #include <pthread.h>
+#include <time.h>
 #include <wchar.h>
 #include <wctype.h>
 
@@ -94,67 +96,111 @@ get_TLS (void)
   return tls;
 }
 
-static int
-do_model_compare (const wchar_t *a, const wchar_t *b)
+/*
+ * Call fn on each of the n jobs, size bytes apart from jobs, the first
+ * on this thread and the rest on threads of their own, running any
+ * that cannot get a thread here instead.  Returns non-zero if any
+ * call returned non-NULL.  Needs no GIL, so callers can release it.
+ */
+int
+run_in_threads (void *(*fn) (void *), void *jobs, size_t size, int n)
 {
-  const wchar_t *digits = L"0123456789";
-  wchar_t quick_a, quick_b;
-  while ((quick_a = *a) != L'\0' && (quick_b = *b) != L'\0') {
-    int end_a = wcsspn (a, digits);
-    int end_b = wcsspn (b, digits);
-    int min;
-    int a_is_digit = 1;
-    int cmp;
-
-    if (quick_a != quick_b && !iswdigit (quick_a) && !iswdigit (quick_b)) {
-      if (quick_a < quick_b) return -1;
-      else return 1;
-    }
-
-    if (!end_a) {
-      end_a = wcscspn (a, digits);
-      a_is_digit = 0;
-    }
-
-    if (!end_b) {
-      if (a_is_digit)
-	return -1;
-      end_b = wcscspn (b, digits);
-    } else if (!a_is_digit)
-      return 1;
-
-    if (a_is_digit) {
-      unsigned long n_a, n_b;
-      n_a = wcstoul (a, NULL, 10);
-      n_b = wcstoul (b, NULL, 10);
-      if (n_a < n_b) cmp = -1;
-      else if (n_a == n_b) cmp = 0;
-      else cmp = 1;
-    } else {
-      min = end_a < end_b ? end_a : end_b;
-      cmp = wcsncmp (a, b, min);
-    }
+  pthread_t *tids = NULL;
+  char *started = NULL;
+  int failed = 0;
+  int t;
+
+  if (n > 1) {
+    tids = calloc (n, sizeof (*tids));
+    started = calloc (n, sizeof (*started));
+  }
 
-    if (!cmp) {
-      if (end_a != end_b)
-	return end_a < end_b ? -1 : 1;
+  for (t = 1; t < n; t++) {
+    void *job = (char *) jobs + t * size;
+    if (tids && started && pthread_create (&tids[t], NULL, fn, job) == 0)
+      started[t] = 1;
+    else if (fn (job))
+      failed = 1;
+  }
 
-      a += end_a;
-      b += end_b;
-      continue;
-    }
+  if (fn (jobs))
+    failed = 1;
 
-    return cmp;
+  for (t = 1; t < n; t++) {
+    void *status = NULL;
+    if (started && started[t] &&
+	(pthread_join (tids[t], &status) != 0 || status))
+      failed = 1;
   }
 
-  if (quick_a == L'\0') {
-    if (*b == L'\0')
-      return 0;
+  free (tids);
+  free (started);
+  return failed;
+}
 
-    return -1;
+/*
+ * Sort key for a model string: runs of digits sort by their numeric
+ * value, before any other text, and other text sorts by character.
+ * The key is packed so that comparing keys as bytes gives that order,
+ * letting sorts use memcmp instead of re-scanning the strings.
+ *
+ *   digits: 0x01, value (8 bytes, saturated), run length (4 bytes)
+ *   text:   0x02, each character + 1 (3 bytes each), 0x000000
+ *
+ * All numbers are big-endian.  0x01 < 0x02 puts numbers before text,
+ * and the zero terminator puts a text run before any longer one
+ * starting the same way.
+ */
+static PyObject *
+model_sort_key (const wchar_t *s, size_t len)
+{
+  PyObject *ret;
+  unsigned char *key, *p;
+  size_t i = 0;
+  int k;
+
+  // At most 13 bytes per character.
+  key = malloc (13 * len + 1);
+  if (!key)
+    return PyErr_NoMemory ();
+
+  p = key;
+  while (i < len) {
+    size_t start = i;
+
+    if (iswdigit (s[i])) {
+      unsigned long long n = 0;
+      for (; i < len && iswdigit (s[i]); i++) {
+	unsigned long long digit = s[i] - L'0';
+	if (n > (ULONG_MAX - digit) / 10)
+	  n = ULONG_MAX; // as wcstoul
+	else
+	  n = n * 10 + digit;
+      }
+
+      *p++ = 0x01;
+      for (k = 7; k >= 0; k--)
+	*p++ = (n >> (8 * k)) & 0xff;
+      for (k = 3; k >= 0; k--)
+	*p++ = ((i - start) >> (8 * k)) & 0xff;
+    } else {
+      *p++ = 0x02;
+      for (; i < len && !iswdigit (s[i]); i++) {
+	unsigned long c = (unsigned long) s[i] + 1;
+	*p++ = (c >> 16) & 0xff;
+	*p++ = (c >> 8) & 0xff;
+	*p++ = c & 0xff;
+      }
+
+      *p++ = 0;
+      *p++ = 0;
+      *p++ = 0;
+    }
   }
 
-  return 1;
+  ret = PyBytes_FromStringAndSize ((char *) key, p - key);
+  free (key);
+  return ret;
 }
 
 #ifndef HAVE_CUPS_1_4
@@ -257,6 +303,12 @@ ippGetRange(ipp_attribute_t *attr,
   return (attr->values[element].range.lower);
 }
 
+int
+ippGetRequestId(ipp_t *ipp)
+{
+  return (ipp->request.any.request_id);
+}
+
 int
 ippGetResolution(
     ipp_attribute_t *attr,
@@ -315,6 +367,16 @@ ippNextAttribute(ipp_t *ipp)
   return (ipp->current = ipp->current->next);
 }
 
+int
+ippSetBoolean(ipp_t           *ipp,
+              ipp_attribute_t **attr,
+              int             element,
+              int             boolvalue)
+{
+  (*attr)->values[element].boolean = (char) boolvalue;
+  return (1);
+}
+
 int
 ippSetInteger(ipp_t           *ipp,
               ipp_attribute_t **attr,
@@ -333,6 +395,14 @@ ippSetOperation(ipp_t    *ipp,
   return (1);
 }
 
+int
+ippSetRequestId(ipp_t *ipp,
+                int   request_id)
+{
+  ipp->request.any.request_id = request_id;
+  return (1);
+}
+
 int
 ippSetState(ipp_t       *ipp,
 	    ipp_state_t state)
@@ -361,73 +431,232 @@ ippSetString(ipp_t           *ipp,
 
 #endif
 
-//////////////////////////
-// Module-level methods //
-//////////////////////////
+/* ippSetString() copies the string it is given, but the shim above
+ * keeps the pointer, so callers patching a value from a temporary
+ * buffer go through here. */
+int
+copy_ipp_string (ipp_t *ipp, ipp_attribute_t **attr, int element,
+		 const char *value)
+{
+#ifdef HAVE_CUPS_1_6
+  return ippSetString (ipp, attr, element, value);
+#else /* !HAVE_CUPS_1_6 */
+  return ippSetString (ipp, attr, element, strdup (value));
+#endif /* !HAVE_CUPS_1_6 */
+}
 
-static PyObject *
-cups_modelSort (PyObject *self, PyObject *args)
+////////////////
+// Statistics //
+////////////////
+
+unsigned long long
+stats_now (void)
 {
-  PyObject *Oa, *Ob, *a, *b;
-  int len_a, len_b;
-  size_t size_a, size_b;
-  wchar_t *wca, *wcb;
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-  if (!PyArg_ParseTuple (args, "OO", &Oa, &Ob))
-    return NULL;
+#ifdef PYCUPS_STATS
+/* Latency histogram buckets: bucket 0 counts times under 1us,
+ * bucket i times under 2^i us, and the last bucket the rest. */
+#define STATS_BUCKETS 24
 
-  a = PyUnicode_FromObject (Oa);
-  b = PyUnicode_FromObject (Ob);
-  if (a == NULL || b == NULL || !PyUnicode_Check (a) || !PyUnicode_Check (b)) {
-    if (a) {
-      Py_DECREF (a);
-    }
-    if (b) {
-      Py_DECREF (b);
-    }
+struct stats_phase_s
+{
+  unsigned long long count;
+  unsigned long long total_ns;
+  unsigned long long max_ns;
+  unsigned long long buckets[STATS_BUCKETS];
+};
 
-    PyErr_SetString (PyExc_TypeError, "Unable to convert to Unicode");
-    return NULL;
+static struct
+{
+  unsigned long long failed;
+  struct stats_phase_s phases[STATS_NUM_PHASES];
+} stats[STATS_NUM_OPS];
+
+static const char *stats_op_names[STATS_NUM_OPS] = {
+  "getPrinters",
+  "getJobs",
+  "getJobAttributes",
+  "getPPDs",
+};
+
+static const char *stats_phase_names[STATS_NUM_PHASES] = {
+  "build",
+  "wait",
+  "decode",
+};
+
+/* Called with the GIL held, which serialises the updates. */
+void
+stats_phase (enum stats_op op, enum stats_phase phase,
+	     unsigned long long *since)
+{
+  struct stats_phase_s *p = &stats[op].phases[phase];
+  unsigned long long now = stats_now ();
+  unsigned long long ns = now - *since;
+  unsigned long long us = ns / 1000;
+  int bucket = 0;
+
+  while (us && bucket < STATS_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
   }
 
-  len_a = 1 + PyUnicode_GetSize (a);
-  size_a = len_a * sizeof (wchar_t);
-  if ((size_a / sizeof (wchar_t)) != len_a) {
-    Py_DECREF (a);
-    Py_DECREF (b);
-    PyErr_SetString (PyExc_RuntimeError, "String too long");
+  p->count++;
+  p->total_ns += ns;
+  if (ns > p->max_ns)
+    p->max_ns = ns;
+
+  p->buckets[bucket]++;
+  *since = now;
+}
+
+void
+stats_failed (enum stats_op op)
+{
+  stats[op].failed++;
+}
+#endif /* PYCUPS_STATS */
+
+//////////////////////////
+// Module-level methods //
+//////////////////////////
+
+static PyObject *
+model_sort_key_from_PyObj (PyObject *obj)
+{
+  PyObject *u, *ret;
+  int len;
+  size_t size;
+  wchar_t *wc;
+
+  u = PyUnicode_FromObject (obj);
+  if (u == NULL || !PyUnicode_Check (u)) {
+    Py_XDECREF (u);
+    PyErr_SetString (PyExc_TypeError, "Unable to convert to Unicode");
     return NULL;
   }
 
-  len_b = 1 + PyUnicode_GetSize (b);
-  size_b = len_b * sizeof (wchar_t);
-  if ((size_b / sizeof (wchar_t)) != len_b) {
-    Py_DECREF (a);
-    Py_DECREF (b);
+  len = 1 + PyUnicode_GetSize (u);
+  size = len * sizeof (wchar_t);
+  if ((size / sizeof (wchar_t)) != len) {
+    Py_DECREF (u);
     PyErr_SetString (PyExc_RuntimeError, "String too long");
     return NULL;
   }
 
-  wca = malloc (size_a);
-  wcb = malloc (size_b);
-  if (wca == NULL || wcb == NULL) {
-    Py_DECREF (a);
-    Py_DECREF (b);
-    free (wca);
-    free (wcb);
+  wc = malloc (size);
+  if (wc == NULL) {
+    Py_DECREF (u);
     PyErr_SetString (PyExc_RuntimeError, "Insufficient memory");
     return NULL;
   }
 #if PY_MAJOR_VERSION >= 3
-  PyUnicode_AsWideChar (a, wca, size_a);
-  PyUnicode_AsWideChar (b, wcb, size_b);
+  PyUnicode_AsWideChar (u, wc, size);
 #else
-  PyUnicode_AsWideChar ((PyUnicodeObject *) a, wca, size_a);
-  PyUnicode_AsWideChar ((PyUnicodeObject *) b, wcb, size_b);
+  PyUnicode_AsWideChar ((PyUnicodeObject *) u, wc, size);
 #endif
+  Py_DECREF (u);
+  ret = model_sort_key (wc, len - 1);
+  free (wc);
+  return ret;
+}
+
+static PyObject *
+cups_modelSortKey (PyObject *self, PyObject *args)
+{
+  PyObject *obj;
+
+  if (!PyArg_ParseTuple (args, "O", &obj))
+    return NULL;
+
+  return model_sort_key_from_PyObj (obj);
+}
+
+/* Sort a sequence of model strings by decorating each with its key. */
+static PyObject *
+model_sort_list (PyObject *seqobj)
+{
+  PyObject *seq, *decorated, *ret = NULL;
+  Py_ssize_t i, n;
+
+  seq = PySequence_Fast (seqobj, "modelSort needs a sequence or two strings");
+  if (!seq)
+    return NULL;
+
+  n = PySequence_Fast_GET_SIZE (seq);
+  decorated = PyList_New (n);
+  if (!decorated) {
+    Py_DECREF (seq);
+    return NULL;
+  }
+
+  for (i = 0; i < n; i++) {
+    // The index keeps the sort stable and stops the strings
+    // themselves ever being compared.
+    PyObject *item = PySequence_Fast_GET_ITEM (seq, i);
+    PyObject *key = model_sort_key_from_PyObj (item), *entry;
+    if (!key)
+      goto out;
+
+    entry = Py_BuildValue ("(OnO)", key, i, item);
+    Py_DECREF (key);
+    if (!entry)
+      goto out;
+
+    PyList_SET_ITEM (decorated, i, entry);
+  }
+
+  if (PyList_Sort (decorated) < 0)
+    goto out;
+
+  ret = PyList_New (n);
+  for (i = 0; ret && i < n; i++) {
+    PyObject *item = PyTuple_GET_ITEM (PyList_GET_ITEM (decorated, i), 2);
+    Py_INCREF (item);
+    PyList_SET_ITEM (ret, i, item);
+  }
+
+ out:
+  Py_DECREF (decorated);
+  Py_DECREF (seq);
+  return ret;
+}
+
+static PyObject *
+cups_modelSort (PyObject *self, PyObject *args)
+{
+  PyObject *Oa, *Ob = NULL, *a, *b;
+  int cmp;
+
+  if (!PyArg_ParseTuple (args, "O|O", &Oa, &Ob))
+    return NULL;
+
+  if (!Ob)
+    return model_sort_list (Oa);
+
+  a = model_sort_key_from_PyObj (Oa);
+  if (!a)
+    return NULL;
+
+  b = model_sort_key_from_PyObj (Ob);
+  if (!b) {
+    Py_DECREF (a);
+    return NULL;
+  }
+
+  cmp = memcmp (PyBytes_AS_STRING (a), PyBytes_AS_STRING (b),
+		PyBytes_GET_SIZE (a) < PyBytes_GET_SIZE (b) ?
+		PyBytes_GET_SIZE (a) : PyBytes_GET_SIZE (b));
+  if (!cmp && PyBytes_GET_SIZE (a) != PyBytes_GET_SIZE (b))
+    cmp = PyBytes_GET_SIZE (a) < PyBytes_GET_SIZE (b) ? -1 : 1;
+
   Py_DECREF (a);
   Py_DECREF (b);
-  return Py_BuildValue ("i", do_model_compare (wca, wcb));
+  return Py_BuildValue ("i", cmp < 0 ? -1 : cmp > 0);
 }
 
 static PyObject *
@@ -511,6 +740,108 @@ cups_getEncryption (PyObject *self)
   return Py_BuildValue ("i", cupsEncryption ());
 }
 
+static PyObject *
+cups_setPPDCache (PyObject *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *dirobj;
+  char *dir = NULL;
+  long max_size = 0;
+  static char *kwlist[] = { "directory", "max_size", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|l", kwlist,
+				    &dirobj, &max_size))
+    return NULL;
+
+  if (dirobj != Py_None && UTF8_from_PyObj (&dir, dirobj) == NULL)
+    return NULL;
+
+  if (Connection_set_ppd_cache (dir, max_size) < 0) {
+    PyErr_SetFromErrnoWithFilename (PyExc_OSError, dir);
+    free (dir);
+    return NULL;
+  }
+
+  free (dir);
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+cups_getPPDCache (PyObject *self)
+{
+  long max_size;
+  const char *dir = Connection_get_ppd_cache (&max_size);
+
+  if (!dir)
+    Py_RETURN_NONE;
+
+  return Py_BuildValue ("(sl)", dir, max_size);
+}
+
+static PyObject *
+cups_getStats (PyObject *self)
+{
+#ifdef PYCUPS_STATS
+  PyObject *result = PyDict_New ();
+  int op, phase, i;
+
+  for (op = 0; result && op < STATS_NUM_OPS; op++) {
+    PyObject *opdict = Py_BuildValue ("{sK}", "failed", stats[op].failed);
+
+    for (phase = 0; opdict && phase < STATS_NUM_PHASES; phase++) {
+      struct stats_phase_s *p = &stats[op].phases[phase];
+      PyObject *hist = PyList_New (STATS_BUCKETS);
+      PyObject *phasedict;
+
+      for (i = 0; hist && i < STATS_BUCKETS; i++)
+	PyList_SET_ITEM (hist, i, PyLong_FromUnsignedLongLong (p->buckets[i]));
+
+      phasedict = Py_BuildValue ("{sKsdsdsN}",
+				 "count", p->count,
+				 "total", p->total_ns / 1e9,
+				 "max", p->max_ns / 1e9,
+				 "histogram", hist);
+      if (!phasedict || PyDict_SetItemString (opdict,
+					      stats_phase_names[phase],
+					      phasedict) < 0)
+	Py_CLEAR (opdict);
+
+      Py_XDECREF (phasedict);
+    }
+
+    if (!opdict || PyDict_SetItemString (result, stats_op_names[op],
+					 opdict) < 0)
+      Py_CLEAR (result);
+
+    Py_XDECREF (opdict);
+  }
+
+  return result;
+#else /* !PYCUPS_STATS */
+  Py_RETURN_NONE;
+#endif /* !PYCUPS_STATS */
+}
+
+static PyObject *
+cups_resetStats (PyObject *self)
+{
+#ifdef PYCUPS_STATS
+  memset (stats, 0, sizeof (stats));
+#endif /* PYCUPS_STATS */
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+cups_setPPDPoolSize (PyObject *self, PyObject *args)
+{
+  int size;
+
+  if (!PyArg_ParseTuple (args, "i", &size))
+    return NULL;
+
+  PPD_set_pool_size (size);
+  Py_RETURN_NONE;
+}
+
 static PyObject *
 cups_setPasswordCB (PyObject *self, PyObject *args)
 {
@@ -677,6 +1008,7 @@ cups_connectDest (PyObject *self, PyObject *args, PyObject *kwds)
   Dest *dest_o;
   cups_dest_t dest;
   PyObject *ret;
+  int i;
   static char *kwlist[] = { "dest",
 			    "cb",
 			    "flags",
@@ -715,13 +1047,14 @@ cups_connectDest (PyObject *self, PyObject *args, PyObject *kwds)
   dest.is_default = dest_o->is_default;
   dest.name = dest_o->destname;
   dest.instance = dest_o->instance;
-  dest.num_options = dest_o->num_options;
-  dest.options = malloc (dest_o->num_options * sizeof (dest.options[0]));
-  int i;
-  for (i = 0; i < dest_o->num_options; i++) {
-    dest.options[i].name = dest_o->name[i];
-    dest.options[i].value = dest_o->value[i];
-  }
+  // cupsConnectDest() may add to or replace the options, so give it
+  // copies of its own rather than the Dest's arena.
+  dest.num_options = 0;
+  dest.options = NULL;
+  for (i = 0; i < dest_o->num_options; i++)
+    dest.num_options = cupsAddOption (dest_o->options[i].name,
+				      dest_o->options[i].value,
+				      dest.num_options, &dest.options);
 
   conn = cupsConnectDest (&dest,
 			  flags,
@@ -733,7 +1066,7 @@ cups_connectDest (PyObject *self, PyObject *args, PyObject *kwds)
 			  &context);
   Py_XDECREF (cb);
   Py_XDECREF (user_data);
-  free (dest.options);
+  cupsFreeOptions (dest.num_options, dest.options);
 
   if (!conn) {
     set_ipp_error (cupsLastError (), cupsLastErrorString ());
@@ -832,13 +1165,27 @@ static struct module_state _state;
 
 static PyMethodDef cups_methods[] = {
   { "modelSort", cups_modelSort, METH_VARARGS,
-    "modelSort(s1,s2) -> integer\n\n"
-    "Sort two model strings.\n\n"
+    "modelSort(s1,s2) -> integer\n"
+    "modelSort(models) -> list\n\n"
+    "Sort two model strings, or a whole list of them.  Sorting a list \n"
+    "this way is much quicker than using modelSort as a comparison \n"
+    "function.\n\n"
     "@type s1: string\n"
     "@param s1: first string\n"
     "@type s2: string\n"
     "@param s2: second string\n"
-    "@return: strcmp-style comparision result"},
+    "@type models: string list\n"
+    "@param models: strings to sort\n"
+    "@return: strcmp-style comparision result, or a new sorted list"},
+
+  { "modelSortKey", cups_modelSortKey, METH_VARARGS,
+    "modelSortKey(s) -> bytes\n\n"
+    "Sort key for a model string, for use as sorted(models, \n"
+    "key=cups.modelSortKey).  Keys compare in the same order as \n"
+    "L{modelSort}.\n\n"
+    "@type s: string\n"
+    "@param s: model string\n"
+    "@return: key that compares as the string should sort"},
 
   { "setUser", cups_setUser, METH_VARARGS,
     "setUser(user) -> None\n\n"
@@ -882,6 +1229,85 @@ static PyMethodDef cups_methods[] = {
     "Get encryption policy.\n"
     "@see: L{setEncryption}" },
 
+  { "fanout", (PyCFunction) Connection_fanout, METH_VARARGS | METH_KEYWORDS,
+    "fanout(hosts, operation, requested_attributes=None, concurrency=8, \n"
+    "port=ippPort(), encryption=cupsEncryption()) -> dict\n\n"
+    "Ask each of several CUPS servers the same question at once.  \n"
+    "Connections are opened and requests sent in parallel, up to \n"
+    "concurrency at a time, without holding the global interpreter \n"
+    "lock.  Servers asking for authentication are refused it; the \n"
+    "password callback is not called.\n\n"
+    "@type hosts: string list\n"
+    "@param hosts: servers to query\n"
+    "@type operation: string\n"
+    "@param operation: 'getPrinters' or 'getJobs'\n"
+    "@type requested_attributes: string list\n"
+    "@param requested_attributes: list of requested attribute names, \n"
+    "in place of the L{Connection} method's default\n"
+    "@type concurrency: integer\n"
+    "@param concurrency: most servers to talk to at once\n"
+    "@type port: integer\n"
+    "@param port: IPP port\n"
+    "@type encryption: integer\n"
+    "@param encryption: encryption to use, as for L{Connection}\n"
+    "@return: dict indexed by host, each value being what the \n"
+    "L{Connection} method of that name returns, or the exception \n"
+    "it would have raised: RuntimeError on failure to connect, \n"
+    "otherwise L{IPPError}\n"
+    "@raise ValueError: unknown operation" },
+
+  { "clearDeviceCache", (PyCFunction) Connection_clearDeviceCache,
+    METH_NOARGS,
+    "clearDeviceCache() -> None\n\n"
+    "Forget the devices remembered by L{Connection.getDevices} and \n"
+    "L{Connection.streamDevices} calls made with a cache_ttl." },
+
+  { "setPPDCache", (PyCFunction) cups_setPPDCache,
+    METH_VARARGS | METH_KEYWORDS,
+    "setPPDCache(directory, max_size=0) -> None\n\n"
+    "Keep copies of PPDs fetched by L{Connection.getPPD} and \n"
+    "L{Connection.getPPD3} in a directory, so that unchanged PPDs are \n"
+    "not downloaded again.  The directory may be shared between \n"
+    "processes and survives between them.  Entries are named by \n"
+    "server, port and queue.\n\n"
+    "@type directory: string\n"
+    "@param directory: cache directory, created if needed, or None to \n"
+    "stop caching\n"
+    "@type max_size: integer\n"
+    "@param max_size: size limit in bytes, 0 for none; the least \n"
+    "recently used PPDs are removed to keep within it\n"
+    "@raise OSError: directory could not be created" },
+
+  { "getPPDCache", (PyCFunction) cups_getPPDCache, METH_NOARGS,
+    "getPPDCache() -> (string, integer) or None\n\n"
+    "@return: cache directory and size limit, or None if not caching\n"
+    "@see: L{setPPDCache}" },
+
+  { "getStats", (PyCFunction) cups_getStats, METH_NOARGS,
+    "getStats() -> dict or None\n\n"
+    "Counters for the most used L{Connection} methods, if pycups was \n"
+    "built with PYCUPS_STATS set in the environment.\n\n"
+    "@return: None if not built with statistics, otherwise a dict \n"
+    "indexed by method name.  Each value is a dict with the number \n"
+    "of calls that 'failed', and for each phase 'build' (making the \n"
+    "request), 'wait' (the round trip to the server) and 'decode' \n"
+    "(making the result), a dict giving its 'count', 'total' and \n"
+    "'max' time in seconds, and a 'histogram' list: element 0 counts \n"
+    "times under a microsecond, element i times under 2**i \n"
+    "microseconds, and the last element all longer times." },
+
+  { "resetStats", (PyCFunction) cups_resetStats, METH_NOARGS,
+    "resetStats() -> None\n\n"
+    "Set the counters returned by L{getStats} back to zero." },
+
+  { "setPPDPoolSize", cups_setPPDPoolSize, METH_VARARGS,
+    "setPPDPoolSize(size) -> None\n\n"
+    "Set how many parsed PPD files are kept once unused, so that \n"
+    "a new L{PPD} for an unchanged file need not parse it again.  \n"
+    "The default is 16.\n\n"
+    "@type size: integer\n"
+    "@param size: number of parsed files to keep, or 0 to keep none" },
+
   { "setPasswordCB", cups_setPasswordCB, METH_VARARGS,
     "setPasswordCB(fn) -> None\n\n"
     "Set password callback function.  This Python function will be called \n"
@@ -1034,6 +1460,81 @@ initcups (void)
   PyModule_AddObject (m, "Connection",
 		      (PyObject *)&cups_ConnectionType);
 
+  // ConnectionPool type
+  cups_ConnectionPoolType.tp_new = PyType_GenericNew;
+  if (PyType_Ready (&cups_ConnectionPoolType) < 0)
+    INITERROR;
+
+  PyModule_AddObject (m, "ConnectionPool",
+		      (PyObject *)&cups_ConnectionPoolType);
+
+  // ResultMap and ResultEntry types
+  if (PyType_Ready (&cups_ResultMapType) < 0 ||
+      PyType_Ready (&cups_ResultEntryType) < 0)
+    INITERROR;
+
+  PyModule_AddObject (m, "ResultMap",
+		      (PyObject *)&cups_ResultMapType);
+  PyModule_AddObject (m, "ResultEntry",
+		      (PyObject *)&cups_ResultEntryType);
+
+  // Let isinstance(x, Mapping) work for them.
+#if PY_MAJOR_VERSION >= 3
+  obj = PyImport_ImportModule ("collections.abc");
+#else
+  obj = PyImport_ImportModule ("collections");
+#endif
+  if (obj) {
+    PyObject *mapping = PyObject_GetAttrString (obj, "Mapping");
+    Py_DECREF (obj);
+    if (mapping) {
+      PyObject *ret;
+      ret = PyObject_CallMethod (mapping, "register", "O",
+				 (PyObject *) &cups_ResultMapType);
+      Py_XDECREF (ret);
+      ret = PyObject_CallMethod (mapping, "register", "O",
+				 (PyObject *) &cups_ResultEntryType);
+      Py_XDECREF (ret);
+      Py_DECREF (mapping);
+    }
+  }
+
+  PyErr_Clear ();
+
+  // JobIterator type
+  if (PyType_Ready (&cups_JobIteratorType) < 0)
+    INITERROR;
+
+  PyModule_AddObject (m, "JobIterator",
+		      (PyObject *)&cups_JobIteratorType);
+
+  // PPDIterator type
+  if (PyType_Ready (&cups_PPDIteratorType) < 0)
+    INITERROR;
+
+  PyModule_AddObject (m, "PPDIterator",
+		      (PyObject *)&cups_PPDIteratorType);
+
+  // PrinterStateCache type
+  cups_PrinterStateCacheType.tp_new = PyType_GenericNew;
+  if (PyType_Ready (&cups_PrinterStateCacheType) < 0)
+    INITERROR;
+
+  PyModule_AddObject (m, "PrinterStateCache",
+		      (PyObject *)&cups_PrinterStateCacheType);
+
+  // NotificationPump type
+  cups_NotificationPumpType.tp_new = PyType_GenericNew;
+  if (PyType_Ready (&cups_NotificationPumpType) < 0)
+    INITERROR;
+
+  PyModule_AddObject (m, "NotificationPump",
+		      (PyObject *)&cups_NotificationPumpType);
+
+  // Shared strings for IPP attribute names and keywords
+  if (Connection_init_interned () < 0)
+    INITERROR;
+
   // PPD type
   cups_PPDType.tp_new = PyType_GenericNew;
   if (PyType_Ready (&cups_PPDType) < 0)
@@ -1098,6 +1599,13 @@ initcups (void)
   PyModule_AddObject (m, "IPPAttribute",
 		      (PyObject *)&cups_IPPAttributeType);
 
+  // IPPAttributeSequence type
+  if (PyType_Ready (&cups_IPPAttributeSequenceType) < 0)
+      INITERROR;
+
+  PyModule_AddObject (m, "IPPAttributeSequence",
+		      (PyObject *)&cups_IPPAttributeSequenceType);
+
   // Constants
 #if PY_MAJOR_VERSION >= 3
 #  define INT_CONSTANT(name)					\
@@ -1545,14 +2053,11 @@ initcups (void)
 ///////////////
 
 #define ENVAR "PYCUPS_DEBUG"
-static int debugging_enabled = -1;
+int debugging_enabled = -1;
 
 void
-debugprintf (const char *fmt, ...)
+do_debugprintf (const char *fmt, ...)
 {
-  if (!debugging_enabled)
-    return;
-
   if (debugging_enabled == -1)
     {
       if (!getenv (ENVAR))
@@ -32,7 +32,59 @@
 # define FORMAT(x) __attribute__ ((__format__ x))
 #endif
 
-extern void debugprintf (const char *fmt, ...) FORMAT ((__printf__, 1, 2));
+extern int debugging_enabled;
+extern void do_debugprintf (const char *fmt, ...) FORMAT ((__printf__, 1, 2));
+
+/* Only pay for the call when PYCUPS_DEBUG may be set. */
+#define debugprintf(...)				\
+  do {							\
+    if (debugging_enabled)				\
+      do_debugprintf (__VA_ARGS__);			\
+  } while (0)
+
+/* Per-operation counters and latency histograms, read by
+ * cups.getStats().  Built only with PYCUPS_STATS defined; otherwise
+ * the STATS_* macros expand to nothing. */
+enum stats_op
+{
+  STATS_GET_PRINTERS,
+  STATS_GET_JOBS,
+  STATS_GET_JOB_ATTRIBUTES,
+  STATS_GET_PPDS,
+  STATS_NUM_OPS
+};
+
+enum stats_phase
+{
+  STATS_BUILD,
+  STATS_WAIT,
+  STATS_DECODE,
+  STATS_NUM_PHASES
+};
+
+/* Monotonic clock in nanoseconds. */
+extern unsigned long long stats_now (void);
+
+#ifdef PYCUPS_STATS
+extern void stats_phase (enum stats_op op, enum stats_phase phase,
+			 unsigned long long *since);
+extern void stats_failed (enum stats_op op);
+
+/* Declare a clock, started now; it must come last among the
+ * declarations.  Each phase macro records the time since the
+ * clock was last read. */
+# define STATS_CLOCK(clock)		unsigned long long clock = stats_now ()
+# define STATS_BUILT(op, clock)		stats_phase (op, STATS_BUILD, &clock)
+# define STATS_WAITED(op, clock)	stats_phase (op, STATS_WAIT, &clock)
+# define STATS_DECODED(op, clock)	stats_phase (op, STATS_DECODE, &clock)
+# define STATS_FAILED(op)		stats_failed (op)
+#else /* !PYCUPS_STATS */
+# define STATS_CLOCK(clock)
+# define STATS_BUILT(op, clock)
+# define STATS_WAITED(op, clock)
+# define STATS_DECODED(op, clock)
+# define STATS_FAILED(op)
+#endif /* !PYCUPS_STATS */
 
 #if (CUPS_VERSION_MAJOR > 1) || (CUPS_VERSION_MAJOR == 1 && CUPS_VERSION_MINOR >= 2)
 #define HAVE_CUPS_1_2 1
@@ -77,6 +129,9 @@ struct TLS
 
 extern struct TLS *get_TLS (void);
 
+extern int run_in_threads (void *(*fn) (void *), void *jobs, size_t size,
+			   int n);
+
 #ifdef HAVE_CUPS_1_6
 typedef struct
 {
@@ -93,6 +148,7 @@ int ippGetInteger(ipp_attribute_t *attr, int element);
 const char * ippGetName(ipp_attribute_t *attr);
 ipp_op_t ippGetOperation(ipp_t *ipp);
 int ippGetRange(ipp_attribute_t *attr, int element, int *uppervalue);
+int ippGetRequestId(ipp_t *ipp);
 int ippGetResolution(ipp_attribute_t *attr, int element,
                      int *yres, ipp_res_t *units);
 ipp_status_t ippGetStatusCode(ipp_t *ipp);
@@ -101,9 +157,12 @@ const char * ippGetString(ipp_attribute_t *attr, int element,
 ipp_tag_t ippGetValueTag(ipp_attribute_t *attr);
 ipp_attribute_t	* ippFirstAttribute(ipp_t *ipp);
 ipp_attribute_t * ippNextAttribute(ipp_t *ipp);
+int ippSetBoolean(ipp_t *ipp, ipp_attribute_t **attr,
+                  int element, int boolvalue);
 int ippSetInteger(ipp_t *ipp, ipp_attribute_t **attr,
                   int element, int intvalue);
 int ippSetOperation(ipp_t *ipp, ipp_op_t op);
+int ippSetRequestId(ipp_t *ipp, int request_id);
 ipp_state_t ippGetState(ipp_t *ipp);
 int ippSetState(ipp_t *ipp, ipp_state_t state);
 int ippSetStatusCode(ipp_t *ipp, ipp_status_t status);
@@ -112,5 +171,7 @@ int ippSetString(ipp_t *ipp, ipp_attribute_t **attr,
 #endif
 
 extern const char * UTF8_from_PyObj (char **const utf8, PyObject *obj);
+extern int copy_ipp_string (ipp_t *ipp, ipp_attribute_t **attr, int element,
+			    const char *value);
 
 #endif /* HAVE_CUPSMODULE_H */
@@ -21,14 +21,19 @@
 #include "cupsmodule.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <iconv.h>
 #include <stdbool.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 typedef struct
 {
   PyObject_HEAD
   ppd_option_t *option;
   PPD *ppd;
+  PyObject *choices;		/* tuple of choice dicts, without "marked" */
+  unsigned int localized;	/* ppd->localized when choices was built */
 } Option;
 
 typedef struct
@@ -43,6 +48,8 @@ typedef struct
   PyObject_HEAD
   ppd_group_t *group;
   PPD *ppd;
+  PyObject *options;		/* tuple of Option, built on first use */
+  PyObject *subgroups;		/* tuple of Group, built on first use */
 } Group;
 
 typedef struct
@@ -52,6 +59,477 @@ typedef struct
   PPD *ppd;
 } Attribute;
 
+/*
+ * The Group and Option objects for a PPD are made once and kept, so
+ * walking the option tree repeatedly costs nothing after the first
+ * time.  They refer back to the PPD, so all three types take part in
+ * cyclic garbage collection.
+ */
+
+static PyObject *
+new_Group (PPD *ppd, ppd_group_t *group)
+{
+  PyObject *args = Py_BuildValue ("()");
+  PyObject *kwlist = Py_BuildValue ("{}");
+  Group *grp = (Group *) PyType_GenericNew (&cups_GroupType, args, kwlist);
+  Py_DECREF (args);
+  Py_DECREF (kwlist);
+  if (!grp)
+    return NULL;
+
+  grp->group = group;
+  grp->ppd = ppd;
+  Py_INCREF (ppd);
+  return (PyObject *) grp;
+}
+
+static PyObject *
+new_Option (PPD *ppd, ppd_option_t *option)
+{
+  PyObject *args = Py_BuildValue ("()");
+  PyObject *kwlist = Py_BuildValue ("{}");
+  Option *opt = (Option *) PyType_GenericNew (&cups_OptionType, args, kwlist);
+  Py_DECREF (args);
+  Py_DECREF (kwlist);
+  if (!opt)
+    return NULL;
+
+  opt->option = option;
+  opt->ppd = ppd;
+  Py_INCREF (ppd);
+  return (PyObject *) opt;
+}
+
+/////////////////////////
+// Option/choice index //
+/////////////////////////
+
+/*
+ * Hash tables from option keyword to option, and from option and
+ * choice to choice, compared without regard to case as
+ * ppdFindOption and ppdFindChoice do.  Each option slot also holds
+ * the Option object for it once one has been asked for, so the same
+ * object is returned each time.
+ */
+
+typedef struct
+{
+  ppd_option_t *option;
+  PyObject *obj;
+  int id;			/* option number in the compiled rules */
+} ppd_option_slot_t;
+
+struct ppd_index_s
+{
+  size_t num_options;		/* power of two */
+  ppd_option_slot_t *options;
+  size_t num_choices;		/* power of two */
+  ppd_choice_t **choices;
+};
+
+static size_t
+ppd_hash (size_t h, const char *s)
+{
+  for (; *s; s++) {
+    h ^= (unsigned char) tolower ((unsigned char) *s);
+    h *= 16777619;
+  }
+
+  return h;
+}
+
+static size_t
+ppd_hash_choice (const ppd_option_t *option, const char *choice)
+{
+  return ppd_hash (2166136261u ^ (size_t) option / sizeof (*option), choice);
+}
+
+static size_t
+table_size (size_t n)
+{
+  size_t size = 16;
+  while (size < 2 * n)
+    size *= 2;
+
+  return size;
+}
+
+static void
+ppd_index_add_group (struct ppd_index_s *index, ppd_group_t *group)
+{
+  ppd_option_t *o;
+  ppd_group_t *sg;
+  int oi, ci, sgi;
+
+  for (oi = 0, o = group->options; oi < group->num_options; oi++, o++) {
+    size_t i = ppd_hash (2166136261u, o->keyword) & (index->num_options - 1);
+    while (index->options[i].option) {
+      if (!strcasecmp (index->options[i].option->keyword, o->keyword))
+	break; // first one wins, as for ppdFindOption
+
+      i = (i + 1) & (index->num_options - 1);
+    }
+
+    if (!index->options[i].option)
+      index->options[i].option = o;
+
+    for (ci = 0; ci < o->num_choices; ci++) {
+      ppd_choice_t *c = &o->choices[ci];
+      size_t j = ppd_hash_choice (o, c->choice) & (index->num_choices - 1);
+      while (index->choices[j])
+	j = (j + 1) & (index->num_choices - 1);
+
+      index->choices[j] = c;
+    }
+  }
+
+  for (sgi = 0, sg = group->subgroups; sgi < group->num_subgroups;
+       sgi++, sg++)
+    ppd_index_add_group (index, sg);
+}
+
+static void
+ppd_index_count (ppd_group_t *group, size_t *options, size_t *choices)
+{
+  int oi, sgi;
+
+  *options += group->num_options;
+  for (oi = 0; oi < group->num_options; oi++)
+    *choices += group->options[oi].num_choices;
+
+  for (sgi = 0; sgi < group->num_subgroups; sgi++)
+    ppd_index_count (&group->subgroups[sgi], options, choices);
+}
+
+static struct ppd_index_s *
+ppd_index (PPD *self)
+{
+  struct ppd_index_s *index;
+  size_t num_options = 0, num_choices = 0;
+  int gi;
+
+  if (self->index)
+    return self->index;
+
+  for (gi = 0; gi < self->ppd->num_groups; gi++)
+    ppd_index_count (&self->ppd->groups[gi], &num_options, &num_choices);
+
+  index = calloc (1, sizeof (*index));
+  if (!index) {
+    PyErr_NoMemory ();
+    return NULL;
+  }
+
+  index->num_options = table_size (num_options);
+  index->options = calloc (index->num_options, sizeof (index->options[0]));
+  index->num_choices = table_size (num_choices);
+  index->choices = calloc (index->num_choices, sizeof (index->choices[0]));
+  if (!index->options || !index->choices) {
+    free (index->options);
+    free (index->choices);
+    free (index);
+    PyErr_NoMemory ();
+    return NULL;
+  }
+
+  for (gi = 0; gi < self->ppd->num_groups; gi++)
+    ppd_index_add_group (index, &self->ppd->groups[gi]);
+
+  debugprintf ("PPD %p: indexed %zu options, %zu choices\n",
+	       self, num_options, num_choices);
+  self->index = index;
+  return index;
+}
+
+static void
+ppd_index_free (PPD *self)
+{
+  size_t i;
+
+  if (!self->index)
+    return;
+
+  for (i = 0; i < self->index->num_options; i++)
+    Py_CLEAR (self->index->options[i].obj);
+
+  free (self->index->options);
+  free (self->index->choices);
+  free (self->index);
+  self->index = NULL;
+}
+
+static ppd_option_slot_t *
+ppd_index_option (struct ppd_index_s *index, const char *keyword)
+{
+  size_t i = ppd_hash (2166136261u, keyword) & (index->num_options - 1);
+
+  for (; index->options[i].option; i = (i + 1) & (index->num_options - 1))
+    if (!strcasecmp (index->options[i].option->keyword, keyword))
+      return &index->options[i];
+
+  return NULL;
+}
+
+static ppd_choice_t *
+ppd_index_choice (struct ppd_index_s *index,
+		  ppd_option_t *option, const char *choice)
+{
+  size_t i = ppd_hash_choice (option, choice) & (index->num_choices - 1);
+
+  for (; index->choices[i]; i = (i + 1) & (index->num_choices - 1))
+    if (index->choices[i]->option == option &&
+	!strcasecmp (index->choices[i]->choice, choice))
+      return index->choices[i];
+
+  return NULL;
+}
+
+//////////////////////////
+// Compiled constraints //
+//////////////////////////
+
+/*
+ * The UIConstraints of a PPD as numbers, for checking many option
+ * sets without marking any of them.  Options are numbered, and the
+ * choices of each option numbered consecutively from first_choice.
+ * A constraint side with no choice applies when its option is set to
+ * anything but None, Off or False; those choices are clear in the
+ * "on" bitset.
+ */
+
+typedef struct
+{
+  int option1, choice1;		/* choice -1 for "any on" */
+  int option2, choice2;
+  ppd_const_t *constraint;
+} ppd_rule_t;
+
+struct ppd_rules_s
+{
+  int num_options;
+  int *first_choice;		/* per option */
+  int *defaults;		/* per option; choice number or -1 */
+  unsigned char *on;		/* bitset over choices */
+  int num_rules;
+  ppd_rule_t *rules;
+};
+
+#define BIT_SET(bits,n) ((bits)[(n) / 8] |= 1 << ((n) % 8))
+#define BIT_TEST(bits,n) ((bits)[(n) / 8] & (1 << ((n) % 8)))
+
+static void
+ppd_rules_free (PPD *self)
+{
+  if (!self->rules)
+    return;
+
+  free (self->rules->first_choice);
+  free (self->rules->defaults);
+  free (self->rules->on);
+  free (self->rules->rules);
+  free (self->rules);
+  self->rules = NULL;
+}
+
+/* Find an option and choice as compiled option and choice numbers;
+ * choice may be empty, giving -1.  Returns -1 if either is unknown. */
+static int
+ppd_rules_lookup (struct ppd_index_s *index, struct ppd_rules_s *rules,
+		  const char *option, const char *choice,
+		  int *option_id, int *choice_id)
+{
+  ppd_option_slot_t *slot = ppd_index_option (index, option);
+  ppd_choice_t *c;
+
+  if (!slot)
+    return -1;
+
+  *option_id = slot->id;
+  if (!choice[0]) {
+    *choice_id = -1;
+    return 0;
+  }
+
+  c = ppd_index_choice (index, slot->option, choice);
+  if (!c)
+    return -1;
+
+  *choice_id = rules->first_choice[slot->id] + (c - slot->option->choices);
+  return 0;
+}
+
+static struct ppd_rules_s *
+ppd_rules (PPD *self)
+{
+  struct ppd_index_s *index = ppd_index (self);
+  struct ppd_rules_s *rules;
+  int num_choices = 0;
+  size_t i;
+  int n, ci, unused;
+
+  if (!index)
+    return NULL;
+
+  if (self->rules)
+    return self->rules;
+
+  rules = calloc (1, sizeof (*rules));
+  if (!rules)
+    return (void *) PyErr_NoMemory ();
+
+  for (i = 0; i < index->num_options; i++)
+    if (index->options[i].option)
+      rules->num_options++;
+
+  rules->first_choice = calloc (rules->num_options + 1, sizeof (int));
+  rules->defaults = calloc (rules->num_options + 1, sizeof (int));
+  rules->rules = calloc (self->ppd->num_consts + 1, sizeof (ppd_rule_t));
+  if (!rules->first_choice || !rules->defaults || !rules->rules)
+    goto oom;
+
+  for (i = 0, n = 0; i < index->num_options; i++) {
+    ppd_option_t *o = index->options[i].option;
+    if (!o)
+      continue;
+
+    index->options[i].id = n;
+    rules->first_choice[n] = num_choices;
+    num_choices += o->num_choices;
+    n++;
+  }
+
+  rules->on = calloc (num_choices / 8 + 1, 1);
+  if (!rules->on)
+    goto oom;
+
+  for (i = 0; i < index->num_options; i++) {
+    ppd_option_t *o = index->options[i].option;
+    int id = index->options[i].id;
+    if (!o)
+      continue;
+
+    for (ci = 0; ci < o->num_choices; ci++) {
+      const char *name = o->choices[ci].choice;
+      if (strcasecmp (name, "None") && strcasecmp (name, "Off") &&
+	  strcasecmp (name, "False"))
+	BIT_SET (rules->on, rules->first_choice[id] + ci);
+    }
+
+    if (ppd_rules_lookup (index, rules, o->keyword, o->defchoice,
+			  &unused, &rules->defaults[id]) < 0)
+      rules->defaults[id] = -1;
+  }
+
+  for (n = 0; n < self->ppd->num_consts; n++) {
+    ppd_const_t *c = &self->ppd->consts[n];
+    ppd_rule_t *r = &rules->rules[rules->num_rules];
+
+    // A constraint naming something not in the PPD can never apply.
+    if (ppd_rules_lookup (index, rules, c->option1, c->choice1,
+			  &r->option1, &r->choice1) < 0 ||
+	ppd_rules_lookup (index, rules, c->option2, c->choice2,
+			  &r->option2, &r->choice2) < 0)
+      continue;
+
+    r->constraint = c;
+    rules->num_rules++;
+  }
+
+  debugprintf ("PPD %p: compiled %d of %d constraints\n",
+	       self, rules->num_rules, self->ppd->num_consts);
+  self->rules = rules;
+  return rules;
+
+ oom:
+  free (rules->first_choice);
+  free (rules->defaults);
+  free (rules->on);
+  free (rules->rules);
+  free (rules);
+  return (void *) PyErr_NoMemory ();
+}
+
+static int
+ppd_rule_side (const struct ppd_rules_s *rules, const int *selected,
+	       int option, int choice)
+{
+  int sel = selected[option];
+
+  if (sel < 0)
+    return 0;
+
+  if (choice >= 0)
+    return sel == choice;
+
+  return BIT_TEST (rules->on, sel) != 0;
+}
+
+typedef struct
+{
+  const struct ppd_rules_s *rules;
+  int use_defaults;
+  int first_set, end_set;
+  const int *offsets;		/* per set, into overrides; end_set+1 of them */
+  const int *overrides;		/* pairs of option number, choice number */
+  unsigned char *violated;	/* per set, a bitset over rules */
+  size_t violated_len;
+} ppd_check_job_t;
+
+static void *
+ppd_check_sets (void *arg)
+{
+  ppd_check_job_t *job = arg;
+  const struct ppd_rules_s *rules = job->rules;
+  int *selected = malloc ((rules->num_options + 1) * sizeof (int));
+  int set, k, r;
+
+  if (!selected)
+    return (void *) -1;
+
+  for (set = job->first_set; set < job->end_set; set++) {
+    unsigned char *violated = job->violated + set * job->violated_len;
+
+    for (k = 0; k < rules->num_options; k++)
+      selected[k] = job->use_defaults ? rules->defaults[k] : -1;
+
+    for (k = job->offsets[set]; k < job->offsets[set + 1]; k += 2)
+      selected[job->overrides[k]] = job->overrides[k + 1];
+
+    for (r = 0; r < rules->num_rules; r++) {
+      const ppd_rule_t *rule = &rules->rules[r];
+      if (ppd_rule_side (rules, selected, rule->option1, rule->choice1) &&
+	  ppd_rule_side (rules, selected, rule->option2, rule->choice2))
+	BIT_SET (violated, r);
+    }
+  }
+
+  free (selected);
+  return NULL;
+}
+
+/* Returns a new reference to the Option object for option, the same
+ * one each time. */
+static PyObject *
+PPD_option_object (PPD *ppd, ppd_option_t *option)
+{
+  struct ppd_index_s *index = ppd_index (ppd);
+  ppd_option_slot_t *slot;
+
+  if (!index)
+    return NULL;
+
+  slot = ppd_index_option (index, option->keyword);
+  if (!slot || slot->option != option)
+    // A repeated keyword, not reachable by findOption.
+    return new_Option (ppd, option);
+
+  if (!slot->obj)
+    slot->obj = new_Option (ppd, option);
+
+  Py_XINCREF (slot->obj);
+  return slot->obj;
+}
+
 /////////////////////////
 // Encoding conversion //
 /////////////////////////
@@ -187,6 +665,208 @@ utf8_to_ppd_encoding (PPD *ppd, const char *inbuf)
   return ret;
 }
 
+//////////////
+// PPD pool //
+//////////////
+
+/*
+ * Parsing a large PPD is expensive, so parsed files are kept after
+ * the PPD object using them goes away and handed to the next PPD
+ * object opened on the same file.  A file is identified by its path,
+ * device, inode, size, modification and change times, and a hash of
+ * its contents, since a rewrite within the timestamp resolution can
+ * leave everything else the same.  Each parse is only ever used by one PPD
+ * object at a time, so marking options on one never affects another;
+ * the mark state is cleared when a parse is returned to the pool.
+ */
+
+typedef struct ppd_pool_entry_s
+{
+  struct ppd_pool_entry_s *next;
+  ppd_file_id_t id;
+  ppd_file_t *ppd;
+} ppd_pool_entry_t;
+
+static ppd_pool_entry_t *ppd_pool = NULL; /* most recently returned first */
+static int ppd_pool_len = 0;
+static int ppd_pool_max = 16;
+
+static void
+ppd_pool_trim (int max)
+{
+  ppd_pool_entry_t **e = &ppd_pool;
+  int n = 0;
+
+  while (*e) {
+    if (n < max) {
+      e = &(*e)->next;
+      n++;
+    } else {
+      ppd_pool_entry_t *gone = *e;
+      *e = gone->next;
+      ppdClose (gone->ppd);
+      free (gone->id.path);
+      free (gone);
+      ppd_pool_len--;
+    }
+  }
+}
+
+void
+PPD_set_pool_size (int size)
+{
+  ppd_pool_max = size < 0 ? 0 : size;
+  ppd_pool_trim (ppd_pool_max);
+}
+
+#ifdef __APPLE__
+# define ST_MTIM(st) ((st)->st_mtimespec)
+# define ST_CTIM(st) ((st)->st_ctimespec)
+#else
+# define ST_MTIM(st) ((st)->st_mtim)
+# define ST_CTIM(st) ((st)->st_ctim)
+#endif
+
+/* Fill in id for the open file f, leaving f rewound.  The path is
+ * copied.  Returns -1 if the file cannot be identified. */
+static int
+ppd_file_id (ppd_file_id_t *id, FILE *f, const char *path)
+{
+  struct stat st;
+  unsigned char buf[8192];
+  unsigned long long hash = 14695981039346656037ULL; // FNV-1a
+  size_t n, i;
+
+  if (fstat (fileno (f), &st) != 0 || !S_ISREG (st.st_mode))
+    return -1;
+
+  while ((n = fread (buf, 1, sizeof (buf), f)) > 0)
+    for (i = 0; i < n; i++) {
+      hash ^= buf[i];
+      hash *= 1099511628211ULL;
+    }
+
+  if (ferror (f))
+    return -1;
+
+  rewind (f);
+  id->path = strdup (path);
+  if (!id->path)
+    return -1;
+
+  id->dev = st.st_dev;
+  id->ino = st.st_ino;
+  id->size = st.st_size;
+  id->mtime = ST_MTIM (&st);
+  id->ctime = ST_CTIM (&st);
+  id->hash = hash;
+  return 0;
+}
+
+static int
+ppd_file_id_equal (const ppd_file_id_t *a, const ppd_file_id_t *b)
+{
+  return (a->size == b->size &&
+	  a->mtime.tv_sec == b->mtime.tv_sec &&
+	  a->mtime.tv_nsec == b->mtime.tv_nsec &&
+	  a->ctime.tv_sec == b->ctime.tv_sec &&
+	  a->ctime.tv_nsec == b->ctime.tv_nsec &&
+	  a->hash == b->hash &&
+	  !strcmp (a->path, b->path));
+}
+
+/* Take a parse of the given file from the pool, or NULL.  Parses of
+ * older versions of the same file are thrown away. */
+static ppd_file_t *
+ppd_pool_take (PPD *self)
+{
+  ppd_pool_entry_t **e = &ppd_pool;
+  ppd_file_t *ppd = NULL;
+
+  while (*e) {
+    ppd_pool_entry_t *this = *e;
+    if (this->id.dev != self->id.dev || this->id.ino != self->id.ino) {
+      e = &this->next;
+      continue;
+    }
+
+    *e = this->next;
+    ppd_pool_len--;
+    if (!ppd && ppd_file_id_equal (&this->id, &self->id))
+      ppd = this->ppd;
+    else
+      ppdClose (this->ppd);
+
+    free (this->id.path);
+    free (this);
+  }
+
+  return ppd;
+}
+
+static void
+ppd_reset_group (ppd_group_t *group)
+{
+  ppd_option_t *o;
+  ppd_group_t *sg;
+  int oi, ci, sgi;
+
+  for (oi = 0, o = group->options; oi < group->num_options; oi++, o++) {
+    o->conflicted = 0;
+    for (ci = 0; ci < o->num_choices; ci++)
+      o->choices[ci].marked = 0;
+  }
+
+  for (sgi = 0, sg = group->subgroups; sgi < group->num_subgroups;
+       sgi++, sg++)
+    ppd_reset_group (sg);
+}
+
+/* Marking a custom value also changes the custom page size or the
+ * custom parameters' current values.  That is not worth undoing, so
+ * such a parse is not returned to the pool. */
+static void
+ppd_pool_note_choice (PPD *self, const char *choice)
+{
+  if (!strncasecmp (choice, "Custom", 6) || choice[0] == '{')
+    self->poolable = 0;
+}
+
+/* Return a parse to the pool, with nothing marked as after ppdOpen. */
+static void
+ppd_pool_give (PPD *self)
+{
+  ppd_pool_entry_t *entry;
+  ppd_group_t *g;
+  int gi, i;
+
+  if (!self->poolable || ppd_pool_max == 0 ||
+      (entry = malloc (sizeof (*entry))) == NULL) {
+    ppdClose (self->ppd);
+    free (self->id.path);
+    self->id.path = NULL;
+    return;
+  }
+
+  for (gi = 0, g = self->ppd->groups; gi < self->ppd->num_groups; gi++, g++)
+    ppd_reset_group (g);
+
+  if (self->ppd->marked)
+    cupsArrayClear (self->ppd->marked);
+
+  for (i = 0; i < self->ppd->num_sizes; i++)
+    self->ppd->sizes[i].marked = 0;
+
+  // The entry takes over the path.
+  entry->id = self->id;
+  self->id.path = NULL;
+  entry->ppd = self->ppd;
+  entry->next = ppd_pool;
+  ppd_pool = entry;
+  ppd_pool_len++;
+  ppd_pool_trim (ppd_pool_max);
+}
+
 /////////
 // PPD //
 /////////
@@ -201,6 +881,12 @@ PPD_new (PyTypeObject *type, PyObject *args, PyObject *kwds)
     self->file = NULL;
     self->conv_from = NULL;
     self->conv_to = NULL;
+    self->poolable = 0;
+    self->id.path = NULL;
+    self->groups = NULL;
+    self->index = NULL;
+    self->rules = NULL;
+    self->localized = 0;
   }
 
   return (PyObject *) self;
@@ -226,7 +912,13 @@ PPD_init (PPD *self, PyObject *args, PyObject *kwds)
   }
 
   debugprintf ("+ PPD %p %s (fd %d)\n", self, filename, fileno (self->file));
-  self->ppd = ppdOpenFile (filename);
+  self->poolable = ppd_file_id (&self->id, self->file, filename) == 0;
+
+  if (self->poolable && (self->ppd = ppd_pool_take (self)) != NULL)
+    debugprintf ("PPD %p: reusing parse from pool\n", self);
+  else
+    self->ppd = ppdOpenFile (filename);
+
   free (filename);
   if (!self->ppd) {
     fclose (self->file);
@@ -239,9 +931,39 @@ PPD_init (PPD *self, PyObject *args, PyObject *kwds)
   return 0;
 }
 
+static int
+PPD_traverse (PPD *self, visitproc visit, void *arg)
+{
+  size_t i;
+
+  Py_VISIT (self->groups);
+  if (self->index)
+    for (i = 0; i < self->index->num_options; i++)
+      Py_VISIT (self->index->options[i].obj);
+
+  return 0;
+}
+
+static int
+PPD_clear (PPD *self)
+{
+  size_t i;
+
+  Py_CLEAR (self->groups);
+  if (self->index)
+    for (i = 0; i < self->index->num_options; i++)
+      Py_CLEAR (self->index->options[i].obj);
+
+  return 0;
+}
+
 static void
 PPD_dealloc (PPD *self)
 {
+  PyObject_GC_UnTrack (self);
+  PPD_clear (self);
+  ppd_rules_free (self);
+  ppd_index_free (self);
   if (self->file) {
     debugprintf ("- PPD %p (fd %d)\n", self, fileno (self->file));
     fclose (self->file);
@@ -249,7 +971,8 @@ PPD_dealloc (PPD *self)
     debugprintf ("- PPD %p (no fd)\n", self);
 
   if (self->ppd)
-    ppdClose (self->ppd);
+    ppd_pool_give (self);
+  free (self->id.path);
   if (self->conv_from)
     iconv_close (*self->conv_from);
   if (self->conv_to)
@@ -265,8 +988,16 @@ PPD_dealloc (PPD *self)
 static PyObject *
 PPD_localize (PPD *self)
 {
-  if (!ppdLocalize (self->ppd))
+  // Localized text replaces the original, so don't share this parse,
+  // and decode the text afresh.  Options already handed out notice
+  // the change of self->localized.
+  self->poolable = 0;
+  if (!ppdLocalize (self->ppd)) {
+    PPD_clear (self);
+    self->localized++;
     Py_RETURN_NONE;
+  }
+
   return PyErr_SetFromErrno (PyExc_RuntimeError);
 }
 
@@ -335,48 +1066,210 @@ PPD_localizeMarkerName (PPD *self, PyObject *args)
     Py_RETURN_NONE;
   }
 
-  return ret;
-#else /* earlier than CUPS 1.4 */
-  PyErr_SetString (PyExc_RuntimeError,
-		   "Operation not supported - recompile against CUPS 1.4 or later");
-  return NULL;
-#endif /* CUPS 1.4 */
-}
+  return ret;
+#else /* earlier than CUPS 1.4 */
+  PyErr_SetString (PyExc_RuntimeError,
+		   "Operation not supported - recompile against CUPS 1.4 or later");
+  return NULL;
+#endif /* CUPS 1.4 */
+}
+
+static PyObject *
+PPD_markDefaults (PPD *self)
+{
+  ppdMarkDefaults (self->ppd);
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+PPD_markOption (PPD *self, PyObject *args)
+{
+  int conflicts;
+  char *name, *value;
+  char *encname, *encvalue;
+  if (!PyArg_ParseTuple (args, "eses", "UTF-8", &name, "UTF-8", &value))
+    return NULL;
+
+  encname = utf8_to_ppd_encoding (self, name);
+  PyMem_Free (name);
+  if (!encname) {
+    PyMem_Free (value); 
+    return PyErr_SetFromErrno (PyExc_RuntimeError);
+  }
+
+  encvalue = utf8_to_ppd_encoding (self, value);
+  PyMem_Free (value);
+  if (!encvalue) {
+    free (encname);
+    return PyErr_SetFromErrno (PyExc_RuntimeError);
+  }
+
+  ppd_pool_note_choice (self, encvalue);
+  conflicts = ppdMarkOption (self->ppd, encname, encvalue);
+  free (encname);
+  free (encvalue);
+  return Py_BuildValue ("i", conflicts);
+}
+
+static PyObject *
+PPD_checkOptionSets (PPD *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *setsobj, *seq, *ret = NULL;
+  int use_defaults = 1, num_threads = 1;
+  struct ppd_rules_s *rules;
+  struct ppd_index_s *index;
+  ppd_check_job_t *jobs = NULL;
+  int *offsets = NULL, *overrides = NULL;
+  unsigned char *violated = NULL;
+  int num_sets, num_overrides = 0, set, t, r, failed = 0;
+  static char *kwlist[] = { "option_sets", "defaults", "threads", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|ii", kwlist,
+				    &setsobj, &use_defaults, &num_threads))
+    return NULL;
+
+  if ((rules = ppd_rules (self)) == NULL)
+    return NULL;
+
+  index = self->index;
+  seq = PySequence_Fast (setsobj, "option_sets must be a sequence");
+  if (!seq)
+    return NULL;
+
+  num_sets = PySequence_Fast_GET_SIZE (seq);
+  offsets = calloc (num_sets + 1, sizeof (int));
+  if (!offsets) {
+    PyErr_NoMemory ();
+    goto out;
+  }
+
+  // Turn each dict into option and choice numbers while we still
+  // have the GIL.
+  for (set = 0; set < num_sets; set++) {
+    PyObject *dict = PySequence_Fast_GET_ITEM (seq, set);
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    int *more;
+
+    if (!PyDict_Check (dict)) {
+      PyErr_SetString (PyExc_TypeError, "option sets must be dicts");
+      goto out;
+    }
+
+    more = realloc (overrides, (num_overrides + 2 * PyDict_Size (dict) + 1) *
+		    sizeof (int));
+    if (!more) {
+      PyErr_NoMemory ();
+      goto out;
+    }
+
+    overrides = more;
+    while (PyDict_Next (dict, &pos, &key, &value)) {
+      char *name, *choice, *encname, *encchoice;
+      int bad;
+
+      if (UTF8_from_PyObj (&name, key) == NULL)
+	goto out;
+
+      if (UTF8_from_PyObj (&choice, value) == NULL) {
+	free (name);
+	goto out;
+      }
+
+      encname = utf8_to_ppd_encoding (self, name);
+      encchoice = utf8_to_ppd_encoding (self, choice);
+      free (name);
+      free (choice);
+      bad = (!encname || !encchoice ||
+	     !encchoice[0] ||
+	     ppd_rules_lookup (index, rules, encname, encchoice,
+			       &overrides[num_overrides],
+			       &overrides[num_overrides + 1]) < 0);
+      free (encname);
+      free (encchoice);
+      if (bad) {
+	PyErr_SetObject (PyExc_KeyError, key);
+	goto out;
+      }
+
+      num_overrides += 2;
+    }
+
+    offsets[set + 1] = num_overrides;
+  }
+
+  if (num_threads < 1)
+    num_threads = 1;
+  if (num_threads > num_sets)
+    num_threads = num_sets ? num_sets : 1;
+
+  jobs = calloc (num_threads, sizeof (*jobs));
+  violated = calloc ((size_t) num_sets * (rules->num_rules / 8 + 1), 1);
+  if (!jobs || !violated) {
+    PyErr_NoMemory ();
+    goto out;
+  }
+
+  for (t = 0; t < num_threads; t++) {
+    jobs[t].rules = rules;
+    jobs[t].use_defaults = use_defaults;
+    jobs[t].first_set = (long long) num_sets * t / num_threads;
+    jobs[t].end_set = (long long) num_sets * (t + 1) / num_threads;
+    jobs[t].offsets = offsets;
+    jobs[t].overrides = overrides;
+    jobs[t].violated = violated;
+    jobs[t].violated_len = rules->num_rules / 8 + 1;
+  }
+
+  debugprintf ("-> PPD_checkOptionSets(%d sets, %d threads)\n",
+	       num_sets, num_threads);
+  Py_BEGIN_ALLOW_THREADS;
+  failed = run_in_threads (ppd_check_sets, jobs, sizeof (*jobs), num_threads);
+  Py_END_ALLOW_THREADS;
+
+  if (failed) {
+    PyErr_NoMemory ();
+    goto out;
+  }
+
+  ret = PyList_New (num_sets);
+  for (set = 0; ret && set < num_sets; set++) {
+    unsigned char *bits = violated + set * jobs[0].violated_len;
+    PyObject *list = PyList_New (0);
 
-static PyObject *
-PPD_markDefaults (PPD *self)
-{
-  ppdMarkDefaults (self->ppd);
-  Py_RETURN_NONE;
-}
+    for (r = 0; list && r < rules->num_rules; r++) {
+      ppd_const_t *c = rules->rules[r].constraint;
+      PyObject *o1, *c1, *o2, *c2, *pair;
 
-static PyObject *
-PPD_markOption (PPD *self, PyObject *args)
-{
-  int conflicts;
-  char *name, *value;
-  char *encname, *encvalue;
-  if (!PyArg_ParseTuple (args, "eses", "UTF-8", &name, "UTF-8", &value))
-    return NULL;
+      if (!BIT_TEST (bits, r))
+	continue;
 
-  encname = utf8_to_ppd_encoding (self, name);
-  PyMem_Free (name);
-  if (!encname) {
-    PyMem_Free (value); 
-    return PyErr_SetFromErrno (PyExc_RuntimeError);
-  }
+      o1 = make_PyUnicode_from_ppd_string (self, c->option1);
+      c1 = make_PyUnicode_from_ppd_string (self, c->choice1);
+      o2 = make_PyUnicode_from_ppd_string (self, c->option2);
+      c2 = make_PyUnicode_from_ppd_string (self, c->choice2);
+      pair = Py_BuildValue ("(NNNN)", o1, c1, o2, c2);
+      if (!pair || PyList_Append (list, pair) < 0)
+	Py_CLEAR (list);
 
-  encvalue = utf8_to_ppd_encoding (self, value);
-  PyMem_Free (value);
-  if (!encvalue) {
-    free (encname);
-    return PyErr_SetFromErrno (PyExc_RuntimeError);
+      Py_XDECREF (pair);
+    }
+
+    if (!list)
+      Py_CLEAR (ret);
+    else
+      PyList_SET_ITEM (ret, set, list);
   }
 
-  conflicts = ppdMarkOption (self->ppd, encname, encvalue);
-  free (encname);
-  free (encvalue);
-  return Py_BuildValue ("i", conflicts);
+  debugprintf ("<- PPD_checkOptionSets()\n");
+
+ out:
+  Py_DECREF (seq);
+  free (offsets);
+  free (overrides);
+  free (jobs);
+  free (violated);
+  return ret;
 }
 
 static PyObject *
@@ -392,35 +1285,110 @@ PPD_conflicts (PPD *self)
 static PyObject *
 PPD_findOption (PPD *self, PyObject *args)
 {
-  PyObject *ret;
   PyObject *optionobj;
   char *option;
-  ppd_option_t *opt;
+  struct ppd_index_s *index;
+  ppd_option_slot_t *slot;
 
   if (!PyArg_ParseTuple (args, "O", &optionobj))
     return NULL;
 
+  index = ppd_index (self);
+  if (!index)
+    return NULL;
+
   if (UTF8_from_PyObj (&option, optionobj) == NULL)
     return NULL;
 
-  opt = ppdFindOption (self->ppd, option);
+  slot = ppd_index_option (index, option);
   free (option);
-  if (opt) {
-    PyObject *args = Py_BuildValue ("()");
-    PyObject *kwlist = Py_BuildValue ("{}");
-    Option *optobj = (Option *) PyType_GenericNew (&cups_OptionType,
-						   args, kwlist);
-    Py_DECREF (args);
-    Py_DECREF (kwlist);
-    optobj->option = opt;
-    optobj->ppd = self;
-    Py_INCREF (self);
-    ret = (PyObject *) optobj;
-  } else {
+  if (!slot)
     Py_RETURN_NONE;
+
+  return PPD_option_object (self, slot->option);
+}
+
+static PyObject *
+PPD_markOptions (PPD *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *dict, *key, *value;
+  Py_ssize_t pos = 0;
+  int strict = 0;
+  int num_options = 0;
+  cups_option_t *options = NULL;
+  struct ppd_index_s *index = NULL;
+  ppd_choice_t *choice;
+  int conflicts;
+  static char *kwlist[] = { "options", "strict", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O!|i", kwlist,
+				    &PyDict_Type, &dict, &strict))
+    return NULL;
+
+  if (strict && (index = ppd_index (self)) == NULL)
+    return NULL;
+
+  while (PyDict_Next (dict, &pos, &key, &value)) {
+    char *name, *choice, *encname, *encchoice;
+
+    if (UTF8_from_PyObj (&name, key) == NULL)
+      goto fail;
+
+    if (UTF8_from_PyObj (&choice, value) == NULL) {
+      free (name);
+      goto fail;
+    }
+
+    encname = utf8_to_ppd_encoding (self, name);
+    encchoice = utf8_to_ppd_encoding (self, choice);
+    free (name);
+    free (choice);
+    if (!encname || !encchoice) {
+      free (encname);
+      free (encchoice);
+      PyErr_SetFromErrno (PyExc_RuntimeError);
+      goto fail;
+    }
+
+    if (index) {
+      // Custom values ("Custom.4x6in", "{Param=...}") are choices too,
+      // if the option has a Custom choice.
+      ppd_option_slot_t *slot = ppd_index_option (index, encname);
+      int custom = (!strncasecmp (encchoice, "Custom.", 7) ||
+		    encchoice[0] == '{');
+      if (!slot ||
+	  !ppd_index_choice (index, slot->option,
+			     custom ? "Custom" : encchoice)) {
+	PyErr_SetObject (PyExc_KeyError, key);
+	free (encname);
+	free (encchoice);
+	goto fail;
+      }
+    }
+
+    ppd_pool_note_choice (self, encchoice);
+    num_options = cupsAddOption (encname, encchoice, num_options, &options);
+    free (encname);
+    free (encchoice);
   }
 
-  return ret;
+  // cupsMarkOptions only evaluates the constraints once, at the end,
+  // but just says whether there are any; count them as markOption
+  // does.
+  cupsMarkOptions (self->ppd, num_options, options);
+  cupsFreeOptions (num_options, options);
+  conflicts = ppdConflicts (self->ppd);
+
+  // IPP media values may have been mapped to a custom page size.
+  choice = ppdFindMarkedChoice (self->ppd, "PageSize");
+  if (choice)
+    ppd_pool_note_choice (self, choice->choice);
+
+  return Py_BuildValue ("i", conflicts);
+
+ fail:
+  cupsFreeOptions (num_options, options);
+  return NULL;
 }
 
 static PyObject *
@@ -515,6 +1483,7 @@ PPD_findNextAttr (PPD *self, PyObject *args, PyObject *kwds)
   return ret;
 }
 
+#ifndef HAVE_CUPS_1_4
 static int
 nondefaults_are_marked (ppd_group_t *g)
 {
@@ -538,11 +1507,23 @@ nondefaults_are_marked (ppd_group_t *g)
 
   return 0;
 }
+#endif /* !HAVE_CUPS_1_4 */
 
 static PyObject *
 PPD_nondefaultsMarked (PPD *self)
 {
   int nondefaults_marked = 0;
+#ifdef HAVE_CUPS_1_4
+  ppd_choice_t *c;
+
+  // Only look at what is marked, not every option.
+  for (c = cupsArrayFirst (self->ppd->marked); c;
+       c = cupsArrayNext (self->ppd->marked))
+    if (strcmp (c->choice, c->option->defchoice)) {
+      nondefaults_marked = 1;
+      break;
+    }
+#else /* !HAVE_CUPS_1_4 */
   ppd_group_t *g;
   int gi;
   for (gi = 0, g = self->ppd->groups;
@@ -564,31 +1545,11 @@ PPD_nondefaultsMarked (PPD *self)
       }
     }
   }
+#endif /* !HAVE_CUPS_1_4 */
 
   return PyBool_FromLong (nondefaults_marked);
 }
 
-#if !(_POSIX_C_SOURCE >= 200809L || _XOPEN_SOURCE >= 700)
-/*
- * A rudimentary emulation of getline() for systems that dont support it
- * natively.  Since this is used for PPD file reading, it assumes (possibly
- * falsely) that BUFSIZ is big enough.
- */
-ssize_t
-getline(char **line, size_t *linelen, FILE *fp)
-{
-  if (*linelen == 0) {
-    *linelen = BUFSIZ;
-    *line = malloc(*linelen);
-  }
-
-  memset(*line, 0, *linelen);
-  fgets(*line, *linelen, fp);
-
-  return (strlen(*line));
-}
-#endif
-
 /*
  * emit marked options by returning a string.
  */
@@ -762,67 +1723,275 @@ PPD_emitJCLEnd (PPD *self, PyObject *args)
   return PyErr_SetFromErrno (PyExc_RuntimeError);
 }
 
+/*
+ * Output for writeFd: a file descriptor, a bytearray, or anything
+ * with a write() method, written to in large pieces.
+ */
+
+#define PPD_SINK_SIZE 65536
+
+typedef struct
+{
+  int fd;
+  PyObject *bytearray;
+  PyObject *write;
+  size_t len;
+  char buf[PPD_SINK_SIZE];
+} ppd_sink_t;
+
+static int
+ppd_sink_flush (ppd_sink_t *sink)
+{
+  const char *p = sink->buf;
+  size_t left = sink->len;
+
+  sink->len = 0;
+  if (left == 0)
+    return 0;
+
+  if (sink->bytearray) {
+    Py_ssize_t size = PyByteArray_Size (sink->bytearray);
+    if (PyByteArray_Resize (sink->bytearray, size + left) < 0)
+      return -1;
+
+    memcpy (PyByteArray_AsString (sink->bytearray) + size, p, left);
+    return 0;
+  }
+
+  if (sink->write) {
+    PyObject *bytes = PyBytes_FromStringAndSize (p, left);
+    PyObject *ret;
+
+    if (!bytes)
+      return -1;
+
+    ret = PyObject_CallFunctionObjArgs (sink->write, bytes, NULL);
+    Py_DECREF (bytes);
+    if (!ret)
+      return -1;
+
+    Py_DECREF (ret);
+    return 0;
+  }
+
+  while (left > 0) {
+    ssize_t wrote = write (sink->fd, p, left);
+    if (wrote < 0) {
+      if (errno == EINTR)
+	continue;
+
+      PyErr_SetFromErrno (PyExc_RuntimeError);
+      return -1;
+    }
+
+    p += wrote;
+    left -= wrote;
+  }
+
+  return 0;
+}
+
+static int
+ppd_sink_put (ppd_sink_t *sink, const char *p, size_t len)
+{
+  while (len > 0) {
+    size_t n = sizeof (sink->buf) - sink->len;
+    if (n > len)
+      n = len;
+
+    memcpy (sink->buf + sink->len, p, n);
+    sink->len += n;
+    p += n;
+    len -= n;
+    if (sink->len == sizeof (sink->buf) && ppd_sink_flush (sink) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+static int
+ppd_sink_puts (ppd_sink_t *sink, const char *s)
+{
+  return ppd_sink_put (sink, s, strlen (s));
+}
+
+/* The marked choice for each option slot in the index. */
+static ppd_choice_t **
+ppd_marked_table (struct ppd_index_s *index)
+{
+  ppd_choice_t **marked = calloc (index->num_options, sizeof (*marked));
+  size_t i;
+  int ci;
+
+  if (!marked)
+    return NULL;
+
+  for (i = 0; i < index->num_options; i++) {
+    ppd_option_t *o = index->options[i].option;
+    if (!o)
+      continue;
+
+    for (ci = 0; ci < o->num_choices; ci++)
+      if (o->choices[ci].marked) {
+	marked[i] = &o->choices[ci];
+	break;
+      }
+  }
+
+  return marked;
+}
+
+static ppd_choice_t *
+ppd_marked_lookup (struct ppd_index_s *index, ppd_choice_t **marked,
+		   const char *keyword)
+{
+  ppd_option_slot_t *slot = ppd_index_option (index, keyword);
+  return slot ? marked[slot - index->options] : NULL;
+}
+
+/* Write one line, replacing its default if it is a *Default line for
+ * a marked option. */
+static int
+ppd_write_line (ppd_sink_t *sink, struct ppd_index_s *index,
+		ppd_choice_t **marked, const char *line, size_t len)
+{
+  const char *start = line + 8, *end, *eol = line + len;
+  char keyword[PPD_MAX_NAME];
+  ppd_choice_t *choice;
+
+  if (len < 8 || strncmp (line, "*Default", 8))
+    return ppd_sink_put (sink, line, len);
+
+  for (end = start; end < eol; end++)
+    if (isspace ((unsigned char) *end) || *end == ':')
+      break;
+
+  if (end - start >= sizeof (keyword))
+    return ppd_sink_put (sink, line, len);
+
+  memcpy (keyword, start, end - start);
+  keyword[end - start] = '\0';
+  choice = ppd_marked_lookup (index, marked, keyword);
+
+  // Treat PageRegion, PaperDimension and ImageableArea specially:
+  // if not marked, use PageSize option.
+  if (!choice && (!strcmp (keyword, "PageRegion") ||
+		  !strcmp (keyword, "PaperDimension") ||
+		  !strcmp (keyword, "ImageableArea")))
+    choice = ppd_marked_lookup (index, marked, "PageSize");
+
+  if (!choice)
+    return ppd_sink_put (sink, line, len);
+
+  if (ppd_sink_puts (sink, "*Default") < 0 ||
+      ppd_sink_puts (sink, keyword) < 0 ||
+      ppd_sink_puts (sink, ": ") < 0 ||
+      ppd_sink_puts (sink, choice->choice) < 0 ||
+      (memchr (end, '\r', eol - end) && ppd_sink_puts (sink, "\r") < 0))
+    return -1;
+
+  return ppd_sink_puts (sink, "\n");
+}
+
 PyObject *
 PPD_writeFd (PPD *self, PyObject *args)
 {
-  char *line = NULL;
-  size_t linelen = 0;
-  FILE *out;
-  int fd;
-  int dfd;
-  if (!PyArg_ParseTuple (args, "i", &fd))
+  PyObject *target;
+  struct ppd_index_s *index;
+  ppd_choice_t **marked;
+  ppd_sink_t *sink;
+  char *in;
+  size_t have = 0;
+  int in_long_line = 0;
+  int ret = 0;
+
+  if (!PyArg_ParseTuple (args, "O", &target))
     return NULL;
 
-  dfd = dup (fd);
-  if (dfd == -1)
-    return PyErr_SetFromErrno (PyExc_RuntimeError);
+  index = ppd_index (self);
+  if (!index)
+    return NULL;
 
-  out = fdopen (dfd, "w");
-  if (!out)
-    return PyErr_SetFromErrno (PyExc_RuntimeError);
+  sink = calloc (1, sizeof (*sink));
+  in = malloc (PPD_SINK_SIZE);
+  marked = ppd_marked_table (index);
+  if (!sink || !in || !marked) {
+    free (sink);
+    free (in);
+    free (marked);
+    return PyErr_NoMemory ();
+  }
+
+  sink->fd = -1;
+#if PY_MAJOR_VERSION >= 3
+  if (PyLong_Check (target))
+    sink->fd = PyLong_AsLong (target);
+#else
+  if (PyInt_Check (target) || PyLong_Check (target))
+    sink->fd = PyInt_AsLong (target);
+#endif
+  else if (PyByteArray_Check (target))
+    sink->bytearray = target;
+  else if ((sink->write = PyObject_GetAttrString (target, "write")) == NULL) {
+    PyErr_SetString (PyExc_TypeError,
+		     "target must be a file descriptor, bytearray, or "
+		     "have a write method");
+    ret = -1;
+  }
 
+  if (PyErr_Occurred ())
+    ret = -1;
+
+  // One pass over the file, a buffer at a time.
   rewind (self->file);
-  while (!feof (self->file)) {
-    int written = 0;
-    ssize_t got = getline (&line, &linelen, self->file);
-    if (got == -1)
+  while (ret == 0) {
+    size_t got = fread (in + have, 1, PPD_SINK_SIZE - have, self->file);
+    char *start = in, *end, *nl;
+
+    have += got;
+    end = in + have;
+    while (ret == 0 && (nl = memchr (start, '\n', end - start)) != NULL) {
+      if (in_long_line) {
+	ret = ppd_sink_put (sink, start, nl + 1 - start);
+	in_long_line = 0;
+      } else
+	ret = ppd_write_line (sink, index, marked, start, nl + 1 - start);
+
+      start = nl + 1;
+    }
+
+    have = end - start;
+    if (ret < 0)
       break;
 
-    if (!strncmp (line, "*Default", 8)) {
-      char *keyword;
-      char *start = line + 8;
-      char *end;
-      ppd_choice_t *choice;
-      for (end = start; *end; end++)
-	if (isspace (*end) || *end == ':')
-	  break;
-      keyword = calloc(1, (end - start) + 1);
-      strncpy(keyword, start, end - start);
-      choice = ppdFindMarkedChoice (self->ppd, keyword);
-
-      // Treat PageRegion, PaperDimension and ImageableArea specially:
-      // if not marked, use PageSize option.
-      if (!choice && (!strcmp (keyword, "PageRegion") ||
-		      !strcmp (keyword, "PaperDimension") ||
-		      !strcmp (keyword, "ImageableArea")))
-	choice = ppdFindMarkedChoice (self->ppd, "PageSize");
-
-      if (choice) {
-	fprintf (out, "*Default%s: %s", keyword, choice->choice);
-	if (strchr (end, '\r'))
-	  fputs ("\r", out);
-	fputs ("\n", out);
-	written = 1;
-      }
+    if (got == 0) {
+      // End of file, perhaps with an unterminated last line.
+      if (have && !in_long_line)
+	ret = ppd_write_line (sink, index, marked, start, have);
+      else if (have)
+	ret = ppd_sink_put (sink, start, have);
+      break;
     }
 
-    if (!written)
-      fputs (line, out);
+    if (have == PPD_SINK_SIZE) {
+      // No line ending in a whole buffer: pass it through unchanged.
+      ret = ppd_sink_put (sink, start, have);
+      in_long_line = 1;
+      have = 0;
+    } else
+      memmove (in, start, have);
   }
 
-  fclose (out);
-  if (line)
-    free (line);
+  if (ret == 0)
+    ret = ppd_sink_flush (sink);
+
+  Py_XDECREF (sink->write);
+  free (sink);
+  free (in);
+  free (marked);
+  if (ret < 0)
+    return NULL;
 
   Py_RETURN_NONE;
 }
@@ -880,26 +2049,25 @@ PPD_getAttributes (PPD *self, void *closure)
 static PyObject *
 PPD_getOptionGroups (PPD *self, void *closure)
 {
-  PyObject *ret = PyList_New (0);
-  ppd_group_t *group;
   int i;
 
-  for (i = 0, group = self->ppd->groups;
-       i < self->ppd->num_groups;
-       i++, group++) {
-    PyObject *args = Py_BuildValue ("()");
-    PyObject *kwlist = Py_BuildValue ("{}");
-    Group *grp = (Group *) PyType_GenericNew (&cups_GroupType,
-					      args, kwlist);
-    Py_DECREF (args);
-    Py_DECREF (kwlist);
-    grp->group = group;
-    grp->ppd = self;
-    Py_INCREF (self);
-    PyList_Append (ret, (PyObject *) grp);
+  if (!self->groups) {
+    self->groups = PyTuple_New (self->ppd->num_groups);
+    if (!self->groups)
+      return NULL;
+
+    for (i = 0; i < self->ppd->num_groups; i++) {
+      PyObject *grp = new_Group (self, &self->ppd->groups[i]);
+      if (!grp) {
+	Py_CLEAR (self->groups);
+	return NULL;
+      }
+
+      PyTuple_SET_ITEM (self->groups, i, grp);
+    }
   }
 
-  return ret;
+  return PySequence_List (self->groups);
 }
 
 PyGetSetDef PPD_getseters[] =
@@ -956,6 +2124,41 @@ PyMethodDef PPD_methods[] =
       "conflicts() -> integer\n\n"
       "@return: number of conflicts." },
 
+    { "markOptions",
+      (PyCFunction) PPD_markOptions, METH_VARARGS | METH_KEYWORDS,
+      "markOptions(options, strict=False) -> integer\n\n"
+      "Set several options at once.  Conflicts are only counted once, \n"
+      "after they are all set, which is much quicker than calling \n"
+      "L{markOption} for each.  As for cupsMarkOptions, IPP job \n"
+      "attributes such as 'media' and 'sides' are also understood.\n\n"
+      "@type options: dict\n"
+      "@param options: dict of option keyword to choice\n"
+      "@type strict: boolean\n"
+      "@param strict: if true, every key must be a PPD option keyword and \n"
+      "every value one of its choices, or a custom value if it has a \n"
+      "Custom choice, or nothing is marked\n"
+      "@return: number of conflicts\n"
+      "@raise KeyError: strict and an option or choice is not in the PPD" },
+
+    { "checkOptionSets",
+      (PyCFunction) PPD_checkOptionSets, METH_VARARGS | METH_KEYWORDS,
+      "checkOptionSets(option_sets, defaults=True, threads=1) -> list\n\n"
+      "Check many sets of options against the PPD's constraints (as \n"
+      "listed in L{constraints}) without marking any of them.  The \n"
+      "constraints are compiled once per PPD and the sets are checked \n"
+      "without holding the GIL.\n\n"
+      "@type option_sets: list\n"
+      "@param option_sets: list of dicts of option keyword to choice\n"
+      "@type defaults: boolean\n"
+      "@param defaults: whether options not in a set take their \n"
+      "default choice, as after L{markDefaults}\n"
+      "@type threads: integer\n"
+      "@param threads: number of threads to share the work between\n"
+      "@return: for each set, a list of (option1, choice1, option2, \n"
+      "choice2) tuples for the constraints it breaks; an empty choice \n"
+      "means any choice but None, Off or False\n"
+      "@raise KeyError: an option or choice is not in the PPD" },
+
     { "findOption",
       (PyCFunction) PPD_findOption, METH_VARARGS,
       "findOption(name)\n\n"
@@ -1055,8 +2258,9 @@ PyMethodDef PPD_methods[] =
       "writeFd(fd) -> None\n\n"
       "Write PPD file, with marked choices as defaults, to file\n"
       "descriptor.\n\n"
-      "@type fd: integer\n"
-      "@param fd: open file descriptor" },
+      "@type fd: integer, bytearray, or file-like object\n"
+      "@param fd: open file descriptor, a bytearray to append to, or \n"
+      "an object with a write method taking bytes" },
 
     { NULL } /* Sentinel */
   };
@@ -1082,7 +2286,7 @@ PyTypeObject cups_PPDType =
     0,                         /*tp_getattro*/
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
     "PPD file\n"
     "========\n"
     "  A PPD file.\n\n"
@@ -1093,8 +2297,8 @@ PyTypeObject cups_PPDType =
     "@type optionGroups: L{Group} list\n"
     "@ivar optionGroups: list of PPD option groups\n"
     "",                        /* tp_doc */
-    0,                         /* tp_traverse */
-    0,                         /* tp_clear */
+    (traverseproc)PPD_traverse, /* tp_traverse */
+    (inquiry)PPD_clear,     /* tp_clear */
     0,                         /* tp_richcompare */
     0,                         /* tp_weaklistoffset */
     0,                         /* tp_iter */
@@ -1131,9 +2335,18 @@ Option_init (Option *self, PyObject *args, PyObject *kwds)
   return 0;
 }
 
+static int
+Option_traverse (Option *self, visitproc visit, void *arg)
+{
+  Py_VISIT (self->ppd);
+  return 0;
+}
+
 static void
 Option_dealloc (Option *self)
 {
+  PyObject_GC_UnTrack (self);
+  Py_XDECREF (self->choices);
   Py_XDECREF (self->ppd);
   ((PyObject *)self)->ob_type->tp_free ((PyObject *) self);
 }
@@ -1213,16 +2426,13 @@ Option_getUI (Option *self, void *closure)
 }
 
 static PyObject *
-Option_getChoices (Option *self, void *closure)
+Option_buildChoices (Option *self)
 {
   PyObject *choices = PyList_New (0);
   ppd_choice_t *choice;
   bool defchoice_seen = false;
   int i;
 
-  if (!self->option)
-    return choices;
-
   for (i = 0, choice = self->option->choices;
        i < self->option->num_choices;
        i++, choice++) {
@@ -1237,11 +2447,8 @@ Option_getChoices (Option *self, void *closure)
     PyDict_SetItemString (choice_dict, "text", u);
     Py_DECREF (u);
 
-    u = PyBool_FromLong (choice->marked);
-    PyDict_SetItemString (choice_dict, "marked", u);
-    Py_DECREF (u);
-
     PyList_Append (choices, choice_dict);
+    Py_DECREF (choice_dict);
     if (!strcmp (choice->choice, self->option->defchoice))
       defchoice_seen = true;
   }
@@ -1262,6 +2469,50 @@ Option_getChoices (Option *self, void *closure)
     Py_DECREF (u);
 
     PyList_Append (choices, choice_dict);
+    Py_DECREF (choice_dict);
+  }
+
+  self->choices = PyList_AsTuple (choices);
+  self->localized = self->ppd->localized;
+  Py_DECREF (choices);
+  return self->choices;
+}
+
+static PyObject *
+Option_getChoices (Option *self, void *closure)
+{
+  PyObject *choices;
+  Py_ssize_t i, n;
+
+  if (!self->option)
+    return PyList_New (0);
+
+  // The decoded strings are made once; "marked" is read afresh each
+  // time so that it reflects markOption() and markDefaults().
+  if (self->choices && self->localized != self->ppd->localized)
+    Py_CLEAR (self->choices);
+
+  if (!self->choices && !Option_buildChoices (self))
+    return NULL;
+
+  n = PyTuple_GET_SIZE (self->choices);
+  choices = PyList_New (n);
+  if (!choices)
+    return NULL;
+
+  for (i = 0; i < n; i++) {
+    PyObject *choice_dict = PyDict_Copy (PyTuple_GET_ITEM (self->choices, i));
+    if (!choice_dict) {
+      Py_DECREF (choices);
+      return NULL;
+    }
+
+    if (i < self->option->num_choices)
+      PyDict_SetItemString (choice_dict, "marked",
+			    self->option->choices[i].marked ?
+			    Py_True : Py_False);
+
+    PyList_SET_ITEM (choices, i, choice_dict);
   }
 
   return choices;
@@ -1322,7 +2573,7 @@ PyTypeObject cups_OptionType =
     0,                         /*tp_getattro*/
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
     "PPD option\n"
     "==========\n"
     "  A PPD option.\n\n"
@@ -1340,7 +2591,7 @@ PyTypeObject cups_OptionType =
     "@type choices: list\n"
     "@ivar choices: list of the option's choices\n"
     "",                        /* tp_doc */
-    0,                         /* tp_traverse */
+    (traverseproc)Option_traverse, /* tp_traverse */
     0,                         /* tp_clear */
     0,                         /* tp_richcompare */
     0,                         /* tp_weaklistoffset */
@@ -1378,9 +2629,21 @@ Group_init (Group *self, PyObject *args, PyObject *kwds)
   return 0;
 }
 
+static int
+Group_traverse (Group *self, visitproc visit, void *arg)
+{
+  Py_VISIT (self->ppd);
+  Py_VISIT (self->options);
+  Py_VISIT (self->subgroups);
+  return 0;
+}
+
 static void
 Group_dealloc (Group *self)
 {
+  PyObject_GC_UnTrack (self);
+  Py_XDECREF (self->options);
+  Py_XDECREF (self->subgroups);
   Py_XDECREF (self->ppd);
   ((PyObject *)self)->ob_type->tp_free ((PyObject *) self);
 }
@@ -1428,57 +2691,56 @@ Group_getName (Group *self, void *closure)
 static PyObject *
 Group_getOptions (Group *self, void *closure)
 {
-  PyObject *options = PyList_New (0);
-  ppd_option_t *option;
   int i;
 
   if (!self->group)
-    return options;
+    return PyList_New (0);
 
-  for (i = 0, option = self->group->options;
-       i < self->group->num_options;
-       i++, option++) {
-    PyObject *args = Py_BuildValue ("()");
-    PyObject *kwlist = Py_BuildValue ("{}");
-    Option *opt = (Option *) PyType_GenericNew (&cups_OptionType,
-						args, kwlist);
-    Py_DECREF (args);
-    Py_DECREF (kwlist);
-    opt->option = option;
-    opt->ppd = self->ppd;
-    Py_INCREF (self->ppd);
-    PyList_Append (options, (PyObject *) opt);
+  if (!self->options) {
+    self->options = PyTuple_New (self->group->num_options);
+    if (!self->options)
+      return NULL;
+
+    for (i = 0; i < self->group->num_options; i++) {
+      PyObject *obj = PPD_option_object (self->ppd,
+					 &self->group->options[i]);
+      if (!obj) {
+	Py_CLEAR (self->options);
+	return NULL;
+      }
+
+      PyTuple_SET_ITEM (self->options, i, obj);
+    }
   }
 
-  return options;
+  return PySequence_List (self->options);
 }
 
 static PyObject *
 Group_getSubgroups (Group *self, void *closure)
 {
-  PyObject *subgroups = PyList_New (0);
-  ppd_group_t *subgroup;
   int i;
 
   if (!self->group)
-    return subgroups;
+    return PyList_New (0);
 
-  for (i = 0, subgroup = self->group->subgroups;
-       i < self->group->num_subgroups;
-       i++, subgroup++) {
-    PyObject *args = Py_BuildValue ("()");
-    PyObject *kwlist = Py_BuildValue ("{}");
-    Group *grp = (Group *) PyType_GenericNew (&cups_GroupType,
-					      args, kwlist);
-    Py_DECREF (args);
-    Py_DECREF (kwlist);
-    grp->group = subgroup;
-    grp->ppd = self->ppd;
-    Py_INCREF (self->ppd);
-    PyList_Append (subgroups, (PyObject *) grp);
+  if (!self->subgroups) {
+    self->subgroups = PyTuple_New (self->group->num_subgroups);
+    if (!self->subgroups)
+      return NULL;
+
+    for (i = 0; i < self->group->num_subgroups; i++) {
+      PyObject *obj = new_Group (self->ppd, &self->group->subgroups[i]);
+      if (!obj) {
+	Py_CLEAR (self->subgroups);
+	return NULL;
+      }
+
+      PyTuple_SET_ITEM (self->subgroups, i, obj);
+    }
   }
 
-  return subgroups;
+  return PySequence_List (self->subgroups);
 }
 
 PyGetSetDef Group_getseters[] =
@@ -1528,7 +2790,7 @@ PyTypeObject cups_GroupType =
     0,                         /*tp_getattro*/
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
     "PPD option group\n"
     "================\n\n"
     "  A PPD option group.\n\n"
@@ -1541,7 +2803,7 @@ PyTypeObject cups_GroupType =
     "@type subgroups: L{Group} list\n"
     "@ivar subgroups: list of subgroups in the group\n"
     "",                        /* tp_doc */
-    0,                         /* tp_traverse */
+    (traverseproc)Group_traverse, /* tp_traverse */
     0,                         /* tp_clear */
     0,                         /* tp_richcompare */
     0,                         /* tp_weaklistoffset */
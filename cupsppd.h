@@ -23,6 +23,8 @@
 #include <Python.h>
 #include <cups/ppd.h>
 #include <iconv.h>
+#include <sys/types.h>
+#include <time.h>
 
 extern PyMethodDef PPD_methods[];
 extern PyTypeObject cups_PPDType;
@@ -31,6 +33,18 @@ extern PyTypeObject cups_GroupType;
 extern PyTypeObject cups_ConstraintType;
 extern PyTypeObject cups_AttributeType;
 
+/* Identity of a PPD file, for matching parses in the pool. */
+typedef struct
+{
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  struct timespec ctime;
+  char *path;
+  unsigned long long hash;	/* of the contents */
+} ppd_file_id_t;
+
 typedef struct
 {
   PyObject_HEAD
@@ -38,8 +52,17 @@ typedef struct
   FILE *file;
   iconv_t *conv_from;
   iconv_t *conv_to;
+  PyObject *groups;		/* tuple of Group, built on first use */
+  struct ppd_index_s *index;	/* option/choice lookup, built on first use */
+  struct ppd_rules_s *rules;	/* compiled constraints, built on first use */
+  unsigned int localized;	/* bumped by localize() to stale decoded text */
+
+  ppd_file_id_t id;		/* of the parsed file, for the pool */
+  int poolable;
 } PPD;
 
+extern void PPD_set_pool_size (int size);
+
 extern PyObject *PPD_writeFd (PPD *self, PyObject *args);
 
 #endif /* HAVE_CUPSPPD_H */
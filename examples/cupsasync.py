@@ -0,0 +1,74 @@
+#!/usr/bin/python3
+## Example of driving several cups.Connection objects from one asyncio
+## event loop using Connection.sendRequest() and Connection.pollResponse().
+
+import asyncio
+import cups
+
+def request (conn, req, resource="/", loop=None):
+	"""Send req on conn and return a future for the response.
+
+	The future's result is an IPPRequest holding the response.  Only
+	one request may be outstanding on each connection.  The socket
+	becoming readable only means the response has started to arrive;
+	pollResponse() then reads all of it, so that is done in the
+	loop's default executor rather than on the loop itself.
+	"""
+	if loop is None:
+		loop = asyncio.get_event_loop ()
+
+	fut = loop.create_future ()
+	fd = conn.fileno ()
+
+	def collected (job):
+		if fut.done ():
+			return
+		if job.exception () is not None:
+			fut.set_exception (job.exception ())
+		elif job.result () is None:
+			# Spurious wake-up; keep waiting.
+			loop.add_reader (fd, readable)
+		else:
+			fut.set_result (job.result ())
+
+	def readable ():
+		loop.remove_reader (fd)
+		job = loop.run_in_executor (None, conn.pollResponse)
+		job.add_done_callback (collected)
+
+	conn.sendRequest (req, resource)
+	loop.add_reader (fd, readable)
+	return fut
+
+async def printer_state (conn, name):
+	req = cups.IPPRequest (cups.IPP_OP_GET_PRINTER_ATTRIBUTES)
+	req.add (cups.IPPAttribute (cups.IPP_TAG_OPERATION,
+				    cups.IPP_TAG_CHARSET,
+				    "attributes-charset", "utf-8"))
+	req.add (cups.IPPAttribute (cups.IPP_TAG_OPERATION,
+				    cups.IPP_TAG_LANGUAGE,
+				    "attributes-natural-language", "en"))
+	req.add (cups.IPPAttribute (cups.IPP_TAG_OPERATION,
+				    cups.IPP_TAG_URI,
+				    "printer-uri",
+				    "ipp://localhost/printers/" + name))
+	req.add (cups.IPPAttribute (cups.IPP_TAG_OPERATION,
+				    cups.IPP_TAG_KEYWORD,
+				    "requested-attributes", ["printer-state"]))
+	resp = await request (conn, req)
+	for attr in resp.attributes:
+		if attr.name == "printer-state":
+			return attr.values[0]
+
+	return None
+
+async def main ():
+	names = list (cups.Connection ().getPrinters ().keys ())
+	conns = [cups.Connection () for name in names]
+	states = await asyncio.gather (*[printer_state (c, n)
+					 for c, n in zip (conns, names)])
+	for name, state in zip (names, states):
+		print ("%s: %s" % (name, state))
+
+if __name__ == "__main__":
+	asyncio.run (main ())
@@ -34,9 +34,15 @@ EPSON-Stylus-D78 usb://EPSON/Stylus%20D78
 """
 
 from distutils.core import setup, Extension
+import os
 import sys
 VERSION="1.9.73"
 libraries=["cups"]
+define_macros=[("VERSION", '"%s"' % VERSION)]
+
+# Build in cups.getStats() counters.
+if os.environ.get ("PYCUPS_STATS"):
+	define_macros.append (("PYCUPS_STATS", "1"))
 
 if sys.platform == "darwin" or sys.platform.startswith("freebsd"):
 	libraries.append ("iconv")
@@ -65,4 +71,4 @@ setup (name="pycups",
                               ["cupsmodule.c", "cupsconnection.c",
                                "cupsppd.c", "cupsipp.c"],
                               libraries=libraries,
-                              define_macros=[("VERSION", '"%s"' % VERSION)])])
+                              define_macros=define_macros)])
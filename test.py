@@ -1,6 +1,25 @@
 #!/usr/bin/python
+# -*- coding: utf-8 -*-
+import contextlib
+import functools
+import io
+import os
+import re
+import struct
+import sys
+import tempfile
+import threading
+
 import cups
 
+try:
+	from http.server import BaseHTTPRequestHandler
+	import bench
+except ImportError:
+	# Python 2: bench.py, and so the offline tests, need Python 3.
+	from BaseHTTPServer import BaseHTTPRequestHandler
+	bench = None
+
 # Simple demonstration of cups module
 
 def callback (prompt):
@@ -31,4 +50,702 @@ def test_cups_module ():
 		for opt in group.options:
 			print (list (map (lambda x: x["text"], opt.choices)))
 
-test_cups_module ()
+## Offline tests.  These need no CUPS server: IPP requests are
+## answered by a mock server, using the encoder in bench.py.
+
+offline_tests = []
+
+def offline (fn):
+	offline_tests.append (fn)
+	return fn
+
+def decode_request (body):
+	"""(operation, request ID, {name: [values]}) for an IPP request."""
+	(op, request_id) = struct.unpack (">Hi", body[2:8])
+	attrs = {}
+	name = None
+	i = 8
+	while i < len (body):
+		tag = body[i]
+		i += 1
+		if tag == bench.TAG_END:
+			break
+		if tag < 0x10:
+			# Group delimiter.
+			continue
+
+		(n,) = struct.unpack (">H", body[i:i + 2])
+		i += 2
+		if n:
+			name = body[i:i + n].decode ("ascii")
+			attrs[name] = []
+			i += n
+
+		(n,) = struct.unpack (">H", body[i:i + 2])
+		i += 2
+		value = body[i:i + n]
+		i += n
+		if tag in (bench.TAG_INTEGER, bench.TAG_ENUM):
+			value = struct.unpack (">i", value)[0]
+		elif tag == bench.TAG_BOOLEAN:
+			value = bool (value[0])
+		else:
+			value = value.decode ("utf-8")
+
+		attrs[name].append (value)
+
+	return (op, request_id, attrs)
+
+class MockHandler (BaseHTTPRequestHandler):
+	protocol_version = "HTTP/1.1"
+
+	def do_POST (self):
+		length = int (self.headers.get ("Content-Length", 0))
+		(op, request_id, attrs) = decode_request (self.rfile.read (length))
+		self.server.requests.append ((op, attrs))
+		resp = self.server.respond (op, attrs)
+		resp = resp[:4] + struct.pack (">i", request_id) + resp[8:]
+		self.send_response (200)
+		self.send_header ("Content-Type", "application/ipp")
+		self.send_header ("Content-Length", str (len (resp)))
+		self.end_headers ()
+		self.wfile.write (resp)
+
+	def log_message (self, format, *args):
+		pass
+
+@contextlib.contextmanager
+def mock_server (respond):
+	"""Yield (conn, requests): a Connection to a server answering
+	each request with respond (operation, attrs), and the list of
+	(operation, attrs) pairs it has received."""
+	server = bench.Server (("127.0.0.1", 0), MockHandler)
+	server.respond = respond
+	server.requests = []
+	thread = threading.Thread (target=server.serve_forever)
+	thread.daemon = True
+	thread.start ()
+	try:
+		conn = cups.Connection (host="127.0.0.1",
+					port=server.server_address[1],
+					encryption=cups.HTTP_ENCRYPT_NEVER)
+		yield (conn, server.requests)
+	finally:
+		server.shutdown ()
+		server.server_close ()
+
+@offline
+def test_iter_jobs_priorities ():
+	# (job-id, job-priority).  Like cupsd, the mock returns active
+	# jobs highest priority first, and completed or all jobs in ID
+	# order.  Asked for job-ids, it returns those jobs in that order,
+	# or not-found if any is a ghost: listed, but gone by the time it
+	# is asked for.
+	jobs = [(1, 50), (2, 100), (3, 100), (4, 20), (5, 80), (6, 50),
+		(7, 100)]
+	ghosts = []
+
+	def respond (op, attrs):
+		if "job-ids" in attrs:
+			assert "which-jobs" not in attrs
+			ids = attrs["job-ids"]
+			if [i for i in ids if i in dict (ghosts)]:
+				return bench.encode_response (bench.TAG_JOB, [],
+							      status=cups.IPP_NOT_FOUND)
+
+			by_id = dict (jobs)
+			order = [(i, by_id[i]) for i in ids]
+		else:
+			which = attrs.get ("which-jobs", ["not-completed"])[0]
+			first = attrs.get ("first-job-id", [1])[0]
+			limit = attrs.get ("limit", [0])[0]
+			if which in ("completed", "all"):
+				order = sorted (jobs)
+			else:
+				order = sorted (jobs + ghosts,
+						key=lambda j: (-j[1], j[0]))
+
+			order = [j for j in order if j[0] >= first]
+			if limit:
+				order = order[:limit]
+
+		return bench.encode_response (bench.TAG_JOB, [
+			[(bench.TAG_INTEGER, "job-id", job_id),
+			 (bench.TAG_INTEGER, "job-priority", priority)]
+			for (job_id, priority) in order])
+
+	by_priority = [2, 3, 7, 5, 1, 6, 4]
+	with mock_server (respond) as (conn, requests):
+		for which in ("not-completed", "all"):
+			ids = [job_id for (job_id, job)
+			       in conn.iterJobs (which_jobs=which, page_size=2)]
+			assert sorted (ids) == [j[0] for j in jobs], (which, ids)
+			assert len (set (ids)) == len (ids), (which, ids)
+
+		# Active jobs are listed once, and then fetched a page of
+		# IDs at a time in the server's order.
+		del requests[:]
+		ids = [job_id for (job_id, job) in conn.iterJobs (page_size=2)]
+		assert ids == by_priority, ids
+		assert [len (attrs.get ("job-ids", [])) for (op, attrs)
+			in requests] == [0, 2, 2, 2, 1], requests
+
+		# A job gone after the listing is skipped, the rest of its
+		# page being fetched one job at a time to find it.
+		ghosts.append ((8, 60))
+		del requests[:]
+		ids = [job_id for (job_id, job) in conn.iterJobs (page_size=2)]
+		assert ids == by_priority, ids
+		assert [attrs.get ("job-ids") for (op, attrs) in requests] == [
+			None, [2, 3], [7, 5], [8, 1], [8], [1], [6, 4]], requests
+
+@contextlib.contextmanager
+def ppd_file (text=None, groups=2, options=5, choices=3):
+	"""Yield the path of a PPD file: text if given, or else one made
+	by bench.write_ppd, with each option constrained against the
+	previous one."""
+	(fd, path) = tempfile.mkstemp (suffix=".ppd")
+	os.close (fd)
+	try:
+		if text is None:
+			bench.write_ppd (path, groups, options, choices)
+		else:
+			with open (path, "wb") as f:
+				f.write (text)
+
+		yield path
+	finally:
+		os.unlink (path)
+
+def ppd_options (ppd):
+	for group in ppd.optionGroups:
+		for opt in group.options:
+			yield opt
+
+def marked_choices (ppd):
+	return dict ((opt.keyword,
+		      [c["choice"] for c in opt.choices if c["marked"]])
+		     for opt in ppd_options (ppd))
+
+@offline
+def test_mark_options ():
+	sets = [{},
+		{"Opt0_1": "C1"},
+		{"Opt0_0": "C1", "Opt0_1": "C1"},
+		{"Opt0_1": "C2", "Opt0_2": "C1", "Opt1_4": "C0"},
+		{"Opt1_0": "C1", "Opt1_1": "C1", "Opt1_2": "C1"}]
+	with ppd_file () as path:
+		for opts in sets:
+			# markOptions must leave the same marks, and count the
+			# same conflicts, as markOption for each and conflicts().
+			one = cups.PPD (path)
+			one.markDefaults ()
+			for (option, choice) in opts.items ():
+				one.markOption (option, choice)
+
+			many = cups.PPD (path)
+			many.markDefaults ()
+			assert many.markOptions (opts) == one.conflicts (), opts
+			assert marked_choices (many) == marked_choices (one), opts
+			del one, many
+
+		ppd = cups.PPD (path)
+		ppd.markDefaults ()
+		before = marked_choices (ppd)
+		for bad in ({"Opt0_0": "C1", "NoSuchOption": "C0"},
+			    {"Opt0_0": "C1", "Opt0_1": "NoSuchChoice"}):
+			try:
+				ppd.markOptions (bad, strict=True)
+				assert False, bad
+			except KeyError:
+				pass
+
+			assert marked_choices (ppd) == before, bad
+
+@offline
+def test_check_option_sets ():
+	sets = []
+	for a in range (3):
+		for b in range (3):
+			for c in range (3):
+				sets.append ({"Opt0_0": "C%d" % a,
+					      "Opt0_1": "C%d" % b,
+					      "Opt0_2": "C%d" % c})
+
+	sets += [{}, {"Opt1_3": "C1", "Opt1_4": "C1"}, {"Opt1_0": "C2"}]
+	with ppd_file () as path:
+		ppd = cups.PPD (path)
+		results = ppd.checkOptionSets (sets)
+		assert len (results) == len (sets)
+		assert ppd.checkOptionSets (sets, threads=3) == results
+		for (opts, broken) in zip (sets, results):
+			# A set breaks constraints exactly when marking it
+			# leaves conflicts.
+			ppd.markDefaults ()
+			for (option, choice) in opts.items ():
+				ppd.markOption (option, choice)
+
+			assert bool (broken) == (ppd.conflicts () > 0), opts
+			for (o1, c1, o2, c2) in broken:
+				assert opts.get (o1, "C0") == c1, (opts, broken)
+				assert opts.get (o2, "C0") == c2, (opts, broken)
+
+		# Without defaults only the options in the set count.
+		assert ppd.checkOptionSets ([{"Opt0_1": "C1"}],
+					    defaults=False) == [[]]
+		try:
+			ppd.checkOptionSets ([{"NoSuchOption": "C0"}])
+			assert False
+		except KeyError:
+			pass
+
+WRITEFD_PPD = b"""*PPD-Adobe: "4.3"\r
+*FormatVersion: "4.3"\r
+*FileVersion: "1.0"
+*LanguageVersion: English
+*LanguageEncoding: ISOLatin1
+*PCFileName: "WRITEFD.PPD"
+*Manufacturer: "Test"
+*Product: "(Test)"
+*ModelName: "Test Printer"
+*ShortNickName: "Test Printer"
+*NickName: "Test Printer"
+*PSVersion: "(3010.000) 0"
+*OpenUI *PageSize/Media Size: PickOne
+*DefaultPageSize: Letter
+*PageSize Letter/Letter: "<</PageSize[612 792]>>setpagedevice"
+*PageSize A4/A4: "<</PageSize[595 842]>>setpagedevice"
+*CloseUI: *PageSize
+*OpenUI *PageRegion: PickOne
+*DefaultPageRegion: Letter
+*PageRegion Letter/Letter: "<</PageSize[612 792]>>setpagedevice"
+*PageRegion A4/A4: "<</PageSize[595 842]>>setpagedevice"
+*CloseUI: *PageRegion
+*DefaultImageableArea: Letter
+*ImageableArea Letter/Letter: "18 36 594 756"
+*ImageableArea A4/A4: "18 36 577 806"
+*DefaultPaperDimension: Letter
+*PaperDimension Letter/Letter: "612 792"
+*PaperDimension A4/A4: "595 842"
+*OpenUI *Duplex/2-Sided: PickOne\r
+*DefaultDuplex: None\r
+*Duplex None/Off: ""\r
+*Duplex DuplexNoTumble/Long Edge: ""\r
+*CloseUI: *Duplex\r
+*DefaultResolution: 600dpi
+*DefaultFont: Courier
+""" + b"".join (b"*%% Padding line %05d, so that what follows is past the "
+		b"first read.\n" % i for i in range (1500)) + b"""*OpenUI *Late/Late: PickOne
+*DefaultLate: C0
+*Late C0/Choice 0: ""
+*Late C1/Choice 1: ""
+*Late C2/Choice 2: ""
+*CloseUI: *Late
+"""
+
+def old_write_fd (ppd, path):
+	"""What writeFd wrote before it was rewritten, for comparison."""
+	marked = {}
+	for opt in ppd_options (ppd):
+		for choice in opt.choices:
+			if choice["marked"]:
+				marked[opt.keyword] = choice["choice"]
+
+	out = []
+	with open (path, "rb") as f:
+		for line in f:
+			m = re.match (br"\*Default([^\s:]*)", line)
+			if m:
+				keyword = m.group (1).decode ("ascii")
+				choice = marked.get (keyword)
+				if choice is None and keyword in ("PageRegion",
+								  "PaperDimension",
+								  "ImageableArea"):
+					choice = marked.get ("PageSize")
+
+				if choice is not None:
+					cr = b"\r" if b"\r" in line[m.end ():] else b""
+					out.append (("*Default%s: %s" %
+						     (keyword, choice)).encode ("ascii")
+						    + cr + b"\n")
+					continue
+
+			out.append (line)
+
+	return b"".join (out)
+
+def write_fd_outputs (ppd):
+	"""writeFd's output to each kind of target."""
+	buf = bytearray ()
+	ppd.writeFd (buf)
+	bio = io.BytesIO ()
+	ppd.writeFd (bio)
+	with tempfile.TemporaryFile () as f:
+		ppd.writeFd (f.fileno ())
+		f.seek (0)
+		from_fd = f.read ()
+
+	return [bytes (buf), bio.getvalue (), from_fd]
+
+@offline
+def test_write_fd ():
+	marks = [[],
+		 [("PageSize", "A4"), ("Duplex", "DuplexNoTumble"),
+		  ("Late", "C2")],
+		 [("PageRegion", "A4")]]
+	with ppd_file (WRITEFD_PPD) as path:
+		for opts in marks:
+			ppd = cups.PPD (path)
+			ppd.markDefaults ()
+			for (option, choice) in opts:
+				ppd.markOption (option, choice)
+
+			expected = old_write_fd (ppd, path)
+			for out in write_fd_outputs (ppd):
+				assert out == expected, opts
+			del ppd
+
+	with ppd_file () as path:
+		ppd = cups.PPD (path)
+		ppd.markDefaults ()
+		ppd.markOptions ({"Opt0_1": "C2", "Opt1_4": "C1"})
+		for out in write_fd_outputs (ppd):
+			assert out == old_write_fd (ppd, path)
+
+def sample_request ():
+	# The charset and language come from ippNewRequest.
+	req = cups.IPPRequest (cups.IPP_OP_GET_JOBS)
+	for (group, tag, name, value) in [
+		(cups.IPP_TAG_OPERATION, cups.IPP_TAG_URI,
+		 "printer-uri", "ipp://localhost/printers/test"),
+		(cups.IPP_TAG_OPERATION, cups.IPP_TAG_NAME,
+		 "requesting-user-name", "tester"),
+		(cups.IPP_TAG_OPERATION, cups.IPP_TAG_INTEGER, "limit", 10),
+		(cups.IPP_TAG_OPERATION, cups.IPP_TAG_BOOLEAN, "my-jobs", True),
+		(cups.IPP_TAG_OPERATION, cups.IPP_TAG_KEYWORD,
+		 "requested-attributes", ["job-id", "job-state", "job-name"]),
+		(cups.IPP_TAG_JOB, cups.IPP_TAG_INTEGER, "job-priority", 50),
+		(cups.IPP_TAG_JOB, cups.IPP_TAG_NAME, "job-name", "Tést")]:
+		req.add (cups.IPPAttribute (group, tag, name, value))
+
+	return req
+
+def ipp_bytes (req):
+	chunks = []
+	def write (data):
+		chunks.append (bytes (data))
+		return len (data)
+
+	assert req.writeIO (write) == cups.IPP_STATE_DATA
+	return b"".join (chunks)
+
+def describe (attrs):
+	return [(a.group_tag, a.value_tag, a.name, a.values) for a in attrs]
+
+def ipp_read_io (data):
+	"""An IPPRequest read from data the old way, through readIO."""
+	req = cups.IPPRequest ()
+	assert req.readIO (io.BytesIO (data).read) == cups.IPP_STATE_DATA
+	return req
+
+@offline
+def test_read_from ():
+	sent = sample_request ()
+	data = ipp_bytes (sent)
+	expected = describe (ipp_read_io (data).attributes)
+	assert expected == describe (sent.attributes)
+
+	for source in (data, bytearray (data), memoryview (data)):
+		req = cups.IPPRequest ()
+		assert req.readFrom (source) == cups.IPP_STATE_DATA
+		assert req.operation == cups.IPP_OP_GET_JOBS
+		assert describe (req.attributes) == expected
+
+	(r, w) = os.pipe ()
+	try:
+		os.write (w, data)
+		os.close (w)
+		w = None
+		req = cups.IPPRequest ()
+		assert req.readFrom (r) == cups.IPP_STATE_DATA
+		assert describe (req.attributes) == expected
+	finally:
+		os.close (r)
+		if w is not None:
+			os.close (w)
+
+	buffers = [data, data[:len (data) // 2], bytearray (data), b""] * 3
+	for threads in (1, 4):
+		parsed = cups.IPPRequest.parseMany (buffers, threads=threads)
+		assert len (parsed) == len (buffers)
+		for (buf, req) in zip (buffers, parsed):
+			if len (buf) == len (data):
+				assert describe (req.attributes) == expected
+			else:
+				assert req is None
+
+@offline
+def test_find_attribute ():
+	req = sample_request ()
+	req.addSeparator ()
+	req.add (cups.IPPAttribute (cups.IPP_TAG_JOB, cups.IPP_TAG_NAME,
+				    "job-name", "Second"))
+	for data in (None, ipp_bytes (req)):
+		if data is not None:
+			req = cups.IPPRequest ()
+			req.readFrom (data)
+
+		attrs = req.attributes
+		seq = req.attributeSequence
+		assert len (seq) == len (attrs)
+		assert describe (seq) == describe (attrs)
+		assert describe ([seq[-1]]) == describe (attrs[-1:])
+		assert seq[0] is seq[0]
+		try:
+			seq[len (attrs)]
+			assert False
+		except IndexError:
+			pass
+
+		# findAttribute finds the first of each name, as a scan
+		# of the attributes list would.
+		for attr in attrs:
+			if not attr.name:
+				# Separator.
+				continue
+
+			first = [a for a in attrs if a.name == attr.name][0]
+			found = req.findAttribute (attr.name)
+			assert describe ([found]) == describe ([first]), attr.name
+			in_group = [a for a in attrs if a.name == attr.name and
+				    a.group_tag == attr.group_tag][0]
+			found = req.findAttribute (attr.name,
+						   group=attr.group_tag)
+			assert describe ([found]) == describe ([in_group])
+
+		assert req.findAttribute ("no-such-attribute") is None
+		assert req.findAttribute ("limit", group=cups.IPP_TAG_JOB) is None
+
+@offline
+def test_set_value ():
+	req = sample_request ()
+	req.setValue ("limit", 20)
+	req.setValue ("my-jobs", False)
+	req.setValue ("requested-attributes", "job-uri", element=1)
+	req.setValue ("job-name", "Patched", group=cups.IPP_TAG_JOB)
+
+	# The same as a request built with those values to begin with.
+	built = sample_request ()
+	expected = []
+	for (group, tag, name, values) in describe (built.attributes):
+		values = {"limit": [20],
+			  "my-jobs": [False],
+			  "requested-attributes": ["job-id", "job-uri",
+						   "job-name"],
+			  "job-name": ["Patched"]}.get (name, values)
+		expected.append ((group, tag, name, values))
+
+	assert describe (req.attributes) == expected
+	back = cups.IPPRequest ()
+	back.readFrom (ipp_bytes (req))
+	assert describe (back.attributes) == expected
+
+	for (name, value, element, error) in [
+		("no-such-attribute", 1, 0, KeyError),
+		("limit", 1, 1, IndexError),
+		("limit", "1", 0, TypeError),
+		("my-jobs", 1, 0, TypeError),
+		("printer-uri", 1, 0, TypeError)]:
+		try:
+			req.setValue (name, value, element=element)
+			assert False, name
+		except error:
+			pass
+
+	assert describe (req.attributes) == expected
+
+	# A template sent again and again, patched in between.
+	def respond (op, attrs):
+		return bench.encode_response (bench.TAG_JOB, [])
+
+	with mock_server (respond) as (conn, requests):
+		for limit in (1, 2, 3):
+			req.setValue ("limit", limit)
+			(answer,) = conn.doRequests ([req])
+			assert answer.statuscode == cups.IPP_OK
+
+		assert [attrs["limit"] for (op, attrs) in requests] == \
+			[[1], [2], [3]]
+		assert all (attrs["job-name"] == ["Patched"]
+			    for (op, attrs) in requests)
+
+		# Still the caller's, and intact, after being sent.
+		expected[[a[2] for a in expected].index ("limit")] = \
+			(cups.IPP_TAG_OPERATION, cups.IPP_TAG_INTEGER, "limit", [3])
+		assert describe (req.attributes) == expected
+
+	# getJobAttributes without requested_attributes reuses one
+	# request, patching its job-uri each time.
+	def job_attrs (op, attrs):
+		job_id = int (attrs["job-uri"][0].rsplit ("/", 1)[1])
+		return bench.encode_response (bench.TAG_JOB, [
+			[(bench.TAG_INTEGER, "job-id", job_id)]])
+
+	with mock_server (job_attrs) as (conn, requests):
+		for job_id in (4, 9, 4):
+			assert conn.getJobAttributes (job_id)["job-id"] == job_id
+
+		assert ([attrs["job-uri"] for (op, attrs) in requests] ==
+			[["ipp://localhost/jobs/%d" % i] for i in (4, 9, 4)])
+
+IPP_CANCEL_JOB = 0x0008
+IPP_CANCEL_JOBS = 0x0038
+
+@offline
+def test_pending_response ():
+	def respond (op, attrs):
+		return bench.encode_response (bench.TAG_JOB, [])
+
+	with mock_server (respond) as (conn, requests):
+		conn.sendRequest (sample_request ())
+
+		# Nothing else may be sent until the response is collected,
+		# however the method is reached.
+		for call in (lambda: conn.getJobs (),
+			     lambda: cups.Connection.getJobs (conn),
+			     lambda: conn.cancelJobs ([1]),
+			     lambda: conn.sendRequest (sample_request ())):
+			try:
+				call ()
+			except RuntimeError:
+				pass
+			else:
+				assert False, "sent with a response pending"
+
+		while conn.pollResponse (timeout=1) is None:
+			pass
+
+		assert conn.getJobs () == {}
+		assert len (requests) == 2, requests
+
+@offline
+def test_cancel_jobs ():
+	ids = [3, 5, 8]
+
+	# One Cancel-Jobs request does the lot: nothing more is sent,
+	# and each job gets its status.
+	def bulk_ok (op, attrs):
+		return bench.encode_response (bench.TAG_JOB, [])
+
+	with mock_server (bulk_ok) as (conn, requests):
+		assert conn.cancelJobs (ids) == dict ((i, cups.IPP_OK) for i in ids)
+		assert [op for (op, attrs) in requests] == [IPP_CANCEL_JOBS]
+		assert requests[0][1]["job-ids"] == ids
+
+	# Cancel-Jobs refused: each job is cancelled in turn.
+	def per_job (op, attrs):
+		if op == IPP_CANCEL_JOBS:
+			status = cups.IPP_OPERATION_NOT_SUPPORTED
+		elif attrs["job-uri"][0].endswith ("/5"):
+			status = cups.IPP_NOT_FOUND
+		else:
+			status = cups.IPP_OK
+
+		return bench.encode_response (bench.TAG_JOB, [], status=status)
+
+	with mock_server (per_job) as (conn, requests):
+		assert conn.cancelJobs (ids) == {3: cups.IPP_OK,
+						 5: cups.IPP_NOT_FOUND,
+						 8: cups.IPP_OK}
+		assert ([op for (op, attrs) in requests] ==
+			[IPP_CANCEL_JOBS] + [IPP_CANCEL_JOB] * len (ids))
+
+def old_model_compare (a, b):
+	# A port of the comparison modelSort used before it was keyed,
+	# kept as the reference the keys must agree with.
+	digits = "0123456789"
+	def span (s, i, in_digits):
+		j = i
+		while j < len (s) and (s[j] in digits) == in_digits:
+			j += 1
+		return j - i
+
+	i = j = 0
+	while i < len (a) and j < len (b):
+		end_a = span (a, i, True)
+		end_b = span (b, j, True)
+		a_is_digit = True
+		if a[i] != b[j] and a[i] not in digits and b[j] not in digits:
+			return -1 if a[i] < b[j] else 1
+
+		if not end_a:
+			end_a = span (a, i, False)
+			a_is_digit = False
+
+		if not end_b:
+			if a_is_digit:
+				return -1
+			end_b = span (b, j, False)
+		elif not a_is_digit:
+			return 1
+
+		if a_is_digit:
+			x = int (a[i:i + end_a])
+			y = int (b[j:j + end_b])
+		else:
+			n = min (end_a, end_b)
+			x = a[i:i + n]
+			y = b[j:j + n]
+
+		cmp = (x > y) - (x < y)
+		if cmp:
+			return cmp
+
+		if end_a != end_b:
+			return -1 if end_a < end_b else 1
+
+		i += end_a
+		j += end_b
+
+	if i == len (a):
+		return 0 if j == len (b) else -1
+
+	return 1
+
+@offline
+def test_model_sort ():
+	models = ["HP LaserJet 4000", "HP LaserJet 400", "hp laserjet 4100",
+		  "HP LaserJet 4000 Series", "Epson Stylus C80", "HP LaserJet",
+		  "Epson Stylus C8", "HP DeskJet 9", "HP DeskJet 10", "",
+		  "Canon iP4200", "Canon iP4200", u"Épson Stylus", "12 Pro",
+		  "2 Pro", "HP LaserJet 4000", "HP LaserJet 04000"]
+	for a in models:
+		for b in models:
+			assert cups.modelSort (a, b) == old_model_compare (a, b), (a, b)
+
+	expected = ["", "2 Pro", "12 Pro", "Canon iP4200", "Canon iP4200",
+		    "Epson Stylus C8", "Epson Stylus C80", "HP DeskJet 9",
+		    "HP DeskJet 10", "HP LaserJet", "HP LaserJet 400",
+		    "HP LaserJet 4000", "HP LaserJet 4000",
+		    "HP LaserJet 4000 Series", "HP LaserJet 04000",
+		    "hp laserjet 4100", u"Épson Stylus"]
+	assert sorted (models,
+		       key=functools.cmp_to_key (old_model_compare)) == expected
+	assert sorted (models, key=cups.modelSortKey) == expected
+	assert cups.modelSort (models) == expected
+	assert cups.modelSort (tuple (models)) == expected
+
+def run_offline_tests ():
+	if bench is None:
+		print ("Offline tests need Python 3; skipped")
+		return
+
+	for test in offline_tests:
+		print ("%s..." % test.__name__)
+		test ()
+
+	print ("%d offline tests passed" % len (offline_tests))
+
+run_offline_tests ()
+if "--offline" not in sys.argv[1:]:
+	test_cups_module ()